@@ -0,0 +1,347 @@
+#include "glad/glad.h"
+#include "GLFW/glfw3.h"
+#include "../batch.h"
+#include "../camera.h"
+#include "../light.h"
+
+#include <algorithm>
+#include <cstring>
+
+std::shared_ptr<Kasumi::Batch> Kasumi::Batch::MainBatch = nullptr;
+
+// ==================== Multi Draw Indirect ====================
+// glMultiDrawElementsIndirect is GL 4.3 (ARB_multi_draw_indirect on our 3.3 context), so it is looked up at runtime
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+
+namespace
+{
+using MultiDrawElementsIndirectFn = void (APIENTRY *)(GLenum, GLenum, const void *, GLsizei, GLsizei);
+
+struct DrawElementsIndirectCommand
+{
+	GLuint count;
+	GLuint instance_count;
+	GLuint first_index;
+	GLint base_vertex;
+	GLuint base_instance; // first matrix of the draw, needs GL 4.2 / ARB_base_instance
+};
+
+constexpr size_t ArenaFloats = 11; // position, normal, uv, colour
+
+auto has_extension(const char *name) -> bool
+{
+	GLint count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+	for (GLint i = 0; i < count; ++i)
+	{
+		auto ext = reinterpret_cast<const char *>(glGetStringi(GL_EXTENSIONS, i));
+		if (ext != nullptr && std::strcmp(ext, name) == 0)
+			return true;
+	}
+	return false;
+}
+
+auto multi_draw_indirect() -> MultiDrawElementsIndirectFn
+{
+	static MultiDrawElementsIndirectFn fn = []
+	{
+		GLint major = 0, minor = 0;
+		glGetIntegerv(GL_MAJOR_VERSION, &major);
+		glGetIntegerv(GL_MINOR_VERSION, &minor);
+		auto version = major * 10 + minor;
+		bool supported = version >= 43 || (has_extension("GL_ARB_multi_draw_indirect") && (version >= 42 || has_extension("GL_ARB_base_instance")));
+		return supported ? reinterpret_cast<MultiDrawElementsIndirectFn>(glfwGetProcAddress("glMultiDrawElementsIndirect")) : nullptr;
+	}();
+	return fn;
+}
+
+void instance_attributes(size_t first) // locations 7-10, one mat4 per instance starting at matrix `first`
+{
+	for (GLuint c = 0; c < 4; ++c)
+	{
+		glEnableVertexAttribArray(7 + c);
+		glVertexAttribPointer(7 + c, 4, GL_FLOAT, GL_FALSE, 16 * sizeof(float), (GLvoid *) ((first * 16 + c * 4) * sizeof(float)));
+		glVertexAttribDivisor(7 + c, 1);
+	}
+}
+} // namespace
+
+void Kasumi::Batch::Init() { MainBatch = std::make_shared<Batch>(); }
+Kasumi::Batch::Batch()
+{
+	glGenBuffers(1, &_matrix_vbo);
+	glGenVertexArrays(1, &_vao);
+	glGenBuffers(1, &_vbo);
+	glGenBuffers(1, &_ebo);
+	glGenBuffers(1, &_indirect);
+
+	glBindVertexArray(_vao);
+	glBindBuffer(GL_ARRAY_BUFFER, _vbo);
+	auto stride = static_cast<GLsizei>(ArenaFloats * sizeof(float));
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (GLvoid *) 0); // location = 0, position
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (GLvoid *) (3 * sizeof(float))); // location = 1, normal
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (GLvoid *) (6 * sizeof(float))); // location = 2, tex_coord
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, stride, (GLvoid *) (8 * sizeof(float))); // location = 3, color
+	glEnableVertexAttribArray(3);
+	glBindBuffer(GL_ARRAY_BUFFER, _matrix_vbo);
+	instance_attributes(0); // base_instance offsets into it
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _ebo);
+	glBindVertexArray(0);
+}
+Kasumi::Batch::~Batch()
+{
+	glDeleteVertexArrays(1, &_vao);
+	glDeleteBuffers(1, &_vbo);
+	glDeleteBuffers(1, &_ebo);
+	glDeleteBuffers(1, &_indirect);
+	glDeleteBuffers(1, &_matrix_vbo);
+}
+
+// ==================== Public Methods ====================
+auto Kasumi::Batch::accepts(const Mesh &mesh, const ShaderPtr &shader) const -> bool
+{
+	if (!_opt.enabled || shader == nullptr)
+		return false;
+	const auto &opt = mesh._opt;
+	bool default_state = opt.render_surface && !opt.render_wireframe && !opt.render_bbox && opt.depth_test && !opt.stencil_test && !opt.cull_face && opt.blend && !opt.instanced && !opt.line_model;
+	return default_state && shader->instanced() != nullptr && !_may_be_translucent(mesh);
+}
+void Kasumi::Batch::submit(const MeshPtr &mesh, const ShaderPtr &shader, const mMatrix4x4 &model, int lod) { _draws.push_back({mesh, shader->instanced(), model, lod}); }
+void Kasumi::Batch::flush()
+{
+	if (_draws.empty())
+		return;
+
+	// the instances of one mesh level end up next to each other, and so do the meshes of one shader
+	std::stable_sort(_draws.begin(), _draws.end(), [](const Draw &a, const Draw &b)
+	{
+		if (a.shader != b.shader)
+			return a.shader < b.shader;
+		return a.mesh != b.mesh ? a.mesh < b.mesh : a.lod < b.lod;
+	});
+
+	_matrices.resize(_draws.size() * 16);
+	for (size_t i = 0; i < _draws.size(); ++i)
+	{
+		auto m = _draws[i].model.as_float();
+		std::copy(m.begin(), m.end(), _matrices.begin() + static_cast<std::ptrdiff_t>(i * 16));
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, _matrix_vbo);
+	glBufferData(GL_ARRAY_BUFFER, static_cast<GLsizeiptr>(_matrices.size() * sizeof(float)), _matrices.data(), GL_STREAM_DRAW);
+
+	auto mdi = _opt.multi_draw_indirect ? multi_draw_indirect() : nullptr;
+	for (size_t begin = 0; begin < _draws.size();)
+	{
+		auto &shader = _draws[begin].shader;
+		size_t end = begin;
+		std::vector<Run> runs;
+		while (end < _draws.size() && _draws[end].shader == shader)
+		{
+			size_t first = end;
+			while (end < _draws.size() && _draws[end].shader == shader && _draws[end].mesh == _draws[first].mesh && _draws[end].lod == _draws[first].lod)
+				++end;
+			runs.push_back({first, end - first});
+		}
+
+		shader->use();
+		shader->uniform("view", Camera::MainCamera->get_view());
+		shader->uniform("projection", Camera::MainCamera->get_projection());
+		shader->uniform("lightPos", Light::MainLight->_opt.light_pos);
+		shader->uniform("viewPos", Light::MainLight->_opt.view_pos);
+
+		// textured meshes need their own texture bindings, they stay one instanced draw each
+		std::vector<Run> colored, plain;
+		for (auto &run: runs)
+		{
+			auto &mesh = *_draws[run.first].mesh;
+			if (mdi == nullptr || mesh._opt.textured)
+				_draw_instanced(run);
+			else
+				(mesh._opt.colored ? colored : plain).push_back(run);
+		}
+		if (!colored.empty())
+			_draw_indirect(colored, true);
+		if (!plain.empty())
+			_draw_indirect(plain, false);
+
+		begin = end;
+	}
+
+	_stats.objects += _draws.size();
+	_draws.clear();
+}
+void Kasumi::Batch::end_frame()
+{
+	flush();
+	_last_stats = _stats;
+	_stats = Stats();
+}
+
+// ==================== Private ====================
+// vertex colours have no alpha, so a mesh can only see through its textures: any with an alpha channel, or still
+// decoding, keeps the mesh out of the batch and drawn in submission order
+auto Kasumi::Batch::_may_be_translucent(const Mesh &mesh) -> bool
+{
+	if (!mesh._opt.textured)
+		return false;
+	for (auto &slot: mesh._textures)
+		for (auto &texture: slot.second)
+			if (texture != nullptr && (texture->_nr_channels == 0 || texture->_nr_channels == 4))
+				return true;
+	return false;
+}
+void Kasumi::Batch::_draw_instanced(const Run &run)
+{
+	auto &mesh = *_draws[run.first].mesh;
+	auto &shader = *_draws[run.first].shader;
+
+	// no base instance on GL 3.3: the attributes start at the run's first matrix instead
+	glBindVertexArray(mesh._vao);
+	glBindBuffer(GL_ARRAY_BUFFER, _matrix_vbo);
+	instance_attributes(run.first);
+	glBindVertexArray(0);
+
+	mesh._opt.instanced = true;
+	mesh._opt.instance_count = static_cast<int>(run.count);
+	mesh._opt.lod = _draws[run.first].lod;
+	mesh.render(shader);
+	mesh._opt.instanced = false;
+	mesh._opt.lod = 0;
+
+	glBindVertexArray(mesh._vao);
+	for (GLuint location = 7; location <= 10; ++location)
+		glDisableVertexAttribArray(location);
+	glBindVertexArray(0);
+	++_stats.draw_calls;
+}
+void Kasumi::Batch::_draw_indirect(const std::vector<Run> &runs, bool colored)
+{
+	_reserve(runs);
+
+	std::vector<DrawElementsIndirectCommand> commands;
+	commands.reserve(runs.size());
+	for (auto &run: runs)
+	{
+		auto &draw = _draws[run.first];
+		auto &slot = _slots[draw.mesh.get()];
+		auto range = draw.mesh->_lod_range(draw.lod);
+		commands.push_back({static_cast<GLuint>(range.second), static_cast<GLuint>(run.count), slot.first_index + static_cast<GLuint>(range.first), slot.base_vertex, static_cast<GLuint>(run.first)});
+	}
+
+	auto &shader = *_draws[runs.front().first].shader;
+	shader.uniform("is_colored", colored);
+	shader.uniform("is_textured", false);
+	shader.uniform("diffuse_texture_num", 0);
+	shader.uniform("specular_texture_num", 0);
+	shader.uniform("normal_texture_num", 0);
+	shader.uniform("height_texture_num", 0);
+
+	// accepts() only lets meshes with the default state through
+	glEnable(GL_DEPTH_TEST);
+	glDisable(GL_STENCIL_TEST);
+	glDisable(GL_CULL_FACE);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glEnable(GL_BLEND);
+	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+
+	glBindVertexArray(_vao);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, _indirect);
+	glBufferData(GL_DRAW_INDIRECT_BUFFER, static_cast<GLsizeiptr>(commands.size() * sizeof(DrawElementsIndirectCommand)), commands.data(), GL_STREAM_DRAW);
+	multi_draw_indirect()(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, static_cast<GLsizei>(commands.size()), 0);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	glBindVertexArray(0);
+	++_stats.draw_calls;
+}
+void Kasumi::Batch::_reserve(const std::vector<Run> &runs)
+{
+	auto current = [&](const Mesh *mesh) -> bool
+	{
+		auto it = _slots.find(mesh);
+		return it != _slots.end() && it->second.mesh.lock().get() == mesh && it->second.generation == mesh->_generation;
+	};
+
+	// space for what has to be (re)written; edited meshes that still fit stay in their slot
+	size_t vertices = 0, indices = 0, all_vertices = 0, all_indices = 0;
+	for (auto &run: runs)
+	{
+		auto *mesh = _draws[run.first].mesh.get();
+		all_vertices += mesh->_verts.size();
+		all_indices += mesh->_index_total();
+		if (current(mesh))
+			continue;
+		auto it = _slots.find(mesh);
+		if (it != _slots.end() && it->second.mesh.lock().get() == mesh && mesh->_verts.size() <= it->second.vertex_capacity && mesh->_index_total() <= it->second.index_capacity)
+			continue;
+		vertices += mesh->_verts.size();
+		indices += mesh->_index_total();
+	}
+
+	// out of room: start over with only the meshes drawn now, which drops everything stale or gone
+	if (_vertex_used + vertices > _vertex_capacity || _index_used + indices > _index_capacity)
+	{
+		_slots.clear();
+		_vertex_used = _index_used = 0;
+		_vertex_capacity = std::max(_vertex_capacity, 2 * all_vertices);
+		_index_capacity = std::max(_index_capacity, 2 * all_indices);
+		glBindBuffer(GL_ARRAY_BUFFER, _vbo);
+		glBufferData(GL_ARRAY_BUFFER, static_cast<GLsizeiptr>(_vertex_capacity * ArenaFloats * sizeof(float)), nullptr, GL_STATIC_DRAW);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, _ebo); // the element binding belongs to whatever VAO is bound
+		glBufferData(GL_COPY_WRITE_BUFFER, static_cast<GLsizeiptr>(_index_capacity * sizeof(Mesh::Index)), nullptr, GL_STATIC_DRAW);
+	}
+
+	for (auto &run: runs)
+	{
+		auto &mesh = _draws[run.first].mesh;
+		if (current(mesh.get()))
+			continue;
+
+		auto &slot = _slots[mesh.get()];
+		bool fits = slot.mesh.lock() == mesh && mesh->_verts.size() <= slot.vertex_capacity && mesh->_index_total() <= slot.index_capacity;
+		if (!fits)
+		{
+			slot.base_vertex = static_cast<int>(_vertex_used);
+			slot.first_index = static_cast<unsigned int>(_index_used);
+			slot.vertex_capacity = mesh->_verts.size();
+			slot.index_capacity = mesh->_index_total();
+			_vertex_used += slot.vertex_capacity;
+			_index_used += slot.index_capacity;
+		}
+		slot.mesh = mesh;
+		slot.generation = mesh->_generation;
+		_upload(*mesh, slot);
+	}
+}
+void Kasumi::Batch::_upload(const Mesh &mesh, const Slot &slot)
+{
+	_staging.resize(mesh._verts.size() * ArenaFloats);
+	auto *dst = _staging.data();
+	for (auto &v: mesh._verts)
+	{
+		*dst++ = static_cast<float>(v.position.x());
+		*dst++ = static_cast<float>(v.position.y());
+		*dst++ = static_cast<float>(v.position.z());
+		*dst++ = static_cast<float>(v.normal.x());
+		*dst++ = static_cast<float>(v.normal.y());
+		*dst++ = static_cast<float>(v.normal.z());
+		*dst++ = static_cast<float>(v.tex_coord.x());
+		*dst++ = static_cast<float>(v.tex_coord.y());
+		*dst++ = static_cast<float>(v.color.x());
+		*dst++ = static_cast<float>(v.color.y());
+		*dst++ = static_cast<float>(v.color.z());
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, _vbo);
+	glBufferSubData(GL_ARRAY_BUFFER, static_cast<GLintptr>(slot.base_vertex * ArenaFloats * sizeof(float)), static_cast<GLsizeiptr>(_staging.size() * sizeof(float)), _staging.data());
+	glBindBuffer(GL_COPY_WRITE_BUFFER, _ebo);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, static_cast<GLintptr>(slot.first_index * sizeof(Mesh::Index)), static_cast<GLsizeiptr>(mesh._idxs.size() * sizeof(Mesh::Index)), mesh._idxs.data());
+	for (int level = 1; level < mesh.lod_count(); ++level)
+	{
+		auto range = mesh._lod_range(level);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, static_cast<GLintptr>((slot.first_index + range.first) * sizeof(Mesh::Index)), static_cast<GLsizeiptr>(range.second * sizeof(Mesh::Index)), mesh._lods[level - 1].indices.data());
+	}
+}
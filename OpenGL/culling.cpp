@@ -0,0 +1,355 @@
+#include "glad/glad.h"
+#include "../culling.h"
+#include "../api.h"
+
+#include <algorithm>
+#include <cmath>
+
+std::shared_ptr<Kasumi::Culling> Kasumi::Culling::MainCulling = nullptr;
+
+void Kasumi::Culling::Init() { MainCulling = std::make_shared<Culling>(); }
+Kasumi::Culling::Culling()
+{
+	_view_projection.setIdentity();
+	std::fill(&_planes[0][0], &_planes[0][0] + 6 * 4, 0.f);
+}
+Kasumi::Culling::~Culling()
+{
+	if (_pbo[0] != 0)
+		glDeleteBuffers(2, _pbo);
+}
+
+// ==================== Frame ====================
+void Kasumi::Culling::begin_frame()
+{
+	_last_stats = _stats;
+	_stats = Stats();
+	_depth_fbo = -1;
+	++_frame;
+}
+void Kasumi::Culling::capture_depth()
+{
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &_depth_fbo);
+	glGetIntegerv(GL_VIEWPORT, _depth_viewport);
+}
+void Kasumi::Culling::end_frame()
+{
+	if (!_opt.occlusion)
+	{
+		_hiz.valid = false;
+		_pbo_pending[0] = _pbo_pending[1] = false;
+		return;
+	}
+
+	_update_frustum();
+	if (_pbo[0] == 0)
+		glGenBuffers(2, _pbo);
+
+	// the read issued last frame has had a whole frame to land, build the pyramid from it
+	int prev = _pbo_index ^ 1;
+	if (_pbo_pending[prev])
+	{
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, _pbo[prev]);
+		auto *depth = static_cast<const float *>(glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY));
+		if (depth != nullptr)
+		{
+			_build_hiz(depth, _pbo_size[prev][0], _pbo_size[prev][1]);
+			_hiz.view_projection = _pbo_view_projection[prev];
+			_hiz.valid = true;
+			++_version;
+		}
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		_pbo_pending[prev] = false;
+	}
+
+	// and issue this frame's read from the target the scene was drawn into, it completes asynchronously into the PBO
+	GLint viewport[4];
+	if (_depth_fbo >= 0)
+		std::copy(_depth_viewport, _depth_viewport + 4, viewport);
+	else
+		glGetIntegerv(GL_VIEWPORT, viewport);
+	int width = viewport[2], height = viewport[3];
+	if (width > 0 && height > 0)
+	{
+		GLint read_fbo;
+		glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &read_fbo);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, _depth_fbo >= 0 ? _depth_fbo : 0);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, _pbo[_pbo_index]);
+		if (_pbo_size[_pbo_index][0] != width || _pbo_size[_pbo_index][1] != height)
+		{
+			glBufferData(GL_PIXEL_PACK_BUFFER, static_cast<GLsizeiptr>(width) * height * sizeof(float), nullptr, GL_STREAM_READ);
+			_pbo_size[_pbo_index][0] = width;
+			_pbo_size[_pbo_index][1] = height;
+		}
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+		glReadPixels(viewport[0], viewport[1], width, height, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, read_fbo);
+		_pbo_view_projection[_pbo_index] = _view_projection;
+		_pbo_pending[_pbo_index] = true;
+		_pbo_index = prev;
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+auto Kasumi::Culling::version() -> std::uint64_t
+{
+	_update_frustum();
+	return _version;
+}
+
+// ==================== Tracking ====================
+namespace
+{
+auto tracked() -> std::vector<Kasumi::Renderable *> &
+{
+	static std::vector<Kasumi::Renderable *> objects;
+	return objects;
+}
+} // namespace
+void Kasumi::Culling::Track(Renderable *object) { tracked().push_back(object); }
+void Kasumi::Culling::Untrack(Renderable *object)
+{
+	auto &objects = tracked();
+	auto iter = std::find(objects.rbegin(), objects.rend(), object); // recently created objects tend to go first
+	if (iter == objects.rend())
+		return;
+	*iter = objects.back();
+	objects.pop_back();
+}
+auto Kasumi::Culling::Tracked() -> const std::vector<Renderable *> & { return tracked(); }
+
+// ==================== Tests ====================
+auto Kasumi::Culling::visible(const mBBox3 &local, const mMatrix4x4 &model) -> bool
+{
+	if (!enabled())
+		return true;
+
+	_update_frustum();
+	_load(1);
+	_transform(0, local, model);
+	_test(1);
+
+	++_stats.objects_tested;
+	if (_result[0] == 1) ++_stats.objects_frustum_culled;
+	if (_result[0] == 2) ++_stats.objects_occlusion_culled;
+	return _result[0] == 0;
+}
+void Kasumi::Culling::cull(const std::vector<Renderable *> &objects)
+{
+	_update_frustum();
+
+	std::vector<Renderable *> bounded;
+	bounded.reserve(objects.size());
+	_load(objects.size());
+	for (auto *object: objects)
+	{
+		object->_cull_frame = _frame;
+		object->_cull_version = _version;
+		object->_cull_hidden = false;
+
+		mBBox3 local;
+		mMatrix4x4 model;
+		if (!enabled() || !object->_cull_bounds(local, model))
+			continue;
+		_transform(bounded.size(), local, model);
+		bounded.push_back(object);
+	}
+	_test(bounded.size());
+
+	for (size_t i = 0; i < bounded.size(); ++i)
+	{
+		bounded[i]->_cull_hidden = _result[i] != 0;
+		if (_result[i] == 1) ++_stats.objects_frustum_culled;
+		if (_result[i] == 2) ++_stats.objects_occlusion_culled;
+	}
+	_stats.objects_tested += bounded.size();
+}
+void Kasumi::Culling::cull_instances(const mBBox3 &local, const std::vector<mMatrix4x4> &models, std::vector<unsigned int> &visible)
+{
+	visible.clear();
+	visible.reserve(models.size());
+	if (!enabled())
+	{
+		for (unsigned int i = 0; i < models.size(); ++i)
+			visible.push_back(i);
+		return;
+	}
+
+	_update_frustum();
+	_load(models.size());
+	for (size_t i = 0; i < models.size(); ++i)
+		_transform(i, local, models[i]);
+	_test(models.size());
+
+	for (unsigned int i = 0; i < models.size(); ++i)
+		if (_result[i] == 0)
+			visible.push_back(i);
+	_stats.instances_tested += models.size();
+	_stats.instances_culled += models.size() - visible.size();
+}
+
+// ==================== Private ====================
+void Kasumi::Culling::_update_frustum()
+{
+	if (_frustum_frame == _frame || Camera::MainCamera == nullptr)
+		return;
+	_frustum_frame = _frame;
+
+	Eigen::Matrix<float, 4, 4> view_projection = (Camera::MainCamera->get_projection()._m * Camera::MainCamera->get_view()._m).template cast<float>();
+	if (view_projection != _view_projection || _opt.frustum != _last_opt.frustum || _opt.occlusion != _last_opt.occlusion)
+		++_version;
+	_view_projection = view_projection;
+	_last_opt = _opt;
+
+	// Gribb & Hartmann: each plane is the last row plus or minus one of the others
+	const auto &m = _view_projection;
+	for (int axis = 0; axis < 3; ++axis)
+		for (int side = 0; side < 2; ++side)
+		{
+			float sign = side == 0 ? 1.f : -1.f;
+			for (int c = 0; c < 4; ++c)
+				_planes[axis * 2 + side][c] = m(3, c) + sign * m(axis, c);
+		}
+}
+void Kasumi::Culling::_load(size_t count)
+{
+	if (_cx.size() >= count)
+		return;
+	_cx.resize(count);
+	_cy.resize(count);
+	_cz.resize(count);
+	_ex.resize(count);
+	_ey.resize(count);
+	_ez.resize(count);
+	_result.resize(count);
+}
+void Kasumi::Culling::_transform(size_t i, const mBBox3 &local, const mMatrix4x4 &model)
+{
+	// center goes through the full matrix, the half extent through the absolute rotation-scale part
+	const auto &m = model._m;
+	float c[3] = {static_cast<float>(local._lower_corner.x() + local._upper_corner.x()) * 0.5f,
+				  static_cast<float>(local._lower_corner.y() + local._upper_corner.y()) * 0.5f,
+				  static_cast<float>(local._lower_corner.z() + local._upper_corner.z()) * 0.5f};
+	float e[3] = {static_cast<float>(local._upper_corner.x() - local._lower_corner.x()) * 0.5f,
+				  static_cast<float>(local._upper_corner.y() - local._lower_corner.y()) * 0.5f,
+				  static_cast<float>(local._upper_corner.z() - local._lower_corner.z()) * 0.5f};
+	float wc[3], we[3];
+	for (int r = 0; r < 3; ++r)
+	{
+		wc[r] = static_cast<float>(m(r, 3));
+		we[r] = 0;
+		for (int k = 0; k < 3; ++k)
+		{
+			wc[r] += static_cast<float>(m(r, k)) * c[k];
+			we[r] += std::abs(static_cast<float>(m(r, k))) * e[k];
+		}
+	}
+	_cx[i] = wc[0];
+	_cy[i] = wc[1];
+	_cz[i] = wc[2];
+	_ex[i] = we[0];
+	_ey[i] = we[1];
+	_ez[i] = we[2];
+}
+void Kasumi::Culling::_test(size_t count)
+{
+	const float *cx = _cx.data(), *cy = _cy.data(), *cz = _cz.data();
+	const float *ex = _ex.data(), *ey = _ey.data(), *ez = _ez.data();
+	unsigned char *result = _result.data();
+
+	std::fill(result, result + count, static_cast<unsigned char>(0));
+	if (_opt.frustum)
+		for (const auto &plane: _planes) // plane-major over flat arrays, so the inner loop vectorizes
+		{
+			const float a = plane[0], b = plane[1], c = plane[2], d = plane[3];
+			const float aa = std::abs(a), ab = std::abs(b), ac = std::abs(c);
+			for (size_t i = 0; i < count; ++i)
+			{
+				float distance = a * cx[i] + b * cy[i] + c * cz[i] + d;
+				float radius = aa * ex[i] + ab * ey[i] + ac * ez[i];
+				result[i] |= static_cast<unsigned char>(distance + radius < 0.f);
+			}
+		}
+
+	if (_opt.occlusion && _hiz.valid)
+		for (size_t i = 0; i < count; ++i)
+			if (result[i] == 0 && _occluded(i))
+				result[i] = 2;
+}
+void Kasumi::Culling::_build_hiz(const float *depth, int width, int height)
+{
+	// every texel keeps the farthest depth of the texels it covers (rounded outwards), so a box behind it is behind everything there
+	auto reduce = [](const float *src, int sw, int sh, std::vector<float> &dst, int dw, int dh)
+	{
+		dst.resize(static_cast<size_t>(dw) * dh);
+		for (int y = 0; y < dh; ++y)
+		{
+			int y0 = y * sh / dh, y1 = std::max(y0 + 1, ((y + 1) * sh + dh - 1) / dh);
+			for (int x = 0; x < dw; ++x)
+			{
+				int x0 = x * sw / dw, x1 = std::max(x0 + 1, ((x + 1) * sw + dw - 1) / dw);
+				float farthest = 0;
+				for (int sy = y0; sy < y1; ++sy)
+					for (int sx = x0; sx < x1; ++sx)
+						farthest = std::max(farthest, src[static_cast<size_t>(sy) * sw + sx]);
+				dst[static_cast<size_t>(y) * dw + x] = farthest;
+			}
+		}
+	};
+
+	int w = std::clamp(_opt.hiz_size, 1, width);
+	int h = std::max(1, height * w / width);
+	_hiz.levels.resize(1);
+	_hiz.sizes.assign(1, {w, h});
+	reduce(depth, width, height, _hiz.levels[0], w, h);
+	while (w > 1 || h > 1)
+	{
+		int nw = std::max(1, w / 2), nh = std::max(1, h / 2);
+		_hiz.levels.emplace_back();
+		reduce(_hiz.levels[_hiz.levels.size() - 2].data(), w, h, _hiz.levels.back(), nw, nh);
+		_hiz.sizes.emplace_back(nw, nh);
+		w = nw;
+		h = nh;
+	}
+}
+auto Kasumi::Culling::_occluded(size_t i) const -> bool
+{
+	// screen rect and nearest depth of the box as seen by the camera of the depth buffer
+	float min_x = 1, min_y = 1, max_x = -1, max_y = -1, nearest = 1;
+	for (int corner = 0; corner < 8; ++corner)
+	{
+		Eigen::Vector4f p(_cx[i] + ((corner & 1) ? _ex[i] : -_ex[i]),
+						  _cy[i] + ((corner & 2) ? _ey[i] : -_ey[i]),
+						  _cz[i] + ((corner & 4) ? _ez[i] : -_ez[i]), 1.f);
+		Eigen::Vector4f clip = _hiz.view_projection * p;
+		if (clip.w() <= 1e-5f)
+			return false; // crosses the near plane
+		float x = clip.x() / clip.w(), y = clip.y() / clip.w(), z = clip.z() / clip.w();
+		min_x = std::min(min_x, x);
+		max_x = std::max(max_x, x);
+		min_y = std::min(min_y, y);
+		max_y = std::max(max_y, y);
+		nearest = std::min(nearest, z * 0.5f + 0.5f);
+	}
+	if (max_x < -1 || max_y < -1 || min_x > 1 || min_y > 1)
+		return false; // was off screen back then, nothing is known about it
+
+	float u0 = std::clamp(min_x * 0.5f + 0.5f, 0.f, 1.f), u1 = std::clamp(max_x * 0.5f + 0.5f, 0.f, 1.f);
+	float v0 = std::clamp(min_y * 0.5f + 0.5f, 0.f, 1.f), v1 = std::clamp(max_y * 0.5f + 0.5f, 0.f, 1.f);
+
+	// the first level where the rect covers at most 2x2 texels
+	for (size_t level = 0; level < _hiz.levels.size(); ++level)
+	{
+		auto [w, h] = _hiz.sizes[level];
+		int x0 = std::min(w - 1, static_cast<int>(u0 * w)), x1 = std::min(w - 1, static_cast<int>(u1 * w));
+		int y0 = std::min(h - 1, static_cast<int>(v0 * h)), y1 = std::min(h - 1, static_cast<int>(v1 * h));
+		if (x1 - x0 > 1 || y1 - y0 > 1)
+			continue;
+
+		float farthest = 0;
+		for (int y = y0; y <= y1; ++y)
+			for (int x = x0; x <= x1; ++x)
+				farthest = std::max(farthest, _hiz.levels[level][static_cast<size_t>(y) * w + x]);
+		return nearest > farthest;
+	}
+	return false;
+}
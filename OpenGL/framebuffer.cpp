@@ -1,5 +1,8 @@
 #include "glad/glad.h"
 #include "../framebuffer.h"
+#include "../batch.h"
+#include "../culling.h"
+#include "../api.h"
 
 #include <array>
 #include <stdexcept>
@@ -11,12 +14,20 @@ Kasumi::Framebuffer::~Framebuffer() { glDeleteFramebuffers(1, &_fbo); }
 
 void Kasumi::Framebuffer::render() const
 {
+	// batched draws land in whichever framebuffer is bound when they are flushed
+	if (Batch::MainBatch != nullptr)
+		Batch::MainBatch->flush();
 	glBindFramebuffer(GL_FRAMEBUFFER, _fbo);
 	glClearColor(_opt.background_color.x(), _opt.background_color.y(), _opt.background_color.z(), 1.0);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
 
 	if (render_callback)
 		render_callback();
+	Renderable::RenderVolumes(); // still into this target, over its opaque objects
+	if (Batch::MainBatch != nullptr)
+		Batch::MainBatch->flush();
+	if (Culling::MainCulling != nullptr)
+		Culling::MainCulling->capture_depth(); // the window only gets this quad, the occluders are in here
 
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
@@ -1,4 +1,7 @@
 #include "../mesh.h"
+#include "../culling.h"
+#include "../batch.h"
+#include "../camera.h"
 
 #include "glad/glad.h"
 #include "assimp/Importer.hpp"
@@ -13,17 +16,110 @@
 #define GL_REAL GL_FLOAT
 #endif
 
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+
+// ==================== Vertex Formats ====================
+namespace
+{
+struct LayoutOffsets
+{
+	size_t stride = 0;
+	size_t position = 0, normal = 0, tex_coord = 0, color = 0, tangent = 0, bi_tangent = 0, id = 0;
+};
+
+auto layout_offsets(const Kasumi::Mesh::VertexLayout &layout) -> LayoutOffsets
+{
+	using L = Kasumi::Mesh::VertexLayout;
+	LayoutOffsets res;
+	auto place = [&](size_t &offset, size_t size)
+	{
+		offset = res.stride;
+		res.stride += size;
+	};
+	if (!layout.split_position)
+		place(res.position, 3 * sizeof(float));
+	if (layout.has(L::Normal))
+		place(res.normal, layout.packed ? 4 : 3 * sizeof(float));
+	if (layout.has(L::TexCoord))
+		place(res.tex_coord, layout.packed ? 4 : 2 * sizeof(float));
+	if (layout.has(L::Color))
+		place(res.color, layout.packed ? 4 : 3 * sizeof(float));
+	if (layout.has(L::Tangent))
+	{
+		place(res.tangent, layout.packed ? 4 : 3 * sizeof(float));
+		place(res.bi_tangent, layout.packed ? 4 : 3 * sizeof(float));
+	}
+	if (layout.has(L::ID))
+		place(res.id, sizeof(unsigned int));
+	return res;
+}
+
+// GL_INT_2_10_10_10_REV, normalized; w is left 0
+inline auto pack_snorm_10_10_10(real x, real y, real z) -> std::uint32_t
+{
+	auto q = [](real v) -> std::uint32_t
+	{
+		v = v < -1 ? -1 : (v > 1 ? 1 : v);
+		return static_cast<std::uint32_t>(static_cast<std::int32_t>(std::lround(v * 511))) & 0x3FF;
+	};
+	return q(x) | (q(y) << 10) | (q(z) << 20);
+}
+
+// round to nearest; denormals flush to zero and overflow clamps to the largest half
+inline auto float_to_half(float value) -> std::uint16_t
+{
+	std::uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	std::uint32_t sign = (bits >> 16) & 0x8000;
+	int exponent = static_cast<int>((bits >> 23) & 0xFF) - 127 + 15;
+	std::uint32_t mantissa = bits & 0x7FFFFF;
+	if (exponent <= 0)
+		return static_cast<std::uint16_t>(sign);
+	if (exponent >= 31)
+		return static_cast<std::uint16_t>(sign | 0x7BFF);
+	std::uint32_t half = sign | (static_cast<std::uint32_t>(exponent) << 10) | (mantissa >> 13);
+	if (mantissa & 0x1000)
+		++half;
+	if ((half & 0x7FFF) >= 0x7C00)
+		half = sign | 0x7BFF;
+	return static_cast<std::uint16_t>(half);
+}
+
+inline auto pack_unorm8(real v) -> std::uint32_t
+{
+	v = v < 0 ? 0 : (v > 1 ? 1 : v);
+	return static_cast<std::uint32_t>(v * 255 + static_cast<real>(0.5));
+}
+
+// one pass per stream over [begin, end): each loop is a plain strided conversion the compiler can vectorise
+template<typename Fn>
+inline void write_stream(unsigned char *dst, size_t stride, size_t offset, size_t count, Fn &&fn)
+{
+	for (size_t i = 0; i < count; ++i)
+		fn(dst + i * stride + offset, i);
+}
+inline void write_floats(unsigned char *dst, const float *values, size_t n) { std::memcpy(dst, values, n * sizeof(float)); }
+inline void write_u32(unsigned char *dst, std::uint32_t value) { std::memcpy(dst, &value, sizeof(value)); }
+} // namespace
+
+std::map<std::string, std::weak_ptr<Kasumi::Mesh>> Kasumi::Mesh::_registry;
+
 Kasumi::Mesh::Mesh(const std::string &primitive_name, const std::string &texture_name) : _vao(0), _vbo(0), _ebo(0)
 {
 	std::vector<Vertex> vertices;
 	std::vector<Index> indices;
 	std::vector<TexturePtr> diffuse_textures;
 	_load_primitive(primitive_name, vertices, indices);
+	_layout.streams &= ~VertexLayout::Tangent; // primitives are never normal mapped
 
-	diffuse_textures.push_back(std::make_shared<Kasumi::Texture>(std::string(BackendsTextureDir) + texture_name));
+	diffuse_textures.push_back(Kasumi::Texture::Load(std::string(BackendsTextureDir) + texture_name));
 	_textures["diffuse"] = diffuse_textures;
 	_opt.textured = true;
 	_init(std::move(vertices), std::move(indices));
+	if (AutoLodTriangles > 0 && _idxs.size() / 3 > AutoLodTriangles)
+		build_lods();
 }
 
 Kasumi::Mesh::Mesh(std::vector<Vertex> &&vertices, std::vector<Index> &&indices, std::map<std::string, std::vector<TexturePtr>> &&textures) : _vao(0), _vbo(0), _ebo(0)
@@ -44,16 +140,20 @@ Kasumi::Mesh::Mesh(const std::string &primitive_name, const mVector3 &color) : _
 	std::vector<Vertex> vertices;
 	std::vector<Index> indices;
 	_load_primitive(primitive_name, vertices, indices, color);
+	_layout.streams &= ~(VertexLayout::Tangent | VertexLayout::TexCoord); // primitives are never normal mapped
 	_opt.colored = true;
 	_init(std::move(vertices), std::move(indices));
+	if (AutoLodTriangles > 0 && _idxs.size() / 3 > AutoLodTriangles)
+		build_lods();
 }
 
 Kasumi::Mesh::~Mesh()
 {
-	glDeleteBuffers(1, &_vao);
+	glDeleteVertexArrays(1, &_vao);
 	glDeleteBuffers(1, &_vbo);
-	glDeleteVertexArrays(1, &_ebo);
-	_vao = _vbo = _ebo = 0;
+	glDeleteBuffers(1, &_attr_vbo);
+	glDeleteBuffers(1, &_ebo);
+	_vao = _vbo = _attr_vbo = _ebo = 0;
 	_textures.clear();
 
 #ifdef HINAPE_DEBUG
@@ -65,7 +165,7 @@ Kasumi::Mesh::~Mesh()
 
 void Kasumi::Mesh::render(const Kasumi::Shader &shader)
 {
-	if (_opt.dirty)
+	if (_opt.dirty || _indices_dirty || !_dirty_spans.empty())
 		_update();
 
 	shader.use();
@@ -148,25 +248,120 @@ void Kasumi::Mesh::render(const Kasumi::Shader &shader)
 		shader.uniform("is_colored", _opt.colored);
 		shader.uniform("is_textured", _opt.textured);
 
+		auto range = _lod_range(_opt.lod);
+		auto *offset = (GLvoid *) (range.first * sizeof(Index));
 		glBindVertexArray(_vao);
 		if (_opt.instanced && _opt.instance_count > 0)
-			glDrawElementsInstanced(GL_TRIANGLES, (GLsizei) _idxs.size(), GL_UNSIGNED_INT, 0, _opt.instance_count);
+			glDrawElementsInstanced(GL_TRIANGLES, (GLsizei) range.second, GL_UNSIGNED_INT, offset, _opt.instance_count);
 		else
-			glDrawElements(GL_TRIANGLES, (GLsizei) _idxs.size(), GL_UNSIGNED_INT, nullptr);
+			glDrawElements(GL_TRIANGLES, (GLsizei) range.second, GL_UNSIGNED_INT, offset);
 		glBindVertexArray(0);
 	}
 
 	if (_opt.render_bbox)
 	{
+		_update_bounds();
 		_bbox_lines->render(*Shader::DefaultLineShader);
 	}
 }
 void Kasumi::Mesh::centralize()
 {
-	_update();
+	auto center = center_point();
 
 	for (auto &v: vertices())
-		v.position -= _center_point;
+		v.position -= center;
+}
+auto Kasumi::Mesh::edit_vertices(size_t begin, size_t end) -> std::span<Vertex>
+{
+	end = std::min(end, _verts.size());
+	if (begin >= end)
+		return {};
+	++_generation;
+
+	// neighbouring or overlapping edits are merged, so a sweep over the mesh stays one upload
+	if (!_dirty_spans.empty() && begin <= _dirty_spans.back().second && end >= _dirty_spans.back().first)
+	{
+		_dirty_spans.back().first = std::min(_dirty_spans.back().first, begin);
+		_dirty_spans.back().second = std::max(_dirty_spans.back().second, end);
+	} else
+		_dirty_spans.emplace_back(begin, end);
+#ifdef HINA_EIGEN
+	// the Eigen copies only need patching when they exist; past a few spans a rebuild on next use is cheaper
+	if (_verts_eigen3.rows() + _verts_eigen4.rows() > 0 && !_eigen_dirty)
+	{
+		_eigen_spans.emplace_back(begin, end);
+		if (_eigen_spans.size() > 64)
+			_eigen_dirty = true;
+	}
+#endif
+	_bounds_dirty = true;
+
+	return {_verts.data() + begin, end - begin};
+}
+void Kasumi::Mesh::set_indices(std::vector<Index> &&indices)
+{
+	_idxs = std::move(indices);
+	_lods.clear(); // they index the old topology
+	_opt.lod = 0;
+	_indices_dirty = true;
+	++_generation;
+#ifdef HINA_EIGEN
+	_idxs_eigen.resize(0, 3);
+#endif
+}
+auto Kasumi::Mesh::clone() const -> std::shared_ptr<Mesh>
+{
+	auto res = std::make_shared<Mesh>(std::vector<Vertex>(_verts), std::vector<Index>(_idxs), std::map<std::string, std::vector<TexturePtr>>(_textures));
+	auto opt = _opt;
+	opt.dirty = true;
+	opt.instanced = false;
+	opt.lod = 0;
+	res->_opt = opt;
+	res->_lods = _lods;
+	res->set_layout(_layout);
+	return res;
+}
+auto Kasumi::Mesh::Shared(const std::string &primitive_name, const mVector3 &color) -> std::shared_ptr<Mesh>
+{
+	char key[256];
+	std::snprintf(key, sizeof(key), "%s|color|%.9g,%.9g,%.9g", primitive_name.c_str(), static_cast<double>(color.x()), static_cast<double>(color.y()), static_cast<double>(color.z()));
+	auto &slot = _registry[key];
+	auto mesh = slot.lock();
+	if (mesh == nullptr)
+	{
+		mesh = std::make_shared<Mesh>(primitive_name, color);
+		mesh->_shared = true;
+		slot = mesh;
+	}
+	return mesh;
+}
+auto Kasumi::Mesh::Shared(const std::string &primitive_name, const std::string &texture_name) -> std::shared_ptr<Mesh>
+{
+	auto &slot = _registry[primitive_name + "|texture|" + texture_name];
+	auto mesh = slot.lock();
+	if (mesh == nullptr)
+	{
+		mesh = std::make_shared<Mesh>(primitive_name, texture_name);
+		mesh->_shared = true;
+		slot = mesh;
+	}
+	return mesh;
+}
+auto Kasumi::Mesh::bbox() -> const mBBox3 &
+{
+	_update_bounds();
+	return _bbox;
+}
+auto Kasumi::Mesh::center_point() -> const mVector3 &
+{
+	_update_bounds();
+	return _center_point;
+}
+void Kasumi::Mesh::set_layout(const VertexLayout &layout)
+{
+	_layout = layout;
+	_layout.streams |= VertexLayout::Position;
+	_setup_layout();
 }
 // ================================================== Public Methods ==================================================
 
@@ -182,53 +377,73 @@ void Kasumi::Mesh::_init(std::vector<Vertex> &&vertices, std::vector<Index> &&in
 
 	glGenVertexArrays(1, &_vao);
 	glGenBuffers(1, &_vbo);
+	glGenBuffers(1, &_attr_vbo);
 	glGenBuffers(1, &_ebo);
 
-	glBindVertexArray(_vao);
-
-	glBindBuffer(GL_ARRAY_BUFFER, _vbo);
-
-	glVertexAttribPointer(0, 3, GL_REAL, GL_FALSE, sizeof(Vertex), (GLvoid *) offsetof(Vertex, position)); // location = 0, position
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(1, 3, GL_REAL, GL_FALSE, sizeof(Vertex), (GLvoid *) offsetof(Vertex, normal)); // location = 1, normal
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(2, 2, GL_REAL, GL_FALSE, sizeof(Vertex), (GLvoid *) offsetof(Vertex, tex_coord)); // location = 2, tex_coord
-	glEnableVertexAttribArray(2);
-	glVertexAttribPointer(3, 3, GL_REAL, GL_FALSE, sizeof(Vertex), (GLvoid *) offsetof(Vertex, color)); // location = 3, color
-	glEnableVertexAttribArray(3);
-	glVertexAttribPointer(4, 3, GL_REAL, GL_FALSE, sizeof(Vertex), (GLvoid *) offsetof(Vertex, tangent)); // location = 4, tangent
-	glEnableVertexAttribArray(4);
-	glVertexAttribPointer(5, 3, GL_REAL, GL_FALSE, sizeof(Vertex), (GLvoid *) offsetof(Vertex, bi_tangent)); // location = 5, bi_tangent
-	glEnableVertexAttribArray(5);
-	glVertexAttribIPointer(6, 1, GL_UNSIGNED_INT, sizeof(Vertex), (GLvoid *) offsetof(Vertex, id)); // location = 6, id
-	glEnableVertexAttribArray(6);
+	_setup_layout();
+	_opt.dirty = true;
+}
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _ebo);
+void Kasumi::Mesh::_setup_layout()
+{
+	auto offsets = layout_offsets(_layout);
+	auto stride = static_cast<GLsizei>(offsets.stride);
+	auto packed = _layout.packed;
 
-	glBindVertexArray(0);
-	_opt.dirty = true;
+	glBindVertexArray(_vao);
+	for (GLuint location = 0; location <= 6; ++location)
+		glDisableVertexAttribArray(location);
 
-	// prepare for Eigen
-	_verts_eigen3.resize((Index) _verts.size(), 3);
-	_verts_eigen4.resize((Index) _verts.size(), 4);
-	for (Index i = 0; i < _verts_eigen4.rows(); ++i)
+	if (_layout.split_position)
 	{
-		_verts_eigen3(i, 0) = _verts[i].position.x();
-		_verts_eigen3(i, 1) = _verts[i].position.y();
-		_verts_eigen3(i, 2) = _verts[i].position.z();
+		glBindBuffer(GL_ARRAY_BUFFER, _vbo);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (GLvoid *) 0); // location = 0, position
+		glEnableVertexAttribArray(0);
+	}
 
-		_verts_eigen4(i, 0) = _verts[i].position.x();
-		_verts_eigen4(i, 1) = _verts[i].position.y();
-		_verts_eigen4(i, 2) = _verts[i].position.z();
-		_verts_eigen4(i, 3) = 1;
+	glBindBuffer(GL_ARRAY_BUFFER, _attr_vbo);
+	if (!_layout.split_position)
+	{
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (GLvoid *) offsets.position); // location = 0, position
+		glEnableVertexAttribArray(0);
+	}
+	if (_layout.has(VertexLayout::Normal))
+	{
+		packed ? glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (GLvoid *) offsets.normal) // location = 1, normal
+			   : glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (GLvoid *) offsets.normal);
+		glEnableVertexAttribArray(1);
+	}
+	if (_layout.has(VertexLayout::TexCoord))
+	{
+		packed ? glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, stride, (GLvoid *) offsets.tex_coord) // location = 2, tex_coord
+			   : glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (GLvoid *) offsets.tex_coord);
+		glEnableVertexAttribArray(2);
 	}
-	_idxs_eigen.resize((Index) _idxs.size() / 3, 3);
-	for (Index i = 0; i < _idxs_eigen.rows(); ++i)
+	if (_layout.has(VertexLayout::Color))
 	{
-		_idxs_eigen(i, 0) = (int) _idxs[i * 3 + 0];
-		_idxs_eigen(i, 1) = (int) _idxs[i * 3 + 1];
-		_idxs_eigen(i, 2) = (int) _idxs[i * 3 + 2];
+		packed ? glVertexAttribPointer(3, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride, (GLvoid *) offsets.color) // location = 3, color
+			   : glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, stride, (GLvoid *) offsets.color);
+		glEnableVertexAttribArray(3);
 	}
+	if (_layout.has(VertexLayout::Tangent))
+	{
+		packed ? glVertexAttribPointer(4, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (GLvoid *) offsets.tangent) // location = 4, tangent
+			   : glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, stride, (GLvoid *) offsets.tangent);
+		glEnableVertexAttribArray(4);
+		packed ? glVertexAttribPointer(5, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (GLvoid *) offsets.bi_tangent) // location = 5, bi_tangent
+			   : glVertexAttribPointer(5, 3, GL_FLOAT, GL_FALSE, stride, (GLvoid *) offsets.bi_tangent);
+		glEnableVertexAttribArray(5);
+	}
+	if (_layout.has(VertexLayout::ID))
+	{
+		glVertexAttribIPointer(6, 1, GL_UNSIGNED_INT, stride, (GLvoid *) offsets.id); // location = 6, id
+		glEnableVertexAttribArray(6);
+	}
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _ebo);
+	glBindVertexArray(0);
+
+	_vbo_size = 0; // the buffers are reallocated for the new stride on the next _update
 }
 
 void Kasumi::Mesh::_update()
@@ -238,14 +453,179 @@ void Kasumi::Mesh::_update()
 
 	glBindVertexArray(_vao);
 
-	glBindBuffer(GL_ARRAY_BUFFER, _vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * _verts.size(), &_verts[0], GL_DYNAMIC_DRAW);
+	if (_verts.size() != _vbo_size)
+	{
+		auto offsets = layout_offsets(_layout);
+		if (_layout.split_position)
+		{
+			glBindBuffer(GL_ARRAY_BUFFER, _vbo);
+			glBufferData(GL_ARRAY_BUFFER, 3 * sizeof(float) * _verts.size(), nullptr, GL_DYNAMIC_DRAW);
+		}
+		if (offsets.stride > 0)
+		{
+			glBindBuffer(GL_ARRAY_BUFFER, _attr_vbo);
+			glBufferData(GL_ARRAY_BUFFER, offsets.stride * _verts.size(), nullptr, GL_DYNAMIC_DRAW);
+		}
+		_vbo_size = _verts.size();
+		_upload(0, _verts.size());
+	} else if (_opt.dirty)
+		_upload(0, _verts.size());
+	else
+		for (auto &span: _dirty_spans)
+			_upload(span.first, span.second);
+	if (_opt.dirty)
+		_bounds_dirty = true;
+	_dirty_spans.clear();
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _ebo);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(Index) * _idxs.size(), &_idxs[0], GL_DYNAMIC_DRAW);
+	if (_indices_dirty && !_idxs.empty())
+	{
+		// every level follows the base list in the same buffer, a level is just another offset for glDrawElements
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _ebo);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, static_cast<GLsizeiptr>(sizeof(Index) * _index_total()), nullptr, GL_DYNAMIC_DRAW);
+		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, static_cast<GLsizeiptr>(sizeof(Index) * _idxs.size()), _idxs.data());
+		for (int level = 1; level <= static_cast<int>(_lods.size()); ++level)
+		{
+			auto range = _lod_range(level);
+			glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, static_cast<GLintptr>(sizeof(Index) * range.first), static_cast<GLsizeiptr>(sizeof(Index) * range.second), _lods[level - 1].indices.data());
+		}
+		_indices_dirty = false;
+	}
 
 	glBindVertexArray(0);
 
+	_opt.dirty = false;
+}
+
+void Kasumi::Mesh::_upload(size_t begin, size_t end)
+{
+	auto count = end - begin;
+	const Vertex *src = _verts.data() + begin;
+	auto offsets = layout_offsets(_layout);
+
+	if (_layout.split_position)
+	{
+		_staging.resize(count * 3 * sizeof(float));
+		auto *dst = reinterpret_cast<float *>(_staging.data());
+		for (size_t i = 0; i < count; ++i)
+		{
+			dst[3 * i + 0] = static_cast<float>(src[i].position.x());
+			dst[3 * i + 1] = static_cast<float>(src[i].position.y());
+			dst[3 * i + 2] = static_cast<float>(src[i].position.z());
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, _vbo);
+		glBufferSubData(GL_ARRAY_BUFFER, static_cast<GLintptr>(3 * sizeof(float) * begin), static_cast<GLsizeiptr>(_staging.size()), _staging.data());
+	}
+
+	if (offsets.stride == 0)
+		return;
+
+	_staging.resize(count * offsets.stride);
+	auto *dst = _staging.data();
+	auto stride = offsets.stride;
+	auto vec3 = [](unsigned char *out, const mVector3 &v)
+	{
+		float f[3] = {static_cast<float>(v.x()), static_cast<float>(v.y()), static_cast<float>(v.z())};
+		write_floats(out, f, 3);
+	};
+
+	if (!_layout.split_position)
+		write_stream(dst, stride, offsets.position, count, [&](unsigned char *out, size_t i) { vec3(out, src[i].position); });
+	if (_layout.has(VertexLayout::Normal))
+		_layout.packed ? write_stream(dst, stride, offsets.normal, count, [&](unsigned char *out, size_t i) { write_u32(out, pack_snorm_10_10_10(src[i].normal.x(), src[i].normal.y(), src[i].normal.z())); })
+					   : write_stream(dst, stride, offsets.normal, count, [&](unsigned char *out, size_t i) { vec3(out, src[i].normal); });
+	if (_layout.has(VertexLayout::TexCoord))
+		_layout.packed ? write_stream(dst, stride, offsets.tex_coord, count, [&](unsigned char *out, size_t i)
+		{
+			write_u32(out, static_cast<std::uint32_t>(float_to_half(static_cast<float>(src[i].tex_coord.x()))) | (static_cast<std::uint32_t>(float_to_half(static_cast<float>(src[i].tex_coord.y()))) << 16));
+		})
+					   : write_stream(dst, stride, offsets.tex_coord, count, [&](unsigned char *out, size_t i)
+		{
+			float f[2] = {static_cast<float>(src[i].tex_coord.x()), static_cast<float>(src[i].tex_coord.y())};
+			write_floats(out, f, 2);
+		});
+	if (_layout.has(VertexLayout::Color))
+		_layout.packed ? write_stream(dst, stride, offsets.color, count, [&](unsigned char *out, size_t i) { write_u32(out, pack_unorm8(src[i].color.x()) | (pack_unorm8(src[i].color.y()) << 8) | (pack_unorm8(src[i].color.z()) << 16) | (255u << 24)); })
+					   : write_stream(dst, stride, offsets.color, count, [&](unsigned char *out, size_t i) { vec3(out, src[i].color); });
+	if (_layout.has(VertexLayout::Tangent))
+	{
+		_layout.packed ? write_stream(dst, stride, offsets.tangent, count, [&](unsigned char *out, size_t i) { write_u32(out, pack_snorm_10_10_10(src[i].tangent.x(), src[i].tangent.y(), src[i].tangent.z())); })
+					   : write_stream(dst, stride, offsets.tangent, count, [&](unsigned char *out, size_t i) { vec3(out, src[i].tangent); });
+		_layout.packed ? write_stream(dst, stride, offsets.bi_tangent, count, [&](unsigned char *out, size_t i) { write_u32(out, pack_snorm_10_10_10(src[i].bi_tangent.x(), src[i].bi_tangent.y(), src[i].bi_tangent.z())); })
+					   : write_stream(dst, stride, offsets.bi_tangent, count, [&](unsigned char *out, size_t i) { vec3(out, src[i].bi_tangent); });
+	}
+	if (_layout.has(VertexLayout::ID))
+		write_stream(dst, stride, offsets.id, count, [&](unsigned char *out, size_t i) { write_u32(out, src[i].id); });
+
+	glBindBuffer(GL_ARRAY_BUFFER, _attr_vbo);
+	glBufferSubData(GL_ARRAY_BUFFER, static_cast<GLintptr>(stride * begin), static_cast<GLsizeiptr>(_staging.size()), _staging.data());
+}
+
+#ifdef HINA_EIGEN
+void Kasumi::Mesh::_sync_eigen()
+{
+	// a whole-mesh edit drops the copies (they are rebuilt by whoever asks next); spans are patched in place
+	if (_eigen_dirty || _verts_eigen3.rows() + _verts_eigen4.rows() == 0)
+	{
+		if (_eigen_dirty)
+		{
+			_verts_eigen3.resize(0, 3);
+			_verts_eigen4.resize(0, 4);
+		}
+		_eigen_dirty = false;
+		_eigen_spans.clear();
+		return;
+	}
+
+	for (auto &span: _eigen_spans)
+		for (size_t i = span.first; i < std::min(span.second, _verts.size()); ++i)
+		{
+			auto row = static_cast<Eigen::Index>(i);
+			if (_verts_eigen3.rows() == static_cast<Eigen::Index>(_verts.size()))
+				_verts_eigen3.row(row) << _verts[i].position.x(), _verts[i].position.y(), _verts[i].position.z();
+			if (_verts_eigen4.rows() == static_cast<Eigen::Index>(_verts.size()))
+				_verts_eigen4.row(row) << _verts[i].position.x(), _verts[i].position.y(), _verts[i].position.z(), 1;
+		}
+	_eigen_spans.clear();
+}
+auto Kasumi::Mesh::_eigen_vertices3() -> const Eigen::Matrix<real, Eigen::Dynamic, 3> &
+{
+	_sync_eigen();
+	if (_verts_eigen3.rows() != static_cast<Eigen::Index>(_verts.size()))
+	{
+		_verts_eigen3.resize(static_cast<Eigen::Index>(_verts.size()), 3);
+		for (Eigen::Index i = 0; i < _verts_eigen3.rows(); ++i)
+			_verts_eigen3.row(i) << _verts[i].position.x(), _verts[i].position.y(), _verts[i].position.z();
+	}
+	return _verts_eigen3;
+}
+auto Kasumi::Mesh::_eigen_vertices4() -> const Eigen::Matrix<real, Eigen::Dynamic, 4> &
+{
+	_sync_eigen();
+	if (_verts_eigen4.rows() != static_cast<Eigen::Index>(_verts.size()))
+	{
+		_verts_eigen4.resize(static_cast<Eigen::Index>(_verts.size()), 4);
+		for (Eigen::Index i = 0; i < _verts_eigen4.rows(); ++i)
+			_verts_eigen4.row(i) << _verts[i].position.x(), _verts[i].position.y(), _verts[i].position.z(), 1;
+	}
+	return _verts_eigen4;
+}
+auto Kasumi::Mesh::_eigen_indices() -> const Eigen::Matrix<int, Eigen::Dynamic, Eigen::Dynamic> &
+{
+	if (_idxs_eigen.rows() != static_cast<Eigen::Index>(_idxs.size() / 3))
+	{
+		_idxs_eigen.resize(static_cast<Eigen::Index>(_idxs.size() / 3), 3);
+		for (Eigen::Index i = 0; i < _idxs_eigen.rows(); ++i)
+			_idxs_eigen.row(i) << (int) _idxs[i * 3 + 0], (int) _idxs[i * 3 + 1], (int) _idxs[i * 3 + 2];
+	}
+	return _idxs_eigen;
+}
+#endif
+
+void Kasumi::Mesh::_update_bounds()
+{
+	if (!_bounds_dirty || _verts.empty())
+		return;
+
 	_center_point = mVector3(0.0f, 0.0f, 0.0f);
 	for (auto &v: _verts)
 		_center_point += v.position;
@@ -276,7 +656,7 @@ void Kasumi::Mesh::_update()
 	_bbox_lines->add(mVector3(u.x(), u.y(), l.z()), mVector3(u.x(), u.y(), u.z()), bbox_color);
 	_bbox_lines->add(mVector3(l.x(), u.y(), l.z()), mVector3(l.x(), u.y(), u.z()), bbox_color);
 
-	_opt.dirty = false;
+	_bounds_dirty = false;
 }
 
 void Kasumi::Mesh::_load_primitive(const std::string &primitive_name, std::vector<Kasumi::Mesh::Vertex> &vertices, std::vector<unsigned int> &indices, const mVector3 &color)
@@ -307,6 +687,9 @@ void Kasumi::Mesh::_load_primitive(const std::string &primitive_name, std::vecto
 	for (int i = 0; i < mesh->mNumFaces; ++i)
 		for (int j = 0; j < mesh->mFaces[i].mNumIndices; ++j)
 			indices.emplace_back(mesh->mFaces[i].mIndices[j]);
+
+	if (OptimizeOnLoad)
+		Optimize(vertices, indices, OptimizeOverdraw);
 }
 
 auto Kasumi::Mesh::voxelize() -> HinaPE::Geom::DataGrid3<int>
@@ -397,36 +780,36 @@ void Kasumi::Lines::_update()
 Kasumi::InstancedMesh::InstancedMesh(Kasumi::MeshPtr mesh) : _mesh(std::move(mesh)), _instanceVBO(0)
 {
 	glGenBuffers(1, &_instanceVBO);
-	glBindBuffer(GL_ARRAY_BUFFER, _instanceVBO);
+	glGenBuffers(1, &_colorVBO);
 
 	glBindVertexArray(_mesh->_vao);
+	_bind_instances(0);
 	glEnableVertexAttribArray(7);
-	glVertexAttribPointer(7, 4, GL_REAL, GL_FALSE, sizeof(mMatrix4x4), (void *) 0);
 	glEnableVertexAttribArray(8);
-	glVertexAttribPointer(8, 4, GL_REAL, GL_FALSE, sizeof(mMatrix4x4), (void *) (sizeof(mVector4)));
 	glEnableVertexAttribArray(9);
-	glVertexAttribPointer(9, 4, GL_REAL, GL_FALSE, sizeof(mMatrix4x4), (void *) (2 * sizeof(mVector4)));
 	glEnableVertexAttribArray(10);
-	glVertexAttribPointer(10, 4, GL_REAL, GL_FALSE, sizeof(mMatrix4x4), (void *) (3 * sizeof(mVector4)));
+	glEnableVertexAttribArray(11);
 
 	glVertexAttribDivisor(7, 1);
 	glVertexAttribDivisor(8, 1);
 	glVertexAttribDivisor(9, 1);
 	glVertexAttribDivisor(10, 1);
-
-	glBindVertexArray(0);
-
-	glGenBuffers(1, &_colorVBO);
-	glBindBuffer(GL_ARRAY_BUFFER, _colorVBO);
-	glBindVertexArray(_mesh->_vao);
-	glEnableVertexAttribArray(11);
-	glVertexAttribPointer(11, 4, GL_REAL, GL_FALSE, sizeof(mVector4), (void *) 0);
 	glVertexAttribDivisor(11, 1);
 	glBindVertexArray(0);
 
 	_mesh->_opt.instanced = true;
 	_mesh->_opt.instance_count = static_cast<int>(_opt.instance_matrices.size());
 }
+void Kasumi::InstancedMesh::_bind_instances(size_t first)
+{
+	glBindBuffer(GL_ARRAY_BUFFER, _instanceVBO);
+	glVertexAttribPointer(7, 4, GL_REAL, GL_FALSE, sizeof(mMatrix4x4), (void *) (first * sizeof(mMatrix4x4)));
+	glVertexAttribPointer(8, 4, GL_REAL, GL_FALSE, sizeof(mMatrix4x4), (void *) (first * sizeof(mMatrix4x4) + sizeof(mVector4)));
+	glVertexAttribPointer(9, 4, GL_REAL, GL_FALSE, sizeof(mMatrix4x4), (void *) (first * sizeof(mMatrix4x4) + 2 * sizeof(mVector4)));
+	glVertexAttribPointer(10, 4, GL_REAL, GL_FALSE, sizeof(mMatrix4x4), (void *) (first * sizeof(mMatrix4x4) + 3 * sizeof(mVector4)));
+	glBindBuffer(GL_ARRAY_BUFFER, _colorVBO);
+	glVertexAttribPointer(11, 4, GL_REAL, GL_FALSE, sizeof(mVector4), (void *) (first * sizeof(mVector4)));
+}
 void Kasumi::InstancedMesh::_update()
 {
 	if (!_opt.dirty && _opt.instance_matrices.empty())
@@ -435,29 +818,140 @@ void Kasumi::InstancedMesh::_update()
 	if (_opt.colors.size() != _opt.instance_matrices.size())
 		_opt.colors.resize(_opt.instance_matrices.size(), mVector4(HinaPE::Color::ORANGE.x(), HinaPE::Color::ORANGE.y(), HinaPE::Color::ORANGE.z(), 1.0));
 
+	// the instances to upload: the visible ones, grouped by level of detail
+	auto count = _opt.instance_matrices.size();
+	bool culled = false;
+	if (Culling::MainCulling != nullptr)
+		_cull_version = Culling::MainCulling->version();
+	if (Culling::MainCulling != nullptr && Culling::MainCulling->enabled())
+	{
+		Culling::MainCulling->cull_instances(_mesh->bbox(), _opt.instance_matrices, _visible);
+		culled = _visible.size() != count;
+	}
+	if (!culled)
+	{
+		_visible.resize(count);
+		for (size_t i = 0; i < count; ++i)
+			_visible[i] = static_cast<unsigned int>(i);
+	}
+
+	// every instance picks its own level, kept per instance for the hysteresis; a counting sort makes one run per level
+	_lod_runs.clear();
+	if (Mesh::UseLod && !_mesh->_lods.empty())
+	{
+		_instance_lod.resize(count, -1);
+		std::vector<size_t> offsets(_mesh->lod_count() + 1, 0);
+		for (auto i: _visible)
+		{
+			_instance_lod[i] = _mesh->select_lod(_opt.instance_matrices[i], _instance_lod[i]);
+			++offsets[_instance_lod[i] + 1];
+		}
+		for (int level = 0; level < _mesh->lod_count(); ++level)
+		{
+			if (offsets[level + 1] > 0)
+				_lod_runs.push_back({level, offsets[level], offsets[level + 1]});
+			offsets[level + 1] += offsets[level];
+		}
+		_order.resize(_visible.size());
+		for (auto i: _visible)
+			_order[offsets[_instance_lod[i]]++] = i;
+		_visible.swap(_order);
+	} else
+		_lod_runs.push_back({0, 0, _visible.size()});
+
+	// the full arrays go up untouched when nothing is culled and every instance shares one level
+	auto *matrices = &_opt.instance_matrices;
+	auto *colors = &_opt.colors;
+	_compacted = culled || _lod_runs.size() > 1;
+	if (_compacted)
+	{
+		_visible_matrices.clear();
+		_visible_colors.clear();
+		_visible_index.assign(count, -1);
+		for (auto i: _visible)
+		{
+			_visible_index[i] = static_cast<int>(_visible_matrices.size());
+			_visible_matrices.push_back(_opt.instance_matrices[i]);
+			_visible_colors.push_back(_opt.colors[i]);
+		}
+		matrices = &_visible_matrices;
+		colors = &_visible_colors;
+	}
+
 	glBindVertexArray(_mesh->_vao);
 	glBindBuffer(GL_ARRAY_BUFFER, _instanceVBO);
-	glBufferData(GL_ARRAY_BUFFER, _opt.instance_matrices.size() * sizeof(mMatrix4x4), &_opt.instance_matrices[0], GL_DYNAMIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, matrices->size() * sizeof(mMatrix4x4), matrices->data(), GL_DYNAMIC_DRAW);
 	glBindBuffer(GL_ARRAY_BUFFER, _colorVBO);
-	glBufferData(GL_ARRAY_BUFFER, _opt.colors.size() * sizeof(mVector4), &_opt.colors[0], GL_DYNAMIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, colors->size() * sizeof(mVector4), colors->data(), GL_DYNAMIC_DRAW);
 
 	_mesh->_opt.render_surface = _opt.render_surface;
 	_mesh->_opt.render_wireframe = _opt.render_wireframe;
 	_mesh->_opt.render_bbox = _opt.render_bbox;
-	_mesh->_opt.instance_count = static_cast<int>(_opt.instance_matrices.size());
+	_mesh->_opt.instance_count = static_cast<int>(matrices->size());
 
 	_opt.dirty = false;
 }
-void Kasumi::InstancedMesh::render(const Kasumi::Shader &shader)
+void Kasumi::InstancedMesh::prepare()
 {
 	if (_opt.instance_matrices.empty())
 		return;
 
+	// a moved camera or a new depth pyramid invalidates the last compaction and the chosen levels
+	bool culling = Culling::MainCulling != nullptr && Culling::MainCulling->enabled();
+	bool lod = Mesh::UseLod && !_mesh->_lods.empty();
+	if ((culling || lod) && Culling::MainCulling != nullptr)
+	{
+		if (Culling::MainCulling->version() != _cull_version)
+			_opt.dirty = true;
+	} else if (_compacted || (!_lod_runs.empty() && _lod_runs.front().level != 0))
+		_opt.dirty = true;
+
 	if (_opt.dirty)
 		_update();
+}
+auto Kasumi::InstancedMesh::visible_index(int instance) const -> int
+{
+	if (!_compacted || instance < 0)
+		return instance;
+	return instance < static_cast<int>(_visible_index.size()) ? _visible_index[instance] : -1;
+}
+void Kasumi::InstancedMesh::render(const Kasumi::Shader &shader)
+{
+	if (_opt.instance_matrices.empty())
+		return;
 
-	_mesh->render(shader);
+	prepare();
+	if (_mesh->_opt.instance_count == 0)
+		return;
+
+	if (_lod_runs.size() <= 1)
+	{
+		_mesh->_opt.lod = _lod_runs.empty() ? 0 : _lod_runs.front().level;
+		shader.uniform("inst_base", 0);
+		_mesh->render(shader);
+		_mesh->_opt.lod = 0;
+		return;
+	}
+
+	// one draw per level, the instance attributes start at the level's first instance (no base instance on GL 3.3)
+	auto total = _mesh->_opt.instance_count;
+	for (auto &run: _lod_runs)
+	{
+		glBindVertexArray(_mesh->_vao);
+		_bind_instances(run.first);
+		glBindVertexArray(0);
+		_mesh->_opt.lod = run.level;
+		_mesh->_opt.instance_count = static_cast<int>(run.count);
+		shader.uniform("inst_base", static_cast<int>(run.first));
+		_mesh->render(shader);
+	}
+	glBindVertexArray(_mesh->_vao);
+	_bind_instances(0);
+	glBindVertexArray(0);
+	_mesh->_opt.lod = 0;
+	_mesh->_opt.instance_count = total;
 }
+
 // ================================================== InstancedMesh ==================================================
 
 Kasumi::InstancedLines::InstancedLines(Kasumi::LinesPtr lines) : _lines(std::move(lines)), _instanceVBO(0)
@@ -623,3 +1117,248 @@ void Kasumi::InstancedPoints::_update()
 
 	_opt.dirty = false;
 }
+Kasumi::SphereImpostors::SphereImpostors() : _vao(0), _sphere_vbo(0), _color_vbo(0)
+{
+	glGenVertexArrays(1, &_vao);
+	glGenBuffers(1, &_sphere_vbo);
+	glGenBuffers(1, &_color_vbo);
+	glBindVertexArray(_vao);
+
+	glBindBuffer(GL_ARRAY_BUFFER, _sphere_vbo);
+	glVertexAttribPointer(0, 4, GL_REAL, GL_FALSE, sizeof(mVector4), (GLvoid *) 0); // location = 0, center & radius
+	glEnableVertexAttribArray(0);
+
+	glBindBuffer(GL_ARRAY_BUFFER, _color_vbo);
+	glVertexAttribPointer(1, 4, GL_REAL, GL_FALSE, sizeof(mVector4), (GLvoid *) 0); // location = 1, color
+	glEnableVertexAttribArray(1);
+
+	glBindVertexArray(0);
+
+	GLfloat range[2] = {1, 64};
+	glGetFloatv(GL_POINT_SIZE_RANGE, range);
+	_max_point_size = range[1];
+}
+Kasumi::SphereImpostors::~SphereImpostors()
+{
+	glDeleteVertexArrays(1, &_vao);
+	glDeleteBuffers(1, &_sphere_vbo);
+	glDeleteBuffers(1, &_color_vbo);
+}
+void Kasumi::SphereImpostors::_update()
+{
+	if (_opt.colors.size() != _opt.spheres.size())
+		_opt.colors.resize(_opt.spheres.size(), mVector4(HinaPE::Color::ORANGE.x(), HinaPE::Color::ORANGE.y(), HinaPE::Color::ORANGE.z(), 1.0));
+
+	glBindBuffer(GL_ARRAY_BUFFER, _sphere_vbo);
+	glBufferData(GL_ARRAY_BUFFER, _opt.spheres.size() * sizeof(mVector4), _opt.spheres.data(), GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, _color_vbo);
+	glBufferData(GL_ARRAY_BUFFER, _opt.colors.size() * sizeof(mVector4), _opt.colors.data(), GL_DYNAMIC_DRAW);
+
+	_opt.dirty = false;
+}
+void Kasumi::SphereImpostors::render(const Kasumi::Shader &shader)
+{
+	if (_opt.spheres.empty())
+		return;
+
+	if (_opt.dirty)
+		_update();
+
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	shader.use();
+	shader.uniform("viewport", mVector4(static_cast<real>(viewport[0]), static_cast<real>(viewport[1]), static_cast<real>(viewport[2]), static_cast<real>(viewport[3])));
+	shader.uniform("max_point_size", _max_point_size);
+	shader.uniform("lod_pixels", static_cast<float>(_opt.lod_pixels));
+
+	glEnable(GL_DEPTH_TEST);
+	glDisable(GL_BLEND);
+	glEnable(GL_PROGRAM_POINT_SIZE);
+	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+
+	glBindVertexArray(_vao);
+	glDrawArrays(GL_POINTS, 0, (GLsizei) _opt.spheres.size());
+	glBindVertexArray(0);
+
+	glDisable(GL_PROGRAM_POINT_SIZE);
+}
+Kasumi::Volume::Volume() : _vao(0), _vbo(0), _texture(0), _pbo(0), _depth(0)
+{
+	// unit cube, outward faces counter-clockwise; scaled to the box in the vertex shader
+	const float corners[8][3] = {{0, 0, 0}, {1, 0, 0}, {0, 1, 0}, {1, 1, 0}, {0, 0, 1}, {1, 0, 1}, {0, 1, 1}, {1, 1, 1}};
+	const int faces[6][4] = {{0, 4, 6, 2}, {1, 3, 7, 5}, {0, 1, 5, 4}, {2, 6, 7, 3}, {0, 2, 3, 1}, {4, 5, 7, 6}};
+	std::vector<float> cube;
+	for (auto &face: faces)
+		for (int corner: {face[0], face[1], face[2], face[0], face[2], face[3]})
+			cube.insert(cube.end(), corners[corner], corners[corner] + 3);
+
+	glGenVertexArrays(1, &_vao);
+	glGenBuffers(1, &_vbo);
+	glBindVertexArray(_vao);
+	glBindBuffer(GL_ARRAY_BUFFER, _vbo);
+	glBufferData(GL_ARRAY_BUFFER, cube.size() * sizeof(float), cube.data(), GL_STATIC_DRAW);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (GLvoid *) 0); // location = 0, position
+	glEnableVertexAttribArray(0);
+	glBindVertexArray(0);
+
+	glGenTextures(1, &_texture);
+	glBindTexture(GL_TEXTURE_3D, _texture);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_3D, 0);
+
+	glGenTextures(1, &_depth);
+	glBindTexture(GL_TEXTURE_2D, _depth);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+Kasumi::Volume::~Volume()
+{
+	glDeleteVertexArrays(1, &_vao);
+	glDeleteBuffers(1, &_vbo);
+	glDeleteTextures(1, &_texture);
+	glDeleteTextures(1, &_depth);
+	if (_pbo != 0)
+		glDeleteBuffers(1, &_pbo);
+}
+void Kasumi::Volume::resize(int x, int y, int z)
+{
+	_x = std::max(x, 0), _y = std::max(y, 0), _z = std::max(z, 0);
+	_data.assign(static_cast<size_t>(_x) * _y * _z, 0.f);
+	_dirty_begin = _dirty_end = 0;
+	_resized = true;
+}
+auto Kasumi::Volume::slab(int z) -> std::span<float>
+{
+	if (z < 0 || z >= _z)
+		return {};
+	mark_dirty(z, z + 1);
+	auto size = static_cast<size_t>(_x) * _y;
+	return {_data.data() + size * z, size};
+}
+void Kasumi::Volume::mark_dirty(int z_begin, int z_end)
+{
+	z_begin = std::max(z_begin, 0), z_end = std::min(z_end, _z);
+	if (z_begin >= z_end)
+		return;
+	if (_dirty_begin >= _dirty_end)
+		_dirty_begin = z_begin, _dirty_end = z_end;
+	else
+		_dirty_begin = std::min(_dirty_begin, z_begin), _dirty_end = std::max(_dirty_end, z_end);
+}
+void Kasumi::Volume::_update()
+{
+	glBindTexture(GL_TEXTURE_3D, _texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	if (_resized)
+	{
+		glTexImage3D(GL_TEXTURE_3D, 0, GL_R32F, _x, _y, _z, 0, GL_RED, GL_FLOAT, _data.data());
+		_resized = false;
+	} else if (_dirty_begin < _dirty_end)
+	{
+		// the dirty slabs are contiguous in memory and go up in one copy through an orphaned pixel buffer
+		auto offset = static_cast<size_t>(_x) * _y * _dirty_begin;
+		auto bytes = static_cast<size_t>(_x) * _y * (_dirty_end - _dirty_begin) * sizeof(float);
+		if (_pbo == 0)
+			glGenBuffers(1, &_pbo);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, _pbo);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, static_cast<GLsizeiptr>(bytes), nullptr, GL_STREAM_DRAW);
+		auto *dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, static_cast<GLsizeiptr>(bytes), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		const void *pixels = nullptr;
+		if (dst != nullptr)
+		{
+			std::memcpy(dst, _data.data() + offset, bytes);
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		} else
+		{
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			pixels = _data.data() + offset;
+		}
+		glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, _dirty_begin, _x, _y, _dirty_end - _dirty_begin, GL_RED, GL_FLOAT, pixels);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}
+	glBindTexture(GL_TEXTURE_3D, 0);
+	_dirty_begin = _dirty_end = 0;
+}
+void Kasumi::Volume::render(const Kasumi::Shader &shader)
+{
+	if (_data.empty())
+		return;
+
+	_update();
+
+	auto iso = _opt.mode == Mode::Isosurface;
+	shader.use();
+	shader.uniform("box_min", _opt.origin);
+	shader.uniform("box_size", _opt.extent);
+	shader.uniform("texel", mVector3(1.0 / _x, 1.0 / _y, 1.0 / _z));
+	shader.uniform("mode", static_cast<int>(_opt.mode));
+	shader.uniform("range", mVector2(_opt.lower, _opt.upper > _opt.lower ? _opt.upper : _opt.lower + 1));
+	shader.uniform("density", static_cast<float>(_opt.density));
+	shader.uniform("iso", static_cast<float>(_opt.iso));
+	shader.uniform("color", _opt.color);
+	shader.uniform("max_steps", _opt.max_steps);
+	shader.uniform("field", 0);
+	shader.uniform("scene_depth", 1);
+
+	// once here instead of in each of the 36 vertices
+	auto view = Camera::MainCamera->get_view(), projection = Camera::MainCamera->get_projection();
+	Eigen::Matrix<real, 4, 4> inv_view = view._m.inverse();
+	mMatrix4x4 inv_view_projection;
+	inv_view_projection._m = (projection._m * view._m).inverse();
+	shader.uniform("eye", mVector3(inv_view(0, 3), inv_view(1, 3), inv_view(2, 3)));
+	shader.uniform("inv_view_projection", inv_view_projection);
+
+	// copy the depth drawn so far out of the bound target, the rays stop at it; the back faces may lie behind it
+	if (Batch::MainBatch != nullptr)
+		Batch::MainBatch->flush();
+	GLint viewport[4], draw_fbo, read_fbo;
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &draw_fbo);
+	glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &read_fbo);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, _depth);
+	if (_depth_width != viewport[2] || _depth_height != viewport[3])
+	{
+		_depth_width = viewport[2], _depth_height = viewport[3];
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, _depth_width, _depth_height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+	}
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, draw_fbo);
+	glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, viewport[0], viewport[1], viewport[2], viewport[3]);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, read_fbo);
+	shader.uniform("viewport", mVector4(viewport[0], viewport[1], viewport[2], viewport[3]));
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_3D, _texture);
+
+	// back faces only, always passing: the scene depth is handled per ray, and an isosurface hit is never behind it.
+	// The test stays enabled as the iso depth is not written otherwise; the colour comes out premultiplied
+	glEnable(GL_DEPTH_TEST);
+	glDepthFunc(GL_ALWAYS);
+	glEnable(GL_CULL_FACE);
+	glCullFace(GL_FRONT);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+	glDepthMask(iso ? GL_TRUE : GL_FALSE);
+	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+
+	glBindVertexArray(_vao);
+	glDrawArrays(GL_TRIANGLES, 0, 36);
+	glBindVertexArray(0);
+
+	glDepthMask(GL_TRUE);
+	glDepthFunc(GL_LESS);
+	glCullFace(GL_BACK);
+	glDisable(GL_CULL_FACE);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glBindTexture(GL_TEXTURE_3D, 0);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glActiveTexture(GL_TEXTURE0);
+}
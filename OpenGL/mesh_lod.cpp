@@ -0,0 +1,439 @@
+#include "../mesh.h"
+#include "../camera.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <queue>
+#include <unordered_map>
+
+bool Kasumi::Mesh::UseLod = true;
+real Kasumi::Mesh::LodPixelError = 1;
+real Kasumi::Mesh::LodHysteresis = 0.2;
+size_t Kasumi::Mesh::AutoLodTriangles = 4096;
+
+// ==================== Quadric Simplification ====================
+// Garland-Heckbert quadrics driving half edge collapses: a vertex only ever moves onto one of its neighbours, so each
+// level is an index list over the vertices of the full mesh and all levels share one vertex buffer
+namespace
+{
+constexpr int MaxLodLevels = 4;
+constexpr double BoundaryWeight = 10; // open borders are held in place by planes perpendicular to them
+constexpr double MinFlipCosine = 0.2; // a collapse may not turn a triangle further than ~78 degrees
+
+struct Quadric
+{
+	double a[10] = {}; // upper triangle of the symmetric 4x4 matrix
+	double weight = 0; // summed plane weights, turns the error back into a squared distance
+
+	static auto plane(const double n[3], double d, double w) -> Quadric
+	{
+		Quadric q;
+		q.a[0] = w * n[0] * n[0], q.a[1] = w * n[0] * n[1], q.a[2] = w * n[0] * n[2], q.a[3] = w * n[0] * d;
+		q.a[4] = w * n[1] * n[1], q.a[5] = w * n[1] * n[2], q.a[6] = w * n[1] * d;
+		q.a[7] = w * n[2] * n[2], q.a[8] = w * n[2] * d;
+		q.a[9] = w * d * d;
+		q.weight = w;
+		return q;
+	}
+	auto operator+=(const Quadric &o) -> Quadric &
+	{
+		for (int i = 0; i < 10; ++i)
+			a[i] += o.a[i];
+		weight += o.weight;
+		return *this;
+	}
+	auto error(const double p[3]) const -> double
+	{
+		double x = p[0], y = p[1], z = p[2];
+		double e = a[0] * x * x + 2 * a[1] * x * y + 2 * a[2] * x * z + 2 * a[3] * x
+				   + a[4] * y * y + 2 * a[5] * y * z + 2 * a[6] * y
+				   + a[7] * z * z + 2 * a[8] * z
+				   + a[9];
+		return std::max(e, 0.0);
+	}
+};
+
+inline void sub(const double a[3], const double b[3], double r[3]) { r[0] = a[0] - b[0], r[1] = a[1] - b[1], r[2] = a[2] - b[2]; }
+inline void cross(const double a[3], const double b[3], double r[3])
+{
+	r[0] = a[1] * b[2] - a[2] * b[1];
+	r[1] = a[2] * b[0] - a[0] * b[2];
+	r[2] = a[0] * b[1] - a[1] * b[0];
+}
+inline auto dot(const double a[3], const double b[3]) -> double { return a[0] * b[0] + a[1] * b[1] + a[2] * b[2]; }
+inline auto normalize(double v[3]) -> double
+{
+	double len = std::sqrt(dot(v, v));
+	if (len > 0)
+		v[0] /= len, v[1] /= len, v[2] /= len;
+	return len;
+}
+
+struct PositionKey
+{
+	float x, y, z;
+	auto operator==(const PositionKey &o) const -> bool { return x == o.x && y == o.y && z == o.z; }
+};
+struct PositionHash
+{
+	auto operator()(const PositionKey &k) const -> size_t
+	{
+		std::uint32_t bits[3];
+		std::memcpy(bits, &k, sizeof(bits));
+		return (static_cast<size_t>(bits[0]) * 73856093u) ^ (static_cast<size_t>(bits[1]) * 19349663u) ^ (static_cast<size_t>(bits[2]) * 83492791u);
+	}
+};
+
+class Simplifier
+{
+public:
+	using Index = Kasumi::Mesh::Index;
+
+	Simplifier(const std::vector<Kasumi::Mesh::Vertex> &vertices, const std::vector<Index> &indices) : _verts(vertices)
+	{
+		// vertices split only by normal or uv (seams, hard edges) are welded into one group, which is what collapses
+		std::unordered_map<PositionKey, unsigned int, PositionHash> weld;
+		_group.resize(vertices.size());
+		for (size_t i = 0; i < vertices.size(); ++i)
+		{
+			auto &p = vertices[i].position;
+			auto res = weld.try_emplace(PositionKey{static_cast<float>(p.x()), static_cast<float>(p.y()), static_cast<float>(p.z())}, static_cast<unsigned int>(_members.size()));
+			if (res.second)
+			{
+				_members.emplace_back();
+				_pos.push_back({static_cast<double>(p.x()), static_cast<double>(p.y()), static_cast<double>(p.z())});
+			}
+			_group[i] = res.first->second;
+			_members[res.first->second].push_back(static_cast<unsigned int>(i));
+		}
+
+		auto groups = _members.size();
+		_quadrics.resize(groups);
+		_group_tris.resize(groups);
+		_stamp.assign(groups, 0);
+		_dead.assign(groups, false);
+
+		std::unordered_map<std::uint64_t, int> edge_use;
+		for (size_t t = 0; t + 2 < indices.size(); t += 3)
+		{
+			std::array<unsigned int, 3> tri{indices[t], indices[t + 1], indices[t + 2]};
+			auto g0 = _group[tri[0]], g1 = _group[tri[1]], g2 = _group[tri[2]];
+			if (g0 == g1 || g1 == g2 || g2 == g0)
+				continue;
+			auto id = static_cast<unsigned int>(_tris.size());
+			_tris.push_back(tri);
+			_alive.push_back(true);
+			for (auto g: {g0, g1, g2})
+				_group_tris[g].push_back(id);
+
+			double n[3];
+			_normal(g0, g1, g2, n);
+			double area = normalize(n) / 2;
+			if (area > 0)
+			{
+				auto q = Quadric::plane(n, -dot(n, _pos[g0].data()), area);
+				_quadrics[g0] += q;
+				_quadrics[g1] += q;
+				_quadrics[g2] += q;
+			}
+			++edge_use[_edge(g0, g1)];
+			++edge_use[_edge(g1, g2)];
+			++edge_use[_edge(g2, g0)];
+		}
+		_alive_triangles = _tris.size();
+
+		for (auto &tri: _tris)
+		{
+			unsigned int g[3] = {_group[tri[0]], _group[tri[1]], _group[tri[2]]};
+			double n[3];
+			_normal(g[0], g[1], g[2], n);
+			normalize(n);
+			for (int e = 0; e < 3; ++e)
+			{
+				auto a = g[e], b = g[(e + 1) % 3];
+				if (edge_use[_edge(a, b)] != 1)
+					continue;
+				double edge[3], side[3];
+				sub(_pos[b].data(), _pos[a].data(), edge);
+				cross(edge, n, side);
+				double length2 = dot(edge, edge);
+				if (normalize(side) == 0)
+					continue;
+				auto q = Quadric::plane(side, -dot(side, _pos[a].data()), BoundaryWeight * length2);
+				_quadrics[a] += q;
+				_quadrics[b] += q;
+			}
+		}
+
+		for (auto &pair: edge_use)
+		{
+			auto a = static_cast<unsigned int>(pair.first >> 32), b = static_cast<unsigned int>(pair.first & 0xFFFFFFFFu);
+			_push(a, b);
+			_push(b, a);
+		}
+	}
+
+	// collapses the cheapest edges until at most target triangles are left or nothing valid remains
+	void run(size_t target)
+	{
+		while (_alive_triangles > target && !_queue.empty())
+		{
+			auto c = _queue.top();
+			_queue.pop();
+			if (_dead[c.from] || _dead[c.to] || _stamp[c.from] != c.from_stamp || _stamp[c.to] != c.to_stamp)
+				continue; // stale: one side moved since it was queued
+			if (!_valid(c.from, c.to))
+				continue;
+			_collapse(c.from, c.to);
+			_error = std::max(_error, c.distance2);
+		}
+	}
+	auto indices() const -> std::vector<Index>
+	{
+		std::vector<Index> res;
+		res.reserve(_alive_triangles * 3);
+		for (size_t t = 0; t < _tris.size(); ++t)
+			if (_alive[t])
+				res.insert(res.end(), _tris[t].begin(), _tris[t].end());
+		return res;
+	}
+
+	size_t _alive_triangles = 0;
+	double _error = 0; // largest squared distance error of any collapse so far
+
+private:
+	struct Collapse
+	{
+		double cost; // area weighted, orders the queue
+		double distance2; // the same error as a squared distance
+		unsigned int from, to;
+		std::uint32_t from_stamp, to_stamp;
+		auto operator>(const Collapse &o) const -> bool { return cost > o.cost; }
+	};
+
+	static auto _edge(unsigned int a, unsigned int b) -> std::uint64_t { return a < b ? (static_cast<std::uint64_t>(a) << 32) | b : (static_cast<std::uint64_t>(b) << 32) | a; }
+	void _normal(unsigned int g0, unsigned int g1, unsigned int g2, double n[3]) const
+	{
+		double e1[3], e2[3];
+		sub(_pos[g1].data(), _pos[g0].data(), e1);
+		sub(_pos[g2].data(), _pos[g0].data(), e2);
+		cross(e1, e2, n);
+	}
+	void _push(unsigned int from, unsigned int to)
+	{
+		auto q = _quadrics[from];
+		q += _quadrics[to];
+		auto cost = q.error(_pos[to].data());
+		_queue.push({cost, q.weight > 0 ? cost / q.weight : 0, from, to, _stamp[from], _stamp[to]});
+	}
+	template<typename Fn>
+	void _neighbours(unsigned int g, Fn &&fn) const
+	{
+		for (auto t: _group_tris[g])
+			if (_alive[t])
+				for (auto v: _tris[t])
+					if (_group[v] != g)
+						fn(_group[v]);
+	}
+	auto _valid(unsigned int a, unsigned int b) -> bool
+	{
+		// link condition: a and b may only share the neighbours across their common triangles, else the surface pinches
+		size_t shared = 0;
+		for (auto t: _group_tris[a])
+			if (_alive[t] && (_group[_tris[t][0]] == b || _group[_tris[t][1]] == b || _group[_tris[t][2]] == b))
+				++shared;
+		if (shared == 0)
+			return false;
+
+		_mark.clear();
+		_neighbours(a, [&](unsigned int g) { _mark.push_back(g); });
+		std::sort(_mark.begin(), _mark.end());
+		_mark.erase(std::unique(_mark.begin(), _mark.end()), _mark.end());
+		_common.clear();
+		_neighbours(b, [&](unsigned int g) { if (std::binary_search(_mark.begin(), _mark.end(), g)) _common.push_back(g); });
+		std::sort(_common.begin(), _common.end());
+		if (static_cast<size_t>(std::unique(_common.begin(), _common.end()) - _common.begin()) != shared)
+			return false;
+
+		// no triangle around a may flip or fold onto itself once a sits on b
+		for (auto t: _group_tris[a])
+		{
+			if (!_alive[t])
+				continue;
+			unsigned int g[3] = {_group[_tris[t][0]], _group[_tris[t][1]], _group[_tris[t][2]]};
+			if (g[0] == b || g[1] == b || g[2] == b)
+				continue;
+			double before[3], after[3];
+			_normal(g[0], g[1], g[2], before);
+			for (auto &x: g)
+				if (x == a)
+					x = b;
+			_normal(g[0], g[1], g[2], after);
+			if (normalize(after) == 0)
+				return false;
+			if (normalize(before) > 0 && dot(before, after) < MinFlipCosine)
+				return false;
+		}
+		return true;
+	}
+	void _collapse(unsigned int a, unsigned int b)
+	{
+		for (auto t: _group_tris[a])
+		{
+			if (!_alive[t])
+				continue;
+			auto &tri = _tris[t];
+			if (_group[tri[0]] == b || _group[tri[1]] == b || _group[tri[2]] == b)
+			{
+				_alive[t] = false;
+				--_alive_triangles;
+				continue;
+			}
+			for (auto &v: tri)
+				if (_group[v] == a)
+					v = _closest_member(b, v);
+			_group_tris[b].push_back(t);
+		}
+		_group_tris[a].clear();
+		auto &tris = _group_tris[b];
+		tris.erase(std::remove_if(tris.begin(), tris.end(), [&](unsigned int t) { return !_alive[t]; }), tris.end());
+
+		_quadrics[b] += _quadrics[a];
+		_dead[a] = true;
+		++_stamp[b];
+
+		_mark.clear();
+		_neighbours(b, [&](unsigned int g) { _mark.push_back(g); });
+		std::sort(_mark.begin(), _mark.end());
+		_mark.erase(std::unique(_mark.begin(), _mark.end()), _mark.end());
+		for (auto n: _mark)
+		{
+			_push(b, n);
+			_push(n, b);
+		}
+	}
+	// the corner takes over the vertex of the target group that looks most like it, so seams keep their uvs and hard
+	// edges their normals where the target has them
+	auto _closest_member(unsigned int group, unsigned int vertex) const -> unsigned int
+	{
+		auto &v = _verts[vertex];
+		unsigned int best = _members[group].front();
+		double best_score = -1e30;
+		for (auto m: _members[group])
+		{
+			auto &c = _verts[m];
+			double du = static_cast<double>(c.tex_coord.x() - v.tex_coord.x()), dv = static_cast<double>(c.tex_coord.y() - v.tex_coord.y());
+			double score = static_cast<double>(c.normal.dot(v.normal)) - (du * du + dv * dv);
+			if (score > best_score)
+				best_score = score, best = m;
+		}
+		return best;
+	}
+
+	const std::vector<Kasumi::Mesh::Vertex> &_verts;
+	std::vector<unsigned int> _group; // vertex -> welded group
+	std::vector<std::vector<unsigned int>> _members; // group -> vertices
+	std::vector<std::array<double, 3>> _pos;
+	std::vector<Quadric> _quadrics;
+	std::vector<std::vector<unsigned int>> _group_tris;
+	std::vector<std::uint32_t> _stamp;
+	std::vector<bool> _dead;
+	std::vector<std::array<unsigned int, 3>> _tris; // corners as vertex indices
+	std::vector<bool> _alive;
+	std::priority_queue<Collapse, std::vector<Collapse>, std::greater<>> _queue;
+	std::vector<unsigned int> _mark, _common;
+};
+} // namespace
+
+auto Kasumi::Mesh::BuildLods(const std::vector<Vertex> &vertices, const std::vector<Index> &indices, size_t min_triangles) -> std::vector<Lod>
+{
+	std::vector<Lod> res;
+	if (indices.size() / 3 < 2 * std::max<size_t>(min_triangles, 1))
+		return res;
+
+	// one continuous simplification, a level is taken each time the triangle count halves
+	Simplifier simplifier(vertices, indices);
+	auto previous = simplifier._alive_triangles;
+	for (int level = 0; level < MaxLodLevels; ++level)
+	{
+		auto target = previous / 2;
+		if (target < min_triangles)
+			break;
+		simplifier.run(target);
+		if (simplifier._alive_triangles * 4 > previous * 3)
+			break; // stalled, what is left is borders and pinches the simplifier will not touch
+		res.push_back({simplifier.indices(), static_cast<real>(std::sqrt(simplifier._error))});
+		OptimizeVertexCache(res.back().indices, vertices.size());
+		previous = simplifier._alive_triangles;
+	}
+	return res;
+}
+void Kasumi::Mesh::build_lods() { set_lods(BuildLods(_verts, _idxs)); }
+void Kasumi::Mesh::set_lods(std::vector<Lod> &&lods)
+{
+	_lods = std::move(lods);
+	_opt.lod = 0;
+	_indices_dirty = true;
+	++_generation;
+}
+auto Kasumi::Mesh::select_lod(const mMatrix4x4 &model, int current) -> int
+{
+	if (!UseLod || _lods.empty() || Camera::MainCamera == nullptr)
+		return 0;
+
+	// bounding sphere of the box placed by the model matrix; the largest axis scale covers non uniform scaling
+	_update_bounds();
+	auto &m = model._m;
+	auto lower = _bbox._lower_corner, upper = _bbox._upper_corner;
+	Eigen::Matrix<real, 4, 1> center = m * Eigen::Matrix<real, 4, 1>((lower.x() + upper.x()) / 2, (lower.y() + upper.y()) / 2, (lower.z() + upper.z()) / 2, 1);
+	real scale = std::max({m.col(0).head<3>().norm(), m.col(1).head<3>().norm(), m.col(2).head<3>().norm()});
+	real radius = (upper - lower).length() / 2 * scale;
+
+	// pixels per world unit at the near side of the sphere; orthographic projections have no distance falloff
+	auto &camera = *Camera::MainCamera;
+	auto projection = camera.get_projection()._m;
+	auto eye = camera._opt.position;
+	real distance = Eigen::Matrix<real, 3, 1>(center.x() - eye.x(), center.y() - eye.y(), center.z() - eye.z()).norm() - radius;
+	bool orthographic = projection(3, 3) == 1;
+	if (!orthographic && distance <= camera._opt.near_plane)
+		return 0;
+	real pixels_per_unit = camera._opt.height / 2 * projection(1, 1) / (orthographic ? 1 : distance);
+
+	// coarsest level whose error stays under the threshold; errors grow with the level
+	auto level_at = [&](real threshold) -> int
+	{
+		int level = 0;
+		for (auto &lod: _lods)
+		{
+			if (lod.error * scale * pixels_per_unit > threshold)
+				break;
+			++level;
+		}
+		return level;
+	};
+	auto strict = level_at(LodPixelError);
+	if (current < 0 || LodHysteresis <= 0)
+		return strict;
+	// between the two thresholds the current level is kept, so an object on the boundary does not flicker
+	auto loose = level_at(LodPixelError * (1 - LodHysteresis));
+	return std::clamp(current, loose, strict);
+}
+auto Kasumi::Mesh::_lod_range(int level) const -> std::pair<size_t, size_t>
+{
+	level = std::clamp(level, 0, static_cast<int>(_lods.size()));
+	if (level == 0)
+		return {0, _idxs.size()};
+	size_t first = _idxs.size();
+	for (int i = 0; i < level - 1; ++i)
+		first += _lods[i].indices.size();
+	return {first, _lods[level - 1].indices.size()};
+}
+auto Kasumi::Mesh::_index_total() const -> size_t
+{
+	auto total = _idxs.size();
+	for (auto &lod: _lods)
+		total += lod.indices.size();
+	return total;
+}
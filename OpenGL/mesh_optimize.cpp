@@ -0,0 +1,266 @@
+#include "../mesh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <unordered_map>
+
+bool Kasumi::Mesh::OptimizeOnLoad = false;
+bool Kasumi::Mesh::OptimizeOverdraw = false;
+int Kasumi::Mesh::VertexCacheSize = 16;
+
+// ==================== Vertex Cache Optimisation ====================
+namespace
+{
+constexpr size_t MinClusterTriangles = 64; // smaller overdraw clusters are merged, so the sort does not undo the cache order
+
+auto vertex_hash(const Kasumi::Mesh::Vertex &v) -> std::uint64_t
+{
+	real values[17] = {v.position.x(), v.position.y(), v.position.z(), v.normal.x(), v.normal.y(), v.normal.z(), v.tex_coord.x(), v.tex_coord.y(),
+					   v.color.x(), v.color.y(), v.color.z(), v.tangent.x(), v.tangent.y(), v.tangent.z(), v.bi_tangent.x(), v.bi_tangent.y(), v.bi_tangent.z()};
+	std::uint64_t hash = 14695981039346656037ull; // FNV-1a
+	auto bytes = reinterpret_cast<const unsigned char *>(values);
+	for (size_t i = 0; i < sizeof(values); ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+auto same_vertex(const Kasumi::Mesh::Vertex &a, const Kasumi::Mesh::Vertex &b) -> bool // everything but the id
+{
+	auto eq3 = [](const mVector3 &x, const mVector3 &y) { return x.x() == y.x() && x.y() == y.y() && x.z() == y.z(); };
+	return eq3(a.position, b.position) && eq3(a.normal, b.normal) && a.tex_coord.x() == b.tex_coord.x() && a.tex_coord.y() == b.tex_coord.y()
+		   && eq3(a.color, b.color) && eq3(a.tangent, b.tangent) && eq3(a.bi_tangent, b.bi_tangent);
+}
+
+// Tipsify (Sander, Nehab & Barczak 2007): fans around the most recently used vertex that will still be in the cache,
+// falling back to dead-end vertices and then a linear scan. `clusters` receives the first triangle of every run that
+// started from such a fallback, which is where the cache starts cold anyway
+auto tipsify(const std::vector<Kasumi::Mesh::Index> &indices, size_t vertex_count, int cache_size, std::vector<size_t> *clusters) -> std::vector<Kasumi::Mesh::Index>
+{
+	auto triangles = indices.size() / 3;
+	std::vector<unsigned int> live(vertex_count, 0), offsets(vertex_count + 1, 0), adjacency(triangles * 3);
+	for (auto i: indices)
+		++offsets[i + 1];
+	std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+	std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+	for (size_t t = 0; t < triangles; ++t)
+		for (int c = 0; c < 3; ++c)
+		{
+			auto v = indices[t * 3 + c];
+			adjacency[fill[v]++] = static_cast<unsigned int>(t);
+			++live[v];
+		}
+
+	std::vector<Kasumi::Mesh::Index> res;
+	res.reserve(indices.size());
+	std::vector<std::int64_t> stamp(vertex_count, 0);
+	std::vector<bool> emitted(triangles, false);
+	std::vector<unsigned int> dead_end, candidates;
+	std::int64_t time = cache_size + 1;
+	size_t cursor = 0;
+	auto cold_start = [&]() -> std::int64_t
+	{
+		while (!dead_end.empty())
+		{
+			auto d = dead_end.back();
+			dead_end.pop_back();
+			if (live[d] > 0)
+				return d;
+		}
+		while (cursor < vertex_count)
+			if (live[cursor++] > 0)
+				return static_cast<std::int64_t>(cursor - 1);
+		return -1;
+	};
+
+	std::int64_t fan = cold_start();
+	if (clusters != nullptr && fan >= 0)
+		clusters->push_back(0);
+	while (fan >= 0)
+	{
+		candidates.clear();
+		for (auto a = offsets[fan]; a < offsets[fan + 1]; ++a)
+		{
+			auto t = adjacency[a];
+			if (emitted[t])
+				continue;
+			emitted[t] = true;
+			for (int c = 0; c < 3; ++c)
+			{
+				auto v = indices[t * 3 + c];
+				res.push_back(v);
+				dead_end.push_back(v);
+				candidates.push_back(v);
+				--live[v];
+				if (time - stamp[v] > cache_size)
+					stamp[v] = time++;
+			}
+		}
+
+		// the candidate furthest back in the cache that still fits with all its remaining triangles
+		std::int64_t next = -1, best = -1;
+		for (auto v: candidates)
+		{
+			if (live[v] == 0)
+				continue;
+			std::int64_t priority = 0;
+			if (time - stamp[v] + 2 * static_cast<std::int64_t>(live[v]) <= cache_size)
+				priority = time - stamp[v];
+			if (priority > best)
+				best = priority, next = v;
+		}
+		if (next < 0)
+		{
+			next = cold_start();
+			if (clusters != nullptr && next >= 0)
+				clusters->push_back(res.size() / 3);
+		}
+		fan = next;
+	}
+	return res;
+}
+
+// outside-in cluster order (Sander et al.'s fast overdraw heuristic): clusters facing away from the mesh centre are
+// drawn first, so what they hide fails the depth test instead of being shaded and overwritten
+void sort_clusters(const std::vector<Kasumi::Mesh::Vertex> &vertices, std::vector<Kasumi::Mesh::Index> &indices, std::vector<size_t> clusters)
+{
+	auto triangles = indices.size() / 3;
+	std::vector<size_t> merged;
+	for (auto first: clusters)
+		if (merged.empty() || first - merged.back() >= MinClusterTriangles)
+			merged.push_back(first);
+	merged.push_back(triangles);
+	if (merged.size() <= 2)
+		return;
+
+	double center[3] = {0, 0, 0}, total = 0;
+	struct Cluster
+	{
+		size_t first, last;
+		double centroid[3], normal[3];
+		double key;
+	};
+	std::vector<Cluster> list;
+	for (size_t c = 0; c + 1 < merged.size(); ++c)
+	{
+		Cluster cluster{merged[c], merged[c + 1], {0, 0, 0}, {0, 0, 0}, 0};
+		double area = 0;
+		for (auto t = cluster.first; t < cluster.last; ++t)
+		{
+			auto &p0 = vertices[indices[t * 3]].position, &p1 = vertices[indices[t * 3 + 1]].position, &p2 = vertices[indices[t * 3 + 2]].position;
+			double e1[3] = {p1.x() - p0.x(), p1.y() - p0.y(), p1.z() - p0.z()}, e2[3] = {p2.x() - p0.x(), p2.y() - p0.y(), p2.z() - p0.z()};
+			double n[3] = {e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0]};
+			double c[3] = {(p0.x() + p1.x() + p2.x()) / 3, (p0.y() + p1.y() + p2.y()) / 3, (p0.z() + p1.z() + p2.z()) / 3};
+			double a = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]) / 2;
+			for (int k = 0; k < 3; ++k)
+			{
+				cluster.centroid[k] += a * c[k];
+				cluster.normal[k] += n[k]; // twice the area weighted normal
+			}
+			area += a;
+		}
+		for (int k = 0; k < 3; ++k)
+		{
+			center[k] += cluster.centroid[k];
+			cluster.centroid[k] = area > 0 ? cluster.centroid[k] / area : 0;
+		}
+		total += area;
+		list.push_back(cluster);
+	}
+	if (total <= 0)
+		return;
+	for (auto &k: center)
+		k /= total;
+	for (auto &cluster: list)
+	{
+		double length = std::sqrt(cluster.normal[0] * cluster.normal[0] + cluster.normal[1] * cluster.normal[1] + cluster.normal[2] * cluster.normal[2]);
+		cluster.key = 0;
+		if (length > 0)
+			for (int k = 0; k < 3; ++k)
+				cluster.key += (cluster.centroid[k] - center[k]) * cluster.normal[k] / length;
+	}
+	std::stable_sort(list.begin(), list.end(), [](const Cluster &a, const Cluster &b) { return a.key > b.key; });
+
+	std::vector<Kasumi::Mesh::Index> res;
+	res.reserve(indices.size());
+	for (auto &cluster: list)
+		res.insert(res.end(), indices.begin() + static_cast<std::ptrdiff_t>(cluster.first * 3), indices.begin() + static_cast<std::ptrdiff_t>(cluster.last * 3));
+	indices = std::move(res);
+}
+} // namespace
+
+auto Kasumi::Mesh::MeasureCache(const std::vector<Index> &indices, size_t vertex_count) -> CacheStats
+{
+	// FIFO post-transform cache of VertexCacheSize entries, the model most hardware is tuned against
+	CacheStats res;
+	if (indices.empty())
+		return res;
+	std::vector<std::int64_t> entered(vertex_count, -1);
+	std::vector<bool> referenced(vertex_count, false);
+	std::int64_t misses = 0;
+	size_t unique = 0;
+	for (auto i: indices)
+	{
+		if (entered[i] < 0 || misses - entered[i] >= VertexCacheSize)
+			entered[i] = misses++;
+		if (!referenced[i])
+			referenced[i] = true, ++unique;
+	}
+	res.acmr = static_cast<real>(misses) / static_cast<real>(indices.size() / 3);
+	res.atvr = static_cast<real>(misses) / static_cast<real>(unique);
+	return res;
+}
+void Kasumi::Mesh::OptimizeVertexCache(std::vector<Index> &indices, size_t vertex_count)
+{
+	if (indices.size() >= 3)
+		indices = tipsify(indices, vertex_count, VertexCacheSize, nullptr);
+}
+auto Kasumi::Mesh::Optimize(std::vector<Vertex> &vertices, std::vector<Index> &indices, bool overdraw) -> std::pair<CacheStats, CacheStats>
+{
+	auto before = MeasureCache(indices, vertices.size());
+	if (indices.size() < 3 || vertices.empty())
+		return {before, before};
+
+	// weld: split vertices that ended up identical (assimp splits per face corner on some formats)
+	std::unordered_map<std::uint64_t, std::vector<Index>> buckets;
+	std::vector<Index> weld(vertices.size());
+	for (size_t i = 0; i < vertices.size(); ++i)
+	{
+		auto &bucket = buckets[vertex_hash(vertices[i])];
+		auto it = std::find_if(bucket.begin(), bucket.end(), [&](Index j) { return same_vertex(vertices[i], vertices[j]); });
+		if (it == bucket.end())
+		{
+			bucket.push_back(static_cast<Index>(i));
+			weld[i] = static_cast<Index>(i);
+		} else
+			weld[i] = *it;
+	}
+	for (auto &i: indices)
+		i = weld[i];
+
+	// triangles for the post-transform cache, then optionally whole cache clusters for overdraw
+	std::vector<size_t> clusters;
+	indices = tipsify(indices, vertices.size(), VertexCacheSize, overdraw ? &clusters : nullptr);
+	if (overdraw)
+		sort_clusters(vertices, indices, std::move(clusters));
+
+	// vertices in first use order, so the fetches walk the buffer forward; unreferenced vertices are dropped
+	std::vector<Index> remap(vertices.size(), ~0u);
+	std::vector<Vertex> ordered;
+	ordered.reserve(vertices.size());
+	for (auto &i: indices)
+	{
+		if (remap[i] == ~0u)
+		{
+			remap[i] = static_cast<Index>(ordered.size());
+			ordered.push_back(vertices[i]);
+			ordered.back().id = remap[i];
+		}
+		i = remap[i];
+	}
+	vertices = std::move(ordered);
+
+	return {before, MeasureCache(indices, vertices.size())};
+}
@@ -2,11 +2,42 @@
 #include "../model.h"
 #include "../camera.h"
 #include "../light.h"
+#include "../culling.h"
 
 #include "stb_image.h"
 
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <tuple>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool Kasumi::Model::UseMeshCache = true;
+std::string Kasumi::Model::MeshCacheDir;
+
 Kasumi::Model::Model(const std::string &model_path, real scale) : _path(model_path), _scale(scale), _bbox_lines(std::make_shared<Lines>()) { _load(model_path); }
-Kasumi::Model::~Model() { std::cout << "delete model: " << _path << std::endl; }
+Kasumi::Model::~Model()
+{
+	if (_queries[0] != 0)
+		glDeleteQueries(2, _queries);
+	std::cout << "delete model: " << _path << std::endl;
+}
 
 void Kasumi::Model::render()
 {
@@ -17,8 +48,9 @@ void Kasumi::Model::render()
 	Shader::DefaultSimpleMeshShader->uniform("lightPos", Light::MainLight->_opt.light_pos);
 	Shader::DefaultSimpleMeshShader->uniform("viewPos", Light::MainLight->_opt.view_pos);
 
-	for (auto &mesh: _meshes)
-		mesh->render(*Shader::DefaultSimpleMeshShader);
+	_begin_timer();
+	_render_meshes(*Shader::DefaultSimpleMeshShader, true);
+	_end_timer();
 
 	Shader::DefaultLineShader->use();
 	Shader::DefaultLineShader->uniform("model", mMatrix4x4::Identity());
@@ -38,8 +70,9 @@ void Kasumi::Model::render(const Shader &shader)
 	shader.uniform("lightPos", Light::MainLight->_opt.light_pos);
 	shader.uniform("viewPos", Light::MainLight->_opt.view_pos);
 
-	for (auto &mesh: _meshes)
-		mesh->render(shader);
+	_begin_timer();
+	_render_meshes(shader, false);
+	_end_timer();
 
 	Shader::DefaultLineShader->use();
 	Shader::DefaultLineShader->uniform("view", Camera::MainCamera->get_view());
@@ -50,22 +83,301 @@ void Kasumi::Model::render(const Shader &shader)
 	_bbox_lines->render(*Shader::DefaultLineShader);
 }
 
+void Kasumi::Model::_render_meshes(const Shader &shader, bool cull)
+{
+	// the merged box rejects the whole model at once, then each mesh on its own
+	auto culling = cull ? Culling::MainCulling : nullptr;
+	if (culling != nullptr && !culling->visible(_bbox, mMatrix4x4::Identity()))
+		return;
+
+	_lods.resize(_meshes.size(), -1);
+	for (size_t i = 0; i < _meshes.size(); ++i)
+	{
+		auto &mesh = _meshes[i];
+		if (culling != nullptr && _meshes.size() > 1 && !culling->visible(mesh->bbox(), mMatrix4x4::Identity()))
+			continue;
+		_lods[i] = mesh->select_lod(mMatrix4x4::Identity(), _lods[i]);
+		mesh->_opt.lod = _lods[i];
+		mesh->render(shader);
+		mesh->_opt.lod = 0;
+	}
+}
+
+void Kasumi::Model::_begin_timer()
+{
+	if (_queries[0] == 0)
+		glGenQueries(2, _queries);
+
+	// the other query was issued a frame ago and is usually done by now; if not, its result is skipped
+	auto other = 1 - _query_index;
+	if (_query_pending[other])
+	{
+		GLint available = 0;
+		glGetQueryObjectiv(_queries[other], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (available)
+		{
+			GLuint64 elapsed = 0;
+			glGetQueryObjectui64v(_queries[other], GL_QUERY_RESULT, &elapsed);
+			_draw_time = static_cast<float>(elapsed) / 1e6f;
+			_query_pending[other] = false;
+		}
+	}
+	if (_query_pending[_query_index])
+		return; // still busy, this frame goes untimed
+	glBeginQuery(GL_TIME_ELAPSED, _queries[_query_index]);
+	_query_pending[_query_index] = true;
+}
+void Kasumi::Model::_end_timer()
+{
+	GLint active = 0;
+	glGetQueryiv(GL_TIME_ELAPSED, GL_CURRENT_QUERY, &active);
+	if (active == 0 || static_cast<GLuint>(active) != _queries[_query_index])
+		return;
+	glEndQuery(GL_TIME_ELAPSED);
+	_query_index = 1 - _query_index;
+}
+
+// ==================== Mesh Cache ====================
+namespace
+{
+constexpr unsigned int ImportFlags = aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace;
+constexpr std::uint32_t MeshCacheMagic = 0x4D43534B; // "KSCM"
+constexpr std::uint32_t MeshCacheVersion = 2; // 2: levels of detail
+
+struct MeshCacheHeader
+{
+	std::uint32_t magic;
+	std::uint32_t version;
+	std::uint64_t key;
+	std::uint32_t vertex_size; // layout guard: the vertex blob is Mesh::Vertex as laid out by this build
+	std::uint32_t mesh_count;
+};
+
+// read only mapping of a whole file; the cache is consumed straight from the page cache
+class MappedFile
+{
+public:
+	explicit MappedFile(const std::string &path)
+	{
+#if defined(_WIN32)
+		_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (_file == INVALID_HANDLE_VALUE)
+			return;
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(_file, &size) || size.QuadPart == 0)
+			return;
+		_mapping = CreateFileMappingA(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (_mapping == nullptr)
+			return;
+		_data = static_cast<const unsigned char *>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+		_size = _data != nullptr ? static_cast<size_t>(size.QuadPart) : 0;
+#else
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return;
+		struct stat st{};
+		if (fstat(fd, &st) == 0 && st.st_size > 0)
+		{
+			void *data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+			if (data != MAP_FAILED)
+			{
+				_data = static_cast<const unsigned char *>(data);
+				_size = static_cast<size_t>(st.st_size);
+			}
+		}
+		close(fd);
+#endif
+	}
+	~MappedFile()
+	{
+#if defined(_WIN32)
+		if (_data != nullptr)
+			UnmapViewOfFile(_data);
+		if (_mapping != nullptr)
+			CloseHandle(_mapping);
+		if (_file != INVALID_HANDLE_VALUE)
+			CloseHandle(_file);
+#else
+		if (_data != nullptr)
+			munmap(const_cast<unsigned char *>(_data), _size);
+#endif
+	}
+	MappedFile(const MappedFile &) = delete;
+	auto operator=(const MappedFile &) -> MappedFile & = delete;
+
+	const unsigned char *_data = nullptr;
+	size_t _size = 0;
+
+private:
+#if defined(_WIN32)
+	HANDLE _file = INVALID_HANDLE_VALUE;
+	HANDLE _mapping = nullptr;
+#endif
+};
+
+// bounds checked cursor over the mapped cache
+struct BlobReader
+{
+	const unsigned char *_cur;
+	const unsigned char *_end;
+
+	auto remaining() const -> size_t { return static_cast<size_t>(_end - _cur); }
+	// whether count elements of size bytes can still be in the file, checked before anything is allocated for them
+	auto fits(size_t count, size_t size) const -> bool { return count <= remaining() / size; }
+
+	auto read(void *dst, size_t size) -> bool
+	{
+		if (static_cast<size_t>(_end - _cur) < size)
+			return false;
+		if (size > 0)
+			std::memcpy(dst, _cur, size);
+		_cur += size;
+		return true;
+	}
+	template<typename T>
+	auto read(T &value) -> bool { return read(&value, sizeof(T)); }
+	auto read(std::string &str) -> bool
+	{
+		std::uint32_t size;
+		if (!read(size) || static_cast<size_t>(_end - _cur) < size)
+			return false;
+		str.assign(reinterpret_cast<const char *>(_cur), size);
+		_cur += size;
+		return true;
+	}
+};
+
+auto in_range(const std::vector<Kasumi::Mesh::Index> &indices, std::uint32_t vertex_count) -> bool
+{
+	return std::all_of(indices.begin(), indices.end(), [vertex_count](Kasumi::Mesh::Index index) { return index < vertex_count; });
+}
+
+template<typename T>
+void write(std::ofstream &file, const T &value) { file.write(reinterpret_cast<const char *>(&value), sizeof(T)); }
+void write(std::ofstream &file, const std::string &str)
+{
+	write(file, static_cast<std::uint32_t>(str.size()));
+	file.write(str.data(), static_cast<std::streamsize>(str.size()));
+}
+
+// runs job(i) for i in [0, count) on at most hardware_concurrency threads, the calling thread included; the first
+// exception a job throws is rethrown here once every thread has stopped
+template<typename Fn>
+void parallel_for(size_t count, Fn &&job)
+{
+	std::atomic<size_t> next{0};
+	std::exception_ptr error;
+	std::mutex error_mutex;
+	auto work = [&]
+	{
+		for (size_t i = next++; i < count; i = next++)
+		{
+			try
+			{
+				job(i);
+			} catch (...)
+			{
+				std::lock_guard lock(error_mutex);
+				if (!error)
+					error = std::current_exception();
+			}
+		}
+	};
+	auto threads = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), count);
+	std::vector<std::thread> workers;
+	for (size_t t = 1; t < threads; ++t)
+		workers.emplace_back(work);
+	work();
+	for (auto &worker: workers)
+		worker.join();
+	if (error)
+		std::rethrow_exception(error);
+}
+
+struct DecodedImage
+{
+	unsigned char *data = nullptr; // handed over to Kasumi::Texture
+	int width = 0, height = 0, nr_channels = 0;
+};
+
+// FNV-1a
+auto hash_bytes(std::uint64_t hash, const void *data, size_t size) -> std::uint64_t
+{
+	auto bytes = static_cast<const unsigned char *>(data);
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+auto cache_key(const std::string &path) -> std::uint64_t
+{
+	std::error_code ec;
+	auto size = static_cast<std::uint64_t>(std::filesystem::file_size(path, ec));
+	auto time = static_cast<std::int64_t>(std::filesystem::last_write_time(path, ec).time_since_epoch().count());
+	std::uint32_t layout[7] = {static_cast<std::uint32_t>(sizeof(Kasumi::Mesh::Vertex)), ImportFlags, MeshCacheVersion, static_cast<std::uint32_t>(Kasumi::Mesh::AutoLodTriangles),
+							   Kasumi::Mesh::OptimizeOnLoad, Kasumi::Mesh::OptimizeOverdraw, static_cast<std::uint32_t>(Kasumi::Mesh::VertexCacheSize)};
+
+	auto hash = hash_bytes(14695981039346656037ull, path.data(), path.size());
+	hash = hash_bytes(hash, &size, sizeof(size));
+	hash = hash_bytes(hash, &time, sizeof(time));
+	return hash_bytes(hash, layout, sizeof(layout));
+}
+} // namespace
+
 auto Kasumi::Model::_load(const std::string &path) -> bool
 {
-	Assimp::Importer importer;
-	const aiScene *scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
-	if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
-		return false;
+	std::vector<MeshData> meshes;
+	Assimp::Importer importer; // embedded textures live in the importer's scene until _build
+	const aiScene *scene = nullptr;
+
+	if (!_read_cache(meshes))
+	{
+		scene = importer.ReadFile(path, ImportFlags);
+		if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
+			return false;
+
+		std::vector<const aiMesh *> ai_meshes;
+		_collect_node(scene->mRootNode, scene, ai_meshes);
+
+		// meshes are independent, so they are converted concurrently; the order still follows the node tree
+		meshes.resize(ai_meshes.size());
+		parallel_for(ai_meshes.size(), [&](size_t i) { meshes[i] = _process_mesh(ai_meshes[i], scene); });
+
+		if (Mesh::OptimizeOnLoad)
+		{
+			// triangle weighted over the meshes of the model
+			double triangles = 0, acmr[2] = {0, 0}, atvr[2] = {0, 0};
+			for (auto &mesh: meshes)
+			{
+				auto t = static_cast<double>(mesh.indices.size() / 3);
+				triangles += t;
+				acmr[0] += t * mesh.cache_before.acmr, acmr[1] += t * mesh.cache_after.acmr;
+				atvr[0] += t * mesh.cache_before.atvr, atvr[1] += t * mesh.cache_after.atvr;
+			}
+			if (triangles > 0)
+				std::cout << "Optimize model: " << path << " ACMR " << acmr[0] / triangles << " -> " << acmr[1] / triangles << ", ATVR " << atvr[0] / triangles << " -> " << atvr[1] / triangles << std::endl;
+		}
+
+		if (scene->mNumTextures == 0) // embedded textures would need the importer again, so those models are not cached
+			_write_cache(meshes);
+	}
 
-	_process_node(scene->mRootNode, scene);
+	_build(std::move(meshes), scene);
 
 	if (_scale != 1)
 		for (auto &m: _meshes)
+		{
 			for (auto &v: m->vertices())
 				v.position *= _scale;
+			for (auto &lod: m->_lods)
+				lod.error *= _scale;
+		}
 
 	for (auto &m: _meshes)
-		_bbox.merge(m->_bbox);
+		_bbox.merge(m->bbox());
 
 	auto l = _bbox._lower_corner;
 	auto u = _bbox._upper_corner;
@@ -84,26 +396,82 @@ auto Kasumi::Model::_load(const std::string &path) -> bool
 	return true;
 }
 
-void Kasumi::Model::_process_node(const struct aiNode *node, const struct aiScene *scene)
+void Kasumi::Model::_build(std::vector<MeshData> &&meshes, const aiScene *scene)
 {
-	for (int i = 0; i < node->mNumMeshes; ++i)
+	// files go through the shared texture cache (decoded on its workers, one GL texture per file across all models);
+	// embedded images belong to this scene and are decoded here, in parallel
+	std::map<std::string, TexturePtr> textures;
+	std::vector<std::string> embedded;
+	for (auto &mesh: meshes)
+		for (auto &slot: mesh.textures)
+			for (auto &name: slot.second)
+			{
+				if (textures.contains(name) || std::find(embedded.begin(), embedded.end(), name) != embedded.end())
+					continue;
+				if (name[0] != '*')
+				{
+					textures[name] = Texture::Load(name);
+					continue;
+				}
+				embedded.push_back(name);
+			}
+	std::vector<DecodedImage> decoded(embedded.size());
+	parallel_for(embedded.size(), [&](size_t i)
+	{
+		auto *tex = scene != nullptr ? scene->GetEmbeddedTexture(embedded[i].c_str() + 1) : nullptr;
+		if (tex != nullptr)
+			decoded[i].data = stbi_load_from_memory(reinterpret_cast<unsigned char *>(tex->pcData), static_cast<int>(tex->mWidth), &decoded[i].width, &decoded[i].height, &decoded[i].nr_channels, 0);
+	});
+
+	// GL objects are created here, on the thread that owns the context, in one batch
+	for (size_t i = 0; i < embedded.size(); ++i)
 	{
-		auto *mesh = scene->mMeshes[node->mMeshes[i]];
-		_meshes.emplace_back(std::move(_process_mesh(mesh, scene)));
+		auto &image = decoded[i];
+		if (image.data == nullptr)
+		{
+			std::cout << "Failed to load texture: " << embedded[i] << std::endl;
+			continue;
+		}
+		auto texture = std::make_shared<Kasumi::Texture>(image.data, image.width, image.height, image.nr_channels, false);
+		texture->_path = embedded[i];
+		textures[embedded[i]] = texture;
+		std::cout << "Load texture: " << embedded[i] << std::endl;
 	}
+
+	_meshes.reserve(_meshes.size() + meshes.size());
+	for (auto &mesh: meshes)
+	{
+		std::map<std::string, std::vector<Kasumi::TexturePtr>> mesh_textures;
+		for (auto &slot: mesh.textures)
+		{
+			auto &res = mesh_textures[slot.first];
+			for (auto &name: slot.second)
+				if (textures.contains(name))
+					res.push_back(textures[name]);
+		}
+		_meshes.emplace_back(std::make_shared<Kasumi::Mesh>(std::move(mesh.vertices), std::move(mesh.indices), std::move(mesh_textures)));
+		if (!mesh.lods.empty())
+			_meshes.back()->set_lods(std::move(mesh.lods));
+	}
+}
+
+void Kasumi::Model::_collect_node(const aiNode *node, const aiScene *scene, std::vector<const aiMesh *> &meshes) const
+{
+	for (unsigned int i = 0; i < node->mNumMeshes; ++i)
+		meshes.push_back(scene->mMeshes[node->mMeshes[i]]);
 	for (unsigned int i = 0; i < node->mNumChildren; i++)
-		_process_node(node->mChildren[i], scene);
+		_collect_node(node->mChildren[i], scene, meshes);
 }
 
-auto Kasumi::Model::_process_mesh(const aiMesh *mesh, const aiScene *scene) -> Kasumi::MeshPtr
+auto Kasumi::Model::_process_mesh(const aiMesh *mesh, const aiScene *scene) const -> MeshData
 {
-	std::vector<Mesh::Vertex> vertices;
-	std::vector<Mesh::Index> indices;
+	MeshData res;
 
 	// Load vertices
-	for (int i = 0; i < mesh->mNumVertices; ++i)
+	res.vertices.resize(mesh->mNumVertices);
+	for (unsigned int i = 0; i < mesh->mNumVertices; ++i)
 	{
-		Mesh::Vertex v;
+		auto &v = res.vertices[i];
 		v.position = {mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z};
 		if (mesh->HasNormals())
 			v.normal = {mesh->mNormals[i].x, mesh->mNormals[i].y, mesh->mNormals[i].z};
@@ -115,52 +483,169 @@ auto Kasumi::Model::_process_mesh(const aiMesh *mesh, const aiScene *scene) -> K
 			v.bi_tangent = {mesh->mBitangents[i].x, mesh->mBitangents[i].y, mesh->mBitangents[i].z};
 		}
 		v.id = i; // TODO: auto id
-		vertices.emplace_back(std::move(v));
 	}
 
 	// Load indices
-	for (int i = 0; i < mesh->mNumFaces; ++i)
-		for (int j = 0; j < mesh->mFaces[i].mNumIndices; ++j)
-			indices.emplace_back(mesh->mFaces[i].mIndices[j]);
+	res.indices.reserve(static_cast<size_t>(mesh->mNumFaces) * 3);
+	for (unsigned int i = 0; i < mesh->mNumFaces; ++i)
+		for (unsigned int j = 0; j < mesh->mFaces[i].mNumIndices; ++j)
+			res.indices.push_back(mesh->mFaces[i].mIndices[j]);
 
-	// Load materials
+	if (Mesh::OptimizeOnLoad)
+		std::tie(res.cache_before, res.cache_after) = Mesh::Optimize(res.vertices, res.indices, Mesh::OptimizeOverdraw);
+	if (Mesh::AutoLodTriangles > 0 && res.indices.size() / 3 > Mesh::AutoLodTriangles)
+		res.lods = Mesh::BuildLods(res.vertices, res.indices);
+
+	// Load materials (paths only, the images are decoded in _build)
 	auto *materials = scene->mMaterials[mesh->mMaterialIndex];
-	auto load_material = [&](aiTextureType type) -> std::vector<Kasumi::TexturePtr>
+	auto load_material = [&](aiTextureType type) -> std::vector<std::string>
 	{
-		std::vector<Kasumi::TexturePtr> res;
-		for (int i = 0; i < materials->GetTextureCount(type); ++i)
+		std::vector<std::string> paths;
+		for (unsigned int i = 0; i < materials->GetTextureCount(type); ++i)
 		{
 			aiString aiPath;
 			materials->GetTexture(type, i, &aiPath);
 
-			std::string tex_path(aiPath.C_Str());
-			std::replace(tex_path.begin(), tex_path.end(), '\\', '/');
-			std::string absolute_path = _path.substr(0, _path.find_last_of('/')) + "/" + tex_path;
-
 			if (scene->GetEmbeddedTexture(aiPath.C_Str()) != nullptr)
 			{
-				auto *tex = scene->GetEmbeddedTexture(aiPath.C_Str());
-
-				int width, height, nr_channels;
-				unsigned char *data = stbi_load_from_memory(reinterpret_cast<unsigned char *>(tex->pcData), tex->mWidth, &width, &height, &nr_channels, 0);
-				if (data)
-					res.push_back(std::move(std::make_shared<Kasumi::Texture>(data, width, height, nr_channels)));
-				else
-					std::cout << "Failed to load embedded texture: " << tex_path << std::endl;
-			} else
-				res.push_back(std::move(std::make_shared<Kasumi::Texture>(absolute_path)));
-
-			std::cout << "Load texture: " << absolute_path << std::endl;
+				paths.push_back(std::string("*") + aiPath.C_Str());
+				continue;
+			}
+
+			std::string tex_path(aiPath.C_Str());
+			std::replace(tex_path.begin(), tex_path.end(), '\\', '/');
+			paths.push_back(_path.substr(0, _path.find_last_of('/')) + "/" + tex_path);
 		}
-		return res;
+		return paths;
 	};
 
-	std::map<std::string, std::vector<Kasumi::TexturePtr>> textures;
-	textures["diffuse"] = load_material(aiTextureType_DIFFUSE);
-	textures["specular"] = load_material(aiTextureType_SPECULAR);
-	textures["normal"] = load_material(aiTextureType_NORMALS);
-	textures["height"] = load_material(aiTextureType_HEIGHT);
-	textures["ambient"] = load_material(aiTextureType_AMBIENT);
+	res.textures["diffuse"] = load_material(aiTextureType_DIFFUSE);
+	res.textures["specular"] = load_material(aiTextureType_SPECULAR);
+	res.textures["normal"] = load_material(aiTextureType_NORMALS);
+	res.textures["height"] = load_material(aiTextureType_HEIGHT);
+	res.textures["ambient"] = load_material(aiTextureType_AMBIENT);
+
+	return res;
+}
+
+auto Kasumi::Model::_cache_file() const -> std::string
+{
+	char name[32];
+	std::snprintf(name, sizeof(name), "%016llx.bin", static_cast<unsigned long long>(cache_key(_path)));
+	auto dir = MeshCacheDir.empty() ? std::filesystem::temp_directory_path() / "Kasumi_MeshCache" : std::filesystem::path(MeshCacheDir);
+	return (dir / name).string();
+}
+
+auto Kasumi::Model::_read_cache(std::vector<MeshData> &meshes) const -> bool
+{
+	if (!UseMeshCache)
+		return false;
+
+	MappedFile file(_cache_file());
+	if (file._data == nullptr)
+		return false;
+
+	BlobReader reader{file._data, file._data + file._size};
+	MeshCacheHeader header{};
+	if (!reader.read(header) || header.magic != MeshCacheMagic || header.version != MeshCacheVersion || header.key != cache_key(_path) || header.vertex_size != sizeof(Mesh::Vertex))
+		return false;
+
+	// every count below comes from the file, a corrupt one must fail the read instead of the allocation
+	if (!reader.fits(header.mesh_count, 4 * sizeof(std::uint32_t)))
+		return false;
+	std::vector<MeshData> res(header.mesh_count);
+	for (auto &mesh: res)
+	{
+		std::uint32_t vertex_count, index_count, lod_count, slot_count;
+		if (!reader.read(vertex_count) || !reader.read(index_count) || !reader.read(lod_count) || !reader.read(slot_count))
+			return false;
+		for (std::uint32_t i = 0; i < slot_count; ++i)
+		{
+			std::string slot;
+			std::uint32_t path_count;
+			if (!reader.read(slot) || !reader.read(path_count) || !reader.fits(path_count, sizeof(std::uint32_t)))
+				return false;
+			auto &paths = mesh.textures[slot];
+			paths.resize(path_count);
+			for (auto &path: paths)
+				if (!reader.read(path))
+					return false;
+		}
+
+		if (!reader.fits(vertex_count, sizeof(Mesh::Vertex)))
+			return false;
+		mesh.vertices.resize(vertex_count);
+		if (!reader.read(mesh.vertices.data(), mesh.vertices.size() * sizeof(Mesh::Vertex)) || !reader.fits(index_count, sizeof(Mesh::Index)))
+			return false;
+		mesh.indices.resize(index_count);
+		if (!reader.read(mesh.indices.data(), mesh.indices.size() * sizeof(Mesh::Index)) || !in_range(mesh.indices, vertex_count))
+			return false;
+
+		if (!reader.fits(lod_count, sizeof(std::uint32_t) + sizeof(float)))
+			return false;
+		mesh.lods.resize(lod_count);
+		for (auto &lod: mesh.lods)
+		{
+			std::uint32_t count;
+			float error;
+			if (!reader.read(count) || !reader.read(error) || !reader.fits(count, sizeof(Mesh::Index)))
+				return false;
+			lod.error = error;
+			lod.indices.resize(count);
+			if (!reader.read(lod.indices.data(), lod.indices.size() * sizeof(Mesh::Index)) || !in_range(lod.indices, vertex_count))
+				return false;
+		}
+	}
+
+	meshes = std::move(res);
+	return true;
+}
+
+void Kasumi::Model::_write_cache(const std::vector<MeshData> &meshes) const
+{
+	if (!UseMeshCache)
+		return;
+
+	auto path = _cache_file();
+	std::error_code ec;
+	std::filesystem::create_directories(std::filesystem::path(path).parent_path(), ec);
+
+	// written aside and renamed, so a concurrent reader never maps half a file; the temp name is unique per writer, as
+	// other processes may be importing the same model
+	char suffix[32];
+	std::snprintf(suffix, sizeof(suffix), ".%08x%08x.tmp", std::random_device{}(), std::random_device{}());
+	auto temp = path + suffix;
+	std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+	if (!file)
+		return;
+
+	write(file, MeshCacheHeader{MeshCacheMagic, MeshCacheVersion, cache_key(_path), static_cast<std::uint32_t>(sizeof(Mesh::Vertex)), static_cast<std::uint32_t>(meshes.size())});
+	for (auto &mesh: meshes)
+	{
+		write(file, static_cast<std::uint32_t>(mesh.vertices.size()));
+		write(file, static_cast<std::uint32_t>(mesh.indices.size()));
+		write(file, static_cast<std::uint32_t>(mesh.lods.size()));
+		write(file, static_cast<std::uint32_t>(mesh.textures.size()));
+		for (auto &slot: mesh.textures)
+		{
+			write(file, slot.first);
+			write(file, static_cast<std::uint32_t>(slot.second.size()));
+			for (auto &texture: slot.second)
+				write(file, texture);
+		}
+		file.write(reinterpret_cast<const char *>(mesh.vertices.data()), static_cast<std::streamsize>(mesh.vertices.size() * sizeof(Mesh::Vertex)));
+		file.write(reinterpret_cast<const char *>(mesh.indices.data()), static_cast<std::streamsize>(mesh.indices.size() * sizeof(Mesh::Index)));
+		for (auto &lod: mesh.lods)
+		{
+			write(file, static_cast<std::uint32_t>(lod.indices.size()));
+			write(file, static_cast<float>(lod.error));
+			file.write(reinterpret_cast<const char *>(lod.indices.data()), static_cast<std::streamsize>(lod.indices.size() * sizeof(Mesh::Index)));
+		}
+	}
+	file.close();
 
-	return std::make_shared<Kasumi::Mesh>(std::move(vertices), std::move(indices), std::move(textures));
+	if (!file)
+		std::filesystem::remove(temp, ec);
+	else
+		std::filesystem::rename(temp, path, ec);
 }
@@ -362,6 +362,9 @@ void Kasumi::Platform::_clear_window()
 void Kasumi::Platform::_begin_frame()
 {
 	_clear_window();
+	Texture::Poll();
+	if (Culling::MainCulling != nullptr)
+		Culling::MainCulling->begin_frame();
 	ImGui_ImplOpenGL3_NewFrame();
 	ImGui_ImplGlfw_NewFrame();
 	ImGui::NewFrame();
@@ -385,6 +388,10 @@ void Kasumi::Platform::_begin_frame()
 
 void Kasumi::Platform::_end_frame()
 {
+	if (Batch::MainBatch != nullptr)
+		Batch::MainBatch->end_frame();
+	if (Culling::MainCulling != nullptr)
+		Culling::MainCulling->end_frame(); // the scene depth is complete here, the UI draws without it
 	ImGui::Render();
 	ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 	glfwSwapBuffers(_current_window);
@@ -399,6 +406,24 @@ void Kasumi::Platform::_menu(Kasumi::App &app)
 	{
 		app.ui_menu();
 
+		if (Culling::MainCulling != nullptr && ImGui::BeginMenu("Culling"))
+		{
+			auto &culling = *Culling::MainCulling;
+			auto &stats = culling.stats();
+			ImGui::Checkbox("Frustum", &culling._opt.frustum);
+			ImGui::Checkbox("Occlusion (HiZ)", &culling._opt.occlusion);
+			ImGui::Text("Objects: %zu / %zu culled (frustum %zu, occlusion %zu)", stats.objects_frustum_culled + stats.objects_occlusion_culled, stats.objects_tested, stats.objects_frustum_culled, stats.objects_occlusion_culled);
+			ImGui::Text("Instances: %zu / %zu culled", stats.instances_culled, stats.instances_tested);
+			ImGui::EndMenu();
+		}
+		if (Batch::MainBatch != nullptr && ImGui::BeginMenu("Batching"))
+		{
+			auto &batch = *Batch::MainBatch;
+			ImGui::Checkbox("Enabled", &batch._opt.enabled);
+			ImGui::Checkbox("Multi Draw Indirect", &batch._opt.multi_draw_indirect);
+			ImGui::Text("Objects: %zu in %zu draw calls", batch.stats().objects, batch.stats().draw_calls);
+			ImGui::EndMenu();
+		}
 		ImGui::Text("FPS: %.0f", ImGui::GetIO().Framerate);
 		ImGui::EndMainMenuBar();
 	}
@@ -457,7 +482,11 @@ void Kasumi::Platform::_color_picker()
 }
 void Kasumi::Platform::_update(Kasumi::App &app)
 {
+	// decide the visibility of every object at once, Renderable::render() then only looks the result up
+	if (Culling::MainCulling != nullptr && Culling::MainCulling->enabled())
+		Culling::MainCulling->cull(Culling::Tracked());
 	app.update(0.02);
+	Renderable::RenderVolumes();
 	GLint m_viewport[4];
 	glGetIntegerv(GL_VIEWPORT, m_viewport);
 	app.update_viewport(m_viewport[2], m_viewport[3]);
@@ -472,6 +501,8 @@ Kasumi::App::App() : _platform(std::make_shared<Kasumi::Platform>(_opt.width, _o
 	Camera::MainCamera->_opt.aspect_ratio = static_cast<float>(_opt.width) / static_cast<float>(_opt.height);
 	Camera::MainCamera->_rebuild_();
 	Light::Init();
+	Culling::Init();
+	Batch::Init();
 }
 void Kasumi::App::launch() { _platform->launch(*this); }
 void Kasumi::App::inspect(Kasumi::INSPECTOR *ptr) { _inspectors.emplace_back(ptr); }
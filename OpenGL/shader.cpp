@@ -1,7 +1,11 @@
 #include "../shader.h"
 #include "glad/glad.h"
+#include "GLFW/glfw3.h"
 #include <fstream>
 #include <exception>
+#include <filesystem>
+#include <cstring>
+#include <cstdio>
 
 std::shared_ptr<Kasumi::Shader> Kasumi::Shader::DefaultMeshShader = nullptr;
 std::shared_ptr<Kasumi::Shader> Kasumi::Shader::DefaultInstanceShader = nullptr;
@@ -12,108 +16,166 @@ std::shared_ptr<Kasumi::Shader> Kasumi::Shader::DefaultInstancePointShader = nul
 std::shared_ptr<Kasumi::Shader> Kasumi::Shader::DefaultFrameShader = nullptr;
 std::shared_ptr<Kasumi::Shader> Kasumi::Shader::Default2DShader = nullptr;
 std::shared_ptr<Kasumi::Shader> Kasumi::Shader::DefaultSimpleMeshShader = nullptr;
+std::shared_ptr<Kasumi::Shader> Kasumi::Shader::DefaultImpostorShader = nullptr;
+std::shared_ptr<Kasumi::Shader> Kasumi::Shader::DefaultVolumeShader = nullptr;
+bool Kasumi::Shader::UseProgramCache = true;
+std::string Kasumi::Shader::ProgramCacheDir;
+
+// ==================== Program Binary Cache ====================
+// glGetProgramBinary/glProgramBinary are GL 4.1 (ARB_get_program_binary on our 3.3 context), so they are looked up at runtime
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+
+namespace
+{
+using GetProgramBinaryFn = void (APIENTRY *)(GLuint, GLsizei, GLsizei *, GLenum *, void *);
+using ProgramBinaryFn = void (APIENTRY *)(GLuint, GLenum, const void *, GLsizei);
+using ProgramParameteriFn = void (APIENTRY *)(GLuint, GLenum, GLint);
+using MaxShaderCompilerThreadsFn = void (APIENTRY *)(GLuint);
+
+struct ProgramBinaryApi
+{
+	GetProgramBinaryFn get_binary = nullptr;
+	ProgramBinaryFn program_binary = nullptr;
+	ProgramParameteriFn program_parameter = nullptr;
+	std::string driver; // vendor, renderer and version: a driver update invalidates every binary
+};
+
+struct ProgramBinaryHeader
+{
+	std::uint32_t magic;
+	std::uint32_t version;
+	std::uint64_t key;
+	std::uint32_t format;
+	std::uint32_t length;
+};
+constexpr std::uint32_t ProgramBinaryMagic = 0x5350534B; // "KSPS"
+constexpr std::uint32_t ProgramBinaryVersion = 1;
+
+auto has_extension(const char *name) -> bool
+{
+	GLint count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+	for (GLint i = 0; i < count; ++i)
+	{
+		auto ext = reinterpret_cast<const char *>(glGetStringi(GL_EXTENSIONS, i));
+		if (ext != nullptr && std::strcmp(ext, name) == 0)
+			return true;
+	}
+	return false;
+}
+
+auto gl_string(GLenum name) -> std::string
+{
+	auto str = reinterpret_cast<const char *>(glGetString(name));
+	return str != nullptr ? str : "";
+}
+
+auto binary_api() -> const ProgramBinaryApi &
+{
+	static ProgramBinaryApi api = []
+	{
+		ProgramBinaryApi res;
+		GLint major = 0, minor = 0;
+		glGetIntegerv(GL_MAJOR_VERSION, &major);
+		glGetIntegerv(GL_MINOR_VERSION, &minor);
+
+		GLint formats = 0;
+		if (major * 10 + minor >= 41 || has_extension("GL_ARB_get_program_binary"))
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		if (formats > 0) // some drivers expose the entry points but no format to store
+		{
+			res.get_binary = reinterpret_cast<GetProgramBinaryFn>(glfwGetProcAddress("glGetProgramBinary"));
+			res.program_binary = reinterpret_cast<ProgramBinaryFn>(glfwGetProcAddress("glProgramBinary"));
+			res.program_parameter = reinterpret_cast<ProgramParameteriFn>(glfwGetProcAddress("glProgramParameteri"));
+			if (res.get_binary == nullptr || res.program_binary == nullptr || res.program_parameter == nullptr)
+				res.get_binary = nullptr;
+		}
+
+		// let the driver use as many compiler threads as it likes; the default shaders are submitted together in Shader::Init()
+		MaxShaderCompilerThreadsFn max_threads = nullptr;
+		if (has_extension("GL_KHR_parallel_shader_compile"))
+			max_threads = reinterpret_cast<MaxShaderCompilerThreadsFn>(glfwGetProcAddress("glMaxShaderCompilerThreadsKHR"));
+		else if (has_extension("GL_ARB_parallel_shader_compile"))
+			max_threads = reinterpret_cast<MaxShaderCompilerThreadsFn>(glfwGetProcAddress("glMaxShaderCompilerThreadsARB"));
+		if (max_threads != nullptr)
+			max_threads(0xFFFFFFFF);
+
+		res.driver = gl_string(GL_VENDOR) + "\n" + gl_string(GL_RENDERER) + "\n" + gl_string(GL_VERSION);
+		return res;
+	}();
+	return api;
+}
+
+// FNV-1a
+auto hash_source(std::uint64_t hash, const char *src) -> std::uint64_t
+{
+	for (; src != nullptr && *src != '\0'; ++src)
+	{
+		hash ^= static_cast<unsigned char>(*src);
+		hash *= 1099511628211ull;
+	}
+	// separator, so moving text from one stage to the next changes the key
+	hash ^= 0xFF;
+	hash *= 1099511628211ull;
+	return hash;
+}
+} // namespace
 
 Kasumi::Shader::Shader(const std::string &vertex_path, const std::string &fragment_path) : Shader(vertex_path, fragment_path, "") {}
 Kasumi::Shader::Shader(const std::string &vertex_path, const std::string &fragment_path, const std::string &geometry_path)
 {
 	std::ifstream vertex_shader_stream(vertex_path);
 	std::string vertex_shader_src((std::istreambuf_iterator<char>(vertex_shader_stream)), std::istreambuf_iterator<char>());
-	const char *vertex_shader_source = vertex_shader_src.c_str();
 
 	std::ifstream fragment_shader_stream(fragment_path);
 	std::string fragment_shader_src((std::istreambuf_iterator<char>(fragment_shader_stream)), std::istreambuf_iterator<char>());
-	const char *fragment_shader_source = fragment_shader_src.c_str();
 
-	// TODO: enable geometry shader
-	unsigned int g;
-	const char *geometry_shader_source;
+	std::string geometry_shader_src;
 	if (!geometry_path.empty())
 	{
 		std::ifstream geometry_shader_stream(geometry_path);
-		std::string geometry_shader_src((std::istreambuf_iterator<char>(geometry_shader_stream)), std::istreambuf_iterator<char>());
-		geometry_shader_source = geometry_shader_src.c_str();
+		geometry_shader_src.assign((std::istreambuf_iterator<char>(geometry_shader_stream)), std::istreambuf_iterator<char>());
 	}
 
-	auto v = glCreateShader(GL_VERTEX_SHADER);
-	auto f = glCreateShader(GL_FRAGMENT_SHADER);
-	if (!geometry_path.empty())
-		g = glCreateShader(GL_GEOMETRY_SHADER);
-	glShaderSource(v, 1, &vertex_shader_source, nullptr);
-	glShaderSource(f, 1, &fragment_shader_source, nullptr);
-	if (!geometry_path.empty())
-		glShaderSource(g, 1, &geometry_shader_source, nullptr);
-	glCompileShader(v);
-	glCompileShader(f);
-	if (!geometry_path.empty())
-		glCompileShader(g);
-
-	ID = glCreateProgram();
-	glAttachShader(ID, v);
-	glAttachShader(ID, f);
-	if (!geometry_path.empty())
-		glAttachShader(ID, g);
-	glLinkProgram(ID);
-
-	_validate(v, "VERTEX");
-	_validate(f, "FRAGMENT");
-	if (!geometry_path.empty())
-		_validate(ID, "GEOMETRY");
-	_validate(ID, "PROGRAM");
-
-	// to save GPU memory
-	glDeleteShader(v);
-	glDeleteShader(f);
-	if (!geometry_path.empty())
-		glDeleteShader(g);
+	_compile(vertex_shader_src.c_str(), fragment_shader_src.c_str(), geometry_path.empty() ? nullptr : geometry_shader_src.c_str());
+	_finish();
 }
 Kasumi::Shader::Shader(const char *vertex_src, const char *fragment_src) : Shader(vertex_src, fragment_src, nullptr) {}
 Kasumi::Shader::Shader(const char *vertex_src, const char *fragment_src, const char *geometry_src)
 {
-	auto v = glCreateShader(GL_VERTEX_SHADER);
-	auto f = glCreateShader(GL_FRAGMENT_SHADER);
-	unsigned int g;
-	if (geometry_src != nullptr)
-		g = glCreateShader(GL_GEOMETRY_SHADER);
-	glShaderSource(v, 1, &vertex_src, nullptr);
-	glShaderSource(f, 1, &fragment_src, nullptr);
-	if (geometry_src != nullptr)
-		glShaderSource(g, 1, &geometry_src, nullptr);
-	glCompileShader(v);
-	glCompileShader(f);
-	if (geometry_src != nullptr)
-		glCompileShader(g);
-
-	ID = glCreateProgram();
-	glAttachShader(ID, v);
-	glAttachShader(ID, f);
-	if (geometry_src != nullptr)
-		glAttachShader(ID, g);
-	glLinkProgram(ID);
-
-	_validate(v, "VERTEX");
-	_validate(f, "FRAGMENT");
-	if (geometry_src != nullptr)
-		_validate(ID, "GEOMETRY");
-	_validate(ID, "PROGRAM");
-
-	// to save GPU memory
-	glDeleteShader(v);
-	glDeleteShader(f);
-	if (geometry_src != nullptr)
-		glDeleteShader(g);
+	_compile(vertex_src, fragment_src, geometry_src);
+	_finish();
+}
+Kasumi::Shader::Shader(Deferred, const char *vertex_src, const char *fragment_src, const char *geometry_src)
+{
+	_compile(vertex_src, fragment_src, geometry_src);
 }
 
 Kasumi::Shader::~Shader()
 {
+	for (auto stage: _stages)
+		if (stage != 0)
+			glDeleteShader(stage);
 	glUseProgram(0);
 	glDeleteProgram(ID);
 }
 void Kasumi::Shader::use() const
 {
+	if (_pending)
+		_finish();
 	glUseProgram(ID);
 }
 void Kasumi::Shader::Init()
 {
+	// all default programs are submitted before any status query; each one is finished on its first use()
 	if (DefaultMeshShader == nullptr)
 	{
 		std::string vertex_src = R"(
@@ -209,7 +271,7 @@ void main()
     FragColor = vec4(out_color, alpha);
 }
 		)";
-		DefaultMeshShader = std::make_shared<Shader>(vertex_src.c_str(), fragment_src.c_str());
+		DefaultMeshShader = std::shared_ptr<Shader>(new Shader(Deferred{}, vertex_src.c_str(), fragment_src.c_str(), nullptr));
 	}
 	if (DefaultInstanceShader == nullptr)
 	{
@@ -230,6 +292,7 @@ uniform mat4 view;
 //uniform mat4 model; we don't need this
 
 uniform int inst_id;
+uniform int inst_base; // first instance of this draw, when the instances are drawn in several parts
 
 out VS_OUT {
     vec3 FragPos;
@@ -248,9 +311,9 @@ void main()
     vs_out.Color = aInstColor.xyz;
     gl_Position = projection * view * aInstanceMatrix * vec4(aPos.x, aPos.y, aPos.z, 1.0);
 
-    instanceID = gl_InstanceID;
+    instanceID = inst_base + gl_InstanceID;
 
-    if (inst_id == gl_InstanceID)
+    if (inst_id == instanceID)
     {
         vs_out.Color = vec3(1.0, 0.3, 0.3);
     }
@@ -328,7 +391,7 @@ void main()
     FragColor = vec4(out_color, alpha);
 }
 		)";
-		DefaultInstanceShader = std::make_shared<Shader>(vertex_src.c_str(), fragment_src.c_str());
+		DefaultInstanceShader = std::shared_ptr<Shader>(new Shader(Deferred{}, vertex_src.c_str(), fragment_src.c_str(), nullptr));
 	}
 	if (DefaultLineShader == nullptr)
 	{
@@ -361,7 +424,7 @@ void main()
     FragColor = vec4(Color, opacity);
 }
 		)";
-		DefaultLineShader = std::make_shared<Shader>(vertex_src.c_str(), fragment_src.c_str());
+		DefaultLineShader = std::shared_ptr<Shader>(new Shader(Deferred{}, vertex_src.c_str(), fragment_src.c_str(), nullptr));
 	}
 	if (DefaultInstanceLineShader == nullptr)
 	{
@@ -407,7 +470,7 @@ void main()
     FragColor = vec4(fs_in.Color, opacity);
 }
 		)";
-		DefaultInstanceLineShader = std::make_shared<Shader>(vertex_src.c_str(), fragment_src.c_str());
+		DefaultInstanceLineShader = std::shared_ptr<Shader>(new Shader(Deferred{}, vertex_src.c_str(), fragment_src.c_str(), nullptr));
 	}
 	if (DefaultPointShader == nullptr) // we can use the same shader for point and line
 	{
@@ -440,7 +503,7 @@ void main()
     FragColor = vec4(Color, opacity);
 }
 		)";
-		DefaultPointShader = std::make_shared<Shader>(vertex_src.c_str(), fragment_src.c_str());
+		DefaultPointShader = std::shared_ptr<Shader>(new Shader(Deferred{}, vertex_src.c_str(), fragment_src.c_str(), nullptr));
 	}
 	if (DefaultInstancePointShader == nullptr)
 	{
@@ -473,7 +536,7 @@ void main()
     FragColor = vec4(Color, opacity);
 }
 		)";
-		DefaultInstancePointShader = std::make_shared<Shader>(vertex_src.c_str(), fragment_src.c_str());
+		DefaultInstancePointShader = std::shared_ptr<Shader>(new Shader(Deferred{}, vertex_src.c_str(), fragment_src.c_str(), nullptr));
 	}
 	if (DefaultFrameShader == nullptr)
 	{
@@ -503,7 +566,7 @@ void main()
     FragColor = texture(screenTexture, TexCoords);
 }
 		)";
-		DefaultFrameShader = std::make_shared<Shader>(vertex_src.c_str(), fragment_src.c_str());
+		DefaultFrameShader = std::shared_ptr<Shader>(new Shader(Deferred{}, vertex_src.c_str(), fragment_src.c_str(), nullptr));
 	}
 	if (Default2DShader == nullptr)
 	{
@@ -540,7 +603,7 @@ void main()
     FragColor = vec4(Color, 1.0f);
 }
 		)";
-		Default2DShader = std::make_shared<Shader>(vertex_src.c_str(), fragment_src.c_str());
+		Default2DShader = std::shared_ptr<Shader>(new Shader(Deferred{}, vertex_src.c_str(), fragment_src.c_str(), nullptr));
 	}
 	if (DefaultSimpleMeshShader == nullptr)
 	{
@@ -622,7 +685,259 @@ void main()
     FragColor = vec4(out_color, alpha);
 }
 		)";
-		DefaultSimpleMeshShader = std::make_shared<Shader>(vertex_src.c_str(), fragment_src.c_str());
+		DefaultSimpleMeshShader = std::shared_ptr<Shader>(new Shader(Deferred{}, vertex_src.c_str(), fragment_src.c_str(), nullptr));
+	}
+	if (DefaultImpostorShader == nullptr)
+	{
+		// one point sprite per sphere, sized to the exact screen bounds of the sphere, then ray-cast per fragment
+		std::string vertex_src = R"(
+#version 330 core
+layout (location = 0) in vec4 aSphere; // center, radius
+layout (location = 1) in vec4 aColor;
+
+uniform mat4 projection;
+uniform mat4 view;
+uniform vec3 lightPos;
+uniform vec4 viewport;
+uniform float max_point_size;
+
+uniform int inst_id;
+uniform bool is_random_color;
+
+out VS_OUT {
+    flat vec3 Center; // view space
+    flat float Radius;
+    flat vec3 Color;
+    flat vec3 LightPos; // view space
+    flat float Pixels; // screen space radius
+} vs_out;
+
+// half extent, in tangent units, of the sphere's silhouette around its projected center along one axis
+float half_extent(float c, float depth, float r)
+{
+    float d = sqrt(c * c + depth * depth);
+    if (d <= r * 1.0001)
+        return 1e6; // the camera is inside
+    float center = atan(c, depth);
+    float spread = asin(r / d);
+    float lo = tan(max(center - spread, -1.55));
+    float hi = tan(min(center + spread, 1.55));
+    float mid = tan(center);
+    return max(hi - mid, mid - lo);
+}
+
+void main()
+{
+    vec4 center = view * vec4(aSphere.xyz, 1.0);
+    float r = aSphere.w;
+    gl_Position = projection * center;
+
+    float depth = max(-center.z, 1e-4);
+    float px = half_extent(center.x, depth, r) * projection[0][0] * viewport.z * 0.5;
+    float py = half_extent(center.y, depth, r) * projection[1][1] * viewport.w * 0.5;
+    vs_out.Pixels = max(px, py);
+    gl_PointSize = clamp(2.0 * vs_out.Pixels + 2.0, 1.0, max_point_size);
+
+    vs_out.Center = center.xyz;
+    vs_out.Radius = r;
+    vs_out.LightPos = (view * vec4(lightPos, 1.0)).xyz;
+    vs_out.Color = aColor.rgb;
+    if (is_random_color)
+    {
+        uint h = uint(gl_VertexID) * 747796405u + 2891336453u;
+        h = ((h >> ((h >> 28u) + 4u)) ^ h) * 277803737u;
+        vs_out.Color = vec3(float(h & 255u), float((h >> 8u) & 255u), float((h >> 16u) & 255u)) / 255.0;
+    }
+    if (inst_id == gl_VertexID)
+        vs_out.Color = vec3(1.0, 0.3, 0.3);
+}
+		)";
+		std::string fragment_src = R"(
+#version 330 core
+out vec4 FragColor;
+
+uniform mat4 projection;
+uniform vec4 viewport;
+uniform float lod_pixels;
+
+in VS_OUT {
+    flat vec3 Center;
+    flat float Radius;
+    flat vec3 Color;
+    flat vec3 LightPos;
+    flat float Pixels;
+} fs_in;
+
+void main()
+{
+    // too small for the shape to show: a flat dot at the sprite's depth, no ray-cast
+    if (fs_in.Pixels < lod_pixels)
+    {
+        FragColor = vec4(fs_in.Color, 1.0);
+        gl_FragDepth = gl_FragCoord.z;
+        return;
+    }
+
+    // view space ray through this pixel
+    vec2 ndc = (gl_FragCoord.xy - viewport.xy) / viewport.zw * 2.0 - 1.0;
+    vec3 dir = normalize(vec3(ndc.x / projection[0][0], ndc.y / projection[1][1], -1.0));
+
+    vec3 c = fs_in.Center;
+    float b = dot(dir, c);
+    float h = b * b - dot(c, c) + fs_in.Radius * fs_in.Radius;
+    if (h < 0.0)
+        discard;
+    float t = b - sqrt(h);
+    if (t <= 0.0)
+        discard;
+
+    vec3 hit = dir * t;
+    vec3 norm = (hit - c) / fs_in.Radius;
+    vec4 clip = projection * vec4(hit, 1.0);
+    gl_FragDepth = clip.z / clip.w * 0.5 + 0.5;
+
+    // blinn-phong lighting, in view space
+    vec3 ambient = 0.1 * fs_in.Color;
+    vec3 lightDir = normalize(fs_in.LightPos - hit);
+    float diff = max(dot(norm, lightDir), 0.0);
+    vec3 diffuse = diff * fs_in.Color;
+    vec3 viewDir = normalize(-hit);
+    vec3 reflectDir = reflect(-lightDir, norm);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32);
+    vec3 specular = spec * vec3(0.5, 0.5, 0.5);
+
+    FragColor = vec4(ambient + diffuse + specular, 1.0);
+}
+		)";
+		DefaultImpostorShader = std::shared_ptr<Shader>(new Shader(Deferred{}, vertex_src.c_str(), fragment_src.c_str(), nullptr));
+	}
+	if (DefaultVolumeShader == nullptr)
+	{
+		// the back faces of the field's box, each fragment marching its view ray from where it enters the box to the box
+		// exit or the scene depth, whichever comes first
+		std::string vertex_src = R"(
+#version 330 core
+layout (location = 0) in vec3 aPos; // unit cube
+
+uniform mat4 projection;
+uniform mat4 view;
+uniform vec3 box_min;
+uniform vec3 box_size;
+
+out vec3 WorldPos;
+
+void main()
+{
+    WorldPos = box_min + aPos * box_size;
+    gl_Position = projection * view * vec4(WorldPos, 1.0);
+}
+		)";
+		std::string fragment_src = R"(
+#version 330 core
+out vec4 FragColor;
+
+in vec3 WorldPos;
+
+uniform mat4 projection;
+uniform mat4 view;
+uniform vec3 lightPos;
+uniform sampler3D field;
+uniform sampler2D scene_depth; // depth of everything drawn before the volume
+uniform vec4 viewport;
+uniform vec3 eye; // camera position and inverse(projection * view), set once per draw
+uniform mat4 inv_view_projection;
+uniform vec3 box_min;
+uniform vec3 box_size;
+uniform vec3 texel; // 1 / resolution
+uniform int mode; // 0 density, 1 colour map, 2 isosurface
+uniform vec2 range; // values mapped to 0..1
+uniform float density;
+uniform float iso;
+uniform vec3 color;
+uniform int max_steps;
+
+float value(vec3 p)
+{
+    return clamp((texture(field, (p - box_min) / box_size).r - range.x) / (range.y - range.x), 0.0, 1.0);
+}
+vec3 ramp(float t) // blue, cyan, yellow, red
+{
+    return clamp(vec3(1.5) - abs(4.0 * t - vec3(3.0, 2.0, 1.0)), 0.0, 1.0);
+}
+
+void main()
+{
+    gl_FragDepth = gl_FragCoord.z;
+
+    vec3 dir = normalize(WorldPos - eye);
+    vec3 t0 = (box_min - eye) / dir;
+    vec3 t1 = (box_min + box_size - eye) / dir;
+    vec3 near = min(t0, t1), far = max(t0, t1);
+    float enter = max(max(max(near.x, near.y), near.z), 0.0);
+    float leave = min(min(far.x, far.y), far.z);
+
+    // end the ray at the opaque geometry in this pixel, unprojected back to a distance along the ray
+    vec2 uv = (gl_FragCoord.xy - viewport.xy) / viewport.zw;
+    vec4 ndc = vec4(uv * 2.0 - 1.0, texture(scene_depth, uv).r * 2.0 - 1.0, 1.0);
+    vec4 scene = inv_view_projection * ndc;
+    leave = min(leave, dot(scene.xyz / scene.w - eye, dir));
+    if (leave <= enter)
+        discard;
+
+    // about one step per cell, so thin features are not skipped
+    vec3 cell = box_size * texel;
+    float spacing = min(min(cell.x, cell.y), cell.z);
+    int steps = clamp(int(ceil((leave - enter) / spacing)), 1, max_steps);
+    float dt = (leave - enter) / float(steps);
+
+    if (mode == 2)
+    {
+        float t = enter, last = enter;
+        float v = value(eye + dir * t);
+        for (int i = 0; i <= steps && v < iso; ++i)
+        {
+            last = t;
+            t = enter + float(i) * dt;
+            v = value(eye + dir * t);
+        }
+        if (v < iso)
+            discard;
+        for (int i = 0; i < 6; ++i) // bisection between the last two samples
+        {
+            float mid = 0.5 * (last + t);
+            if (value(eye + dir * mid) < iso)
+                last = mid;
+            else
+                t = mid;
+        }
+        vec3 hit = eye + dir * t;
+        vec3 g = vec3(value(hit + vec3(cell.x, 0, 0)) - value(hit - vec3(cell.x, 0, 0)),
+                      value(hit + vec3(0, cell.y, 0)) - value(hit - vec3(0, cell.y, 0)),
+                      value(hit + vec3(0, 0, cell.z)) - value(hit - vec3(0, 0, cell.z)));
+        vec3 norm = length(g) > 0.0 ? -normalize(g) : -dir;
+        float diff = abs(dot(norm, normalize(lightPos - hit)));
+        FragColor = vec4((0.1 + 0.9 * diff) * color, 1.0);
+        vec4 clip = projection * view * vec4(hit, 1.0);
+        gl_FragDepth = clip.z / clip.w * 0.5 + 0.5;
+        return;
+    }
+
+    // emission-absorption front to back, stopping once nearly opaque
+    vec4 acc = vec4(0.0);
+    for (int i = 0; i < steps && acc.a < 0.99; ++i)
+    {
+        float v = value(eye + dir * (enter + (float(i) + 0.5) * dt));
+        float a = 1.0 - exp(-density * v * dt);
+        vec3 c = mode == 1 ? ramp(v) : color;
+        acc.rgb += (1.0 - acc.a) * a * c;
+        acc.a += (1.0 - acc.a) * a;
+    }
+    if (acc.a <= 0.0)
+        discard;
+    FragColor = acc; // premultiplied
+}
+		)";
+		DefaultVolumeShader = std::shared_ptr<Shader>(new Shader(Deferred{}, vertex_src.c_str(), fragment_src.c_str(), nullptr));
 	}
 }
 void Kasumi::Shader::_validate(unsigned int shader, const std::string &type)
@@ -650,6 +965,145 @@ void Kasumi::Shader::_validate(unsigned int shader, const std::string &type)
 	}
 }
 
+auto Kasumi::Shader::instanced() -> std::shared_ptr<Shader>
+{
+	if (_instanced_tried)
+		return _instanced;
+	_instanced_tried = true;
+
+	const std::string model_uniform = "uniform mat4 model;";
+	auto pos = _vertex_src.find(model_uniform);
+	if (_has_geometry || pos == std::string::npos || _fragment_src.find(model_uniform) != std::string::npos)
+		return nullptr;
+
+	// a mat4 attribute takes four locations, the same 7-10 InstancedMesh feeds
+	auto vertex_src = _vertex_src;
+	vertex_src.replace(pos, model_uniform.size(), "layout (location = 7) in mat4 model;");
+	_instanced = std::make_shared<Shader>(vertex_src.c_str(), _fragment_src.c_str());
+	return _instanced;
+}
+void Kasumi::Shader::_compile(const char *vertex_src, const char *fragment_src, const char *geometry_src)
+{
+	ID = glCreateProgram();
+	_vertex_src = vertex_src;
+	_fragment_src = fragment_src;
+	_has_geometry = geometry_src != nullptr;
+
+	auto &api = binary_api();
+	if (UseProgramCache && api.get_binary != nullptr)
+	{
+		_cache_key = hash_source(hash_source(hash_source(hash_source(14695981039346656037ull, api.driver.c_str()), vertex_src), fragment_src), geometry_src);
+		char name[32];
+		std::snprintf(name, sizeof(name), "%016llx.bin", static_cast<unsigned long long>(_cache_key));
+		auto dir = ProgramCacheDir.empty() ? std::filesystem::temp_directory_path() / "Kasumi_ProgramCache" : std::filesystem::path(ProgramCacheDir);
+		_cache_file = (dir / name).string();
+
+		if (_load_binary())
+			return;
+		api.program_parameter(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	}
+
+	_stages[0] = glCreateShader(GL_VERTEX_SHADER);
+	_stages[1] = glCreateShader(GL_FRAGMENT_SHADER);
+	if (geometry_src != nullptr)
+		_stages[2] = glCreateShader(GL_GEOMETRY_SHADER);
+	glShaderSource(_stages[0], 1, &vertex_src, nullptr);
+	glShaderSource(_stages[1], 1, &fragment_src, nullptr);
+	if (geometry_src != nullptr)
+		glShaderSource(_stages[2], 1, &geometry_src, nullptr);
+
+	// no status query here: that would block until the driver is done
+	for (auto stage: _stages)
+		if (stage != 0)
+		{
+			glCompileShader(stage);
+			glAttachShader(ID, stage);
+		}
+	glLinkProgram(ID);
+	_pending = true;
+}
+void Kasumi::Shader::_finish() const
+{
+	if (!_pending)
+		return;
+	_pending = false;
+
+	_validate(_stages[0], "VERTEX");
+	_validate(_stages[1], "FRAGMENT");
+	if (_stages[2] != 0)
+		_validate(_stages[2], "GEOMETRY");
+	_validate(ID, "PROGRAM");
+
+	// to save GPU memory
+	for (auto &stage: _stages)
+		if (stage != 0)
+		{
+			glDetachShader(ID, stage);
+			glDeleteShader(stage);
+			stage = 0;
+		}
+
+	_save_binary();
+}
+auto Kasumi::Shader::_load_binary() -> bool
+{
+	std::ifstream file(_cache_file, std::ios::binary);
+	if (!file)
+		return false;
+
+	ProgramBinaryHeader header{};
+	file.read(reinterpret_cast<char *>(&header), sizeof(header));
+	if (!file || header.magic != ProgramBinaryMagic || header.version != ProgramBinaryVersion || header.key != _cache_key || header.length == 0)
+		return false;
+
+	std::vector<char> binary(header.length);
+	file.read(binary.data(), static_cast<std::streamsize>(binary.size()));
+	if (!file)
+		return false;
+
+	binary_api().program_binary(ID, header.format, binary.data(), static_cast<GLsizei>(binary.size()));
+	GLint success = GL_FALSE;
+	glGetProgramiv(ID, GL_LINK_STATUS, &success);
+	if (success != GL_TRUE)
+	{
+		// rejected by the driver: compile from source and overwrite the stale binary
+		file.close();
+		std::error_code ec;
+		std::filesystem::remove(_cache_file, ec);
+		return false;
+	}
+	return true;
+}
+void Kasumi::Shader::_save_binary() const
+{
+	auto &api = binary_api();
+	if (_cache_file.empty() || api.get_binary == nullptr)
+		return;
+
+	GLint length = 0;
+	glGetProgramiv(ID, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+
+	std::vector<char> binary(length);
+	GLsizei written = 0;
+	GLenum format = 0;
+	api.get_binary(ID, length, &written, &format, binary.data());
+	if (written <= 0)
+		return;
+
+	std::error_code ec;
+	std::filesystem::create_directories(std::filesystem::path(_cache_file).parent_path(), ec);
+
+	ProgramBinaryHeader header{ProgramBinaryMagic, ProgramBinaryVersion, _cache_key, format, static_cast<std::uint32_t>(written)};
+	std::ofstream file(_cache_file, std::ios::binary | std::ios::trunc);
+	file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+	file.write(binary.data(), written);
+	file.close();
+	if (!file) // a truncated binary would only be rejected on the next run
+		std::filesystem::remove(_cache_file, ec);
+}
+
 void Kasumi::Shader::uniform(const std::string &name, bool value) const
 {
 	use();
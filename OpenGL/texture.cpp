@@ -5,10 +5,417 @@
 #include "stb/stb_image.h"
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb/stb_image_write.h"
+#define STB_DXT_IMPLEMENTATION
+#include "stb/stb_dxt.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <random>
 #include <utility>
 
+// S3TC is an extension on every desktop driver rather than core, so a core profile loader may not carry its enums
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+bool Kasumi::Texture::UseMipmaps = true;
+bool Kasumi::Texture::UseCompression = true;
+bool Kasumi::Texture::UseDiskCache = true;
+std::string Kasumi::Texture::CacheDir;
+std::map<std::string, std::weak_ptr<Kasumi::Texture>> Kasumi::Texture::_registry;
+std::vector<std::pair<std::weak_ptr<Kasumi::Texture>, std::future<Kasumi::Texture::Decoded>>> Kasumi::Texture::_pending;
+
+// ==================== Decoding ====================
+namespace
+{
+constexpr std::uint32_t TextureCacheMagic = 0x5854534B; // "KSTX"
+constexpr std::uint32_t TextureCacheVersion = 1;
+
+struct TextureCacheHeader
+{
+	std::uint32_t magic;
+	std::uint32_t version;
+	std::uint64_t key;
+	std::int32_t width, height, channels;
+	std::uint32_t format;
+	std::uint32_t level_count;
+};
+
+auto has_extension(const char *name) -> bool
+{
+	GLint count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+	for (GLint i = 0; i < count; ++i)
+	{
+		auto ext = reinterpret_cast<const char *>(glGetStringi(GL_EXTENSIONS, i));
+		if (ext != nullptr && std::strcmp(ext, name) == 0)
+			return true;
+	}
+	return false;
+}
+auto s3tc_supported() -> bool
+{
+	static bool supported = has_extension("GL_EXT_texture_compression_s3tc");
+	return supported;
+}
+
+auto pixel_format(int channels) -> GLenum
+{
+	switch (channels)
+	{
+		case 2:
+			return GL_RG;
+		case 3:
+			return GL_RGB;
+		case 4:
+			return GL_RGBA;
+		default:
+			return GL_RED;
+	}
+}
+
+auto placeholder() -> GLuint // bound in place of a texture that is still decoding
+{
+	static GLuint id = []
+	{
+		GLuint res = 0;
+		const unsigned char white[4] = {255, 255, 255, 255};
+		glGenTextures(1, &res);
+		glBindTexture(GL_TEXTURE_2D, res);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, white);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		return res;
+	}();
+	return id;
+}
+
+// next mip level with a 2x2 box filter; an odd last row or column is folded into its neighbour
+auto downsample(const std::vector<unsigned char> &src, int width, int height, int channels) -> std::vector<unsigned char>
+{
+	int w = std::max(1, width / 2), h = std::max(1, height / 2);
+	std::vector<unsigned char> dst(static_cast<size_t>(w) * h * channels);
+	for (int y = 0; y < h; ++y)
+		for (int x = 0; x < w; ++x)
+		{
+			int x0 = std::min(2 * x, width - 1), x1 = std::min(2 * x + 1, width - 1);
+			int y0 = std::min(2 * y, height - 1), y1 = std::min(2 * y + 1, height - 1);
+			for (int c = 0; c < channels; ++c)
+			{
+				auto texel = [&](int tx, int ty) { return static_cast<int>(src[(static_cast<size_t>(ty) * width + tx) * channels + c]); };
+				dst[(static_cast<size_t>(y) * w + x) * channels + c] = static_cast<unsigned char>((texel(x0, y0) + texel(x1, y0) + texel(x0, y1) + texel(x1, y1) + 2) / 4);
+			}
+		}
+	return dst;
+}
+
+// 4x4 blocks, BC1 for rgb and BC3 for rgba; blocks over the edge repeat the last row and column
+auto compress(const std::vector<unsigned char> &src, int width, int height, int channels) -> std::vector<unsigned char>
+{
+	bool alpha = channels == 4;
+	size_t block_size = alpha ? 16 : 8;
+	int bw = (width + 3) / 4, bh = (height + 3) / 4;
+	std::vector<unsigned char> dst(static_cast<size_t>(bw) * bh * block_size);
+	unsigned char block[64];
+	auto *out = dst.data();
+	for (int by = 0; by < bh; ++by)
+		for (int bx = 0; bx < bw; ++bx)
+		{
+			for (int py = 0; py < 4; ++py)
+				for (int px = 0; px < 4; ++px)
+				{
+					int sx = std::min(bx * 4 + px, width - 1), sy = std::min(by * 4 + py, height - 1);
+					auto *p = &src[(static_cast<size_t>(sy) * width + sx) * channels];
+					auto *b = &block[(py * 4 + px) * 4];
+					b[0] = p[0], b[1] = p[1], b[2] = p[2], b[3] = alpha ? p[3] : 255;
+				}
+			stb_compress_dxt_block(out, block, alpha ? 1 : 0, STB_DXT_HIGHQUAL);
+			out += block_size;
+		}
+	return dst;
+}
+
+// FNV-1a over path, size, write time and the settings that shape the blocks
+auto texture_key(const std::string &path, bool mipmaps) -> std::uint64_t
+{
+	std::error_code ec;
+	auto size = static_cast<std::uint64_t>(std::filesystem::file_size(path, ec));
+	auto time = static_cast<std::int64_t>(std::filesystem::last_write_time(path, ec).time_since_epoch().count());
+	std::uint32_t settings[2] = {TextureCacheVersion, mipmaps};
+	std::uint64_t hash = 14695981039346656037ull;
+	auto mix = [&](const void *data, size_t bytes)
+	{
+		auto *p = static_cast<const unsigned char *>(data);
+		for (size_t i = 0; i < bytes; ++i)
+		{
+			hash ^= p[i];
+			hash *= 1099511628211ull;
+		}
+	};
+	mix(path.data(), path.size());
+	mix(&size, sizeof(size));
+	mix(&time, sizeof(time));
+	mix(settings, sizeof(settings));
+	return hash;
+}
+auto texture_cache_file(std::uint64_t key) -> std::string
+{
+	char name[32];
+	std::snprintf(name, sizeof(name), "%016llx.tex", static_cast<unsigned long long>(key));
+	auto dir = Kasumi::Texture::CacheDir.empty() ? std::filesystem::temp_directory_path() / "Kasumi_TextureCache" : std::filesystem::path(Kasumi::Texture::CacheDir);
+	return (dir / name).string();
+}
+
+// bytes of one BC1 / BC3 level, 0 for anything the cache never holds
+auto block_bytes(std::int32_t width, std::int32_t height, std::uint32_t format) -> size_t
+{
+	if (width <= 0 || height <= 0 || (format != GL_COMPRESSED_RGB_S3TC_DXT1_EXT && format != GL_COMPRESSED_RGBA_S3TC_DXT5_EXT))
+		return 0;
+	return static_cast<size_t>((width + 3) / 4) * ((height + 3) / 4) * (format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT ? 16 : 8);
+}
+} // namespace
+
+auto Kasumi::Texture::_decode(const std::string &path, bool compress_blocks, bool mipmaps) -> Decoded
+{
+	Decoded res;
+	auto key = texture_key(path, mipmaps);
+	auto file = compress_blocks && UseDiskCache ? texture_cache_file(key) : std::string();
+
+	if (!file.empty())
+	{
+		std::ifstream in(file, std::ios::binary);
+		std::error_code ec;
+		auto file_size = std::filesystem::file_size(file, ec);
+		TextureCacheHeader header{};
+		if (in.read(reinterpret_cast<char *>(&header), sizeof(header)) && header.magic == TextureCacheMagic && header.version == TextureCacheVersion && header.key == key)
+		{
+			res.width = header.width, res.height = header.height, res.channels = header.channels, res.format = header.format;
+			for (std::uint32_t i = 0; i < header.level_count && in; ++i)
+			{
+				std::int32_t size[2];
+				std::uint32_t bytes;
+				in.read(reinterpret_cast<char *>(size), sizeof(size));
+				in.read(reinterpret_cast<char *>(&bytes), sizeof(bytes));
+				// the size is checked against what the level's dimensions imply, and what is left of the file, before
+				// anything is allocated for it
+				if (!in || ec || bytes == 0 || bytes != block_bytes(size[0], size[1], header.format) || bytes > file_size - static_cast<std::uintmax_t>(in.tellg()))
+					break;
+				std::vector<unsigned char> level(bytes);
+				in.read(reinterpret_cast<char *>(level.data()), static_cast<std::streamsize>(bytes));
+				res.sizes.emplace_back(size[0], size[1]);
+				res.levels.emplace_back(std::move(level));
+			}
+			if (in && res.levels.size() == header.level_count)
+				return res;
+		}
+		res = Decoded();
+	}
+
+	int width, height, channels;
+	auto *data = stbi_load(path.c_str(), &width, &height, &channels, 0);
+	if (data == nullptr)
+		return res;
+	res.width = width, res.height = height, res.channels = channels;
+	std::vector<unsigned char> level(data, data + static_cast<size_t>(width) * height * channels);
+	stbi_image_free(data);
+
+	// uncompressed textures go up as level 0 only, the driver builds their chain; blocks need every level made here
+	bool blocks = compress_blocks && (channels == 3 || channels == 4);
+	res.format = blocks ? (channels == 4 ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT) : 0;
+	for (int w = width, h = height;; w = std::max(1, w / 2), h = std::max(1, h / 2))
+	{
+		res.sizes.emplace_back(w, h);
+		if (!blocks)
+		{
+			res.levels.emplace_back(std::move(level));
+			break;
+		}
+		res.levels.emplace_back(compress(level, w, h, channels));
+		if (!mipmaps || (w == 1 && h == 1))
+			break;
+		level = downsample(level, w, h, channels);
+	}
+
+	if (blocks && !file.empty())
+	{
+		// written aside and renamed, so a concurrent reader never sees half a file
+		std::error_code ec;
+		std::filesystem::create_directories(std::filesystem::path(file).parent_path(), ec);
+		char suffix[32];
+		std::snprintf(suffix, sizeof(suffix), ".%08x%08x.tmp", std::random_device{}(), std::random_device{}());
+		auto temp = file + suffix;
+		std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+		TextureCacheHeader header{TextureCacheMagic, TextureCacheVersion, key, width, height, channels, res.format, static_cast<std::uint32_t>(res.levels.size())};
+		out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+		for (size_t i = 0; i < res.levels.size(); ++i)
+		{
+			std::int32_t size[2] = {res.sizes[i].first, res.sizes[i].second};
+			auto bytes = static_cast<std::uint32_t>(res.levels[i].size());
+			out.write(reinterpret_cast<const char *>(size), sizeof(size));
+			out.write(reinterpret_cast<const char *>(&bytes), sizeof(bytes));
+			out.write(reinterpret_cast<const char *>(res.levels[i].data()), static_cast<std::streamsize>(bytes));
+		}
+		out.close();
+		if (!out)
+			std::filesystem::remove(temp, ec);
+		else
+			std::filesystem::rename(temp, file, ec);
+	}
+	return res;
+}
+
+// ==================== Pixel Kernels ====================
+namespace
+{
+// one texel layout per instantiation: the inner loops get constant trip counts and the compiler vectorises them
+template<int S, int D, typename In, typename Out, typename Fn>
+void convert_row(const In *src, Out *dst, int count, Fn &fn, Out alpha)
+{
+	for (int i = 0; i < count; ++i)
+		for (int c = 0; c < D; ++c)
+			dst[i * D + c] = c < S ? fn(src[i * S + c]) : (c == 3 ? alpha : Out(0));
+}
+template<int S, typename In, typename Out, typename Fn>
+void convert_to(int dst_channels, const In *src, Out *dst, int count, Fn &fn, Out alpha)
+{
+	switch (dst_channels)
+	{
+		case 1:
+			convert_row<S, 1>(src, dst, count, fn, alpha);
+			break;
+		case 2:
+			convert_row<S, 2>(src, dst, count, fn, alpha);
+			break;
+		case 3:
+			convert_row<S, 3>(src, dst, count, fn, alpha);
+			break;
+		default:
+			convert_row<S, 4>(src, dst, count, fn, alpha);
+			break;
+	}
+}
+// channels the destination lacks are dropped, channels the source lacks are padded with 0 (alpha with `alpha`)
+template<typename In, typename Out, typename Fn>
+void convert(int src_channels, int dst_channels, const In *src, Out *dst, int count, Fn fn, Out alpha)
+{
+	switch (src_channels)
+	{
+		case 1:
+			convert_to<1>(dst_channels, src, dst, count, fn, alpha);
+			break;
+		case 2:
+			convert_to<2>(dst_channels, src, dst, count, fn, alpha);
+			break;
+		case 3:
+			convert_to<3>(dst_channels, src, dst, count, fn, alpha);
+			break;
+		default:
+			convert_to<4>(dst_channels, src, dst, count, fn, alpha);
+			break;
+	}
+}
+template<int C, typename T>
+void fill_row(T *dst, int count, const T *value)
+{
+	for (int i = 0; i < count; ++i)
+		for (int c = 0; c < C; ++c)
+			dst[i * C + c] = value[c];
+}
+template<typename T>
+void fill_row(int channels, T *dst, int count, const T *value)
+{
+	switch (channels)
+	{
+		case 1:
+			fill_row<1>(dst, count, value);
+			break;
+		case 2:
+			fill_row<2>(dst, count, value);
+			break;
+		case 3:
+			fill_row<3>(dst, count, value);
+			break;
+		default:
+			fill_row<4>(dst, count, value);
+			break;
+	}
+}
+
+// the part of a width x height rectangle at (x, y) inside the texture, and where it starts in the source
+struct Clip
+{
+	int x0, y0, x1, y1;
+	int src_x, src_y;
+	inline auto empty() const -> bool { return x0 >= x1 || y0 >= y1; }
+};
+auto clip(int x, int y, int width, int height, int max_width, int max_height) -> Clip
+{
+	Clip res{std::max(x, 0), std::max(y, 0), std::min(x + width, max_width), std::min(y + height, max_height), 0, 0};
+	res.src_x = res.x0 - x;
+	res.src_y = res.y0 - y;
+	return res;
+}
+
+// the rectangle goes up packed row after row through a pixel buffer; orphaning it first means a transfer still reading
+// the previous contents never stalls the copy
+void upload_rect(GLuint texture, GLuint &pbo, const unsigned char *data, int width, const Kasumi::Texture::DirtyRect &rect, size_t texel_bytes, GLenum format, GLenum type)
+{
+	auto row_bytes = static_cast<size_t>(rect.x1 - rect.x0) * texel_bytes;
+	auto rows = rect.y1 - rect.y0;
+	auto bytes = row_bytes * rows;
+	if (pbo == 0)
+		glGenBuffers(1, &pbo);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, static_cast<GLsizeiptr>(bytes), nullptr, GL_STREAM_DRAW);
+	auto *dst = static_cast<unsigned char *>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, static_cast<GLsizeiptr>(bytes), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+	const void *pixels = nullptr; // offset 0 into the pixel buffer
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	if (dst != nullptr)
+	{
+		for (int y = 0; y < rows; ++y)
+			std::memcpy(dst + y * row_bytes, data + (static_cast<size_t>(rect.y0 + y) * width + rect.x0) * texel_bytes, row_bytes);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+	} else
+	{
+		// the buffer could not be mapped: straight from client memory, GL steps over the rest of each row
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, width);
+		pixels = data + (static_cast<size_t>(rect.y0) * width + rect.x0) * texel_bytes;
+	}
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x0, rect.y0, rect.x1 - rect.x0, rows, format, type, pixels);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+auto float_format(int channels) -> GLint
+{
+	switch (channels)
+	{
+		case 2:
+			return GL_RG32F;
+		case 3:
+			return GL_RGB32F;
+		case 4:
+			return GL_RGBA32F;
+		default:
+			return GL_R32F;
+	}
+}
+} // namespace
+
+// ==================== Texture ====================
 Kasumi::Texture::Texture(const std::string &path) : _path(path)
 {
 	_width = _height = _nr_channels = 0;
@@ -17,14 +424,63 @@ Kasumi::Texture::Texture(const std::string &path) : _path(path)
 	update(true);
 }
 
-Kasumi::Texture::Texture(unsigned char *data, int width, int height, int channels) : _data(data), _width(width), _height(height), _nr_channels(channels) { update(true); }
+Kasumi::Texture::Texture(unsigned char *data, int width, int height, int channels, bool editable) : _data(data), _width(width), _height(height), _nr_channels(channels), _editable(editable) { update(true); }
+
+Kasumi::Texture::Texture(int width, int height, int channels) : _width(width), _height(height), _nr_channels(channels)
+{
+	_data = static_cast<unsigned char *>(std::calloc(static_cast<size_t>(width) * height * channels, 1)); // stbi_image_free is free()
+	update(true);
+}
 
 Kasumi::Texture::~Texture()
 {
 	glDeleteTextures(1, &ID);
+	if (_pbo != 0)
+		glDeleteBuffers(1, &_pbo);
+	if (_data != nullptr)
+		stbi_image_free(_data);
 	std::cout << "delete texture: " << _path << std::endl;
 }
 
+auto Kasumi::Texture::Load(const std::string &path) -> std::shared_ptr<Texture>
+{
+	auto &slot = _registry[path];
+	auto texture = slot.lock();
+	if (texture != nullptr)
+		return texture;
+
+	texture = std::shared_ptr<Texture>(new Texture());
+	texture->_path = path;
+	texture->_editable = false;
+	slot = texture;
+
+	bool compress_blocks = UseCompression && s3tc_supported(); // GL is only asked here, on the render thread
+	bool mipmaps = UseMipmaps;
+	_pending.emplace_back(texture, std::async(std::launch::async, [path, compress_blocks, mipmaps] { return _decode(path, compress_blocks, mipmaps); }));
+	return texture;
+}
+void Kasumi::Texture::Poll()
+{
+	for (auto it = _pending.begin(); it != _pending.end();)
+	{
+		if (it->second.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+		{
+			++it;
+			continue;
+		}
+		auto decoded = it->second.get();
+		if (auto texture = it->first.lock())
+			texture->_upload(std::move(decoded));
+		it = _pending.erase(it);
+	}
+}
+void Kasumi::Texture::Wait()
+{
+	for (auto &pending: _pending)
+		pending.second.wait();
+	Poll();
+}
+
 void Kasumi::Texture::bind(int texture_idx) const
 {
 	switch (texture_idx)
@@ -50,58 +506,262 @@ void Kasumi::Texture::bind(int texture_idx) const
 		default: // TOO MUCH TEXTURES
 			break;
 	}
-	glBindTexture(GL_TEXTURE_2D, ID);
+	glBindTexture(GL_TEXTURE_2D, ID != 0 ? ID : placeholder());
 }
 void Kasumi::Texture::update(bool init)
 {
 	if (!_data)
 		return;
 
-	auto format = GL_RED;
-	if (_nr_channels == 1)
-		format = GL_RED;
-	else if (_nr_channels == 3)
-		format = GL_RGB;
-	else if (_nr_channels == 4)
-		format = GL_RGBA;
+	auto format = pixel_format(_nr_channels);
 
 	if (init)
 	{
 		glGenTextures(1, &ID);
 		glBindTexture(GL_TEXTURE_2D, ID);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // rgb rows are not 4 byte aligned
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, _width, _height, 0, format, GL_UNSIGNED_BYTE, _data);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, UseMipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glBindTexture(GL_TEXTURE_2D, 0);
+		_mipmapped = UseMipmaps;
 	} else
 	{
-		glBindTexture(GL_TEXTURE_2D, ID);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, _width, _height, format, GL_UNSIGNED_BYTE, _data);
-		glBindTexture(GL_TEXTURE_2D, 0);
+		if (_dirty.empty())
+			_dirty.add(0, 0, _width, _height, _width, _height);
+		upload_rect(ID, _pbo, _data, _width, _dirty, _nr_channels, format, GL_UNSIGNED_BYTE);
+	}
+	_dirty.clear();
+	if (_mipmapped)
+		glGenerateMipmap(GL_TEXTURE_2D);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	// read only textures do not need the pixels once the GPU has them
+	if (!_editable)
+	{
+		stbi_image_free(_data);
+		_data = nullptr;
 	}
 }
-auto Kasumi::Texture::get(int x, int y) const -> mVector4
+void Kasumi::Texture::_upload(Decoded &&decoded)
 {
-	// get pixel color from texture data
-	auto red = (int) _data[(_width * y + x) * _nr_channels];
-	auto green = (int) _data[(_width * y + x) * _nr_channels + 1];
-	auto blue = (int) _data[(_width * y + x) * _nr_channels + 2];
-	auto alpha = (int) _data[(_width * y + x) * _nr_channels + 3];
+	if (decoded.levels.empty())
+	{
+		std::cout << "Failed to load texture: " << _path << std::endl;
+		return;
+	}
+	_width = decoded.width;
+	_height = decoded.height;
+	_nr_channels = decoded.channels;
 
-	return {red, green, blue, alpha};
+	auto levels = static_cast<GLint>(decoded.levels.size());
+	glGenTextures(1, &ID);
+	glBindTexture(GL_TEXTURE_2D, ID);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	if (decoded.format != 0)
+	{
+		for (GLint i = 0; i < levels; ++i)
+			glCompressedTexImage2D(GL_TEXTURE_2D, i, decoded.format, decoded.sizes[i].first, decoded.sizes[i].second, 0, static_cast<GLsizei>(decoded.levels[i].size()), decoded.levels[i].data());
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+	} else
+	{
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, _width, _height, 0, pixel_format(_nr_channels), GL_UNSIGNED_BYTE, decoded.levels[0].data());
+		if (UseMipmaps)
+			glGenerateMipmap(GL_TEXTURE_2D);
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	bool mipmapped = decoded.format != 0 ? levels > 1 : UseMipmaps;
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, mipmapped ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	std::cout << "Load texture: " << _path << (decoded.format != 0 ? " (compressed)" : "") << std::endl;
+}
+auto Kasumi::Texture::get(int x, int y) const -> mVector4
+{
+	real res[4] = {0, 0, 0, 255};
+	auto *p = _data + (static_cast<size_t>(_width) * y + x) * _nr_channels;
+	for (int c = 0; c < std::min(_nr_channels, 4); ++c)
+		res[c] = p[c];
+	return {res[0], res[1], res[2], res[3]};
 }
 void Kasumi::Texture::set(int x, int y, const mVector4 &pixel)
 {
-	// set pixel color to texture data
-	_data[(_width * y + x) * _nr_channels] = (unsigned char) pixel.x();
-	_data[(_width * y + x) * _nr_channels + 1] = (unsigned char) pixel.y();
-	_data[(_width * y + x) * _nr_channels + 2] = (unsigned char) pixel.z();
-	_data[(_width * y + x) * _nr_channels + 3] = (unsigned char) pixel.w();
+	real values[4] = {pixel.x(), pixel.y(), pixel.z(), pixel.w()};
+	auto *p = _data + (static_cast<size_t>(_width) * y + x) * _nr_channels;
+	for (int c = 0; c < std::min(_nr_channels, 4); ++c)
+		p[c] = static_cast<unsigned char>(values[c]);
+	mark_dirty(x, y, 1, 1);
 }
 auto Kasumi::Texture::operator()(int x, int y) -> Eigen::Map<Pixel>
 {
+	mark_dirty(x, y, 1, 1);
 	auto start_ptr = _data + (_width * y + x) * _nr_channels;
 	return Eigen::Map<Pixel>(start_ptr);
 }
+
+// ==================== Bulk Editing ====================
+void Kasumi::Texture::DirtyRect::add(int x, int y, int width, int height, int max_width, int max_height)
+{
+	auto rect = clip(x, y, width, height, max_width, max_height);
+	if (rect.empty())
+		return;
+	if (empty())
+	{
+		x0 = rect.x0, y0 = rect.y0, x1 = rect.x1, y1 = rect.y1;
+		return;
+	}
+	x0 = std::min(x0, rect.x0), y0 = std::min(y0, rect.y0);
+	x1 = std::max(x1, rect.x1), y1 = std::max(y1, rect.y1);
+}
+void Kasumi::Texture::mark_dirty(int x, int y, int width, int height) { _dirty.add(x, y, width, height, _width, _height); }
+auto Kasumi::Texture::row(int y) -> std::span<unsigned char>
+{
+	if (_data == nullptr || y < 0 || y >= _height)
+		return {};
+	mark_dirty(0, y, _width, 1);
+	auto stride = static_cast<size_t>(_width) * _nr_channels;
+	return {_data + stride * y, stride};
+}
+void Kasumi::Texture::fill(int x, int y, int width, int height, const mVector4 &pixel)
+{
+	auto rect = clip(x, y, width, height, _width, _height);
+	if (_data == nullptr || rect.empty())
+		return;
+	real values[4] = {pixel.x(), pixel.y(), pixel.z(), pixel.w()};
+	unsigned char value[4];
+	for (int c = 0; c < 4; ++c)
+		value[c] = static_cast<unsigned char>(std::clamp(values[c], static_cast<real>(0), static_cast<real>(255)));
+	for (int ty = rect.y0; ty < rect.y1; ++ty)
+		fill_row(_nr_channels, _data + (static_cast<size_t>(ty) * _width + rect.x0) * _nr_channels, rect.x1 - rect.x0, value);
+	mark_dirty(rect.x0, rect.y0, rect.x1 - rect.x0, rect.y1 - rect.y0);
+}
+void Kasumi::Texture::blit(int x, int y, int width, int height, const unsigned char *src, int src_channels, size_t src_stride)
+{
+	auto rect = clip(x, y, width, height, _width, _height);
+	if (_data == nullptr || src == nullptr || rect.empty())
+		return;
+	if (src_stride == 0)
+		src_stride = width;
+	auto copy = [](unsigned char v) { return v; };
+	for (int ty = rect.y0; ty < rect.y1; ++ty)
+	{
+		auto *in = src + ((ty - y) * src_stride + rect.src_x) * src_channels;
+		auto *out = _data + (static_cast<size_t>(ty) * _width + rect.x0) * _nr_channels;
+		if (src_channels == _nr_channels)
+			std::memcpy(out, in, static_cast<size_t>(rect.x1 - rect.x0) * _nr_channels);
+		else
+			convert(src_channels, _nr_channels, in, out, rect.x1 - rect.x0, copy, static_cast<unsigned char>(255));
+	}
+	mark_dirty(rect.x0, rect.y0, rect.x1 - rect.x0, rect.y1 - rect.y0);
+}
+void Kasumi::Texture::blit(int x, int y, int width, int height, const float *src, int src_channels, float lower, float upper, size_t src_stride)
+{
+	auto rect = clip(x, y, width, height, _width, _height);
+	if (_data == nullptr || src == nullptr || rect.empty() || upper == lower)
+		return;
+	if (src_stride == 0)
+		src_stride = width;
+	float scale = 255.f / (upper - lower);
+	auto quantize = [lower, scale](float v) { return static_cast<unsigned char>(std::clamp((v - lower) * scale, 0.f, 255.f) + 0.5f); };
+	for (int ty = rect.y0; ty < rect.y1; ++ty)
+	{
+		auto *in = src + ((ty - y) * src_stride + rect.src_x) * src_channels;
+		auto *out = _data + (static_cast<size_t>(ty) * _width + rect.x0) * _nr_channels;
+		convert(src_channels, _nr_channels, in, out, rect.x1 - rect.x0, quantize, static_cast<unsigned char>(255));
+	}
+	mark_dirty(rect.x0, rect.y0, rect.x1 - rect.x0, rect.y1 - rect.y0);
+}
+
+// ==================== FloatTexture ====================
+Kasumi::FloatTexture::FloatTexture(int width, int height, int channels) : _width(width), _height(height), _nr_channels(std::clamp(channels, 1, 4))
+{
+	_data.assign(static_cast<size_t>(_width) * _height * _nr_channels, 0.f);
+	glGenTextures(1, &ID);
+	glBindTexture(GL_TEXTURE_2D, ID);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, float_format(_nr_channels), _width, _height, 0, pixel_format(_nr_channels), GL_FLOAT, _data.data());
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+Kasumi::FloatTexture::~FloatTexture()
+{
+	glDeleteTextures(1, &ID);
+	if (_pbo != 0)
+		glDeleteBuffers(1, &_pbo);
+}
+void Kasumi::FloatTexture::bind(int texture_idx) const
+{
+	if (texture_idx >= 0 && texture_idx <= 5) // as many units as Texture::bind
+		glActiveTexture(GL_TEXTURE0 + texture_idx);
+	glBindTexture(GL_TEXTURE_2D, ID);
+}
+void Kasumi::FloatTexture::update()
+{
+	if (_dirty.empty())
+		_dirty.add(0, 0, _width, _height, _width, _height);
+	upload_rect(ID, _pbo, reinterpret_cast<const unsigned char *>(_data.data()), _width, _dirty, _nr_channels * sizeof(float), pixel_format(_nr_channels), GL_FLOAT);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	_dirty.clear();
+}
+auto Kasumi::FloatTexture::get(int x, int y) const -> mVector4
+{
+	real res[4] = {0, 0, 0, 0};
+	auto *p = &_data[(static_cast<size_t>(_width) * y + x) * _nr_channels];
+	for (int c = 0; c < _nr_channels; ++c)
+		res[c] = p[c];
+	return {res[0], res[1], res[2], res[3]};
+}
+void Kasumi::FloatTexture::set(int x, int y, const mVector4 &value)
+{
+	real values[4] = {value.x(), value.y(), value.z(), value.w()};
+	auto *p = &_data[(static_cast<size_t>(_width) * y + x) * _nr_channels];
+	for (int c = 0; c < _nr_channels; ++c)
+		p[c] = static_cast<float>(values[c]);
+	mark_dirty(x, y, 1, 1);
+}
+void Kasumi::FloatTexture::mark_dirty(int x, int y, int width, int height) { _dirty.add(x, y, width, height, _width, _height); }
+auto Kasumi::FloatTexture::row(int y) -> std::span<float>
+{
+	if (y < 0 || y >= _height)
+		return {};
+	mark_dirty(0, y, _width, 1);
+	auto stride = static_cast<size_t>(_width) * _nr_channels;
+	return {_data.data() + stride * y, stride};
+}
+void Kasumi::FloatTexture::fill(int x, int y, int width, int height, const mVector4 &value)
+{
+	auto rect = clip(x, y, width, height, _width, _height);
+	if (rect.empty())
+		return;
+	float texel[4] = {static_cast<float>(value.x()), static_cast<float>(value.y()), static_cast<float>(value.z()), static_cast<float>(value.w())};
+	for (int ty = rect.y0; ty < rect.y1; ++ty)
+		fill_row(_nr_channels, &_data[(static_cast<size_t>(ty) * _width + rect.x0) * _nr_channels], rect.x1 - rect.x0, texel);
+	mark_dirty(rect.x0, rect.y0, rect.x1 - rect.x0, rect.y1 - rect.y0);
+}
+void Kasumi::FloatTexture::blit(int x, int y, int width, int height, const float *src, int src_channels, size_t src_stride)
+{
+	auto rect = clip(x, y, width, height, _width, _height);
+	if (src == nullptr || rect.empty())
+		return;
+	if (src_stride == 0)
+		src_stride = width;
+	auto copy = [](float v) { return v; };
+	for (int ty = rect.y0; ty < rect.y1; ++ty)
+	{
+		auto *in = src + ((ty - y) * src_stride + rect.src_x) * src_channels;
+		auto *out = &_data[(static_cast<size_t>(ty) * _width + rect.x0) * _nr_channels];
+		if (src_channels == _nr_channels)
+			std::memcpy(out, in, static_cast<size_t>(rect.x1 - rect.x0) * _nr_channels * sizeof(float));
+		else
+			convert(src_channels, _nr_channels, in, out, rect.x1 - rect.x0, copy, 1.f);
+	}
+	mark_dirty(rect.x0, rect.y0, rect.x1 - rect.x0, rect.y1 - rect.y0);
+}
@@ -14,6 +14,8 @@
 #include "pose.h"
 #include "framebuffer.h"
 #include "timer.h"
+#include "culling.h"
+#include "batch.h"
 
 #include "imgui.h"
 #include "implot.h"
@@ -168,19 +170,37 @@ private:
 class Renderable
 {
 public:
-	Renderable() = default;
-	virtual ~Renderable() = default;
+	Renderable() { Culling::Track(this); }
+	Renderable(const Renderable &other) : _shader(other._shader) { Culling::Track(this); }
+	virtual ~Renderable()
+	{
+		Culling::Untrack(this);
+		std::erase(_volume_queue, this);
+	}
 
 	virtual void render() final
 	{
+		if (_culled())
+			return;
 		_update_uniform();
 		_draw();
+		if (_has_volume())
+			_volume_queue.push_back(this);
 	}
 	virtual void render_volume() final
 	{
 		_update_uniform();
 		_draw_volume();
 	}
+	// volumes composite over everything opaque, so render() only queues them. The Platform draws the queue after the
+	// app has rendered, and a Framebuffer before it lets go of its target
+	static void RenderVolumes()
+	{
+		auto queue = std::move(_volume_queue);
+		_volume_queue.clear();
+		for (auto *object: queue)
+			object->render_volume();
+	}
 
 	ShaderPtr _shader = nullptr;
 
@@ -201,6 +221,30 @@ protected:
 	}
 	virtual void _draw() = 0;
 	virtual void _draw_volume() {}
+	virtual auto _has_volume() const -> bool { return false; } // render() queues the object for render_volume()
+
+	// local bounds and model matrix for the culling, objects that don't provide them are always drawn
+	virtual auto _cull_bounds(mBBox3 &local, mMatrix4x4 &model) -> bool { return false; }
+
+private:
+	friend class Culling;
+	auto _culled() -> bool
+	{
+		if (Culling::MainCulling == nullptr || !Culling::MainCulling->enabled())
+			return false;
+		auto &culling = *Culling::MainCulling;
+		if (_cull_frame == culling.frame() && _cull_version == culling.version())
+			return _cull_hidden; // already decided by a Culling::cull() batch this frame
+		mBBox3 local;
+		mMatrix4x4 model;
+		if (!_cull_bounds(local, model))
+			return false;
+		return !culling.visible(local, model);
+	}
+	std::uint64_t _cull_frame = ~0ull;
+	std::uint64_t _cull_version = 0;
+	bool _cull_hidden = false;
+	inline static std::vector<Renderable *> _volume_queue;
 };
 
 class App
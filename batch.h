@@ -0,0 +1,84 @@
+#ifndef BACKENDS_BATCH_H
+#define BACKENDS_BATCH_H
+
+// Copyright (c) 2023 Xayah Hina
+// MPL-2.0 license
+
+#include "mesh.h"
+
+#include <unordered_map>
+
+namespace Kasumi
+{
+// Collects mesh draws during a frame and issues them merged: every (shader, mesh, level of detail) becomes one instanced draw,
+// and with glMultiDrawElementsIndirect (GL 4.3) all untextured meshes of a shader go through one shared vertex/index
+// buffer in a single call. Shaders take part through their Shader::instanced() variant.
+class Batch final : public HinaPE::CopyDisable
+{
+public:
+	static void Init();
+	static std::shared_ptr<Batch> MainBatch;
+
+	auto accepts(const Mesh &mesh, const ShaderPtr &shader) const -> bool; // default render state and an instanced shader variant
+	void submit(const MeshPtr &mesh, const ShaderPtr &shader, const mMatrix4x4 &model, int lod = 0);
+	void flush(); // draws everything submitted so far; the Platform flushes at the end of every frame, Framebuffer around its callback
+
+public:
+	struct Opt
+	{
+		bool enabled = true;
+		bool multi_draw_indirect = true; // used when the driver has it
+	} _opt;
+	struct Stats
+	{
+		size_t objects = 0;
+		size_t draw_calls = 0;
+	};
+	auto stats() const -> const Stats & { return _last_stats; } // of the last finished frame
+	void end_frame(); // flush and roll the stats
+	Batch();
+	~Batch();
+
+private:
+	struct Draw
+	{
+		MeshPtr mesh;
+		ShaderPtr shader; // the instanced variant
+		mMatrix4x4 model;
+		int lod;
+	};
+	struct Run // consecutive draws of one mesh level with one shader
+	{
+		size_t first, count;
+	};
+	struct Slot // where a mesh lives in the shared buffers
+	{
+		std::weak_ptr<const Mesh> mesh; // a new mesh at a freed address must not inherit the slot
+		std::uint64_t generation;
+		int base_vertex;
+		unsigned int first_index;
+		size_t vertex_capacity, index_capacity; // indices of the base list and every level of detail behind it
+	};
+	static auto _may_be_translucent(const Mesh &mesh) -> bool; // flush() reorders draws, so only opaque meshes are accepted
+	void _draw_instanced(const Run &run);
+	void _draw_indirect(const std::vector<Run> &runs, bool colored);
+	void _reserve(const std::vector<Run> &runs); // makes every mesh of the runs current in the shared buffers
+	void _upload(const Mesh &mesh, const Slot &slot);
+
+	std::vector<Draw> _draws;
+	std::vector<float> _matrices;
+	unsigned int _matrix_vbo = 0;
+
+	// shared vertex (position, normal, uv, colour as floats) and index buffers for the indirect path
+	unsigned int _vao = 0, _vbo = 0, _ebo = 0, _indirect = 0;
+	std::unordered_map<const Mesh *, Slot> _slots;
+	size_t _vertex_used = 0, _index_used = 0;
+	size_t _vertex_capacity = 0, _index_capacity = 0;
+	std::vector<float> _staging;
+
+	Stats _stats, _last_stats;
+};
+using BatchPtr = std::shared_ptr<Batch>;
+} // namespace Kasumi
+
+#endif //BACKENDS_BATCH_H
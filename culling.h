@@ -0,0 +1,101 @@
+#ifndef BACKENDS_CULLING_H
+#define BACKENDS_CULLING_H
+
+// Copyright (c) 2023 Xayah Hina
+// MPL-2.0 license
+
+#include "common.h"
+
+namespace Kasumi
+{
+class Renderable;
+class Culling final : public HinaPE::CopyDisable
+{
+public:
+	static void Init();
+	static std::shared_ptr<Culling> MainCulling;
+
+	// frame boundaries, called by the Platform: begin_frame() rolls the stats, end_frame() reads back the depth for the next HiZ pyramid
+	void begin_frame();
+	void end_frame();
+	// the scene is being drawn into the bound framebuffer and viewport, end_frame() reads its depth instead of the window's
+	void capture_depth();
+
+	// every live Renderable, culled in one batch by the Platform before the frame is rendered
+	static void Track(Renderable *object);
+	static void Untrack(Renderable *object);
+	static auto Tracked() -> const std::vector<Renderable *> &;
+
+	// single object: local bounds placed by a model matrix
+	auto visible(const mBBox3 &local, const mMatrix4x4 &model) -> bool;
+	// batch over many objects, results are kept until the next frame and picked up by Renderable::render()
+	void cull(const std::vector<Renderable *> &objects);
+	// batch over the instances of one mesh, writes the indices of the visible instances
+	void cull_instances(const mBBox3 &local, const std::vector<mMatrix4x4> &models, std::vector<unsigned int> &visible);
+
+	// changes whenever a previous culling result may be stale (camera moved, new depth, options changed)
+	auto version() -> std::uint64_t;
+	auto frame() const -> std::uint64_t { return _frame; }
+	auto enabled() const -> bool { return _opt.frustum || _opt.occlusion; }
+
+public:
+	struct Opt
+	{
+		bool frustum = true;
+		bool occlusion = false; // hierarchical-Z against the depth of the previous frames
+		int hiz_size = 256; // width of the finest HiZ level
+	} _opt;
+	struct Stats
+	{
+		size_t objects_tested = 0;
+		size_t objects_frustum_culled = 0;
+		size_t objects_occlusion_culled = 0;
+		size_t instances_tested = 0;
+		size_t instances_culled = 0;
+	};
+	auto stats() const -> const Stats & { return _last_stats; } // of the last finished frame
+	Culling();
+	~Culling();
+
+private:
+	void _update_frustum();
+	void _load(size_t count); // resize the batch arrays
+	void _transform(size_t i, const mBBox3 &local, const mMatrix4x4 &model);
+	void _test(size_t count); // _result[i]: 0 visible, 1 outside the frustum, 2 occluded
+	void _build_hiz(const float *depth, int width, int height);
+	auto _occluded(size_t i) const -> bool;
+
+	std::uint64_t _frame = 0;
+	std::uint64_t _version = 0;
+	std::uint64_t _frustum_frame = ~0ull;
+	Opt _last_opt;
+	Stats _stats, _last_stats;
+
+	// frustum planes (a, b, c, d) of the current view-projection, normals pointing inside
+	Eigen::Matrix<float, 4, 4> _view_projection;
+	float _planes[6][4];
+
+	// SoA batch of world space boxes (center, half extent) and their results
+	std::vector<float> _cx, _cy, _cz, _ex, _ey, _ez;
+	std::vector<unsigned char> _result;
+
+	// HiZ: max depth pyramid of an earlier frame, with the view-projection it was rendered with
+	struct HiZ
+	{
+		std::vector<std::vector<float>> levels;
+		std::vector<std::pair<int, int>> sizes;
+		Eigen::Matrix<float, 4, 4> view_projection;
+		bool valid = false;
+	} _hiz;
+	unsigned int _pbo[2] = {0, 0};
+	Eigen::Matrix<float, 4, 4> _pbo_view_projection[2];
+	int _pbo_size[2][2] = {{0, 0}, {0, 0}};
+	bool _pbo_pending[2] = {false, false};
+	int _pbo_index = 0;
+	int _depth_fbo = -1; // -1: the window, whatever viewport is current at end_frame()
+	int _depth_viewport[4] = {0, 0, 0, 0};
+};
+using CullingPtr = std::shared_ptr<Culling>;
+} // namespace Kasumi
+
+#endif //BACKENDS_CULLING_H
@@ -8,6 +8,8 @@
 #include "shader.h"
 #include "texture.h"
 
+#include <span>
+
 // @formatter:off
 namespace Kasumi
 {
@@ -27,11 +29,84 @@ public:
 	};
 	using Index = unsigned int;
 
+	// which streams the GPU copy of the vertices carries and how they are stored; GPU data is always float,
+	// also under HINAPE_DOUBLE, and is converted from Vertex on upload
+	struct VertexLayout
+	{
+		enum Stream : unsigned int
+		{
+			Position = 1 << 0,
+			Normal = 1 << 1,
+			TexCoord = 1 << 2,
+			Color = 1 << 3,
+			Tangent = 1 << 4, // tangent and bi_tangent
+			ID = 1 << 5,
+			All = Position | Normal | TexCoord | Color | Tangent | ID
+		};
+		unsigned int streams = All;
+		bool packed = true; // 2_10_10_10 normals and tangents, half uvs, RGBA8 colours
+		bool split_position = true; // positions in their own buffer, so position-only passes fetch 12 bytes per vertex
+
+		inline auto has(Stream stream) const -> bool { return (streams & stream) != 0; }
+	};
+
 	void render(const Shader &shader);
 	void centralize(); // move local model to the center of gravity
 	auto voxelize() -> HinaPE::Geom::DataGrid3<int>; // voxelize the mesh
-	inline auto vertices() -> std::vector<Vertex> & { _opt.dirty = true; return _verts; }
+	inline auto vertices() -> std::vector<Vertex> & { _opt.dirty = _bounds_dirty = _eigen_dirty = true; ++_generation; return _verts; } // edit everything (re-uploads all vertices)
+	inline auto vertices() const -> const std::vector<Vertex> & { return _verts; } // read only, uploads nothing
+	inline auto vertex_count() const -> size_t { return _verts.size(); }
 	inline auto indices() const -> const std::vector<Index> & { return _idxs; }
+	auto edit_vertices(size_t begin, size_t end) -> std::span<Vertex>; // edit [begin, end), only that range is re-uploaded
+	void set_indices(std::vector<Index> &&indices); // topology change, the only path that re-sends the index buffer
+	auto bbox() -> const mBBox3 &; // computed on demand
+	auto center_point() -> const mVector3 &; // computed on demand
+	void set_layout(const VertexLayout &layout);
+	inline auto layout() const -> const VertexLayout & { return _layout; }
+	inline auto generation() const -> std::uint64_t { return _generation; } // bumped by every vertex or index edit
+	auto clone() const -> std::shared_ptr<Mesh>; // private copy, for an object that wants to edit a shared mesh
+
+	// primitives shared by name and colour (or texture): many objects of one primitive load and upload it once.
+	// Shared meshes must not be edited in place, clone() them first
+	static auto Shared(const std::string &primitive_name, const mVector3 &color) -> std::shared_ptr<Mesh>;
+	static auto Shared(const std::string &primitive_name, const std::string &texture_name) -> std::shared_ptr<Mesh>;
+	inline auto shared() const -> bool { return _shared; } // handed out by Shared(), even while only one object holds it
+
+	// levels of detail: quadric simplified index lists over the same vertices, each about half the triangles of the
+	// one before, level 0 being the mesh itself. Vertex edits keep them, set_indices() drops them
+	struct Lod
+	{
+		std::vector<Index> indices;
+		real error; // object space distance the level may stray from the full mesh
+	};
+	static auto BuildLods(const std::vector<Vertex> &vertices, const std::vector<Index> &indices, size_t min_triangles = 64) -> std::vector<Lod>; // no GL, fine on worker threads
+	void build_lods();
+	void set_lods(std::vector<Lod> &&lods);
+	inline auto lods() const -> const std::vector<Lod> & { return _lods; }
+	inline auto lod_count() const -> int { return 1 + static_cast<int>(_lods.size()); }
+	auto select_lod(const mMatrix4x4 &model, int current = -1) -> int; // from the projected bounding sphere; pass the level in use for hysteresis
+
+	static bool UseLod;
+	static real LodPixelError; // the coarsest level whose error projects under this many pixels is drawn
+	static real LodHysteresis; // switching to a coarser level needs the error this fraction under the threshold
+	static size_t AutoLodTriangles; // primitives with more triangles build their levels on load, 0 turns it off
+
+	// import time optimisation: welds identical vertices, orders triangles for the post-transform cache (Tipsify) and
+	// vertices by first use for fetch locality; with overdraw the cache clusters are also drawn outside-in
+	struct CacheStats
+	{
+		real acmr = 0; // transformed vertices per triangle: 0.5 at best on closed meshes, 3 at worst
+		real atvr = 0; // transformed vertices per referenced vertex: 1 at best
+	};
+	static auto Optimize(std::vector<Vertex> &vertices, std::vector<Index> &indices, bool overdraw = false) -> std::pair<CacheStats, CacheStats>; // before, after
+	static void OptimizeVertexCache(std::vector<Index> &indices, size_t vertex_count); // triangle order only, for lists sharing a vertex buffer
+	static auto MeasureCache(const std::vector<Index> &indices, size_t vertex_count) -> CacheStats;
+
+	// opt-in: primitives and models are welded, reordered and trimmed as they load, so vertices()[i], Vertex::id and
+	// the vertex count no longer follow the file
+	static bool OptimizeOnLoad;
+	static bool OptimizeOverdraw;
+	static int VertexCacheSize; // FIFO entries the triangle order and the stats assume
 
 public:
 	struct Opt
@@ -41,6 +116,7 @@ public:
 		bool textured = false;
 		bool instanced = false;
 		int instance_count;
+		int lod = 0; // level drawn by render()
 
 		// rendering options
 		bool render_surface = true;
@@ -62,13 +138,32 @@ public:
 private:
 	void _init(std::vector<Vertex> &&vertices, std::vector<Index> &&indices);
 	void _load_primitive(const std::string &primitive_name, std::vector<Kasumi::Mesh::Vertex> &vertices, std::vector<unsigned int> &indices, const mVector3 &color = HinaPE::Color::NO_COLORS);
+	void _setup_layout();
 	void _update();
+	void _upload(size_t begin, size_t end);
+	void _update_bounds();
+	auto _lod_range(int level) const -> std::pair<size_t, size_t>; // first index and count of a level in the index buffer
+	auto _index_total() const -> size_t; // the base list followed by every level, as laid out in the index buffer
 
 private:
 	friend class InstancedMesh;
+	friend class Batch;
+	static std::map<std::string, std::weak_ptr<Mesh>> _registry;
+	bool _shared = false;
+	std::uint64_t _generation = 0;
 	unsigned int _vao, _vbo, _ebo;
+	unsigned int _attr_vbo = 0; // every stream but the position when it is split
+	VertexLayout _layout;
+	std::vector<unsigned char> _staging; // converted vertices on their way to the GPU
 	std::vector<Vertex> _verts;
 	std::vector<Index> _idxs;
+	std::vector<Lod> _lods;
+
+	// upload state: _opt.dirty re-sends every vertex, otherwise only the edited spans go through glBufferSubData
+	std::vector<std::pair<size_t, size_t>> _dirty_spans;
+	size_t _vbo_size = 0; // vertices allocated on the GPU
+	bool _indices_dirty = true;
+	bool _bounds_dirty = true;
 	std::map<std::string, std::vector<TexturePtr>> _textures;
 
 	// geometry
@@ -82,10 +177,17 @@ private:
 	friend class ObjectMesh3D;
 	friend class ObjectParticles3D;
 	friend class BunnyObject;
+	// copies for libigl, built on first use and kept in sync through the same dirty spans as the GPU upload
+	auto _eigen_vertices3() -> const Eigen::Matrix<real, Eigen::Dynamic, 3> &;
+	auto _eigen_vertices4() -> const Eigen::Matrix<real, Eigen::Dynamic, 4> &;
+	auto _eigen_indices() -> const Eigen::Matrix<int, Eigen::Dynamic, Eigen::Dynamic> &;
+	void _sync_eigen();
 	Eigen::Matrix<real, Eigen::Dynamic, 3> _verts_eigen3;
 	Eigen::Matrix<real, Eigen::Dynamic, 4> _verts_eigen4;
 	Eigen::Matrix<int, Eigen::Dynamic, Eigen::Dynamic> _idxs_eigen;
 #endif
+	std::vector<std::pair<size_t, size_t>> _eigen_spans;
+	bool _eigen_dirty = true;
 };
 using MeshPtr = std::shared_ptr<Mesh>;
 
@@ -93,6 +195,8 @@ class InstancedMesh final : public HinaPE::CopyDisable
 {
 public:
 	void render(const Shader &shader);
+	void prepare(); // cull and upload the instances, render() does it too
+	auto visible_index(int instance) const -> int; // index among the uploaded (visible) instances, -1 if culled
 
 public:
 	struct Opt
@@ -109,9 +213,28 @@ public:
 private:
 	friend class ObjectParticles3D;
 	void _update();
+	void _bind_instances(size_t first); // points the instance attributes at the first uploaded instance of a draw
 	MeshPtr _mesh;
 	unsigned int _instanceVBO;
 	unsigned int _colorVBO;
+
+	// per instance culling: only the visible instances are compacted and uploaded
+	std::vector<unsigned int> _visible;
+	std::vector<int> _visible_index;
+	std::vector<mMatrix4x4> _visible_matrices;
+	std::vector<mVector4> _visible_colors;
+	bool _compacted = false;
+	std::uint64_t _cull_version = ~0ull;
+
+	// per instance level of detail: the uploaded instances are grouped by level, one draw per level
+	struct LodRun
+	{
+		int level;
+		size_t first, count;
+	};
+	std::vector<int> _instance_lod; // level in use per instance, for the hysteresis
+	std::vector<LodRun> _lod_runs;
+	std::vector<unsigned int> _order;
 };
 using InstancedMeshPtr = std::shared_ptr<InstancedMesh>;
 
@@ -227,6 +350,77 @@ private:
 	unsigned int _instanceVBO;
 };
 using InstancedPointsPtr = std::shared_ptr<InstancedPoints>;
+
+// spheres drawn as one point sprite each and ray-cast per fragment, with exact silhouettes and depth; a sprite is
+// clipped with its center and capped at the driver's largest point size, so spheres leaving the screen edge or
+// filling most of it are better drawn as meshes
+class SphereImpostors final : public HinaPE::CopyDisable
+{
+public:
+	void render(const Shader &shader); // with Shader::DefaultImpostorShader or a compatible one
+
+public:
+	struct Opt
+	{
+		bool dirty = true;
+		std::vector<mVector4> spheres; // center, radius
+		std::vector<mVector4> colors;
+		real lod_pixels = 1.5; // spheres with a smaller screen radius are drawn as flat dots
+	} _opt;
+	SphereImpostors();
+	~SphereImpostors();
+
+private:
+	void _update();
+	unsigned int _vao, _sphere_vbo, _color_vbo;
+	float _max_point_size = 64;
+};
+using SphereImpostorsPtr = std::shared_ptr<SphereImpostors>;
+
+// a scalar field kept as a single channel float 3D texture and raymarched through its bounding box. Values are written
+// slab by slab (one z slice each) and only the slabs marked dirty go up; the box's back faces are drawn without the
+// depth test, so the ray starts at the camera when it is inside, and each ray ends at a copy of the scene depth
+class Volume final : public HinaPE::CopyDisable
+{
+public:
+	enum class Mode : int
+	{
+		Density = 0, // emission-absorption in opt.color
+		ColorMap = 1, // the same, coloured by value from blue to red
+		Isosurface = 2 // opaque lit surface where the value crosses opt.iso, with depth
+	};
+
+	void resize(int x, int y, int z); // clears the field
+	auto slab(int z) -> std::span<float>; // x * y values, x fastest; marks the slab dirty
+	void mark_dirty(int z_begin, int z_end);
+	void render(const Shader &shader); // with Shader::DefaultVolumeShader or a compatible one, after every opaque object
+
+public:
+	struct Opt
+	{
+		Mode mode = Mode::Density;
+		mVector3 origin = mVector3::Zero(); // lower corner of the box in world space
+		mVector3 extent = mVector3::One();
+		real lower = 0, upper = 1; // values mapped to 0..1 before the transfer function
+		real density = 10; // extinction per unit length at the upper value
+		real iso = 0.5; // in the mapped 0..1 range
+		mVector3 color = HinaPE::Color::WHITE;
+		int max_steps = 512;
+	} _opt;
+	Volume();
+	~Volume();
+	int _x = 0, _y = 0, _z = 0;
+	std::vector<float> _data;
+
+private:
+	void _update();
+	unsigned int _vao, _vbo, _texture, _pbo;
+	unsigned int _depth; // copy of the target's depth, resized with the viewport
+	int _depth_width = 0, _depth_height = 0;
+	int _dirty_begin = 0, _dirty_end = 0; // slabs
+	bool _resized = false;
+};
+using VolumePtr = std::shared_ptr<Volume>;
 } // namespace Kasumi
 // @formatter:on
 
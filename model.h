@@ -16,18 +16,47 @@ public:
 	void render(const Shader &shader); // render with custom shader
 	explicit Model(const std::string &path, real scale = 1);
 	~Model();
+	inline auto draw_time() const -> float { return _draw_time; } // GPU milliseconds of a recent render(), from a timer query
+
+public:
+	// imported meshes are kept as a binary blob (vertices, indices, levels of detail, texture paths), keyed by file path, size and write time;
+	// an empty dir means the system temp dir
+	static bool UseMeshCache;
+	static std::string MeshCacheDir;
 
 private:
+	struct MeshData // CPU side of one mesh, built on worker threads and read from / written to the cache
+	{
+		std::vector<Mesh::Vertex> vertices;
+		std::vector<Mesh::Index> indices;
+		std::map<std::string, std::vector<std::string>> textures; // slot -> texture paths, '*' + assimp name for embedded ones
+		std::vector<Mesh::Lod> lods; // simplified on the worker too, so a cached model loads with its levels
+		Mesh::CacheStats cache_before, cache_after; // of the import optimisation, only reported, not cached
+	};
 	auto _load(const std::string &path) -> bool;
-	void _process_node(const aiNode *node, const aiScene *scene);
-	auto _process_mesh(const aiMesh *mesh, const aiScene *scene) -> MeshPtr;
+	void _build(std::vector<MeshData> &&meshes, const aiScene *scene);
+	void _collect_node(const aiNode *node, const aiScene *scene, std::vector<const aiMesh *> &meshes) const;
+	auto _process_mesh(const aiMesh *mesh, const aiScene *scene) const -> MeshData;
+	auto _cache_file() const -> std::string;
+	auto _read_cache(std::vector<MeshData> &meshes) const -> bool;
+	void _write_cache(const std::vector<MeshData> &meshes) const;
+	void _render_meshes(const Shader &shader, bool cull);
+	void _begin_timer();
+	void _end_timer();
 
 private:
 	std::vector<MeshPtr> _meshes;
+	std::vector<int> _lods; // level of detail drawn last frame, per mesh
 	std::shared_ptr<Lines> _bbox_lines;
 	mBBox3 _bbox;
 	std::string _path;
 	real _scale;
+
+	// GL_TIME_ELAPSED queries, two in flight so reading one never waits on the frame being drawn
+	unsigned int _queries[2] = {0, 0};
+	bool _query_pending[2] = {false, false};
+	int _query_index = 0;
+	float _draw_time = 0;
 };
 using ModelPtr = std::shared_ptr<Model>;
 } // namespace Kasumi
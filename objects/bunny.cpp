@@ -7,13 +7,14 @@ Kasumi::BunnyObject::BunnyObject()
 	NAME = "Bunny";
 	_shader = Shader::DefaultMeshShader;
 	_init("bunny", "");
+	_own_mesh();
 	_mesh->centralize();
 	load_surface(this);
 
 	std::vector<mVector3> vertices;
 	std::vector<unsigned int> indices;
 
-	for (auto &v: _mesh->vertices())
+	for (auto &v: std::as_const(*_mesh).vertices())
 		vertices.push_back(v.position);
 	for (auto &i: _mesh->indices())
 		indices.push_back(i);
@@ -25,8 +26,8 @@ Kasumi::BunnyObject::BunnyObject()
 auto Kasumi::BunnyObject::generate_surface() const -> std::vector<mVector3>
 {
 	// igl impl
-	auto V = _mesh->_verts_eigen3;
-	auto F = _mesh->_idxs_eigen;
+	const auto &V = _mesh->_eigen_vertices3();
+	const auto &F = _mesh->_eigen_indices();
 
 	Eigen::MatrixXd P;
 	{
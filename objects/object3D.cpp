@@ -1,6 +1,8 @@
 #include "object3D.h"
 #include "igl/ray_mesh_intersect.h"
 
+#include <limits>
+
 unsigned int Kasumi::IDBase::ID_GLOBAL = 0;
 std::shared_ptr<Kasumi::ObjectLines3D> Kasumi::ObjectLines3D::DefaultLines = nullptr;
 std::shared_ptr<Kasumi::ObjectPoints3D> Kasumi::ObjectPoints3D::DefaultPoints = nullptr;
@@ -9,8 +11,8 @@ std::shared_ptr<Kasumi::ObjectPoints3D> Kasumi::ObjectPoints3D::DefaultPoints =
 auto Kasumi::ObjectMesh3D::ray_cast(const mRay3 &ray) const -> HinaPE::Geom::SurfaceRayIntersection3
 {
 	HinaPE::Geom::SurfaceRayIntersection3 res;
-	const auto &verts_local = _mesh->_verts_eigen4;
-	const auto &idxs = _mesh->_idxs_eigen;
+	const auto &verts_local = _mesh->_eigen_vertices4();
+	const auto &idxs = _mesh->_eigen_indices();
 	auto model = POSE.get_model_matrix()._m;
 	auto t = (model * verts_local.transpose());
 	Eigen::MatrixXd verts_world = t.transpose();
@@ -30,6 +32,7 @@ auto Kasumi::ObjectMesh3D::ray_cast(const mRay3 &ray) const -> HinaPE::Geom::Sur
 }
 void Kasumi::ObjectMesh3D::set_color(const mVector3 &color)
 {
+	_own_mesh();
 	for (auto &v: _mesh->vertices())
 		v.color = color;
 	_mesh->_opt.dirty = true;
@@ -38,15 +41,39 @@ void Kasumi::ObjectMesh3D::_draw()
 {
 	if (_mesh == nullptr) return;
 	_update_surface();
-	_mesh->render(*_shader);
+	auto model = POSE.get_model_matrix();
+	_lod = _mesh->select_lod(model, _lod); // a shared mesh has no level of its own, each object keeps the one it draws
+	if (_batched())
+		Batch::MainBatch->submit(_mesh, _shader, model, _lod);
+	else
+	{
+		_mesh->_opt.lod = _lod;
+		_mesh->render(*_shader);
+		_mesh->_opt.lod = 0;
+	}
 }
 void Kasumi::ObjectMesh3D::_update_uniform()
 {
+	if (_batched())
+		return; // the batch sets the camera and light once per shader
 	Renderable::_update_uniform();
 	_shader->uniform("model", POSE.get_model_matrix());
 	Shader::DefaultLineShader->uniform("model", POSE.get_model_matrix());
 }
-void Kasumi::ObjectMesh3D::_init(const std::string &MESH, const std::string &TEXTURE, const mVector3 &COLOR) { _mesh = TEXTURE.empty() ? std::make_shared<Mesh>(MESH, COLOR) : _mesh = std::make_shared<Mesh>(MESH, TEXTURE); }
+auto Kasumi::ObjectMesh3D::_cull_bounds(mBBox3 &local, mMatrix4x4 &model) -> bool
+{
+	if (_mesh == nullptr) return false;
+	local = _mesh->bbox();
+	model = POSE.get_model_matrix();
+	return true;
+}
+auto Kasumi::ObjectMesh3D::_batched() const -> bool { return _mesh != nullptr && Batch::MainBatch != nullptr && Batch::MainBatch->accepts(*_mesh, _shader); }
+void Kasumi::ObjectMesh3D::_own_mesh()
+{
+	if (_mesh != nullptr && (_mesh.use_count() > 1 || _mesh->shared())) // a later Shared() would hand out the sole copy too
+		_mesh = _mesh->clone();
+}
+void Kasumi::ObjectMesh3D::_init(const std::string &MESH, const std::string &TEXTURE, const mVector3 &COLOR) { _mesh = TEXTURE.empty() ? Mesh::Shared(MESH, COLOR) : Mesh::Shared(MESH, TEXTURE); }
 void Kasumi::ObjectMesh3D::_init(std::vector<Mesh::Vertex> &&vertices, std::vector<Mesh::Index> &&indices, std::map<std::string, std::vector<TexturePtr>> &&textures) { _mesh = std::make_shared<Mesh>(std::move(vertices), std::move(indices), std::move(textures)); }
 void Kasumi::ObjectMesh3D::INSPECT()
 {
@@ -55,8 +82,10 @@ void Kasumi::ObjectMesh3D::INSPECT()
 	if (_mesh == nullptr)
 		return;
 
-	ImGui::TextColored(ImVec4(1, 1, 0, 1), "Mesh Vertices: %zu", _mesh->vertices().size());
+	ImGui::TextColored(ImVec4(1, 1, 0, 1), "Mesh Vertices: %zu", _mesh->vertex_count());
 	ImGui::TextColored(ImVec4(1, 1, 0, 1), "Mesh Indices: %zu", _mesh->indices().size());
+	if (_mesh->lod_count() > 1)
+		ImGui::TextColored(ImVec4(1, 1, 0, 1), "Mesh LOD: %d / %d", std::max(_lod, 0), _mesh->lod_count() - 1);
 }
 void Kasumi::ObjectMesh3D::VALID_CHECK() const
 {
@@ -219,8 +248,35 @@ auto Kasumi::ObjectParticles3D::ray_cast(const mRay3 &ray) const -> HinaPE::Geom
 	HinaPE::Geom::SurfaceRayIntersection3 res;
 	if (_hidden)
 		return res;
-	const auto &verts_local = _mesh->_mesh->_verts_eigen4;
-	const auto &idxs = _mesh->_mesh->_idxs_eigen;
+	if (_impostors != nullptr)
+	{
+		// the impostors are exact spheres, so are their hits
+		for (size_t i = 0; i < POSES.size(); ++i)
+		{
+			auto &pose = POSES[i];
+			real radius = std::max(std::max(pose.scale.x(), pose.scale.y()), pose.scale.z());
+			mVector3 oc = ray._origin - pose.position;
+			real b = oc.dot(ray._direction);
+			real h = b * b - oc.dot(oc) + radius * radius;
+			if (h < 0)
+				continue;
+			real t = -b - std::sqrt(h);
+			if (t < 0)
+				continue;
+			auto distance = (t * ray._direction).length();
+			if (distance < res.distance)
+			{
+				res.is_intersecting = true;
+				res.distance = distance;
+				res.point = ray._origin + t * ray._direction;
+				res.ID = this->ID;
+				res.particleID = i;
+			}
+		}
+		return res;
+	}
+	const auto &verts_local = _mesh->_mesh->_eigen_vertices4();
+	const auto &idxs = _mesh->_mesh->_eigen_indices();
 
 	for (size_t i = 0; i < POSES.size(); ++i)
 	{
@@ -255,6 +311,22 @@ void Kasumi::ObjectParticles3D::track_colormap(std::vector<mVector3> *color_map)
 	_random_color = false;
 }
 void Kasumi::ObjectParticles3D::hide(bool value) { _hidden = value; }
+void Kasumi::ObjectParticles3D::use_impostors(bool value)
+{
+	if (value == (_impostors != nullptr))
+		return;
+	if (value)
+	{
+		_impostors = std::make_shared<SphereImpostors>();
+		_mesh_shader = _shader;
+		_shader = Shader::DefaultImpostorShader;
+	} else
+	{
+		_impostors = nullptr;
+		_shader = _mesh_shader;
+	}
+	_poses_dirty = true;
+}
 void Kasumi::ObjectParticles3D::_init(const std::string &MESH, const std::string &TEXTURE, const mVector3 &COLOR)
 {
 	_mesh = TEXTURE.empty() ? std::make_shared<InstancedMesh>(std::make_shared<Mesh>(MESH, COLOR)) : std::make_shared<InstancedMesh>(std::make_shared<Mesh>(MESH, TEXTURE));
@@ -264,11 +336,40 @@ void Kasumi::ObjectParticles3D::_draw()
 	if (_hidden) return;
 	if (_mesh == nullptr) return;
 	if (_poses_dirty) _update();
+	if (_impostors != nullptr)
+	{
+		_shader->uniform("inst_id", _inst_id);
+		_shader->uniform("is_random_color", _random_color);
+		_impostors->render(*_shader);
+		return;
+	}
+	_mesh->prepare(); // culled instances are compacted away, so the selection follows its instance
+	_shader->uniform("inst_id", _mesh->visible_index(_inst_id));
 	_shader->uniform("is_random_color", _random_color);
 	_mesh->render(*_shader);
 }
 void Kasumi::ObjectParticles3D::_update()
 {
+	if (_impostors != nullptr)
+	{
+		auto &opt = _impostors->_opt;
+		opt.spheres.clear();
+		opt.spheres.reserve(POSES.size());
+		for (auto &pose: POSES)
+			opt.spheres.emplace_back(pose.position.x(), pose.position.y(), pose.position.z(), std::max(std::max(pose.scale.x(), pose.scale.y()), pose.scale.z()));
+
+		if (_color_map != nullptr)
+		{
+			opt.colors.clear();
+			opt.colors.reserve(_color_map->size());
+			for (auto &color: *_color_map)
+				opt.colors.emplace_back(color.x(), color.y(), color.z(), 1);
+		}
+
+		opt.dirty = true;
+		return;
+	}
+
 	_mesh->_opt.instance_matrices.clear();
 	_mesh->_opt.instance_matrices.reserve(POSES.size());
 
@@ -288,141 +389,178 @@ void Kasumi::ObjectParticles3D::_update()
 void Kasumi::ObjectParticles3D::_update_uniform()
 {
 	Renderable::_update_uniform();
-
-	_shader->uniform("inst_id", _inst_id);
 }
 
 // ==================== ObjectGrid3D ====================
+namespace
+{
+auto grid_scalar(real value) -> float { return static_cast<float>(value); }
+auto grid_scalar(int value) -> float { return static_cast<float>(value); }
+auto grid_scalar(const mVector3 &value) -> float { return static_cast<float>(value.length()); }
+
+// cell (i, j, k) fills the box from origin + spacing * (i, j, k) to origin + spacing * (i + 1, j + 1, k + 1), the same
+// box the wire mode draws; only the z slabs whose values changed are marked for upload
+template<typename T>
+void copy_to_volume(HinaPE::Geom::DataGrid3<T> &grid, Kasumi::Volume &volume, bool auto_range)
+{
+	const int nx = static_cast<int>(grid.resolution.x), ny = static_cast<int>(grid.resolution.y), nz = static_cast<int>(grid.resolution.z);
+	if (volume._x != nx || volume._y != ny || volume._z != nz)
+		volume.resize(nx, ny, nz);
+	volume._opt.origin = grid.origin;
+	volume._opt.extent = grid.spacing * mVector3(nx, ny, nz);
+
+	auto &data = grid.data_center;
+	auto lower = std::numeric_limits<float>::max(), upper = std::numeric_limits<float>::lowest();
+	auto size = static_cast<size_t>(nx) * ny;
+	for (int k = 0; k < nz; ++k)
+	{
+		auto *slab = volume._data.data() + size * k;
+		bool changed = false;
+		for (int j = 0; j < ny; ++j)
+			for (int i = 0; i < nx; ++i)
+			{
+				auto value = grid_scalar(data(i, j, k));
+				auto &cell = slab[i + static_cast<size_t>(j) * nx];
+				changed |= cell != value;
+				cell = value;
+				lower = std::min(lower, value);
+				upper = std::max(upper, value);
+			}
+		if (changed)
+			volume.mark_dirty(k, k + 1);
+	}
+	if (auto_range && lower <= upper)
+	{
+		volume._opt.lower = lower;
+		volume._opt.upper = upper;
+	}
+}
+
+template<typename T>
+void collect_boxes(HinaPE::Geom::DataGrid3<T> &grid, const std::vector<mVector3> *color_map, Kasumi::InstancedLines &boxes)
+{
+	const auto nx = grid.resolution.x, ny = grid.resolution.y;
+	auto &matrices = boxes._opt.instance_matrices;
+	auto &colors = boxes._opt.colors;
+	matrices.clear();
+	colors.clear();
+
+	Kasumi::Pose pose;
+	pose.scale = grid.spacing;
+	auto &data = grid.data_center;
+	data.for_each_index(
+			[&](int i, int j, int k)
+			{
+				auto value = grid_scalar(data(i, j, k));
+				if (value == 0)
+					return;
+
+				pose.position = grid.origin + grid.spacing * mVector3(i, j, k);
+				matrices.push_back(pose.get_model_matrix());
+
+				mVector3 color = color_map != nullptr ? (*color_map)[i + j * nx + k * nx * ny] : static_cast<real>(value) * HinaPE::Color::WHITE;
+				colors.emplace_back(color.x(), color.y(), color.z(), 1);
+			});
+	boxes._opt.dirty = true;
+}
+} // namespace
+
 Kasumi::ObjectGrid3D::ObjectGrid3D()
 {
 	NAME = "Grid";
-	_shader = Shader::DefaultInstanceLineShader;
-	_scalar_grid = nullptr;
-	_vector_grid = nullptr;
+	_shader = Shader::DefaultVolumeShader;
 }
 void Kasumi::ObjectGrid3D::track(HinaPE::Geom::DataGrid3<real> *scalar_grid)
 {
 	_scalar_grid = scalar_grid;
-	_color_map = new std::vector<mVector3>();
-	_color_map->resize(_scalar_grid->resolution.x * _scalar_grid->resolution.y * _scalar_grid->resolution.z, HinaPE::Color::WHITE);
 	_init();
 }
 void Kasumi::ObjectGrid3D::track(HinaPE::Geom::DataGrid3<int> *int_grid)
 {
 	_int_grid = int_grid;
-	_color_map = new std::vector<mVector3>();
-	_color_map->resize(_int_grid->resolution.x * _int_grid->resolution.y * _int_grid->resolution.z, HinaPE::Color::WHITE);
 	_init();
 }
 void Kasumi::ObjectGrid3D::track(HinaPE::Geom::DataGrid3<mVector3> *vector_grid)
 {
 	_vector_grid = vector_grid;
-	_color_map = new std::vector<mVector3>();
-	_color_map->resize(_scalar_grid->resolution.x * _scalar_grid->resolution.y * _scalar_grid->resolution.z, HinaPE::Color::WHITE);
 	_init();
 }
 void Kasumi::ObjectGrid3D::track_colormap(std::vector<mVector3> *color_map)
 {
 	_color_map = color_map;
 }
+void Kasumi::ObjectGrid3D::use_boxes(bool value)
+{
+	if (value == (_boxes != nullptr))
+		return;
+	if (value)
+	{
+		std::shared_ptr<Lines> _bbox_lines = std::make_shared<Lines>();
+		_bbox_lines->clear();
+		auto l = mVector3::Zero();
+		auto u = mVector3::One();
+
+		mVector3 color = HinaPE::Color::PURPLE;
+
+		// bounding box lines
+		_bbox_lines->add(mVector3(l.x(), l.y(), l.z()), mVector3(u.x(), l.y(), l.z()), color);
+		_bbox_lines->add(mVector3(u.x(), l.y(), l.z()), mVector3(u.x(), u.y(), l.z()), color);
+		_bbox_lines->add(mVector3(u.x(), u.y(), l.z()), mVector3(l.x(), u.y(), l.z()), color);
+		_bbox_lines->add(mVector3(l.x(), u.y(), l.z()), mVector3(l.x(), l.y(), l.z()), color);
+
+		_bbox_lines->add(mVector3(l.x(), l.y(), u.z()), mVector3(u.x(), l.y(), u.z()), color);
+		_bbox_lines->add(mVector3(u.x(), l.y(), u.z()), mVector3(u.x(), u.y(), u.z()), color);
+		_bbox_lines->add(mVector3(u.x(), u.y(), u.z()), mVector3(l.x(), u.y(), u.z()), color);
+		_bbox_lines->add(mVector3(l.x(), u.y(), u.z()), mVector3(l.x(), l.y(), u.z()), color);
+
+		_bbox_lines->add(mVector3(l.x(), l.y(), l.z()), mVector3(l.x(), l.y(), u.z()), color);
+		_bbox_lines->add(mVector3(u.x(), l.y(), l.z()), mVector3(u.x(), l.y(), u.z()), color);
+		_bbox_lines->add(mVector3(u.x(), u.y(), l.z()), mVector3(u.x(), u.y(), u.z()), color);
+		_bbox_lines->add(mVector3(l.x(), u.y(), l.z()), mVector3(l.x(), u.y(), u.z()), color);
+
+		_boxes = std::make_shared<InstancedLines>(_bbox_lines);
+		_shader = Shader::DefaultInstanceLineShader;
+	} else
+	{
+		_boxes = nullptr;
+		_shader = Shader::DefaultVolumeShader;
+	}
+	UPDATE();
+}
 void Kasumi::ObjectGrid3D::_init()
 {
-	std::shared_ptr<Lines> _bbox_lines = std::make_shared<Lines>();
-	_bbox_lines->clear();
-	auto l = mVector3::Zero();
-	auto u = mVector3::One();
-
-	mVector3 color = HinaPE::Color::PURPLE;
-
-	// bounding box lines
-	_bbox_lines->add(mVector3(l.x(), l.y(), l.z()), mVector3(u.x(), l.y(), l.z()), color);
-	_bbox_lines->add(mVector3(u.x(), l.y(), l.z()), mVector3(u.x(), u.y(), l.z()), color);
-	_bbox_lines->add(mVector3(u.x(), u.y(), l.z()), mVector3(l.x(), u.y(), l.z()), color);
-	_bbox_lines->add(mVector3(l.x(), u.y(), l.z()), mVector3(l.x(), l.y(), l.z()), color);
-
-	_bbox_lines->add(mVector3(l.x(), l.y(), u.z()), mVector3(u.x(), l.y(), u.z()), color);
-	_bbox_lines->add(mVector3(u.x(), l.y(), u.z()), mVector3(u.x(), u.y(), u.z()), color);
-	_bbox_lines->add(mVector3(u.x(), u.y(), u.z()), mVector3(l.x(), u.y(), u.z()), color);
-	_bbox_lines->add(mVector3(l.x(), u.y(), u.z()), mVector3(l.x(), l.y(), u.z()), color);
-
-	_bbox_lines->add(mVector3(l.x(), l.y(), l.z()), mVector3(l.x(), l.y(), u.z()), color);
-	_bbox_lines->add(mVector3(u.x(), l.y(), l.z()), mVector3(u.x(), l.y(), u.z()), color);
-	_bbox_lines->add(mVector3(u.x(), u.y(), l.z()), mVector3(u.x(), u.y(), u.z()), color);
-	_bbox_lines->add(mVector3(l.x(), u.y(), l.z()), mVector3(l.x(), u.y(), u.z()), color);
-
-	_boxes = std::make_shared<InstancedLines>(_bbox_lines);
-
+	if (_volume == nullptr)
+		_volume = std::make_shared<Volume>();
 	UPDATE();
 }
 void Kasumi::ObjectGrid3D::_draw()
 {
-	if (_boxes == nullptr) return;
-	_boxes->render(*_shader);
+	if (_boxes != nullptr)
+		_boxes->render(*_shader);
+}
+void Kasumi::ObjectGrid3D::_draw_volume()
+{
+	if (_boxes == nullptr && _volume != nullptr)
+		_volume->render(*_shader);
 }
 void Kasumi::ObjectGrid3D::UPDATE()
 {
-	if (_scalar_grid)
-	{
-		std::vector<Pose> poses;
-		const auto resolution = _scalar_grid->resolution;
-		const auto spacing = _scalar_grid->spacing;
-		const auto origin = _scalar_grid->origin;
-
-		auto &data = _scalar_grid->data_center;
-		data.for_each_index(
-				[&](int i, int j, int k)
-				{
-					if (data(i, j, k) == 0)
-						return;
-
-					Pose pose;
-					pose.position = origin + spacing * mVector3(i, j, k);
-					pose.scale = spacing;
-					poses.push_back(pose);
-
-					mVector3 color = data(i, j, k) * HinaPE::Color::WHITE;
-
-					(*_color_map)[i + j * resolution.x + k * resolution.x * resolution.y] = color;
-				});
-
-		_boxes->_opt.instance_matrices.clear();
-		for (auto &pose: poses)
-			_boxes->_opt.instance_matrices.push_back(pose.get_model_matrix());
-		_boxes->_opt.dirty = true;
-	} else if (_int_grid) {
-		std::vector<Pose> poses;
-		const auto resolution = _int_grid->resolution;
-		const auto spacing = _int_grid->spacing;
-		const auto origin = _int_grid->origin;
-
-		auto &data = _int_grid->data_center;
-		data.for_each_index(
-				[&](int i, int j, int k)
-				{
-					if (data(i, j, k) == 0)
-						return;
-
-					Pose pose;
-					pose.position = origin + spacing * mVector3(i, j, k);
-					pose.scale = spacing;
-					poses.push_back(pose);
-
-					mVector3 color = HinaPE::Color::WHITE;
-
-					(*_color_map)[i + j * resolution.x + k * resolution.x * resolution.y] = color;
-				});
-
-		_boxes->_opt.instance_matrices.clear();
-		for (auto &pose: poses)
-			_boxes->_opt.instance_matrices.push_back(pose.get_model_matrix());
-		_boxes->_opt.dirty = true;
-	}
-
-	if (_color_map != nullptr)
+	if (_boxes != nullptr)
 	{
-		_boxes->_opt.colors.clear();
-		_boxes->_opt.colors.reserve(_color_map->size());
-		for (auto &color: *_color_map)
-			_boxes->_opt.colors.emplace_back(color.x(), color.y(), color.z(), 1);
+		if (_scalar_grid)
+			collect_boxes(*_scalar_grid, _color_map, *_boxes);
+		else if (_int_grid)
+			collect_boxes(*_int_grid, _color_map, *_boxes);
+		else if (_vector_grid)
+			collect_boxes(*_vector_grid, _color_map, *_boxes);
+		return;
 	}
+	if (_volume == nullptr)
+		return;
+	if (_scalar_grid)
+		copy_to_volume(*_scalar_grid, *_volume, _auto_range);
+	else if (_int_grid)
+		copy_to_volume(*_int_grid, *_volume, _auto_range);
+	else if (_vector_grid)
+		copy_to_volume(*_vector_grid, *_volume, _auto_range);
 }
@@ -29,14 +29,18 @@ protected:
 	void _draw() final;
 	void _update_uniform() final;
 	virtual void _update_surface() {}
+	auto _cull_bounds(mBBox3 &local, mMatrix4x4 &model) -> bool override;
+	auto _batched() const -> bool; // drawn through Batch::MainBatch instead of on its own
+	void _own_mesh(); // primitives share their mesh, anything that edits it takes a private copy first
 
 	friend class Scene3D;
-	void _switch_surface() const { _mesh->_opt.dirty = true;_mesh->_opt.render_surface = !_mesh->_opt.render_surface; }
-	void _switch_wireframe() const { _mesh->_opt.dirty = true;_mesh->_opt.render_wireframe = !_mesh->_opt.render_wireframe; }
-	void _switch_bbox() const { _mesh->_opt.dirty = true;_mesh->_opt.render_bbox = !_mesh->_opt.render_bbox; }
+	void _switch_surface() { _own_mesh(); _mesh->_opt.render_surface = !_mesh->_opt.render_surface; }
+	void _switch_wireframe() { _own_mesh(); _mesh->_opt.render_wireframe = !_mesh->_opt.render_wireframe; }
+	void _switch_bbox() { _own_mesh(); _mesh->_opt.render_bbox = !_mesh->_opt.render_bbox; }
 
 protected:
-	MeshPtr _mesh; // verts & idxs
+	MeshPtr _mesh; // verts & idxs, shared through Mesh::Shared() for primitives
+	int _lod = -1; // level of detail drawn last frame, -1 before the first
 
 	void INSPECT() override;
 	void VALID_CHECK() const final;
@@ -155,6 +159,7 @@ public:
 	auto ray_cast(const mRay3 & ray) const -> HinaPE::Geom::SurfaceRayIntersection3;
 	void track_colormap(std::vector<mVector3>* color_map);
 	void hide(bool value); // hide all particles
+	void use_impostors(bool value); // ray-cast sphere sprites instead of instanced meshes, radius = largest scale component
 	int _inst_id; // selected particle id
 	ObjectParticles3D();
 
@@ -172,6 +177,8 @@ protected:
 
 protected:
 	InstancedMeshPtr _mesh;
+	SphereImpostorsPtr _impostors; // only in impostor mode
+	ShaderPtr _mesh_shader; // restored when leaving impostor mode
 	std::vector<mVector3>* _color_map = nullptr;
 	bool _hidden = false;
 	bool _random_color = false;
@@ -189,20 +196,26 @@ public:
 	ObjectGrid3D();
 	void track(HinaPE::Geom::DataGrid3<real> *scalar_grid);
 	void track(HinaPE::Geom::DataGrid3<int> *int_grid);
-	void track(HinaPE::Geom::DataGrid3<mVector3> *vector_grid);
-	void track_colormap(std::vector<mVector3>* color_map);
+	void track(HinaPE::Geom::DataGrid3<mVector3> *vector_grid); // drawn by magnitude
+	void track_colormap(std::vector<mVector3>* color_map); // per cell colours of the wire boxes
+	void use_boxes(bool value); // one wire box per nonzero cell instead of the raymarched volume, for small debug grids
+	auto volume() const -> VolumePtr { return _volume; } // mode and transfer function
+	bool _auto_range = true; // the volume's value range follows the grid's min and max
 
 protected:
 	void _init();
 	void _draw() final;
+	void _draw_volume() final;
+	auto _has_volume() const -> bool final { return _boxes == nullptr && _volume != nullptr; }
 	friend class Scene3D;
 	void UPDATE() final;
 
 private:
-	InstancedLinesPtr _boxes;
-	HinaPE::Geom::DataGrid3<real> *_scalar_grid;
-	HinaPE::Geom::DataGrid3<int> *_int_grid;
-	HinaPE::Geom::DataGrid3<mVector3> *_vector_grid;
+	InstancedLinesPtr _boxes; // only in box mode
+	VolumePtr _volume;
+	HinaPE::Geom::DataGrid3<real> *_scalar_grid = nullptr;
+	HinaPE::Geom::DataGrid3<int> *_int_grid = nullptr;
+	HinaPE::Geom::DataGrid3<mVector3> *_vector_grid = nullptr;
 	std::vector<mVector3>* _color_map = nullptr;
 };
 
@@ -10,7 +10,7 @@ Kasumi::SphereObject::SphereObject()
 	load_surface(this);
 
 	std::vector<mVector3> verts;
-	for (auto &v: _mesh->vertices())
+	for (auto &v: std::as_const(*_mesh).vertices())
 		verts.emplace_back(v.position);
 	HinaPE::Geom::TriangleMeshSurface surface(verts, _mesh->indices());
 }
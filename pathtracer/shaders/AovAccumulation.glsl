@@ -0,0 +1,22 @@
+#version 330
+
+precision highp float;
+precision highp int;
+precision highp sampler2D;
+precision highp samplerCube;
+precision highp isampler2D;
+precision highp sampler2DArray;
+
+layout(location = 0) out vec4 albedo;
+layout(location = 1) out vec4 normal;
+in vec2 TexCoords;
+
+uniform sampler2D albedoTexture;
+uniform sampler2D normalTexture;
+
+// Drawn with additive blending into the full-frame AOV targets
+void main()
+{
+	albedo = texture(albedoTexture, TexCoords);
+	normal = texture(normalTexture, TexCoords);
+}
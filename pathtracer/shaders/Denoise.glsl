@@ -0,0 +1,20 @@
+#version 330
+
+precision highp float;
+precision highp int;
+precision highp sampler2D;
+precision highp samplerCube;
+precision highp isampler2D;
+precision highp sampler2DArray;
+
+out vec4 color;
+in vec2 TexCoords;
+
+uniform sampler2D pathTraceTexture;
+
+#include common/Denoise.glsl
+
+void main()
+{
+	color = vec4(ATrousFilter(pathTraceTexture, ivec2(gl_FragCoord.xy)), 1.0);
+}
@@ -12,6 +12,9 @@ in vec2 TexCoords;
 
 uniform sampler2D pathTraceTexture;
 uniform float invSampleCounter;
+uniform bool enableDenoiser;
+
+#include common/Denoise.glsl
 
 vec4 ToneMap(in vec4 c, float limit)
 {
@@ -22,6 +25,9 @@ vec4 ToneMap(in vec4 c, float limit)
 
 void main()
 {
-	color = texture(pathTraceTexture, TexCoords) * invSampleCounter;
+	if (enableDenoiser)
+		color = vec4(ATrousFilter(pathTraceTexture, ivec2(gl_FragCoord.xy)), 1.0);
+	else
+		color = texture(pathTraceTexture, TexCoords) * invSampleCounter;
 	color = pow(ToneMap(color, 1.5), vec4(1.0 / 2.2));
 }
\ No newline at end of file
@@ -7,13 +7,17 @@ precision highp samplerCube;
 precision highp isampler2D;
 precision highp sampler2DArray;
 
-out vec3 color;
+layout(location = 0) out vec3 color;
+layout(location = 1) out vec4 positionOut;
 in vec2 TexCoords;
 
 #include common/Uniforms.glsl
 #include common/Globals.glsl
+#include common/CompressedGeometry.glsl
+#include common/Sampler.glsl
 #include common/Intersection.glsl
 #include common/Sampling.glsl
+#include common/LightBvh.glsl
 #include common/AnyHit.glsl
 #include common/ClosestHit.glsl
 #include common/UE4BRDF.glsl
@@ -22,7 +26,7 @@ in vec2 TexCoords;
 
 void main(void)
 {
-	seed = gl_FragCoord.xy;
+	InitSampler(gl_FragCoord.xy);
 
 	float r1 = 2.0 * rand();
 	float r2 = 2.0 * rand();
@@ -50,4 +54,5 @@ void main(void)
 	vec3 pixelColor = PathTrace(ray);
 
 	color = pixelColor;
+	positionOut = aovPosition;
 }
\ No newline at end of file
@@ -0,0 +1,79 @@
+#version 330
+
+precision highp float;
+precision highp int;
+precision highp sampler2D;
+precision highp samplerCube;
+precision highp isampler2D;
+precision highp sampler2DArray;
+
+layout(location = 0) out vec4 historyOut;
+layout(location = 1) out vec4 positionOut;
+in vec2 TexCoords;
+
+struct Camera { vec3 up; vec3 right; vec3 forward; vec3 position; float fov; float focalDist; float aperture; };
+
+// Current preview frame (preview resolution) and the history (frame resolution)
+uniform sampler2D pathTraceTexture;
+uniform sampler2D positionTexture;
+uniform sampler2D historyTexture;
+uniform sampler2D historyPositionTexture;
+
+uniform Camera prevCamera;
+uniform vec3 cameraPosition;
+uniform vec2 screenResolution;
+uniform bool resetHistory;
+uniform float maxHistory;
+uniform float positionTolerance;
+
+// Inverse of the camera ray setup in Progressive.glsl; returns uv < 0 behind the camera
+vec2 ReprojectToPrevious(vec4 position)
+{
+	vec3 dir = position.w > 0.5 ? position.xyz - prevCamera.position : position.xyz;
+	float z = dot(dir, prevCamera.forward);
+	if (z <= 0.0)
+		return vec2(-1.0);
+
+	float scale = tan(prevCamera.fov * 0.5);
+	vec2 d = vec2(dot(dir, prevCamera.right), dot(dir, prevCamera.up)) / z;
+	d.x /= scale;
+	d.y /= scale * screenResolution.y / screenResolution.x;
+
+	return d * 0.5 + 0.5;
+}
+
+bool IsSameSurface(vec4 current, vec4 previous)
+{
+	if (current.w != previous.w)
+		return false;
+
+	// Escaped rays only need to agree on direction
+	if (current.w < 0.5)
+		return dot(current.xyz, previous.xyz) > 0.999;
+
+	// Tolerance grows with distance, like the footprint of a pixel
+	return distance(current.xyz, previous.xyz) < positionTolerance * distance(current.xyz, cameraPosition);
+}
+
+void main()
+{
+	vec3 color = texture(pathTraceTexture, TexCoords).xyz;
+	vec4 position = texture(positionTexture, TexCoords);
+
+	vec4 history = vec4(0.0);
+	if (!resetHistory)
+	{
+		vec2 uv = ReprojectToPrevious(position);
+		if (all(greaterThanEqual(uv, vec2(0.0))) && all(lessThan(uv, vec2(1.0))))
+		{
+			ivec2 texel = ivec2(uv * screenResolution);
+			if (IsSameSurface(position, texelFetch(historyPositionTexture, texel, 0)))
+				history = texelFetch(historyTexture, texel, 0);
+		}
+	}
+
+	// Alpha is the number of frames in the running mean; disoccluded pixels restart from this frame
+	float count = min(history.a + 1.0, maxHistory);
+	historyOut = vec4(mix(history.xyz, color, 1.0 / count), count);
+	positionOut = position;
+}
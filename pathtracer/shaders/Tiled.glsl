@@ -7,13 +7,18 @@ precision highp samplerCube;
 precision highp isampler2D;
 precision highp sampler2DArray;
 
-out vec3 color;
+layout(location = 0) out vec3 color;
+layout(location = 1) out vec4 albedoOut;
+layout(location = 2) out vec4 normalOut;
 in vec2 TexCoords;
 
 #include common/Uniforms.glsl
 #include common/Globals.glsl
+#include common/CompressedGeometry.glsl
+#include common/Sampler.glsl
 #include common/Intersection.glsl
 #include common/Sampling.glsl
+#include common/LightBvh.glsl
 #include common/AnyHit.glsl
 #include common/ClosestHit.glsl
 #include common/UE4BRDF.glsl
@@ -27,7 +32,7 @@ float map(float value, float low1, float high1, float low2, float high2)
 
 void main(void)
 {
-	seed = gl_FragCoord.xy;
+	InitSampler(gl_FragCoord.xy + screenResolution * vec2(invTileWidth * float(tileX), invTileHeight * float(tileY)));
 
 	float r1 = 2.0 * rand();
 	float r2 = 2.0 * rand();
@@ -71,4 +76,8 @@ void main(void)
 	vec3 pixelColor = PathTrace(ray);
 
 	color = pixelColor + accumColor;
+
+	// Alpha counts samples so the accumulated albedo can be averaged
+	albedoOut = vec4(aovAlbedo, 1.0);
+	normalOut = vec4(aovNormal, 1.0);
 }
\ No newline at end of file
@@ -38,6 +38,14 @@ bool AnyHit(Ray r, float maxDist)
 	r_trans.origin = r.origin;
 	r_trans.direction = r.direction;
 
+#ifdef COMPRESSED_GEOMETRY
+	// Node bounds are relative to the tree being traversed: the TLAS, or the BLAS of the current instance
+	vec3 tlasOrigin, tlasScale;
+	FetchBoundsFrame(0, tlasOrigin, tlasScale);
+	vec3 frameOrigin = tlasOrigin;
+	vec3 frameScale = tlasScale;
+#endif
+
 	while (idx > -1 || meshBVH)
 	{
 		int n = idx;
@@ -50,6 +58,10 @@ bool AnyHit(Ray r, float maxDist)
 
 			r_trans.origin = r.origin;
 			r_trans.direction = r.direction;
+#ifdef COMPRESSED_GEOMETRY
+			frameOrigin = tlasOrigin;
+			frameScale = tlasScale;
+#endif
 			continue;
 		}
 
@@ -103,6 +115,9 @@ bool AnyHit(Ray r, float maxDist)
 
 			r_trans.origin = vec3(inverse(temp_transform) * vec4(r.origin, 1.0));
 			r_trans.direction = vec3(inverse(temp_transform) * vec4(r.direction, 0.0));
+#ifdef COMPRESSED_GEOMETRY
+			FetchBoundsFrame(-leaf, frameOrigin, frameScale);
+#endif
 
 			stack[ptr++] = -1;
 			meshBVH = true;
@@ -114,8 +129,16 @@ bool AnyHit(Ray r, float maxDist)
 			ivec2 lc = ivec2(leftIndex >> 12, leftIndex & 0x00000FFF);
 			ivec2 rc = ivec2(rightIndex >> 12, rightIndex & 0x00000FFF);
 
+#ifdef COMPRESSED_GEOMETRY
+			vec3 lmin, lmax, rmin, rmax;
+			FetchNodeBounds(lc, frameOrigin, frameScale, lmin, lmax);
+			FetchNodeBounds(rc, frameOrigin, frameScale, rmin, rmax);
+			leftHit = AABBIntersect(lmin, lmax, r_trans);
+			rightHit = AABBIntersect(rmin, rmax, r_trans);
+#else
 			leftHit = AABBIntersect(texelFetch(BBoxMin, lc, 0).xyz, texelFetch(BBoxMax, lc, 0).xyz, r_trans);
 			rightHit = AABBIntersect(texelFetch(BBoxMin, rc, 0).xyz, texelFetch(BBoxMax, rc, 0).xyz, r_trans);
+#endif
 
 
 			if (leftHit > 0.0 && rightHit > 0.0)
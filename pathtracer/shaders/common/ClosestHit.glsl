@@ -26,52 +26,7 @@ float ClosestHit(Ray r, inout State state, inout LightSampleRec lightSampleRec)
 	float d;
 
 	// Intersect Emitters
-	for (int i = 0; i < numOfLights; i++)
-	{
-		// Fetch light Data
-		vec3 position = texelFetch(lightsTex, ivec2(i * 5 + 0, 0), 0).xyz;
-		vec3 emission = texelFetch(lightsTex, ivec2(i * 5 + 1, 0), 0).xyz;
-		vec3 u = texelFetch(lightsTex, ivec2(i * 5 + 2, 0), 0).xyz;
-		vec3 v = texelFetch(lightsTex, ivec2(i * 5 + 3, 0), 0).xyz;
-		vec3 radiusAreaType = texelFetch(lightsTex, ivec2(i * 5 + 4, 0), 0).xyz;
-
-		if (radiusAreaType.z == 0.) // Rectangular Area Light
-		{
-			vec3 normal = normalize(cross(u, v));
-			//if (dot(normal, r.direction) > 0.) // Hide backfacing quad light
-			//	continue;
-			vec4 plane = vec4(normal, dot(normal, position));
-			u *= 1.0f / dot(u, u);
-			v *= 1.0f / dot(v, v);
-
-			d = RectIntersect(position, u, v, plane, r);
-			if (d < 0.)
-				d = INFINITY;
-			if (d < t)
-			{
-				t = d;
-				float cosTheta = dot(-r.direction, normal);
-				float pdf = (t * t) / (radiusAreaType.y * cosTheta);
-				lightSampleRec.emission = emission;
-				lightSampleRec.pdf = pdf;
-				state.isEmitter = true;
-			}
-		}
-		if (radiusAreaType.z == 1.) // Spherical Area Light
-		{
-			d = SphereIntersect(radiusAreaType.x, position, r);
-			if (d < 0.)
-				d = INFINITY;
-			if (d < t)
-			{
-				t = d;
-				float pdf = (t * t) / radiusAreaType.y;
-				lightSampleRec.emission = emission;
-				lightSampleRec.pdf = pdf;
-				state.isEmitter = true;
-			}
-		}
-	}
+	IntersectLightBvh(r, t, state, lightSampleRec);
 
 	int stack[64];
 	int ptr = 0;
@@ -82,6 +37,7 @@ float ClosestHit(Ray r, inout State state, inout LightSampleRec lightSampleRec)
 	float rightHit = 0.0;
 
 	int currMatID = 0;
+	int currInstance = 0;
 	bool meshBVH = false;
 
 	Ray r_trans;
@@ -89,6 +45,14 @@ float ClosestHit(Ray r, inout State state, inout LightSampleRec lightSampleRec)
 	r_trans.origin = r.origin;
 	r_trans.direction = r.direction;
 
+#ifdef COMPRESSED_GEOMETRY
+	// Node bounds are relative to the tree being traversed: the TLAS, or the BLAS of the current instance
+	vec3 tlasOrigin, tlasScale;
+	FetchBoundsFrame(0, tlasOrigin, tlasScale);
+	vec3 frameOrigin = tlasOrigin;
+	vec3 frameScale = tlasScale;
+#endif
+
 	while (idx > -1 || meshBVH)
 	{
 		int n = idx;
@@ -101,6 +65,10 @@ float ClosestHit(Ray r, inout State state, inout LightSampleRec lightSampleRec)
 
 			r_trans.origin = r.origin;
 			r_trans.direction = r.direction;
+#ifdef COMPRESSED_GEOMETRY
+			frameOrigin = tlasOrigin;
+			frameScale = tlasScale;
+#endif
 			continue;
 		}
 
@@ -142,10 +110,14 @@ float ClosestHit(Ray r, inout State state, inout LightSampleRec lightSampleRec)
 					t = uvt.z;
 					state.isEmitter = false;
 					state.triID = vert_indices;
+					state.triIndex = leftIndex + i;
+					state.instanceID = currInstance;
 					state.matID = currMatID;
 					state.fhp = r_trans.origin + r_trans.direction * t;
 					state.bary = uvt.wxy;
+#ifndef COMPRESSED_GEOMETRY
 					tempTexCoords = vec3(v0.w, v1.w, v2.w);
+#endif
 					state.fhp = vec3(temp_transform * vec4(state.fhp, 1.0));
 					transform = temp_transform;
 				}
@@ -164,10 +136,14 @@ float ClosestHit(Ray r, inout State state, inout LightSampleRec lightSampleRec)
 
 			r_trans.origin = vec3(inverse(temp_transform) * vec4(r.origin, 1.0));
 			r_trans.direction = vec3(inverse(temp_transform) * vec4(r.direction, 0.0));
+#ifdef COMPRESSED_GEOMETRY
+			FetchBoundsFrame(-leaf, frameOrigin, frameScale);
+#endif
 
 			stack[ptr++] = -1;
 			meshBVH = true;
 			currMatID = rightIndex;
+			currInstance = -leaf - 1;
 			continue;
 		}
 		else
@@ -175,8 +151,16 @@ float ClosestHit(Ray r, inout State state, inout LightSampleRec lightSampleRec)
 			ivec2 lc = ivec2(leftIndex >> 12, leftIndex & 0x00000FFF);
 			ivec2 rc = ivec2(rightIndex >> 12, rightIndex & 0x00000FFF);
 
+#ifdef COMPRESSED_GEOMETRY
+			vec3 lmin, lmax, rmin, rmax;
+			FetchNodeBounds(lc, frameOrigin, frameScale, lmin, lmax);
+			FetchNodeBounds(rc, frameOrigin, frameScale, rmin, rmax);
+			leftHit = AABBIntersect(lmin, lmax, r_trans);
+			rightHit = AABBIntersect(rmin, rmax, r_trans);
+#else
 			leftHit = AABBIntersect(texelFetch(BBoxMin, lc, 0).xyz, texelFetch(BBoxMax, lc, 0).xyz, r_trans);
 			rightHit = AABBIntersect(texelFetch(BBoxMin, rc, 0).xyz, texelFetch(BBoxMax, rc, 0).xyz, r_trans);
+#endif
 
 			if (leftHit > 0.0 && rightHit > 0.0)
 			{
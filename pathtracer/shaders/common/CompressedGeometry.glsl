@@ -0,0 +1,62 @@
+// Decoding of the quantized geometry layout (see core/CompressedGeometry.h), compiled in with
+// COMPRESSED_GEOMETRY. GLSL 3.30 has no packing built-ins, so snorm16 and half are unpacked by hand.
+
+#ifdef COMPRESSED_GEOMETRY
+
+//-----------------------------------------------------------------------
+vec2 UnpackSnorm2x16(uint p)
+//-----------------------------------------------------------------------
+{
+	// int(uint) keeps the bit pattern, so the arithmetic shifts sign extend
+	ivec2 v = ivec2(int(p << 16) >> 16, int(p) >> 16);
+	return max(vec2(v) / 32767.0, vec2(-1.0));
+}
+
+//-----------------------------------------------------------------------
+float HalfToFloat(uint h)
+//-----------------------------------------------------------------------
+{
+	// Denormal halves are never written, see CompressedGeometry::FloatToHalf()
+	uint e = (h >> 10) & 0x1Fu;
+	uint bits = ((h & 0x8000u) << 16) | (e == 0u ? 0u : (((e + 112u) << 23) | ((h & 0x3FFu) << 13)));
+	return uintBitsToFloat(bits);
+}
+
+//-----------------------------------------------------------------------
+vec2 UnpackHalf2x16(uint p)
+//-----------------------------------------------------------------------
+{
+	return vec2(HalfToFloat(p & 0xFFFFu), HalfToFloat(p >> 16));
+}
+
+//-----------------------------------------------------------------------
+vec3 OctahedralDecode(vec2 e)
+//-----------------------------------------------------------------------
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	if (n.z < 0.0)
+	{
+		vec2 s = vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+		n.xy = (1.0 - abs(n.yx)) * s;
+	}
+	return normalize(n);
+}
+
+//-----------------------------------------------------------------------
+void FetchBoundsFrame(int tree, out vec3 origin, out vec3 scale)
+//-----------------------------------------------------------------------
+{
+	origin = texelFetch(BBoxFrames, ivec2(tree * 2 + 0, 0), 0).xyz;
+	scale  = texelFetch(BBoxFrames, ivec2(tree * 2 + 1, 0), 0).xyz;
+}
+
+//-----------------------------------------------------------------------
+void FetchNodeBounds(ivec2 node, vec3 origin, vec3 scale, out vec3 bboxMin, out vec3 bboxMax)
+//-----------------------------------------------------------------------
+{
+	uvec3 q = texelFetch(BBoxQuantized, node, 0).xyz;
+	bboxMin = origin + vec3(q & 0xFFFFu) * scale;
+	bboxMax = origin + vec3(q >> 16) * scale;
+}
+
+#endif
@@ -0,0 +1,61 @@
+// Edge-avoiding a-trous wavelet filter (Dammertz et al. 2010), guided by the accumulated
+// albedo and normal AOVs. core/Denoiser.cpp implements the same filter on the CPU.
+
+uniform sampler2D albedoTexture;
+uniform sampler2D normalTexture;
+uniform int stepWidth;
+uniform float colorScale;
+uniform float colorPhi;
+uniform float normalPhi;
+uniform float albedoPhi;
+
+//-----------------------------------------------------------------------
+vec3 FetchAlbedo(ivec2 p)
+//-----------------------------------------------------------------------
+{
+	vec4 albedo = texelFetch(albedoTexture, p, 0);
+	return albedo.xyz / max(albedo.w, 1.0);
+}
+
+//-----------------------------------------------------------------------
+vec3 FetchNormal(ivec2 p)
+//-----------------------------------------------------------------------
+{
+	vec3 normal = texelFetch(normalTexture, p, 0).xyz;
+	float len = length(normal);
+	return len > 0.0 ? normal / len : vec3(0.0);
+}
+
+//-----------------------------------------------------------------------
+vec3 ATrousFilter(sampler2D colorTex, ivec2 p)
+//-----------------------------------------------------------------------
+{
+	const float kernel[3] = float[3](3.0 / 8.0, 1.0 / 4.0, 1.0 / 16.0);
+
+	ivec2 size = textureSize(colorTex, 0);
+	vec3 color = texelFetch(colorTex, p, 0).xyz * colorScale;
+	vec3 albedo = FetchAlbedo(p);
+	vec3 normal = FetchNormal(p);
+
+	vec3 sum = vec3(0.0);
+	float weightSum = 0.0;
+
+	for (int y = -2; y <= 2; y++)
+	{
+		for (int x = -2; x <= 2; x++)
+		{
+			ivec2 q = clamp(p + ivec2(x, y) * stepWidth, ivec2(0), size - 1);
+
+			vec3 c = texelFetch(colorTex, q, 0).xyz * colorScale;
+			vec3 dc = c - color;
+			vec3 dn = FetchNormal(q) - normal;
+			vec3 da = FetchAlbedo(q) - albedo;
+
+			float w = kernel[abs(x)] * kernel[abs(y)] * exp(-dot(dc, dc) / colorPhi - dot(dn, dn) / normalPhi - dot(da, da) / albedoPhi);
+			sum += c * w;
+			weightSum += w;
+		}
+	}
+
+	return sum / weightSum;
+}
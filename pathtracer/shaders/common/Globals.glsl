@@ -9,20 +9,19 @@ mat4 transform;
 
 vec2 seed;
 vec3 tempTexCoords;
+
+// First-hit AOVs that guide the denoiser
+vec3 aovAlbedo;
+vec3 aovNormal;
+
+// First-hit world position (w = 1), or the ray direction (w = 0) when it escapes; reprojects the preview
+vec4 aovPosition;
 struct Ray { vec3 origin; vec3 direction; };
 struct Material { vec4 albedo; vec4 emission; vec4 param; vec4 texIDs; };
 struct Camera { vec3 up; vec3 right; vec3 forward; vec3 position; float fov; float focalDist; float aperture; };
 struct Light { vec3 position; vec3 emission; vec3 u; vec3 v; vec3 radiusAreaType; };
-struct State { vec3 normal; vec3 ffnormal; vec3 fhp; bool isEmitter; int depth; float hitDist; vec2 texCoord; vec3 bary; ivec3 triID; int matID; Material mat; bool specularBounce; };
+struct State { vec3 normal; vec3 ffnormal; vec3 fhp; bool isEmitter; int depth; float hitDist; vec2 texCoord; vec3 bary; ivec3 triID; int triIndex; int instanceID; int matID; Material mat; bool specularBounce; };
 struct BsdfSampleRec { vec3 bsdfDir; float pdf; };
 struct LightSampleRec { vec3 surfacePos; vec3 normal; vec3 emission; float pdf; };
 
 uniform Camera camera;
-
-//-----------------------------------------------------------------------
-float rand()
-//-----------------------------------------------------------------------
-{
-	seed -= vec2(randomVector.x * randomVector.y);
-	return fract(sin(dot(seed, vec2(12.9898, 78.233))) * 43758.5453);
-}
\ No newline at end of file
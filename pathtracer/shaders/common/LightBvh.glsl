@@ -0,0 +1,240 @@
+// Light BVH (see bvh/LightBvh.h): lights are picked proportionally to a conservative estimate of
+// their contribution to the shading point, and emitters are intersected through the tree.
+
+#define LIGHT_BVH_NODES_PER_ROW 256
+#define LIGHTS_PER_ROW 256
+#define TRIANGLE_LIGHT 2.0
+
+int hitLightIndex;
+
+//-----------------------------------------------------------------------
+vec4 FetchLightNode(int node, int texel)
+//-----------------------------------------------------------------------
+{
+	return texelFetch(lightBvhTex, ivec2((node % LIGHT_BVH_NODES_PER_ROW) * 4 + texel, node / LIGHT_BVH_NODES_PER_ROW), 0);
+}
+
+//-----------------------------------------------------------------------
+vec3 FetchLightTexel(int index, int texel)
+//-----------------------------------------------------------------------
+{
+	return texelFetch(lightsTex, ivec2((index % LIGHTS_PER_ROW) * 6 + texel, index / LIGHTS_PER_ROW), 0).xyz;
+}
+
+//-----------------------------------------------------------------------
+Light FetchLight(int index)
+//-----------------------------------------------------------------------
+{
+	vec3 position = FetchLightTexel(index, 0);
+	vec3 emission = FetchLightTexel(index, 1);
+	vec3 u = FetchLightTexel(index, 2);
+	vec3 v = FetchLightTexel(index, 3);
+	vec3 radiusAreaType = FetchLightTexel(index, 4);
+
+	return Light(position, emission, u, v, radiusAreaType);
+}
+
+//-----------------------------------------------------------------------
+int MeshLightIndex(State state)
+//-----------------------------------------------------------------------
+{
+	// Second row of the transforms: first triangle light of the instance (or -1) and first triangle of its mesh
+	vec2 range = texelFetch(transformsTex, ivec2(state.instanceID, 1), 0).xy;
+	return range.x < 0.0 ? -1 : int(range.x) + state.triIndex - int(range.y);
+}
+
+//-----------------------------------------------------------------------
+float LightNodeImportance(int node, vec3 p, vec3 n)
+//-----------------------------------------------------------------------
+{
+	vec4 minPower = FetchLightNode(node, 0);
+	vec4 maxCosThetaO = FetchLightNode(node, 1);
+	vec4 axisCosThetaE = FetchLightNode(node, 2);
+
+	if (minPower.w <= 0.0)
+		return 0.0;
+
+	vec3 toCenter = 0.5 * (minPower.xyz + maxCosThetaO.xyz) - p;
+	float radius = 0.5 * length(maxCosThetaO.xyz - minPower.xyz);
+	float dist2 = dot(toCenter, toCenter);
+	float dist = sqrt(dist2);
+	vec3 dir = toCenter / max(dist, EPS);
+
+	// Half-angle of the cone around dir that contains the node bounds
+	float thetaU = dist <= radius ? PI : asin(radius / dist);
+
+	// Emitter side: can any normal in the cone face p?
+	float theta = acos(clamp(dot(axisCosThetaE.xyz, -dir), -1.0, 1.0));
+	float thetaP = max(theta - acos(maxCosThetaO.w) - thetaU, 0.0);
+	if (thetaP >= acos(axisCosThetaE.w))
+		return 0.0;
+
+	// Receiver side: can the bounds be above the shading hemisphere?
+	float thetaI = acos(clamp(dot(n, dir), -1.0, 1.0));
+	float thetaIP = max(thetaI - thetaU, 0.0);
+	if (thetaIP >= 0.5 * PI)
+		return 0.0;
+
+	return minPower.w * cos(thetaP) * cos(thetaIP) / max(dist2, 0.25 * radius * radius);
+}
+
+//-----------------------------------------------------------------------
+float LightLeftProbability(vec4 children, vec3 p, vec3 n)
+//-----------------------------------------------------------------------
+{
+	float left = LightNodeImportance(int(children.x), p, n);
+	float right = LightNodeImportance(int(children.y), p, n);
+	return (left + right) > 0.0 ? left / (left + right) : 0.5;
+}
+
+//-----------------------------------------------------------------------
+int SampleLightBvh(vec3 p, vec3 n, out float pmf)
+//-----------------------------------------------------------------------
+{
+#ifdef OPT_SINGLE_LIGHT
+	pmf = 1.0;
+	return 0;
+#endif
+
+	// One random number is rescaled at every level to pick the child
+	float u = rand();
+	int node = 0;
+	pmf = 1.0;
+
+	vec4 children = FetchLightNode(node, 3);
+	while (children.z < 0.5)
+	{
+		float pLeft = LightLeftProbability(children, p, n);
+		if (u < pLeft)
+		{
+			u = min(u / pLeft, 0.99999994);
+			node = int(children.x);
+			pmf *= pLeft;
+		}
+		else
+		{
+			u = min((u - pLeft) / (1.0 - pLeft), 0.99999994);
+			node = int(children.y);
+			pmf *= 1.0 - pLeft;
+		}
+		children = FetchLightNode(node, 3);
+	}
+
+	return int(children.x);
+}
+
+//-----------------------------------------------------------------------
+float LightBvhPmf(int lightIndex, vec3 p, vec3 n)
+//-----------------------------------------------------------------------
+{
+#ifdef OPT_SINGLE_LIGHT
+	return 1.0;
+#endif
+
+	// Replays the light's root-to-leaf trail, recorded when the tree was built
+	vec3 trailDepth = FetchLightTexel(lightIndex, 5);
+	uint trail = uint(trailDepth.x);
+	int depth = int(trailDepth.y);
+
+	int node = 0;
+	float pmf = 1.0;
+	for (int i = 0; i < depth; i++)
+	{
+		vec4 children = FetchLightNode(node, 3);
+		float pLeft = LightLeftProbability(children, p, n);
+		if (((trail >> uint(i)) & 1u) != 0u)
+		{
+			pmf *= 1.0 - pLeft;
+			node = int(children.y);
+		}
+		else
+		{
+			pmf *= pLeft;
+			node = int(children.x);
+		}
+	}
+
+	return pmf;
+}
+
+//-----------------------------------------------------------------------
+bool LightNodeHit(int node, Ray r, float tMax)
+//-----------------------------------------------------------------------
+{
+	vec3 invdir = 1.0 / r.direction;
+	vec3 f = (FetchLightNode(node, 1).xyz - r.origin) * invdir;
+	vec3 n = (FetchLightNode(node, 0).xyz - r.origin) * invdir;
+
+	vec3 tmax = max(f, n);
+	vec3 tmin = min(f, n);
+
+	float t1 = min(tmax.x, min(tmax.y, tmax.z));
+	float t0 = max(tmin.x, max(tmin.y, tmin.z));
+
+	return t1 >= max(t0, 0.0) && t0 < tMax;
+}
+
+//-----------------------------------------------------------------------
+void IntersectLightBvh(Ray r, inout float t, inout State state, inout LightSampleRec lightSampleRec)
+//-----------------------------------------------------------------------
+{
+#ifndef OPT_LIGHTS
+	return;
+#endif
+
+	int stack[32];
+	int ptr = 0;
+	stack[ptr++] = 0;
+
+	while (ptr > 0)
+	{
+		int node = stack[--ptr];
+
+		// Emissive triangles are found through the scene BVH instead
+		vec4 children = FetchLightNode(node, 3);
+		if (children.w < 0.5 || !LightNodeHit(node, r, t))
+			continue;
+
+		if (children.z < 0.5)
+		{
+			stack[ptr++] = int(children.x);
+			stack[ptr++] = int(children.y);
+			continue;
+		}
+
+		int index = int(children.x);
+		Light light = FetchLight(index);
+		float d;
+
+		if (light.radiusAreaType.z == 0.) // Rectangular Area Light
+		{
+			vec3 normal = normalize(cross(light.u, light.v));
+			vec4 plane = vec4(normal, dot(normal, light.position));
+			vec3 u = light.u / dot(light.u, light.u);
+			vec3 v = light.v / dot(light.v, light.v);
+
+			d = RectIntersect(light.position, u, v, plane, r);
+			if (d > 0. && d < t)
+			{
+				t = d;
+				float cosTheta = dot(-r.direction, normal);
+				lightSampleRec.emission = light.emission;
+				lightSampleRec.pdf = (t * t) / (light.radiusAreaType.y * cosTheta);
+				state.isEmitter = true;
+				hitLightIndex = index;
+			}
+		}
+		else // Spherical Area Light
+		{
+			d = SphereIntersect(light.radiusAreaType.x, light.position, r);
+			if (d > 0. && d < t)
+			{
+				t = d;
+				lightSampleRec.emission = light.emission;
+				lightSampleRec.pdf = (t * t) / light.radiusAreaType.y;
+				state.isEmitter = true;
+				hitLightIndex = index;
+			}
+		}
+	}
+}
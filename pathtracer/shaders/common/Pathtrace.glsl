@@ -22,6 +22,19 @@
 void GetNormalsAndTexCoord(inout State state, inout Ray r)
 //-----------------------------------------------------------------------
 {
+#ifdef COMPRESSED_GEOMETRY
+	uvec2 p1 = texelFetch(normalsTex, ivec2(state.triID.x >> 12, state.triID.x & 0x00000FFF), 0).xy;
+	uvec2 p2 = texelFetch(normalsTex, ivec2(state.triID.y >> 12, state.triID.y & 0x00000FFF), 0).xy;
+	uvec2 p3 = texelFetch(normalsTex, ivec2(state.triID.z >> 12, state.triID.z & 0x00000FFF), 0).xy;
+
+	vec4 n1 = vec4(OctahedralDecode(UnpackSnorm2x16(p1.x)), 0.0);
+	vec4 n2 = vec4(OctahedralDecode(UnpackSnorm2x16(p2.x)), 0.0);
+	vec4 n3 = vec4(OctahedralDecode(UnpackSnorm2x16(p3.x)), 0.0);
+
+	vec2 t1 = UnpackHalf2x16(p1.y);
+	vec2 t2 = UnpackHalf2x16(p2.y);
+	vec2 t3 = UnpackHalf2x16(p3.y);
+#else
 	vec4 n1 = texelFetch(normalsTex, ivec2(state.triID.x >> 12, state.triID.x & 0x00000FFF), 0).xyzw;
 	vec4 n2 = texelFetch(normalsTex, ivec2(state.triID.y >> 12, state.triID.y & 0x00000FFF), 0).xyzw;
 	vec4 n3 = texelFetch(normalsTex, ivec2(state.triID.z >> 12, state.triID.z & 0x00000FFF), 0).xyzw;
@@ -29,6 +42,7 @@ void GetNormalsAndTexCoord(inout State state, inout Ray r)
 	vec2 t1 = vec2(tempTexCoords.x, n1.w);
 	vec2 t2 = vec2(tempTexCoords.y, n2.w);
 	vec2 t3 = vec2(tempTexCoords.z, n3.w);
+#endif
 
 	state.texCoord = t1 * state.bary.x + t2 * state.bary.y + t3 * state.bary.z;
 
@@ -52,6 +66,7 @@ void GetMaterialsAndTextures(inout State state, in Ray r)
 	mat.param = texelFetch(materialsTex, ivec2(index * 4 + 2, 0), 0);
 	mat.texIDs = texelFetch(materialsTex, ivec2(index * 4 + 3, 0), 0);
 
+#ifdef OPT_TEXTURES
 	vec2 texUV = state.texCoord;
 	texUV.y = 1.0 - texUV.y;
 
@@ -80,7 +95,8 @@ void GetMaterialsAndTextures(inout State state, in Ray r)
 	{
 		mat.emission.xyz *= pow(texture(textureMapsArrayTex, vec3(texUV, int(mat.texIDs.w))).xyz, vec3(2.2));
 	}
-	
+#endif
+
 	state.mat = mat;
 }
 
@@ -94,7 +110,7 @@ vec3 DirectLight(in Ray r, in State state)
 	vec3 surfacePos = state.fhp + state.ffnormal * EPS;
 
 	/* Environment Light */
-	if (useEnvMap)
+#ifdef OPT_ENVMAP
 	{
 		vec3 color;
 		vec4 dirPdf = EnvSample(color);
@@ -114,24 +130,20 @@ vec3 DirectLight(in Ray r, in State state)
 				L += misWeight * f * abs(dot(lightDir, state.ffnormal)) * color / lightPdf;
 		}
 	}
+#endif
 
 	/* Sample Analytic Lights */
-	if (numOfLights > 0)
+#ifdef OPT_LIGHTS
 	{
 		LightSampleRec lightSampleRec;
-		Light light;
-
-		//Pick a light to sample
-		int index = int(rand() * float(numOfLights));
 
-		// Fetch light Data
-		vec3 p = texelFetch(lightsTex, ivec2(index * 5 + 0, 0), 0).xyz;
-		vec3 e = texelFetch(lightsTex, ivec2(index * 5 + 1, 0), 0).xyz;
-		vec3 u = texelFetch(lightsTex, ivec2(index * 5 + 2, 0), 0).xyz;
-		vec3 v = texelFetch(lightsTex, ivec2(index * 5 + 3, 0), 0).xyz;
-		vec3 rad = texelFetch(lightsTex, ivec2(index * 5 + 4, 0), 0).xyz;
+		// Pick a light proportionally to its estimated contribution
+		float selectPmf;
+		int index = SampleLightBvh(surfacePos, state.ffnormal, selectPmf);
+		if (selectPmf <= 0.0)
+			return L;
 
-		light = Light(p, e, u, v, rad);
+		Light light = FetchLight(index);
 		sampleLight(light, lightSampleRec);
 
 		vec3 lightDir = lightSampleRec.surfacePos - surfacePos;
@@ -139,6 +151,10 @@ vec3 DirectLight(in Ray r, in State state)
 		float lightDistSq = lightDist * lightDist;
 		lightDir /= sqrt(lightDistSq);
 
+		// Emissive triangles emit on both sides
+		if (light.radiusAreaType.z == TRIANGLE_LIGHT && dot(lightDir, lightSampleRec.normal) > 0.0)
+			lightSampleRec.normal = -lightSampleRec.normal;
+
 		if (dot(lightDir, state.ffnormal) <= 0.0 || dot(lightDir, lightSampleRec.normal) >= 0.0)
 			return L;
 
@@ -149,11 +165,12 @@ vec3 DirectLight(in Ray r, in State state)
 		{
 			float bsdfPdf = UE4Pdf(r, state, lightDir);
 			vec3 f = UE4Eval(r, state, lightDir);
-			float lightPdf = lightDistSq / (light.radiusAreaType.y * abs(dot(lightSampleRec.normal, lightDir)));
+			float lightPdf = selectPmf * lightDistSq / (light.radiusAreaType.y * abs(dot(lightSampleRec.normal, lightDir)));
 
 			L += powerHeuristic(lightPdf, bsdfPdf) * f * abs(dot(state.ffnormal, lightDir)) * lightSampleRec.emission / lightPdf;
 		}
 	}
+#endif
 
 	return L;
 }
@@ -167,6 +184,12 @@ vec3 PathTrace(Ray r)
 	State state;
 	LightSampleRec lightSampleRec;
 	BsdfSampleRec bsdfSampleRec;
+	vec3 lastPos;
+	vec3 lastNormal;
+
+	aovAlbedo = vec3(0.0);
+	aovNormal = vec3(0.0);
+	aovPosition = vec4(r.direction, 0.0);
 
 	for (int depth = 0; depth < maxDepth; depth++)
 	{
@@ -176,7 +199,7 @@ vec3 PathTrace(Ray r)
 
 		if (t == INFINITY)
 		{
-			if (useEnvMap)
+#ifdef OPT_ENVMAP
 			{
 				float misWeight = 1.0f;
 				vec2 uv = vec2((PI + atan(r.direction.z, r.direction.x)) * (1.0 / TWO_PI), acos(r.direction.y) * (1.0 / PI));
@@ -188,21 +211,52 @@ vec3 PathTrace(Ray r)
 				}
 				radiance += misWeight * texture(hdrTex, uv).xyz * throughput * hdrMultiplier;
 			}
+#endif
 			break;
 		}
 
 		GetNormalsAndTexCoord(state, r);
 		GetMaterialsAndTextures(state, r);
 
-		radiance += state.mat.emission.xyz * throughput;
+		if (depth == 0)
+		{
+			aovAlbedo = state.isEmitter ? vec3(1.0) : state.mat.albedo.xyz;
+			aovNormal = state.isEmitter ? -r.direction : state.ffnormal;
+			aovPosition = vec4(r.origin + r.direction * t, 1.0);
+		}
+
+		vec3 emission = state.mat.emission.xyz;
+
+		// Emissive meshes are also reached by light sampling from the previous vertex, see Scene::CreateMeshLights
+#ifdef OPT_LIGHTS
+		if (depth > 0 && !state.specularBounce && !state.isEmitter && dot(emission, emission) > 0.0)
+		{
+			int lightIndex = MeshLightIndex(state);
+			if (lightIndex >= 0)
+			{
+				Light light = FetchLight(lightIndex);
+				float cosTheta = abs(dot(normalize(cross(light.u, light.v)), r.direction));
+				float meshLightPdf = LightBvhPmf(lightIndex, lastPos, lastNormal) * t * t / (light.radiusAreaType.y * cosTheta);
+				emission *= powerHeuristic(bsdfSampleRec.pdf, meshLightPdf);
+			}
+		}
+#endif
+
+		radiance += emission * throughput;
 
 		if (state.isEmitter)
 		{
+			// Account for the light BVH choosing this emitter from the previous vertex
+			if (depth > 0 && !state.specularBounce)
+				lightSampleRec.pdf *= LightBvhPmf(hitLightIndex, lastPos, lastNormal);
+
 			radiance += EmitterSample(r, state, lightSampleRec, bsdfSampleRec) * throughput;
 			break;
 		}
 
+#ifdef OPT_GLASS
 		if (state.mat.albedo.w == 0.0) // UE4 Brdf
+#endif
 		{
 			state.specularBounce = false;
 			radiance += DirectLight(r, state) * throughput;
@@ -215,6 +269,7 @@ vec3 PathTrace(Ray r)
 			else
 				break;
 		}
+#ifdef OPT_GLASS
 		else // Glass
 		{
 			state.specularBounce = true;
@@ -224,6 +279,10 @@ vec3 PathTrace(Ray r)
 
 			throughput *= GlassEval(r, state); // Pdf will always be 1.0
 		}
+#endif
+
+		lastPos = state.fhp + state.ffnormal * EPS;
+		lastNormal = state.ffnormal;
 
 		r.direction = bsdfSampleRec.bsdfDir;
 		r.origin = state.fhp + r.direction * EPS;
@@ -0,0 +1,98 @@
+// Low-discrepancy sampler: 4D Sobol, Owen-scrambled with hashing (Burley 2020) and padded
+// to higher dimensions by reseeding each group of 4, then Cranley-Patterson rotated per
+// pixel by a blue-noise tile so the remaining error is distributed as blue noise.
+
+ivec2 pixelCoord;
+int sampleDimension;
+vec4 sobolGroup;
+
+uint ReverseBits(uint x)
+{
+	x = ((x >> 1u) & 0x55555555u) | ((x & 0x55555555u) << 1u);
+	x = ((x >> 2u) & 0x33333333u) | ((x & 0x33333333u) << 2u);
+	x = ((x >> 4u) & 0x0F0F0F0Fu) | ((x & 0x0F0F0F0Fu) << 4u);
+	x = ((x >> 8u) & 0x00FF00FFu) | ((x & 0x00FF00FFu) << 8u);
+	return (x >> 16u) | (x << 16u);
+}
+
+uint Hash(uint x)
+{
+	x ^= x >> 16u;
+	x *= 0x7feb352du;
+	x ^= x >> 15u;
+	x *= 0x846ca68bu;
+	x ^= x >> 16u;
+	return x;
+}
+
+uint LaineKarrasPermutation(uint x, uint seed)
+{
+	x += seed;
+	x ^= x * 0x6c50b47cu;
+	x ^= x * 0xb82f1e52u;
+	x ^= x * 0xc7afe638u;
+	x ^= x * 0x8d22f6e6u;
+	return x;
+}
+
+uint NestedUniformScramble(uint x, uint seed)
+{
+	return ReverseBits(LaineKarrasPermutation(ReverseBits(x), seed));
+}
+
+vec4 SobolOwen4(uint index, uint seed)
+{
+	index = NestedUniformScramble(index, seed);
+
+	uvec4 x = uvec4(0u);
+	for (int bit = 0; bit < 32; bit++)
+	{
+		if ((index >> uint(bit)) == 0u)
+			break;
+		if (((index >> uint(bit)) & 1u) != 0u)
+			x ^= uvec4(sobolDirections[bit], sobolDirections[32 + bit], sobolDirections[64 + bit], sobolDirections[96 + bit]);
+	}
+
+	x.x = NestedUniformScramble(x.x, Hash(seed ^ 0x2c1b3c6du));
+	x.y = NestedUniformScramble(x.y, Hash(seed ^ 0x297a2d39u));
+	x.z = NestedUniformScramble(x.z, Hash(seed ^ 0x1fb1e8f5u));
+	x.w = NestedUniformScramble(x.w, Hash(seed ^ 0x5f356495u));
+
+	return vec4(x >> 8u) / 16777216.0;
+}
+
+//-----------------------------------------------------------------------
+void InitSampler(vec2 pixel)
+//-----------------------------------------------------------------------
+{
+	seed = pixel;
+	pixelCoord = ivec2(pixel);
+	sampleDimension = 0;
+}
+
+//-----------------------------------------------------------------------
+float rand()
+//-----------------------------------------------------------------------
+{
+	if (samplerType == 0)
+	{
+		seed -= vec2(randomVector.x * randomVector.y);
+		return fract(sin(dot(seed, vec2(12.9898, 78.233))) * 43758.5453);
+	}
+
+	int component = sampleDimension & 3;
+	if (component == 0)
+	{
+		uint group = uint(sampleDimension >> 2);
+
+		// R2 offsets decorrelate the blue-noise tile between dimension groups
+		ivec2 noiseSize = textureSize(blueNoiseTex, 0);
+		ivec2 shift = ivec2(fract(vec2(0.7548776662, 0.5698402910) * float(group)) * vec2(noiseSize));
+		vec4 noise = texelFetch(blueNoiseTex, (pixelCoord + shift) % noiseSize, 0);
+
+		sobolGroup = fract(SobolOwen4(uint(sampleIndex), Hash(group + 0x9e3779b9u)) + noise);
+	}
+
+	sampleDimension++;
+	return sobolGroup[component];
+}
@@ -69,7 +69,7 @@ void sampleSphereLight(in Light light, inout LightSampleRec lightSampleRec)
 
 	lightSampleRec.surfacePos = light.position + UniformSampleSphere(r1, r2) * light.radiusAreaType.x;
 	lightSampleRec.normal = normalize(lightSampleRec.surfacePos - light.position);
-	lightSampleRec.emission = light.emission * float(numOfLights);
+	lightSampleRec.emission = light.emission;
 }
 
 //-----------------------------------------------------------------------
@@ -81,7 +81,20 @@ void sampleQuadLight(in Light light, inout LightSampleRec lightSampleRec)
 
 	lightSampleRec.surfacePos = light.position + light.u * r1 + light.v * r2;
 	lightSampleRec.normal = normalize(cross(light.u, light.v));
-	lightSampleRec.emission = light.emission * float(numOfLights);
+	lightSampleRec.emission = light.emission;
+}
+
+//-----------------------------------------------------------------------
+void sampleTriangleLight(in Light light, inout LightSampleRec lightSampleRec)
+//-----------------------------------------------------------------------
+{
+	// Uniform barycentrics
+	float r1 = sqrt(rand());
+	float r2 = rand();
+
+	lightSampleRec.surfacePos = light.position + light.u * (r1 * (1.0 - r2)) + light.v * (r1 * r2);
+	lightSampleRec.normal = normalize(cross(light.u, light.v));
+	lightSampleRec.emission = light.emission;
 }
 
 //-----------------------------------------------------------------------
@@ -90,6 +103,8 @@ void sampleLight(in Light light, inout LightSampleRec lightSampleRec)
 {
 	if (int(light.radiusAreaType.z) == 0) // Quad Light
 		sampleQuadLight(light, lightSampleRec);
+	else if (int(light.radiusAreaType.z) == 2) // Emissive mesh triangle
+		sampleTriangleLight(light, lightSampleRec);
 	else
 		sampleSphereLight(light, lightSampleRec);
 }
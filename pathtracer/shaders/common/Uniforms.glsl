@@ -1,5 +1,4 @@
 uniform bool isCameraMoving;
-uniform bool useEnvMap;
 uniform vec3 randomVector;
 uniform vec2 screenResolution;
 uniform float hdrTexSize;
@@ -7,18 +6,30 @@ uniform int tileX;
 uniform int tileY;
 uniform float invTileWidth;
 uniform float invTileHeight;
+uniform int samplerType;
+uniform int sampleIndex;
+uniform uint sobolDirections[128];
 
 uniform sampler2D accumTexture;
 uniform isampler2D BVH;
+uniform isampler2D vertexIndicesTex;
+#ifdef COMPRESSED_GEOMETRY
+uniform usampler2D BBoxQuantized;
+uniform sampler2D BBoxFrames;
+uniform sampler2D verticesTex;
+uniform usampler2D normalsTex;
+#else
 uniform sampler2D BBoxMin;
 uniform sampler2D BBoxMax;
-uniform isampler2D vertexIndicesTex;
 uniform sampler2D verticesTex;
 uniform sampler2D normalsTex;
+#endif
 uniform sampler2D materialsTex;
 uniform sampler2D transformsTex;
 uniform sampler2D lightsTex;
+uniform sampler2D lightBvhTex;
 uniform sampler2DArray textureMapsArrayTex;
+uniform sampler2D blueNoiseTex;
 
 uniform sampler2D hdrTex;
 uniform sampler2D hdrMarginalDistTex;
@@ -27,6 +38,12 @@ uniform float hdrResolution;
 uniform float hdrMultiplier;
 
 uniform int numOfLights;
-uniform int maxDepth;
 uniform int topBVHIndex;
-uniform int vertIndicesSize;
\ No newline at end of file
+uniform int vertIndicesSize;
+
+// Scene features are compiled in as OPT_* defines, see TiledRenderer::PathTraceDefines()
+#ifdef OPT_MAX_DEPTH
+const int maxDepth = OPT_MAX_DEPTH;
+#else
+uniform int maxDepth;
+#endif
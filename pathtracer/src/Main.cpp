@@ -1,6 +1,9 @@
 #include <time.h>
 #include <math.h>
+#include <stdlib.h>
 #include <string>
+#include <functional>
+#include <chrono>
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
@@ -13,6 +16,10 @@
 #include "core/Scene.h"
 #include "core/Renderer.h"
 #include "core/TiledRenderer.h"
+#include "core/Checkpoint.h"
+#include "core/ShaderCache.h"
+
+#include "net/RenderFarm.h"
 
 #include "parser/SceneLoader.h"
 #include "parser/GLBLoader.h"
@@ -22,6 +29,10 @@
 
 #include "file/tinydir.h"
 
+#define STB_IMAGE_WRITE_STATIC
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "parser/stb_image_write.h"
+
 using namespace GLSLPT;
 
 int				sampleSceneIndex = -1;
@@ -31,6 +42,19 @@ double			lastTime = 0;
 std::string		shaderDir;
 std::string		assetsDir;
 std::string     hdrResDir;
+std::string     sceneFile;
+int             convergenceSpp = 0;
+int             geometryBenchmarkSpp = 0;
+int             parseBenchmarkInstances = 0;
+int             batchSpp = 0;
+std::string     outputFile = "output.png";
+bool            batchDenoise = false;
+std::string     checkpointFile;
+float           checkpointInterval = 300.0f;
+bool            resumeRender = false;
+int             farmPort = 0;
+int             farmLocalWorkers = 0;
+std::string     farmWorkerAddress;
 
 Scene*			scene = nullptr;
 Renderer*		renderer = nullptr;
@@ -59,7 +83,7 @@ void LoadScene(const std::string& file)
 		useGLB = true;
 		LoadSceneFromGLTF(file.c_str(), scene);
 	}
-	else if (ext == "scene")
+	else if (ext == "scene" || ext == "json")
 	{
 		LoadSceneFromFile(file.c_str(), scene, renderOptions);
 	}
@@ -245,6 +269,20 @@ void OnGUI(float deltaTime)
 		optionsChanged |= ImGui::SliderInt("NumTilesY", &renderOptions.numTilesY, 1, 32);
 		optionsChanged |= ImGui::Checkbox("Use envmap", &renderOptions.useEnvMap);
 		optionsChanged |= ImGui::SliderFloat("HDR multiplier", &renderOptions.intensity, 0.1, 10);
+		optionsChanged |= ImGui::Combo("Sampler", &renderOptions.sampler, "Random\0Sobol + blue noise\0");
+		optionsChanged |= ImGui::Checkbox("Dynamic preview", &renderOptions.dynamicPreview);
+		optionsChanged |= ImGui::SliderFloat("Preview frame time (ms)", &renderOptions.previewFrameTime, 4.0f, 100.0f);
+		optionsChanged |= ImGui::Checkbox("Temporal reprojection", &renderOptions.temporalReprojection);
+		optionsChanged |= ImGui::SliderInt("Temporal history", &renderOptions.temporalHistory, 1, 64);
+		optionsChanged |= ImGui::Checkbox("Denoiser", &renderOptions.enableDenoiser);
+		optionsChanged |= ImGui::SliderInt("Denoiser iterations", &renderOptions.denoiserOptions.iterations, 1, 8);
+
+		// The encoding is baked into the shaders and scene textures, so switching it recreates the renderer
+		if (ImGui::Checkbox("Compressed geometry", &renderOptions.compressedGeometry))
+		{
+			scene->renderOptions = renderOptions;
+			InitRenderer();
+		}
 	}
 
 	if (ImGui::CollapsingHeader("Camera"))
@@ -367,6 +405,293 @@ void Usage()
 	printf("Main options:\n");
 	printf("  -h | -?               show help.\n");
 	printf("  -i <input>            input file name.\n");
+	printf("  -convergence <spp>    write RMSE vs spp of every sampler to convergence.csv and exit.\n");
+	printf("  -geometry-benchmark <spp>\n");
+	printf("                        time <spp> samples with full precision and compressed geometry and exit.\n");
+	printf("  -parse-benchmark <instances>\n");
+	printf("                        time parsing a generated scene with <instances> instances in both formats and exit.\n");
+	printf("  -spp <spp>            render <spp> samples per pixel, save the image and exit.\n");
+	printf("  -o <output>           image written by -spp (default output.png).\n");
+	printf("  -denoise              run the CPU denoiser on the image written by -spp.\n");
+	printf("  -checkpoint <file>    periodically save the -spp accumulation to <file>.\n");
+	printf("  -checkpoint-interval <seconds>\n");
+	printf("                        time between checkpoints (default 300).\n");
+	printf("  -resume               continue the -spp render from its -checkpoint file.\n");
+	printf("\n");
+	printf("Render farm:\n");
+	printf("  -farm <port>          coordinate a -spp render over TCP instead of rendering locally.\n");
+	printf("  -workers <count>      with -farm, also start <count> worker processes on this machine.\n");
+	printf("  -worker <host:port>   render tiles for the coordinator at <host:port> until it is done.\n");
+}
+
+// Steps the renderer until `spp` sample passes are accumulated, calling onPass at each pass boundary.
+// With restart false the accumulation already in the renderer (e.g. a resumed checkpoint) is continued.
+void AccumulatePasses(int sampler, int spp, const std::function<void(int)>& onPass, bool restart = true, Checkpoint* checkpoint = nullptr)
+{
+	scene->renderOptions.sampler = sampler;
+	scene->camera->isMoving = restart;
+
+	int completed = 0;
+	while (completed < spp)
+	{
+		scene->Update(0.0f);
+		renderer->Update(0.0f);
+
+		int passes = renderer->GetSampleCount() - 1;
+		if (passes > completed)
+		{
+			completed = passes;
+			onPass(completed);
+		}
+
+		renderer->Render();
+
+		if (checkpoint) {
+			checkpoint->Update();
+		}
+	}
+}
+
+float ComputeRMSE(const std::vector<float>& image, const std::vector<float>& reference)
+{
+	double sum = 0.0;
+	for (size_t i = 0; i < image.size(); i += 4)
+	{
+		for (int c = 0; c < 3; ++c)
+		{
+			double d = image[i + c] - reference[i + c];
+			sum += d * d;
+		}
+	}
+	return (float)sqrt(sum / (3.0 * (image.size() / 4)));
+}
+
+void RunConvergenceBenchmark(int maxSpp)
+{
+	int width;
+	int height;
+	std::vector<float> reference;
+	std::vector<float> image;
+
+	// The reference uses the random sampler: a Sobol reference would share its scramble and its first sample
+	// indices with the Sobol run it is compared against, and favour it. The random stream is never reseeded,
+	// so the random run that follows draws different samples too
+	printf("Convergence benchmark: rendering %d spp reference\n", maxSpp * 4);
+	AccumulatePasses(RandomSampler, maxSpp * 4, [&](int passes)
+	{
+		if (passes == maxSpp * 4) {
+			renderer->GetOutputBuffer(reference, width, height);
+		}
+	});
+
+	FILE* csv = fopen("convergence.csv", "w");
+	if (csv) {
+		fprintf(csv, "sampler,spp,rmse\n");
+	}
+
+	const char* samplerNames[] = { "random", "sobol" };
+	int samplers[] = { RandomSampler, SobolSampler };
+	for (int s = 0; s < 2; ++s)
+	{
+		AccumulatePasses(samplers[s], maxSpp, [&](int passes)
+		{
+			// Power-of-two sample counts keep the log-log plot evenly spaced
+			if ((passes & (passes - 1)) != 0 && passes != maxSpp) {
+				return;
+			}
+
+			renderer->GetOutputBuffer(image, width, height);
+			float rmse = ComputeRMSE(image, reference);
+			printf("%-8s %6d spp  RMSE %f\n", samplerNames[s], passes, rmse);
+			if (csv) {
+				fprintf(csv, "%s,%d,%f\n", samplerNames[s], passes, rmse);
+			}
+		});
+	}
+
+	if (csv) {
+		fclose(csv);
+	}
+}
+
+// Renders the same samples with both geometry encodings and compares their speed and image
+void RunGeometryBenchmark(int spp)
+{
+	int width;
+	int height;
+	std::vector<float> images[2];
+	double times[2];
+
+	const char* encodingNames[] = { "full precision", "compressed" };
+	for (int e = 0; e < 2; ++e)
+	{
+		scene->renderOptions.compressedGeometry = e == 1;
+		InitRenderer();
+
+		glFinish();
+		double start = glfwGetTime();
+		AccumulatePasses(scene->renderOptions.sampler, spp, [&](int passes)
+		{
+			if (passes == spp)
+			{
+				glFinish();
+				times[e] = glfwGetTime() - start;
+				renderer->GetOutputBuffer(images[e], width, height);
+			}
+		});
+
+		printf("%-15s %6d spp in %.2f s (%.2f ms per pass)\n", encodingNames[e], spp, times[e], times[e] * 1000.0 / spp);
+	}
+
+	printf("Compressed geometry: %.2fx the full precision render time, RMSE %f\n", times[1] / times[0], ComputeRMSE(images[1], images[0]));
+}
+
+// Writes the same generated scene as .scene and .json, and times ParseSceneFile() on both
+bool RunParseBenchmark(int instances)
+{
+	const int numMaterials = 256;
+	const int numMeshes    = 64;
+	const char* files[] = { "parse_benchmark.scene", "parse_benchmark.json" };
+
+	FILE* text = fopen(files[0], "w");
+	FILE* json = fopen(files[1], "w");
+	if (!text || !json)
+	{
+		printf("Couldn't write the benchmark scenes to the working directory\n");
+		if (text) fclose(text);
+		if (json) fclose(json);
+		return false;
+	}
+
+	fprintf(text, "Renderer\n{\n\tresolution 1280 720\n\tmaxDepth 4\n}\n\n");
+	fprintf(text, "Camera\n{\n\tposition 0 0 -100\n\tlookAt 0 0 0\n\tfov 45\n}\n\n");
+	fprintf(json, "{\n\"renderer\": { \"resolution\": [1280, 720], \"maxDepth\": 4 },\n");
+	fprintf(json, "\"camera\": { \"position\": [0, 0, -100], \"lookAt\": [0, 0, 0], \"fov\": 45 },\n\"materials\": [\n");
+
+	for (int i = 0; i < numMaterials; ++i)
+	{
+		float r = float(i % 16) / 15.0f;
+		float g = float(i / 16) / 15.0f;
+		fprintf(text, "material mat%d\n{\n\tcolor %f %f 0.5\n\troughness 0.5\n\tmetallic 0.1\n}\n\n", i, r, g);
+		fprintf(json, "{ \"name\": \"mat%d\", \"color\": [%f, %f, 0.5], \"roughness\": 0.5, \"metallic\": 0.1 }%s\n", i, r, g, i + 1 < numMaterials ? "," : "");
+	}
+
+	fprintf(json, "],\n\"meshes\": [\n");
+	for (int i = 0; i < instances; ++i)
+	{
+		float x = float(i % 100);
+		float y = float((i / 100) % 100);
+		float z = float(i / 10000);
+		fprintf(text, "mesh\n{\n\tfile meshes/mesh%d.obj\n\tmaterial mat%d\n\tposition %f %f %f\n\tscale 0.5 0.5 0.5\n}\n\n", i % numMeshes, i % numMaterials, x, y, z);
+		fprintf(json, "{ \"file\": \"meshes/mesh%d.obj\", \"material\": \"mat%d\", \"position\": [%f, %f, %f], \"scale\": [0.5, 0.5, 0.5] }%s\n",
+			i % numMeshes, i % numMaterials, x, y, z, i + 1 < instances ? "," : "");
+	}
+	fprintf(json, "]\n}\n");
+
+	fclose(text);
+	fclose(json);
+
+	bool success = true;
+	for (int f = 0; f < 2; ++f)
+	{
+		// ParseSceneFile() does not load the meshes, so the files referenced above need not exist
+		Scene* benchmarkScene = new Scene();
+		RenderOptions options;
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		bool parsed = ParseSceneFile(files[f], benchmarkScene, options);
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		if (parsed && benchmarkScene->meshInstances.size() == size_t(instances)) {
+			printf("%-22s %d instances in %.1f ms (%.0f instances/s)\n", files[f], instances, seconds * 1000.0, instances / seconds);
+		}
+		else
+		{
+			printf("%-22s failed to parse\n", files[f]);
+			success = false;
+		}
+
+		delete benchmarkScene;
+		remove(files[f]);
+	}
+
+	return success;
+}
+
+void WriteImage(const std::vector<float>& image, int width, int height);
+
+void RenderImage(int spp)
+{
+	int width;
+	int height;
+	std::vector<float> image;
+
+	Checkpoint* checkpoint = nullptr;
+	bool resumed = false;
+	if (!checkpointFile.empty())
+	{
+		checkpoint = new Checkpoint(scene, renderer, checkpointFile, checkpointInterval);
+		resumed = resumeRender && checkpoint->Resume();
+	}
+
+	printf("Rendering %d spp\n", spp);
+	AccumulatePasses(scene->renderOptions.sampler, spp, [&](int passes)
+	{
+		// A resumed render may already be past spp
+		if (passes >= spp && image.empty()) {
+			renderer->GetOutputBuffer(image, width, height);
+		}
+	}, !resumed, checkpoint);
+
+	if (checkpoint)
+	{
+		// Keep the finished accumulation, so the render can later be resumed with a higher -spp
+		checkpoint->Flush();
+		checkpoint->Save();
+		delete checkpoint;
+	}
+
+	if (batchDenoise)
+	{
+		std::vector<float> albedo;
+		std::vector<float> normal;
+		std::vector<float> denoised;
+		renderer->GetAovBuffers(albedo, normal, width, height);
+
+		double start = glfwGetTime();
+		Denoiser denoiser(scene->taskPool);
+		denoiser.Denoise(image, albedo, normal, width, height, scene->renderOptions.denoiserOptions, denoised);
+		printf("Denoised %dx%d in %.1f ms\n", width, height, (glfwGetTime() - start) * 1000.0);
+		image.swap(denoised);
+	}
+
+	WriteImage(image, width, height);
+}
+
+// Same tone mapping as Output.glsl; image is bottom-up like a GL readback
+void WriteImage(const std::vector<float>& image, int width, int height)
+{
+	std::vector<unsigned char> pixels(width * height * 3);
+	for (int y = 0; y < height; ++y)
+	{
+		for (int x = 0; x < width; ++x)
+		{
+			const float* c = &image[((height - 1 - y) * width + x) * 4];
+			float luminance = 0.3f * c[0] + 0.6f * c[1] + 0.1f * c[2];
+			for (int i = 0; i < 3; ++i)
+			{
+				float v = powf(c[i] / (1.0f + luminance / 1.5f), 1.0f / 2.2f);
+				pixels[(y * width + x) * 3 + i] = (unsigned char)MMath::Clamp(v * 255.0f + 0.5f, 0.0f, 255.0f);
+			}
+		}
+	}
+
+	if (!stbi_write_png(outputFile.c_str(), width, height, 3, &pixels[0], width * 3)) {
+		printf("Failed to write %s\n", outputFile.c_str());
+	}
+	else {
+		printf("Wrote %s\n", outputFile.c_str());
+	}
 }
 
 bool InitOpenGLResources()
@@ -403,6 +728,9 @@ bool InitOpenGLResources()
 		printf("Failed to initialize OpenGL loader!\n");
 		return false;
 	}
+
+	// Program binaries are an optional extension on the 3.3 context; without them shaders just compile every run
+	ShaderCache::LoadBinaryFunctions(glfwGetProcAddress);
     
     lastTime = glfwGetTime();
     
@@ -447,6 +775,12 @@ bool Cleanup()
 
 bool InitScene()
 {
+	if (!sceneFile.empty())
+	{
+		LoadScene(sceneFile);
+		return true;
+	}
+
 	sampleSceneIndex = 0;
 	LoadScene(sceneFiles[sampleSceneIndex]);
 
@@ -505,6 +839,84 @@ bool InitSceneFiles()
 	return true;
 }
 
+bool RunFarmCoordinator(const std::string& exePath)
+{
+	FarmSetup setup;
+	setup.sceneFile = sceneFile;
+	setup.width     = int(scene->renderOptions.frameSize.x);
+	setup.height    = int(scene->renderOptions.frameSize.y);
+	setup.numTilesX = scene->renderOptions.numTilesX;
+	setup.numTilesY = scene->renderOptions.numTilesY;
+	setup.maxDepth  = scene->renderOptions.maxDepth;
+	setup.sampler   = scene->renderOptions.sampler;
+	setup.useEnvMap = scene->renderOptions.useEnvMap;
+	setup.intensity = scene->renderOptions.intensity;
+
+	FarmOptions options;
+	options.port = farmPort;
+	options.spp  = batchSpp > 0 ? batchSpp : options.spp;
+
+	FarmCoordinator coordinator(setup, options);
+	if (farmLocalWorkers > 0 && !coordinator.SpawnLocalWorkers(exePath, farmLocalWorkers)) {
+		return false;
+	}
+
+	std::vector<float> image;
+	if (!coordinator.Run(image)) {
+		return false;
+	}
+
+	WriteImage(image, setup.width, setup.height);
+	return true;
+}
+
+bool RunFarmWorker()
+{
+	std::string::size_type colon = farmWorkerAddress.find_last_of(':');
+	if (colon == std::string::npos)
+	{
+		Usage();
+		return false;
+	}
+
+	FarmWorker worker;
+	FarmSetup setup;
+	if (!worker.Connect(farmWorkerAddress.substr(0, colon), atoi(farmWorkerAddress.c_str() + colon + 1), setup)) {
+		return false;
+	}
+
+	sceneFile = setup.sceneFile;
+	if (!InitScene()) {
+		return false;
+	}
+
+	scene->renderOptions.numTilesX = setup.numTilesX;
+	scene->renderOptions.numTilesY = setup.numTilesY;
+	scene->renderOptions.maxDepth  = setup.maxDepth;
+	scene->renderOptions.sampler   = setup.sampler;
+	scene->renderOptions.useEnvMap = setup.useEnvMap;
+	scene->renderOptions.intensity = setup.intensity;
+
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	if (!InitOpenGLResources() || !InitIMGUI()) {
+		return false;
+	}
+
+	// The hidden window's framebuffer may not match the coordinator's frame, e.g. on HiDPI displays
+	scene->renderOptions.frameSize = Vector2(setup.width, setup.height);
+
+	if (!InitRenderer()) {
+		return false;
+	}
+
+	scene->Update(0.0f);
+	renderer->Update(0.0f);
+
+	worker.Run(renderer);
+	Cleanup();
+	return true;
+}
+
 int main(int argc, char** argv)
 {
 	std::string exePath = argv[0];
@@ -519,13 +931,95 @@ int main(int argc, char** argv)
 	shaderDir = dirPath + "shaders/";
 	hdrResDir = assetsDir + "HDR/";
 
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if (arg == "-h" || arg == "-?")
+		{
+			Usage();
+			return 0;
+		}
+		else if (arg == "-i" && i + 1 < argc)
+		{
+			sceneFile = argv[++i];
+		}
+		else if (arg == "-convergence" && i + 1 < argc)
+		{
+			convergenceSpp = atoi(argv[++i]);
+		}
+		else if (arg == "-geometry-benchmark" && i + 1 < argc)
+		{
+			geometryBenchmarkSpp = atoi(argv[++i]);
+		}
+		else if (arg == "-parse-benchmark" && i + 1 < argc)
+		{
+			parseBenchmarkInstances = atoi(argv[++i]);
+		}
+		else if (arg == "-spp" && i + 1 < argc)
+		{
+			batchSpp = atoi(argv[++i]);
+		}
+		else if (arg == "-o" && i + 1 < argc)
+		{
+			outputFile = argv[++i];
+		}
+		else if (arg == "-denoise")
+		{
+			batchDenoise = true;
+		}
+		else if (arg == "-checkpoint" && i + 1 < argc)
+		{
+			checkpointFile = argv[++i];
+		}
+		else if (arg == "-checkpoint-interval" && i + 1 < argc)
+		{
+			checkpointInterval = float(atof(argv[++i]));
+		}
+		else if (arg == "-resume")
+		{
+			resumeRender = true;
+		}
+		else if (arg == "-farm" && i + 1 < argc)
+		{
+			farmPort = atoi(argv[++i]);
+		}
+		else if (arg == "-workers" && i + 1 < argc)
+		{
+			farmLocalWorkers = atoi(argv[++i]);
+		}
+		else if (arg == "-worker" && i + 1 < argc)
+		{
+			farmWorkerAddress = argv[++i];
+		}
+		else
+		{
+			Usage();
+			return 1;
+		}
+	}
+
 	if (!InitSceneFiles()) {
 		return 1;
 	}
 
+	if (!farmWorkerAddress.empty()) {
+		return RunFarmWorker() ? 0 : 1;
+	}
+
+	if (parseBenchmarkInstances > 0) {
+		return RunParseBenchmark(parseBenchmarkInstances) ? 0 : 1;
+	}
+
 	if (!InitScene()) {
 		return 1;
 	}
+
+	if (farmPort > 0)
+	{
+		bool success = RunFarmCoordinator(exePath);
+		delete scene;
+		return success ? 0 : 1;
+	}
     
 	if (!InitOpenGLResources()) {
 		return 1;
@@ -538,6 +1032,27 @@ int main(int argc, char** argv)
 	if (!InitRenderer()) {
 		return 1;
 	}
+
+	if (convergenceSpp > 0)
+	{
+		RunConvergenceBenchmark(convergenceSpp);
+		Cleanup();
+		return 0;
+	}
+
+	if (geometryBenchmarkSpp > 0)
+	{
+		RunGeometryBenchmark(geometryBenchmarkSpp);
+		Cleanup();
+		return 0;
+	}
+
+	if (batchSpp > 0)
+	{
+		RenderImage(batchSpp);
+		Cleanup();
+		return 0;
+	}
     
 	while (!glfwWindowShouldClose(glfwWindow)) {
 		MainLoop();
@@ -38,6 +38,9 @@ namespace RadeonRays
 		void ProcessTLAS();
 		void UpdateTLAS(const Bvh* topLevelBvh, const std::vector<GLSLPT::MeshInstance>& instances);
 		void Process(const Bvh* topLevelBvh, const std::vector<GLSLPT::Mesh*>& meshes, const std::vector<GLSLPT::MeshInstance>& instances);
+
+		// First node of each mesh's BLAS, in mesh order
+		const std::vector<int>& GetBLASRootIndices() const { return bvhRootStartIndices; }
 		
 	private:
 		int ProcessBLASNodes(const Bvh::Node* root);
@@ -0,0 +1,165 @@
+#include <algorithm>
+#include <cmath>
+
+#include "LightBvh.h"
+#include "math/Math.h"
+
+namespace GLSLPT
+{
+	void LightBvh::Build(std::vector<Light>& lights)
+	{
+		nodes.clear();
+		primitives.clear();
+		texWidth  = 0;
+		texHeight = 0;
+
+		if (lights.empty()) {
+			return;
+		}
+
+		primitives.resize(lights.size());
+		for (int i = 0; i < lights.size(); ++i)
+		{
+			const Light& light = lights[i];
+			Primitive& prim = primitives[i];
+
+			float luminance = 0.2126f * light.emission.x + 0.7152f * light.emission.y + 0.0722f * light.emission.z;
+			prim.power      = luminance * light.area * PI;
+			prim.lightIndex = i;
+
+			if (int(light.type) == QuadLight)
+			{
+				Vector3 p0 = light.position;
+				Vector3 p1 = light.position + light.u;
+				Vector3 p2 = light.position + light.v;
+				Vector3 p3 = light.position + light.u + light.v;
+				prim.bounds = Bounds3D(Vector3::Min(Vector3::Min(p0, p1), Vector3::Min(p2, p3)), Vector3::Max(Vector3::Max(p0, p1), Vector3::Max(p2, p3)));
+
+				// Quad lights emit on the side of cross(u, v) only
+				prim.cone.axis   = Vector3::CrossProduct(light.u, light.v).GetSafeNormal();
+				prim.cone.thetaO = 0.0f;
+				prim.cone.thetaE = 0.5f * PI;
+			}
+			else if (int(light.type) == TriangleLight)
+			{
+				Vector3 p0 = light.position;
+				Vector3 p1 = light.position + light.u;
+				Vector3 p2 = light.position + light.v;
+				prim.bounds = Bounds3D(Vector3::Min(Vector3::Min(p0, p1), p2), Vector3::Max(Vector3::Max(p0, p1), p2));
+
+				// Mesh emission is two-sided
+				prim.power      *= 2.0f;
+				prim.cone.axis   = Vector3::CrossProduct(light.u, light.v).GetSafeNormal();
+				prim.cone.thetaO = PI;
+				prim.cone.thetaE = 0.5f * PI;
+			}
+			else
+			{
+				Vector3 r = Vector3(light.radius);
+				prim.bounds = Bounds3D(light.position - r, light.position + r);
+
+				prim.cone.axis   = Vector3(0.0f, 1.0f, 0.0f);
+				prim.cone.thetaO = PI;
+				prim.cone.thetaE = 0.5f * PI;
+			}
+
+			// Pad so flat quads still give the shader's slab test a non-degenerate box
+			prim.bounds.min = prim.bounds.min - 1e-4f;
+			prim.bounds.max = prim.bounds.max + 1e-4f;
+			prim.centroid = prim.bounds.Center();
+		}
+
+		nodes.reserve(2 * lights.size() - 1);
+		BuildRecursive(lights, 0, int(primitives.size()), 0, 0);
+
+		int numNodes = int(nodes.size());
+		texWidth  = nodesPerRow * texelsPerNode;
+		texHeight = (numNodes + nodesPerRow - 1) / nodesPerRow;
+		nodes.resize(texHeight * nodesPerRow);
+	}
+
+	LightBvh::Cone LightBvh::Union(const Cone& a, const Cone& b)
+	{
+		if (b.thetaO > a.thetaO) {
+			return Union(b, a);
+		}
+
+		float thetaE = std::max(a.thetaE, b.thetaE);
+		float thetaD = acosf(MMath::Clamp(Vector3::DotProduct(a.axis, b.axis), -1.0f, 1.0f));
+
+		// b already lies inside a
+		if (std::min(thetaD + b.thetaO, PI) <= a.thetaO)
+		{
+			Cone result = a;
+			result.thetaE = thetaE;
+			return result;
+		}
+
+		Cone result;
+		result.thetaE = thetaE;
+		result.thetaO = 0.5f * (a.thetaO + thetaD + b.thetaO);
+
+		Vector3 perp = b.axis - a.axis * Vector3::DotProduct(a.axis, b.axis);
+		if (result.thetaO >= PI || perp.SizeSquared() < 1e-8f)
+		{
+			result.axis   = a.axis;
+			result.thetaO = PI;
+			return result;
+		}
+
+		// Rotate a's axis toward b's by the amount the spread grew
+		float thetaR = result.thetaO - a.thetaO;
+		result.axis = (a.axis * cosf(thetaR) + perp.GetSafeNormal() * sinf(thetaR)).GetSafeNormal();
+		return result;
+	}
+
+	int LightBvh::BuildRecursive(std::vector<Light>& lights, int begin, int end, unsigned int trail, int depth)
+	{
+		int index = int(nodes.size());
+		nodes.push_back(Node());
+
+		Bounds3D bounds = primitives[begin].bounds;
+		Bounds3D centroidBounds(primitives[begin].centroid);
+		Cone cone = primitives[begin].cone;
+		float power = 0.0f;
+
+		for (int i = begin; i < end; ++i)
+		{
+			bounds = Bounds3D::Union(bounds, primitives[i].bounds);
+			centroidBounds = Bounds3D::Union(centroidBounds, Bounds3D(primitives[i].centroid));
+			if (i > begin) {
+				cone = Union(cone, primitives[i].cone);
+			}
+			power += primitives[i].power;
+		}
+
+		Node& node = nodes[index];
+		node.bboxMinPower     = Vector4(bounds.min, power);
+		node.bboxMaxCosThetaO = Vector4(bounds.max, cosf(cone.thetaO));
+		node.axisCosThetaE    = Vector4(cone.axis, cosf(cone.thetaE));
+
+		if (end - begin == 1)
+		{
+			Light& light   = lights[primitives[begin].lightIndex];
+			light.bvhTrail = float(trail);
+			light.bvhDepth = float(depth);
+			light.power    = power;
+
+			nodes[index].children = Vector4(float(primitives[begin].lightIndex), 0.0f, 1.0f, int(light.type) == TriangleLight ? 0.0f : 1.0f);
+			return index;
+		}
+
+		// Median split on the longest centroid axis keeps the tree balanced, so trails fit in a float
+		int axis = centroidBounds.Maxdim();
+		int mid  = (begin + end) / 2;
+		std::nth_element(primitives.begin() + begin, primitives.begin() + mid, primitives.begin() + end,
+			[axis](const Primitive& a, const Primitive& b) { return a.centroid[axis] < b.centroid[axis]; });
+
+		int left  = BuildRecursive(lights, begin, mid, trail, depth + 1);
+		int right = BuildRecursive(lights, mid, end, trail | (1u << depth), depth + 1);
+
+		float intersectable = std::max(nodes[left].children.w, nodes[right].children.w);
+		nodes[index].children = Vector4(float(left), float(right), 0.0f, intersectable);
+		return index;
+	}
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#ifndef LIGHT_BVH_H
+#define LIGHT_BVH_H
+
+#include <vector>
+
+#include "core/Light.h"
+#include "math/Bounds3D.h"
+#include "math/Vector4.h"
+
+namespace GLSLPT
+{
+	// Light BVH with power and orientation-cone bounds (Estevez & Kulla, "Importance Sampling of
+	// Many Lights with Adaptive Tree Splitting"). The flattened tree is uploaded as an RGBA32F
+	// texture of texelsPerNode texels per node, nodesPerRow nodes per row.
+	class LightBvh
+	{
+	public:
+		static const int texelsPerNode = 4;
+		static const int nodesPerRow = 256;
+
+		// The lights texture also wraps, at lightsPerRow lights of sizeof(Light) / sizeof(Vector3) texels each
+		static const int lightsPerRow = 256;
+
+		struct Node
+		{
+			Vector4 bboxMinPower;     // xyz: bounds min, w: emitted power
+			Vector4 bboxMaxCosThetaO; // xyz: bounds max, w: cos of the normal-spread angle
+			Vector4 axisCosThetaE;    // xyz: orientation axis, w: cos of the emission angle
+			Vector4 children;         // x: left child (or light index for leaves), y: right child, z: 1 for leaves,
+			                          // w: 1 when the subtree has lights that rays intersect through the tree (not triangles)
+		};
+
+		// Builds the tree and writes each light's root-to-leaf trail and power back into lights
+		void Build(std::vector<Light>& lights);
+
+		std::vector<Node> nodes;
+		int texWidth = 0;
+		int texHeight = 0;
+
+	private:
+		struct Cone
+		{
+			Vector3 axis;
+			float thetaO;
+			float thetaE;
+		};
+
+		struct Primitive
+		{
+			Bounds3D bounds;
+			Vector3 centroid;
+			Cone cone;
+			float power;
+			int lightIndex;
+		};
+
+		static Cone Union(const Cone& a, const Cone& b);
+
+		int BuildRecursive(std::vector<Light>& lights, int begin, int end, unsigned int trail, int depth);
+
+		std::vector<Primitive> primitives;
+	};
+}
+
+#endif // LIGHT_BVH_H
@@ -0,0 +1,315 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <thread>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+#include "Checkpoint.h"
+#include "Scene.h"
+#include "Camera.h"
+#include "job/TaskThreadPool.h"
+#include "job/ThreadTask.h"
+
+namespace GLSLPT
+{
+	static const uint32_t checkpointMagic = 0x4B435047; // "GPCK"
+	static const uint32_t checkpointVersion = 1;
+
+	struct CheckpointHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint64_t sceneHash;
+		int32_t sampler;
+		uint32_t randomSeed;
+		int32_t width;
+		int32_t height;
+		int32_t numTilesX;
+		int32_t numTilesY;
+		int32_t tileX;
+		int32_t tileY;
+		int32_t sampleCounter;
+	};
+
+	static double Now()
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	// FNV-1a
+	static void HashBytes(uint64_t& hash, const void* data, size_t size)
+	{
+		const unsigned char* bytes = (const unsigned char*)data;
+		for (size_t i = 0; i < size; ++i)
+		{
+			hash ^= bytes[i];
+			hash *= 1099511628211ull;
+		}
+	}
+
+	template <typename T>
+	static void HashVector(uint64_t& hash, const std::vector<T>& data)
+	{
+		uint64_t size = data.size();
+		HashBytes(hash, &size, sizeof(size));
+		if (!data.empty()) {
+			HashBytes(hash, &data[0], data.size() * sizeof(T));
+		}
+	}
+
+	template <typename T>
+	static bool WriteVector(FILE* file, const std::vector<T>& data)
+	{
+		return data.empty() || fwrite(&data[0], sizeof(T), data.size(), file) == data.size();
+	}
+
+	template <typename T>
+	static bool ReadVector(FILE* file, std::vector<T>& data, size_t count)
+	{
+		data.resize(count);
+		return count == 0 || fread(&data[0], sizeof(T), count, file) == count;
+	}
+
+	class Checkpoint::WriteJob : public ThreadTask
+	{
+	public:
+		WriteJob(const std::string& file)
+			: file(file)
+			, written(false)
+			, done(false)
+		{
+
+		}
+
+		virtual void DoThreadedWork() override
+		{
+			std::string tempFile = file + ".tmp";
+			FILE* output = fopen(tempFile.c_str(), "wb");
+			if (output)
+			{
+				written = fwrite(&header, sizeof(header), 1, output) == 1
+					&& WriteVector(output, state.tileSamples)
+					&& WriteVector(output, state.accumulation)
+					&& WriteVector(output, state.albedo)
+					&& WriteVector(output, state.normal);
+
+				written = fflush(output) == 0 && written;
+				fclose(output);
+
+				// The rename is what makes the new checkpoint visible; until then the previous one stays intact
+#if defined(_WIN32)
+				written = written && MoveFileExA(tempFile.c_str(), file.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+#else
+				written = written && rename(tempFile.c_str(), file.c_str()) == 0;
+#endif
+				if (!written) {
+					remove(tempFile.c_str());
+				}
+			}
+
+			done = true;
+		}
+
+		virtual void Abandon() override
+		{
+
+		}
+
+		std::string file;
+		CheckpointHeader header;
+		RenderState state;
+		bool written;
+		bool done;
+	};
+
+	Checkpoint::Checkpoint(Scene* scene, Renderer* renderer, const std::string& file, float interval)
+		: scene(scene)
+		, renderer(renderer)
+		, file(file)
+		, interval(interval)
+		, lastSave(Now())
+		, sceneHash(HashScene(scene))
+		, pendingWrite(nullptr)
+	{
+
+	}
+
+	Checkpoint::~Checkpoint()
+	{
+		Flush();
+	}
+
+	uint64_t Checkpoint::HashScene(Scene* scene)
+	{
+		uint64_t hash = 14695981039346656037ull;
+
+		HashVector(hash, scene->vertIndices);
+		HashVector(hash, scene->verticesUVX);
+		HashVector(hash, scene->normalsUVY);
+		HashVector(hash, scene->transforms);
+		HashVector(hash, scene->materials);
+		HashVector(hash, scene->lights);
+		HashVector(hash, scene->textureMapsArray);
+		HashBytes(hash, scene->hdrFile.c_str(), scene->hdrFile.size());
+
+		Camera* camera = scene->camera;
+		Vector3 position = camera->GetPosition();
+		Vector3 forward  = camera->GetForward();
+		Vector3 up       = camera->GetUp();
+		float lens[3]    = { camera->GetFov(), camera->focalDist, camera->aperture };
+		HashBytes(hash, &position, sizeof(position));
+		HashBytes(hash, &forward, sizeof(forward));
+		HashBytes(hash, &up, sizeof(up));
+		HashBytes(hash, lens, sizeof(lens));
+
+		// Only the options that change the accumulated image
+		const RenderOptions& options = scene->renderOptions;
+		int ints[4]     = { options.maxDepth, options.sampler, options.useEnvMap ? 1 : 0, options.compressedGeometry ? 1 : 0 };
+		float floats[3] = { options.frameSize.x, options.frameSize.y, options.intensity };
+		HashBytes(hash, ints, sizeof(ints));
+		HashBytes(hash, floats, sizeof(floats));
+
+		return hash;
+	}
+
+	bool Checkpoint::Resume()
+	{
+		FILE* input = fopen(file.c_str(), "rb");
+		if (!input)
+		{
+			printf("Checkpoint: no checkpoint at %s, starting from scratch\n", file.c_str());
+			return false;
+		}
+
+		CheckpointHeader header;
+		RenderState state;
+		bool valid = fread(&header, sizeof(header), 1, input) == 1
+			&& header.magic == checkpointMagic && header.version == checkpointVersion;
+
+		if (valid && header.sceneHash != sceneHash)
+		{
+			printf("Checkpoint: %s was rendered from a different scene or settings, ignoring it\n", file.c_str());
+			fclose(input);
+			return false;
+		}
+
+		if (valid && header.width > 0 && header.height > 0 && header.numTilesX > 0 && header.numTilesY > 0)
+		{
+			size_t pixels = size_t(header.width) * header.height * 4;
+			state.width         = header.width;
+			state.height        = header.height;
+			state.numTilesX     = header.numTilesX;
+			state.numTilesY     = header.numTilesY;
+			state.tileX         = header.tileX;
+			state.tileY         = header.tileY;
+			state.sampleCounter = header.sampleCounter;
+
+			valid = ReadVector(input, state.tileSamples, size_t(header.numTilesX) * header.numTilesY)
+				&& ReadVector(input, state.accumulation, pixels)
+				&& ReadVector(input, state.albedo, pixels)
+				&& ReadVector(input, state.normal, pixels);
+		}
+		else
+		{
+			valid = false;
+		}
+
+		fclose(input);
+
+		if (!valid || !renderer->SetState(state))
+		{
+			printf("Checkpoint: %s is corrupt or does not match the frame layout, ignoring it\n", file.c_str());
+			return false;
+		}
+
+		// Same seed the interrupted run switched to when it wrote this checkpoint
+		srand(header.randomSeed);
+		lastSave = Now();
+
+		printf("Checkpoint: resumed %s at %d samples, tile (%d, %d)\n", file.c_str(), state.sampleCounter - 1, state.tileX, state.tileY);
+		return true;
+	}
+
+	void Checkpoint::Update()
+	{
+		if (pendingWrite && pendingWrite->done) {
+			Flush();
+		}
+
+		if (Now() - lastSave >= interval) {
+			Save();
+		}
+	}
+
+	void Checkpoint::Save()
+	{
+		if (pendingWrite) {
+			return;
+		}
+
+		WriteJob* job = new WriteJob(file);
+		if (!renderer->GetState(job->state))
+		{
+			delete job;
+			return;
+		}
+
+		CheckpointHeader& header = job->header;
+		header.magic         = checkpointMagic;
+		header.version       = checkpointVersion;
+		header.sceneHash     = sceneHash;
+		header.sampler       = scene->renderOptions.sampler;
+		header.width         = job->state.width;
+		header.height        = job->state.height;
+		header.numTilesX     = job->state.numTilesX;
+		header.numTilesY     = job->state.numTilesY;
+		header.tileX         = job->state.tileX;
+		header.tileY         = job->state.tileY;
+		header.sampleCounter = job->state.sampleCounter;
+
+		// Reseed the CPU random stream (used by the legacy sampler) from here on, so a resumed
+		// run draws the same numbers this one will
+		header.randomSeed = uint32_t(header.sampleCounter) * 65537u + uint32_t(header.tileY * header.numTilesX + header.tileX);
+		srand(header.randomSeed);
+
+		lastSave = Now();
+
+		if (scene->taskPool)
+		{
+			pendingWrite = job;
+			scene->taskPool->AddTask(job);
+		}
+		else
+		{
+			job->DoThreadedWork();
+			pendingWrite = job;
+			Flush();
+		}
+	}
+
+	void Checkpoint::Flush()
+	{
+		if (!pendingWrite) {
+			return;
+		}
+
+		while (!pendingWrite->done) {
+			std::this_thread::yield();
+		}
+
+		if (pendingWrite->written) {
+			printf("Checkpoint: saved %d samples to %s\n", pendingWrite->header.sampleCounter - 1, file.c_str());
+		}
+		else {
+			printf("Checkpoint: failed to write %s\n", file.c_str());
+		}
+
+		delete pendingWrite;
+		pendingWrite = nullptr;
+	}
+}
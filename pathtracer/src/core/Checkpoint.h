@@ -0,0 +1,47 @@
+#pragma once
+
+#include <string>
+#include <stdint.h>
+
+#include "Renderer.h"
+
+namespace GLSLPT
+{
+	class Scene;
+
+	// Periodically saves the renderer's accumulation to disk so a long render can be resumed after
+	// the process dies. The GPU readback happens on the render thread; the file is written on the
+	// scene's task pool to a temporary file that is renamed over the checkpoint once complete.
+	class Checkpoint
+	{
+	public:
+		Checkpoint(Scene* scene, Renderer* renderer, const std::string& file, float interval);
+		~Checkpoint();
+
+		// Restores the renderer from the checkpoint file when it exists and matches the scene
+		bool Resume();
+
+		// Call after Renderer::Render(); saves once the interval has elapsed
+		void Update();
+
+		// Starts a save now, unless the previous one is still being written
+		void Save();
+
+		// Blocks until the pending write, if any, is on disk
+		void Flush();
+
+		static uint64_t HashScene(Scene* scene);
+
+	private:
+		class WriteJob;
+
+		Scene* scene;
+		Renderer* renderer;
+		std::string file;
+		float interval;
+		double lastSave;
+		uint64_t sceneHash;
+
+		WriteJob* pendingWrite;
+	};
+}
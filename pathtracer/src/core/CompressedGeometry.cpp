@@ -0,0 +1,178 @@
+#include <math.h>
+#include <string.h>
+
+#include "CompressedGeometry.h"
+#include "Scene.h"
+
+namespace GLSLPT
+{
+	static const float quantizedMax = 65535.0f;
+
+	static void MakeFrame(const Vector3& boundsMin, const Vector3& boundsMax, Vector3& origin, Vector3& scale)
+	{
+		origin = boundsMin;
+		for (int i = 0; i < 3; ++i) {
+			scale[i] = boundsMax[i] > boundsMin[i] ? (boundsMax[i] - boundsMin[i]) / quantizedMax : 0.0f;
+		}
+	}
+
+	// The loops redo the shader's decode in float, so the decoded box always contains the original
+	static uint32_t QuantizeDown(float value, float origin, float scale)
+	{
+		if (scale == 0.0f) {
+			return 0;
+		}
+
+		float q = floorf((value - origin) / scale);
+		q = q < 0.0f ? 0.0f : (q > quantizedMax ? quantizedMax : q);
+		while (q > 0.0f && origin + q * scale > value) {
+			q -= 1.0f;
+		}
+		return uint32_t(q);
+	}
+
+	static uint32_t QuantizeUp(float value, float origin, float scale)
+	{
+		if (scale == 0.0f) {
+			return 0;
+		}
+
+		float q = ceilf((value - origin) / scale);
+		q = q < 0.0f ? 0.0f : (q > quantizedMax ? quantizedMax : q);
+		while (q < quantizedMax && origin + q * scale < value) {
+			q += 1.0f;
+		}
+		return uint32_t(q);
+	}
+
+	uint16_t CompressedGeometry::FloatToHalf(float value)
+	{
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+
+		uint32_t sign     = (bits >> 16) & 0x8000;
+		int exponent      = int((bits >> 23) & 0xFF) - 127 + 15;
+		uint32_t mantissa = bits & 0x7FFFFF;
+
+		// Denormals flush to zero and overflow clamps to the largest half, matching HalfToFloat() in the shader
+		if (exponent <= 0) {
+			return uint16_t(sign);
+		}
+		if (exponent >= 31) {
+			return uint16_t(sign | 0x7BFF);
+		}
+
+		uint32_t half = sign | (uint32_t(exponent) << 10) | (mantissa >> 13);
+		if (mantissa & 0x1000) {
+			half++;
+		}
+		if ((half & 0x7FFF) >= 0x7C00) {
+			half = sign | 0x7BFF;
+		}
+		return uint16_t(half);
+	}
+
+	uint32_t CompressedGeometry::EncodeNormal(const Vector3& normal)
+	{
+		float l1 = fabsf(normal.x) + fabsf(normal.y) + fabsf(normal.z);
+		float x = 0.0f;
+		float y = 0.0f;
+
+		if (l1 > 0.0f)
+		{
+			x = normal.x / l1;
+			y = normal.y / l1;
+
+			// Fold the lower hemisphere over the diagonals of the octahedron
+			if (normal.z < 0.0f)
+			{
+				float fx = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+				float fy = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+				x = fx;
+				y = fy;
+			}
+		}
+
+		int16_t sx = int16_t(roundf(fminf(fmaxf(x, -1.0f), 1.0f) * 32767.0f));
+		int16_t sy = int16_t(roundf(fminf(fmaxf(y, -1.0f), 1.0f) * 32767.0f));
+		return uint32_t(uint16_t(sx)) | (uint32_t(uint16_t(sy)) << 16);
+	}
+
+	void CompressedGeometry::EncodeNodes(const Scene& scene, int first, int last, const Vector3& boundsMin, const Vector3& boundsMax)
+	{
+		const RadeonRays::BvhTranslator& bvh = scene.bvhTranslator;
+
+		Vector3 origin;
+		Vector3 scale;
+		MakeFrame(boundsMin, boundsMax, origin, scale);
+
+		for (int node = first; node < last; ++node)
+		{
+			for (int i = 0; i < 3; ++i)
+			{
+				uint32_t qmin = QuantizeDown(bvh.bboxmin[node][i], origin[i], scale[i]);
+				uint32_t qmax = QuantizeUp(bvh.bboxmax[node][i], origin[i], scale[i]);
+				bounds[node * 3 + i] = qmin | (qmax << 16);
+			}
+		}
+	}
+
+	void CompressedGeometry::EncodeFrames(const Scene& scene)
+	{
+		const RadeonRays::BvhTranslator& bvh = scene.bvhTranslator;
+		const std::vector<int>& roots = bvh.GetBLASRootIndices();
+
+		frames.resize(2 * (scene.meshInstances.size() + 1));
+
+		Vector3 origin;
+		Vector3 scale;
+		MakeFrame(bvh.bboxmin[bvh.topLevelIndex], bvh.bboxmax[bvh.topLevelIndex], origin, scale);
+		frames[0] = Vector4(origin, 0.0f);
+		frames[1] = Vector4(scale, 0.0f);
+
+		// Instance leaves store -(instance + 1), which is directly the index of their frame
+		for (size_t i = 0; i < scene.meshInstances.size(); ++i)
+		{
+			int root = roots[scene.meshInstances[i].meshID];
+			MakeFrame(bvh.bboxmin[root], bvh.bboxmax[root], origin, scale);
+			frames[2 * (i + 1) + 0] = Vector4(origin, 0.0f);
+			frames[2 * (i + 1) + 1] = Vector4(scale, 0.0f);
+		}
+	}
+
+	void CompressedGeometry::Build(const Scene& scene)
+	{
+		size_t numVertices = scene.verticesUVX.size();
+		positions.resize(numVertices);
+		normalsUV.resize(numVertices * 2);
+
+		for (size_t i = 0; i < numVertices; ++i)
+		{
+			const Vector4& v = scene.verticesUVX[i];
+			const Vector4& n = scene.normalsUVY[i];
+			positions[i] = Vector3(v);
+			normalsUV[i * 2 + 0] = EncodeNormal(Vector3(n));
+			normalsUV[i * 2 + 1] = uint32_t(FloatToHalf(v.w)) | (uint32_t(FloatToHalf(n.w)) << 16);
+		}
+
+		const RadeonRays::BvhTranslator& bvh = scene.bvhTranslator;
+		const std::vector<int>& roots = bvh.GetBLASRootIndices();
+		bounds.assign(bvh.nodes.size() * 3, 0);
+
+		// Each BLAS occupies the nodes up to the next root; the TLAS comes last
+		for (size_t i = 0; i < roots.size(); ++i)
+		{
+			int last = i + 1 < roots.size() ? roots[i + 1] : bvh.topLevelIndex;
+			EncodeNodes(scene, roots[i], last, bvh.bboxmin[roots[i]], bvh.bboxmax[roots[i]]);
+		}
+
+		UpdateTLAS(scene);
+	}
+
+	void CompressedGeometry::UpdateTLAS(const Scene& scene)
+	{
+		const RadeonRays::BvhTranslator& bvh = scene.bvhTranslator;
+		EncodeNodes(scene, bvh.topLevelIndex, int(bvh.nodes.size()), bvh.bboxmin[bvh.topLevelIndex], bvh.bboxmax[bvh.topLevelIndex]);
+		EncodeFrames(scene);
+	}
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+
+#include "math/Vector3.h"
+#include "math/Vector4.h"
+
+namespace GLSLPT
+{
+	class Scene;
+
+	// Reduced precision GPU encodings of the scene geometry, used when RenderOptions::compressedGeometry
+	// is set (the shaders are then compiled with COMPRESSED_GEOMETRY, see shaders/common/CompressedGeometry.glsl).
+	//
+	// - Vertices: RGB32F positions; the uv moves next to the normal.
+	// - Normals: RG32UI, an octahedral normal as 2 x snorm16 and the uv as 2 x half.
+	// - Node bounds: RGB32UI, 16 bits per coordinate relative to the bounds of the enclosing tree
+	//   (the TLAS, or the BLAS of the instance being traversed), rounded outwards.
+	// - Bounds frames: RGBA32F origin/scale pairs, the TLAS first and then one per instance.
+	//
+	// The BVH links and vertex indices keep their full precision layout.
+	struct CompressedGeometry
+	{
+		void Build(const Scene& scene);
+
+		// Re-encodes the top level nodes and the frames after Scene::RebuildInstancesData()
+		void UpdateTLAS(const Scene& scene);
+
+		bool IsBuilt() const { return !positions.empty(); }
+
+		std::vector<Vector3>  positions;
+		std::vector<uint32_t> normalsUV;
+		std::vector<uint32_t> bounds;
+		std::vector<Vector4>  frames;
+
+		static uint16_t FloatToHalf(float value);
+		static uint32_t EncodeNormal(const Vector3& normal);
+
+	private:
+		void EncodeNodes(const Scene& scene, int first, int last, const Vector3& boundsMin, const Vector3& boundsMax);
+		void EncodeFrames(const Scene& scene);
+	};
+}
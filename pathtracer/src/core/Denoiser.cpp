@@ -0,0 +1,228 @@
+#include <algorithm>
+#include <cmath>
+
+#include "Denoiser.h"
+#include "job/TaskThreadPool.h"
+#include "job/ThreadTask.h"
+
+namespace GLSLPT
+{
+	static const float kernel[3] = { 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+
+	// Accumulates one kernel tap for pixels [xBegin, xEnd) of row y, reading row yy shifted by offset.
+	// Only the image borders need ClampX; the interior reads stay contiguous so the loop vectorises.
+	template <bool ClampX>
+	static void AccumulateTap(const std::vector<float>* planes, int width, int y, int yy, int offset, int xBegin, int xEnd,
+		float h, float invColorPhi, float invNormalPhi, float invAlbedoPhi, float* sum)
+	{
+		const float* cR = &planes[0][0];
+		const float* cG = &planes[1][0];
+		const float* cB = &planes[2][0];
+		const float* aR = &planes[3][0];
+		const float* aG = &planes[4][0];
+		const float* aB = &planes[5][0];
+		const float* nX = &planes[6][0];
+		const float* nY = &planes[7][0];
+		const float* nZ = &planes[8][0];
+
+		float* sR = sum;
+		float* sG = sum + width;
+		float* sB = sum + width * 2;
+		float* sW = sum + width * 3;
+
+		int row    = y * width;
+		int tapRow = yy * width;
+
+		for (int x = xBegin; x < xEnd; ++x)
+		{
+			int xx = ClampX ? std::min(std::max(x + offset, 0), width - 1) : x + offset;
+			int p = row + x;
+			int q = tapRow + xx;
+
+			float dcR = cR[q] - cR[p];
+			float dcG = cG[q] - cG[p];
+			float dcB = cB[q] - cB[p];
+			float daR = aR[q] - aR[p];
+			float daG = aG[q] - aG[p];
+			float daB = aB[q] - aB[p];
+			float dnX = nX[q] - nX[p];
+			float dnY = nY[q] - nY[p];
+			float dnZ = nZ[q] - nZ[p];
+
+			float dc = dcR * dcR + dcG * dcG + dcB * dcB;
+			float da = daR * daR + daG * daG + daB * daB;
+			float dn = dnX * dnX + dnY * dnY + dnZ * dnZ;
+
+			float w = h * expf(-(dc * invColorPhi + dn * invNormalPhi + da * invAlbedoPhi));
+
+			sR[x] += cR[q] * w;
+			sG[x] += cG[q] * w;
+			sB[x] += cB[q] * w;
+			sW[x] += w;
+		}
+	}
+
+	Denoiser::Denoiser(TaskThreadPool* taskPool)
+		: taskPool(taskPool)
+		, width(0)
+		, height(0)
+		, colorPhi(0.0f)
+	{
+
+	}
+
+	void Denoiser::Denoise(const std::vector<float>& color, const std::vector<float>& albedo, const std::vector<float>& normal,
+		int inWidth, int inHeight, const DenoiserOptions& inOptions, std::vector<float>& output)
+	{
+		width   = inWidth;
+		height  = inHeight;
+		options = inOptions;
+
+		int numPixels = width * height;
+		for (int i = 0; i < 9; ++i) {
+			planes[i].resize(numPixels);
+		}
+		for (int i = 0; i < 3; ++i) {
+			filtered[i].resize(numPixels);
+		}
+
+		for (int i = 0; i < numPixels; ++i)
+		{
+			planes[0][i] = color[i * 4 + 0];
+			planes[1][i] = color[i * 4 + 1];
+			planes[2][i] = color[i * 4 + 2];
+
+			float count = std::max(albedo[i * 4 + 3], 1.0f);
+			planes[3][i] = albedo[i * 4 + 0] / count;
+			planes[4][i] = albedo[i * 4 + 1] / count;
+			planes[5][i] = albedo[i * 4 + 2] / count;
+
+			float nx  = normal[i * 4 + 0];
+			float ny  = normal[i * 4 + 1];
+			float nz  = normal[i * 4 + 2];
+			float len = sqrtf(nx * nx + ny * ny + nz * nz);
+			float inv = len > 0.0f ? 1.0f / len : 0.0f;
+			planes[6][i] = nx * inv;
+			planes[7][i] = ny * inv;
+			planes[8][i] = nz * inv;
+		}
+
+		class FilterJob : public ThreadTask
+		{
+		public:
+			FilterJob(Denoiser* denoiser, int iteration, int rowBegin, int rowEnd)
+				: denoiser(denoiser)
+				, iteration(iteration)
+				, rowBegin(rowBegin)
+				, rowEnd(rowEnd)
+				, done(false)
+			{
+
+			}
+
+			virtual void DoThreadedWork() override
+			{
+				denoiser->FilterRows(iteration, rowBegin, rowEnd);
+				done = true;
+			}
+
+			virtual void Abandon() override
+			{
+
+			}
+
+			Denoiser* denoiser;
+			int iteration;
+			int rowBegin;
+			int rowEnd;
+			bool done;
+		};
+
+		int numBands = taskPool ? std::max(1, std::min(height, taskPool->GetNumThreads() * 2)) : 1;
+
+		for (int iteration = 0; iteration < options.iterations; ++iteration)
+		{
+			// The color edge-stopping function tightens as the filter footprint grows
+			colorPhi = options.colorPhi * powf(2.0f, -float(iteration));
+
+			if (numBands == 1)
+			{
+				FilterRows(iteration, 0, height);
+			}
+			else
+			{
+				std::vector<FilterJob*> jobs(numBands);
+				for (int i = 0; i < numBands; ++i)
+				{
+					jobs[i] = new FilterJob(this, iteration, height * i / numBands, height * (i + 1) / numBands);
+					taskPool->AddTask(jobs[i]);
+				}
+
+				while (jobs.size() > 0)
+				{
+					for (int i = jobs.size() - 1; i >= 0; --i)
+					{
+						if (jobs[i]->done)
+						{
+							delete jobs[i];
+							jobs.erase(jobs.begin() + i);
+						}
+					}
+				}
+			}
+
+			for (int i = 0; i < 3; ++i) {
+				planes[i].swap(filtered[i]);
+			}
+		}
+
+		output.resize(numPixels * 4);
+		for (int i = 0; i < numPixels; ++i)
+		{
+			output[i * 4 + 0] = planes[0][i];
+			output[i * 4 + 1] = planes[1][i];
+			output[i * 4 + 2] = planes[2][i];
+			output[i * 4 + 3] = 1.0f;
+		}
+	}
+
+	void Denoiser::FilterRows(int iteration, int rowBegin, int rowEnd)
+	{
+		int step = 1 << iteration;
+		float invColorPhi  = 1.0f / colorPhi;
+		float invNormalPhi = 1.0f / options.normalPhi;
+		float invAlbedoPhi = 1.0f / options.albedoPhi;
+
+		std::vector<float> sum(width * 4);
+
+		for (int y = rowBegin; y < rowEnd; ++y)
+		{
+			std::fill(sum.begin(), sum.end(), 0.0f);
+
+			for (int ky = -2; ky <= 2; ++ky)
+			{
+				int yy = std::min(std::max(y + ky * step, 0), height - 1);
+
+				for (int kx = -2; kx <= 2; ++kx)
+				{
+					int offset = kx * step;
+					float h    = kernel[std::abs(kx)] * kernel[std::abs(ky)];
+					int xBegin = std::min(std::max(-offset, 0), width);
+					int xEnd   = std::max(std::min(width - offset, width), xBegin);
+
+					AccumulateTap<true>(planes, width, y, yy, offset, 0, xBegin, h, invColorPhi, invNormalPhi, invAlbedoPhi, &sum[0]);
+					AccumulateTap<false>(planes, width, y, yy, offset, xBegin, xEnd, h, invColorPhi, invNormalPhi, invAlbedoPhi, &sum[0]);
+					AccumulateTap<true>(planes, width, y, yy, offset, xEnd, width, h, invColorPhi, invNormalPhi, invAlbedoPhi, &sum[0]);
+				}
+			}
+
+			for (int x = 0; x < width; ++x)
+			{
+				float inv = 1.0f / sum[width * 3 + x];
+				filtered[0][y * width + x] = sum[x] * inv;
+				filtered[1][y * width + x] = sum[width + x] * inv;
+				filtered[2][y * width + x] = sum[width * 2 + x] * inv;
+			}
+		}
+	}
+}
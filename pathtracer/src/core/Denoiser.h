@@ -0,0 +1,50 @@
+#pragma once
+
+#include <vector>
+
+class TaskThreadPool;
+
+namespace GLSLPT
+{
+	struct DenoiserOptions
+	{
+		DenoiserOptions()
+		{
+			iterations = 5;
+			colorPhi   = 0.5f;
+			normalPhi  = 0.1f;
+			albedoPhi  = 0.1f;
+		}
+
+		int iterations;
+		float colorPhi;
+		float normalPhi;
+		float albedoPhi;
+	};
+
+	// CPU counterpart of shaders/common/Denoise.glsl: an edge-avoiding a-trous wavelet filter
+	// guided by albedo and normal AOVs. Images are RGBA32F as read back from the renderer;
+	// albedo alpha holds the sample count and normals need not be normalised.
+	class Denoiser
+	{
+	public:
+		Denoiser(TaskThreadPool* taskPool);
+
+		void Denoise(const std::vector<float>& color, const std::vector<float>& albedo, const std::vector<float>& normal,
+			int width, int height, const DenoiserOptions& options, std::vector<float>& output);
+
+	private:
+		void FilterRows(int iteration, int rowBegin, int rowEnd);
+
+		TaskThreadPool* taskPool;
+
+		// Planar (SoA) copies so the inner loops run over contiguous floats and vectorise
+		std::vector<float> planes[9];
+		std::vector<float> filtered[3];
+
+		int width;
+		int height;
+		float colorPhi;
+		DenoiserOptions options;
+	};
+}
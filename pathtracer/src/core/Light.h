@@ -7,7 +7,10 @@ namespace GLSLPT
 	enum LightType
 	{
 		QuadLight,
-		SphereLight
+		SphereLight,
+		// A triangle of an emissive mesh instance, created by Scene::CreateMeshLights: position is the
+		// first vertex and u/v the two edges from it, in world space. Emits on both sides like mesh emission.
+		TriangleLight
 	};
 
 	struct Light
@@ -20,5 +23,10 @@ namespace GLSLPT
 		float radius;
 		float area;
 		float type;
+
+		// Filled by Scene::CreateLightBvh: path from the light BVH root (bit i set = right child at depth i)
+		float bvhTrail;
+		float bvhDepth;
+		float power;
 	};
 }
@@ -4,12 +4,16 @@
 
 namespace GLSLPT
 {
-    Program::Program(const std::vector<Shader>& shaders)
+    Program::Program(const std::vector<Shader>& shaders, BeforeLinkFunc beforeLink)
     {
         m_Object = glCreateProgram();
 		for (unsigned i = 0; i < shaders.size(); i++) {
 			glAttachShader(m_Object, shaders[i].Object());
 		}
+
+		if (beforeLink) {
+			beforeLink(m_Object);
+		}
         
         glLinkProgram(m_Object);
 		printf("Linking program %d\n", int(m_Object));
@@ -34,6 +38,12 @@ namespace GLSLPT
         }
     }
 
+    Program::Program(GLuint object)
+        : m_Object(object)
+    {
+
+    }
+
     Program::~Program()
     {
         glDeleteProgram(m_Object);
@@ -9,7 +9,11 @@ namespace GLSLPT
     class Program
     {
     public:
-        Program(const std::vector<Shader>& shaders);
+        // beforeLink runs on the new program object after the shaders are attached, e.g. to set program parameters
+        typedef void (*BeforeLinkFunc)(GLuint program);
+        Program(const std::vector<Shader>& shaders, BeforeLinkFunc beforeLink = nullptr);
+        // Takes ownership of an already linked program object, e.g. one restored by ShaderCache
+        explicit Program(GLuint object);
         ~Program();
 
         void Active();
@@ -1,15 +1,33 @@
 #include "glad/glad.h"
 
 #include "Renderer.h"
+#include "ShaderCache.h"
 #include "Scene.h"
 
 namespace GLSLPT
 {
-    Program* LoadShaders(const std::string& vertFileName, const std::string& fragFileName)
+    void GenTexture2D(GLuint& target, GLint internalformat, GLenum format, GLenum type, int width, int height, void* data)
+    {
+        glGenTextures(1, &target);
+        glBindTexture(GL_TEXTURE_2D, target);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalformat, width, height, 0, format, type, data);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    static size_t TextureBytes(GfxTexture* texture, size_t texelBytes)
+    {
+        return texture ? size_t(texture->GetWidth()) * texture->GetHeight() * texture->GetDepth() * texelBytes : 0;
+    }
+
+    Program* LoadShaders(const std::string& vertFileName, const std::string& fragFileName, const std::string& defines)
     {
         std::vector<Shader> shaders;
-        shaders.push_back(Shader(vertFileName, GL_VERTEX_SHADER));
-        shaders.push_back(Shader(fragFileName, GL_FRAGMENT_SHADER));
+        shaders.push_back(Shader(vertFileName, GL_VERTEX_SHADER, defines));
+        shaders.push_back(Shader(fragFileName, GL_FRAGMENT_SHADER, defines));
         return new Program(shaders);
     }
     
@@ -48,6 +66,10 @@ namespace GLSLPT
         if (lightsTex) {
             delete lightsTex;
         }
+
+        if (lightBvhTex) {
+            delete lightBvhTex;
+        }
         
         if (textureMapsArrayTex) {
             delete textureMapsArrayTex;
@@ -64,6 +86,13 @@ namespace GLSLPT
         if (hdrConditionalDistTex) {
             delete hdrConditionalDistTex;
         }
+
+        if (blueNoiseTex) {
+            delete blueNoiseTex;
+        }
+
+        delete shaderCache;
+        shaderCache = nullptr;
         
         initialized = false;
 		printf("Renderer disposed!\n");
@@ -82,33 +111,65 @@ namespace GLSLPT
         }
 
         quad = new Quad();
+        shaderCache = new ShaderCache(shadersDirectory + "cache/");
 
 		// Create texture for BVH Tree
         bvhTex = new GfxTexture(GL_TEXTURE_2D, GL_RGB32I, GL_RGB_INTEGER, GL_INT, scene->bvhTranslator.nodeTexWidth, scene->bvhTranslator.nodeTexWidth, 1, &scene->bvhTranslator.nodes[0]);
 		
-		// Create texture for Bounding boxes
-        aabbMinTex = new GfxTexture(GL_TEXTURE_2D, GL_RGB32F, GL_RGB, GL_FLOAT, scene->bvhTranslator.nodeTexWidth, scene->bvhTranslator.nodeTexWidth, 1, &scene->bvhTranslator.bboxmin[0]);
-        aabbMaxTex = new GfxTexture(GL_TEXTURE_2D, GL_RGB32F, GL_RGB, GL_FLOAT, scene->bvhTranslator.nodeTexWidth, scene->bvhTranslator.nodeTexWidth, 1, &scene->bvhTranslator.bboxmax[0]);
-		
 		// Create texture for VertexIndices
         vertexIndicesTex = new GfxTexture(GL_TEXTURE_2D, GL_RGB32I, GL_RGB_INTEGER, GL_INT, scene->indicesTexWidth, scene->indicesTexWidth, 1, &scene->vertIndices[0]);
-		
-		// Create texture for Vertices
-        verticesTex = new GfxTexture(GL_TEXTURE_2D, GL_RGBA32F, GL_RGBA, GL_FLOAT, scene->triDataTexWidth, scene->triDataTexWidth, 1, &scene->verticesUVX[0]);
-        normalsTex = new GfxTexture(GL_TEXTURE_2D, GL_RGBA32F, GL_RGBA, GL_FLOAT, scene->triDataTexWidth, scene->triDataTexWidth, 1, &scene->normalsUVY[0]);
+
+        compressedGeometry = scene->renderOptions.compressedGeometry;
+        bool compressed = compressedGeometry;
+        if (compressed)
+        {
+            CompressedGeometry& geometry = scene->compressedGeometry;
+            if (!geometry.IsBuilt()) {
+                geometry.Build(*scene);
+            }
+
+            // Quantized bounds and their frames take the units of the min/max bounds
+            aabbMinTex = new GfxTexture(GL_TEXTURE_2D, GL_RGB32UI, GL_RGB_INTEGER, GL_UNSIGNED_INT, scene->bvhTranslator.nodeTexWidth, scene->bvhTranslator.nodeTexWidth, 1, &geometry.bounds[0]);
+            aabbMaxTex = new GfxTexture(GL_TEXTURE_2D, GL_RGBA32F, GL_RGBA, GL_FLOAT, geometry.frames.size(), 1, 1, &geometry.frames[0]);
+
+            verticesTex = new GfxTexture(GL_TEXTURE_2D, GL_RGB32F, GL_RGB, GL_FLOAT, scene->triDataTexWidth, scene->triDataTexWidth, 1, &geometry.positions[0]);
+            normalsTex = new GfxTexture(GL_TEXTURE_2D, GL_RG32UI, GL_RG_INTEGER, GL_UNSIGNED_INT, scene->triDataTexWidth, scene->triDataTexWidth, 1, &geometry.normalsUV[0]);
+        }
+        else
+        {
+            // Create texture for Bounding boxes
+            aabbMinTex = new GfxTexture(GL_TEXTURE_2D, GL_RGB32F, GL_RGB, GL_FLOAT, scene->bvhTranslator.nodeTexWidth, scene->bvhTranslator.nodeTexWidth, 1, &scene->bvhTranslator.bboxmin[0]);
+            aabbMaxTex = new GfxTexture(GL_TEXTURE_2D, GL_RGB32F, GL_RGB, GL_FLOAT, scene->bvhTranslator.nodeTexWidth, scene->bvhTranslator.nodeTexWidth, 1, &scene->bvhTranslator.bboxmax[0]);
+
+            // Create texture for Vertices
+            verticesTex = new GfxTexture(GL_TEXTURE_2D, GL_RGBA32F, GL_RGBA, GL_FLOAT, scene->triDataTexWidth, scene->triDataTexWidth, 1, &scene->verticesUVX[0]);
+            normalsTex = new GfxTexture(GL_TEXTURE_2D, GL_RGBA32F, GL_RGBA, GL_FLOAT, scene->triDataTexWidth, scene->triDataTexWidth, 1, &scene->normalsUVY[0]);
+        }
+
+        // Both layouts are reported, so a scene can be checked before switching its encoding
+        size_t triTexels  = size_t(scene->triDataTexWidth) * scene->triDataTexWidth;
+        size_t nodeTexels = size_t(scene->bvhTranslator.nodeTexWidth) * scene->bvhTranslator.nodeTexWidth;
+        size_t boundsBytes   = TextureBytes(aabbMinTex, 12) + TextureBytes(aabbMaxTex, compressed ? 16 : 12);
+        size_t verticesBytes = TextureBytes(verticesTex, compressed ? 12 : 16) + TextureBytes(normalsTex, compressed ? 8 : 16);
+        size_t linksBytes    = TextureBytes(bvhTex, 12) + TextureBytes(vertexIndicesTex, 12);
+        size_t fullBytes       = nodeTexels * 24 + triTexels * 32 + linksBytes;
+        size_t compressedBytes = nodeTexels * 12 + (scene->meshInstances.size() + 1) * 32 + triTexels * 20 + linksBytes;
+        printf("Geometry memory (%s): bounds %.2f MB, vertices %.2f MB, links/indices %.2f MB\n", compressed ? "compressed" : "full precision",
+            boundsBytes / 1048576.0, verticesBytes / 1048576.0, linksBytes / 1048576.0);
+        printf("Geometry memory: %.2f MB full precision, %.2f MB compressed (%.0f%%)\n",
+            fullBytes / 1048576.0, compressedBytes / 1048576.0, 100.0 * compressedBytes / fullBytes);
 
 		// Create texture for Materials
         materialsTex = new GfxTexture(GL_TEXTURE_2D, GL_RGBA32F, GL_RGBA, GL_FLOAT, (sizeof(Material) / sizeof(Vector4)) * scene->materials.size(), 1, 1, &scene->materials[0]);
 
-		// Create texture for Transforms
-        transformsTex = new GfxTexture(GL_TEXTURE_2D, GL_RGBA32F, GL_RGBA, GL_FLOAT, (sizeof(Matrix4x4) / sizeof(Vector4)) * scene->transforms.size(), 1, 1, &scene->transforms[0]);
+		// Create texture for Transforms, with the mesh light ranges of the instances in the second row
+        int transformsWidth = (sizeof(Matrix4x4) / sizeof(Vector4)) * scene->transforms.size();
+        transformsTex = new GfxTexture(GL_TEXTURE_2D, GL_RGBA32F, GL_RGBA, GL_FLOAT, transformsWidth, 2, 1);
+        transformsTex->SubImage2D(0, 0, 0, transformsWidth, 1, &scene->transforms[0]);
+        transformsTex->SubImage2D(0, 0, 1, transformsWidth, 1, &scene->meshLightRanges[0]);
 
 		// Create Buffer and Texture for Lights
-		numOfLights = int(scene->lights.size());
-		if (numOfLights > 0)
-		{
-            lightsTex = new GfxTexture(GL_TEXTURE_2D, GL_RGB32F, GL_RGB, GL_FLOAT, (sizeof(Light) / sizeof(Vector3)) * scene->lights.size(), 1, 1, &scene->lights[0]);
-		}
+		UploadLights();
         
 		if (scene->textures.size() > 0)
 		{
@@ -127,14 +188,69 @@ namespace GLSLPT
             hdrConditionalDistTex = new GfxTexture(GL_TEXTURE_2D, GL_RG32F, GL_RG, GL_FLOAT, scene->hdrData->width, scene->hdrData->height, 1, scene->hdrData->conditionalDistData);
 		}
 
+		// Sampler tables are shared by every scene, so they are cached next to the shaders directory
+		if (!samplerTables.loaded) {
+			samplerTables.LoadOrGenerate(shadersDirectory + "../SamplerTables.bin");
+		}
+        blueNoiseTex = new GfxTexture(GL_TEXTURE_2D, GL_RGBA32F, GL_RGBA, GL_FLOAT, SamplerTables::blueNoiseSize, SamplerTables::blueNoiseSize, 1, &samplerTables.blueNoise[0]);
+
         initialized = true;
     }
 	
+	void Renderer::UploadLights()
+	{
+		numOfLights = int(scene->lights.size());
+
+		int texelsPerLight = sizeof(Light) / sizeof(Vector3);
+		int width  = LightBvh::lightsPerRow * texelsPerLight;
+		int height = (numOfLights + LightBvh::lightsPerRow - 1) / LightBvh::lightsPerRow;
+
+		// Reallocate only when the number of rows changes; callers rebind the texture units
+		if (lightsTex && lightsTex->GetHeight() != height)
+		{
+			delete lightsTex;
+			lightsTex = nullptr;
+		}
+		if (lightBvhTex && lightBvhTex->GetHeight() != scene->lightBvh.texHeight)
+		{
+			delete lightBvhTex;
+			lightBvhTex = nullptr;
+		}
+
+		if (numOfLights == 0) {
+			return;
+		}
+
+		if (!lightsTex) {
+			lightsTex = new GfxTexture(GL_TEXTURE_2D, GL_RGB32F, GL_RGB, GL_FLOAT, width, height, 1);
+		}
+		if (!lightBvhTex) {
+			lightBvhTex = new GfxTexture(GL_TEXTURE_2D, GL_RGBA32F, GL_RGBA, GL_FLOAT, scene->lightBvh.texWidth, scene->lightBvh.texHeight, 1);
+		}
+
+		// Full rows, then the partial last row
+		int fullRows = numOfLights / LightBvh::lightsPerRow;
+		if (fullRows > 0) {
+			lightsTex->SubImage2D(0, 0, 0, width, fullRows, &scene->lights[0]);
+		}
+		int remaining = numOfLights - fullRows * LightBvh::lightsPerRow;
+		if (remaining > 0) {
+			lightsTex->SubImage2D(0, 0, fullRows, remaining * texelsPerLight, 1, &scene->lights[fullRows * LightBvh::lightsPerRow]);
+		}
+
+		lightBvhTex->SubImage2D(0, 0, 0, scene->lightBvh.texWidth, scene->lightBvh.texHeight, &scene->lightBvh.nodes[0]);
+	}
+
 	void Renderer::Update(float secondsElapsed)
 	{
 		if (scene->instancesModified)
 		{
-            transformsTex->SubImage2D(0, 0, 0, (sizeof(Matrix4x4) / sizeof(Vector4)) * scene->transforms.size(), 1, &scene->transforms[0]);
+            int transformsWidth = (sizeof(Matrix4x4) / sizeof(Vector4)) * scene->transforms.size();
+            transformsTex->SubImage2D(0, 0, 0, transformsWidth, 1, &scene->transforms[0]);
+            transformsTex->SubImage2D(0, 0, 1, transformsWidth, 1, &scene->meshLightRanges[0]);
+
+            // Emissive triangles move with their instances
+            UploadLights();
             
             materialsTex->SubImage2D(0, 0, 0, (sizeof(Material) / sizeof(Vector4)) * scene->materials.size(), 1, &scene->materials[0]);
             
@@ -143,9 +259,18 @@ namespace GLSLPT
 
             bvhTex->SubImage2D(0, 0, yPos, scene->bvhTranslator.nodeTexWidth, scene->bvhTranslator.nodeTexWidth - yPos, &scene->bvhTranslator.nodes[index]);
             
-            aabbMinTex->SubImage2D(0, 0, yPos, scene->bvhTranslator.nodeTexWidth, scene->bvhTranslator.nodeTexWidth - yPos, &scene->bvhTranslator.bboxmin[index]);
-            
-            aabbMaxTex->SubImage2D(0, 0, yPos, scene->bvhTranslator.nodeTexWidth, scene->bvhTranslator.nodeTexWidth - yPos, &scene->bvhTranslator.bboxmax[index]);
+            if (compressedGeometry)
+            {
+                CompressedGeometry& geometry = scene->compressedGeometry;
+                aabbMinTex->SubImage2D(0, 0, yPos, scene->bvhTranslator.nodeTexWidth, scene->bvhTranslator.nodeTexWidth - yPos, &geometry.bounds[index * 3]);
+                aabbMaxTex->SubImage2D(0, 0, 0, geometry.frames.size(), 1, &geometry.frames[0]);
+            }
+            else
+            {
+                aabbMinTex->SubImage2D(0, 0, yPos, scene->bvhTranslator.nodeTexWidth, scene->bvhTranslator.nodeTexWidth - yPos, &scene->bvhTranslator.bboxmin[index]);
+
+                aabbMaxTex->SubImage2D(0, 0, yPos, scene->bvhTranslator.nodeTexWidth, scene->bvhTranslator.nodeTexWidth - yPos, &scene->bvhTranslator.bboxmax[index]);
+            }
 		}
 
 		if (scene->hdrModified && hdrTex)
@@ -7,10 +7,12 @@
 
 #include "Quad.h"
 #include "Program.h"
+#include "Sampler.h"
+#include "Denoiser.h"
 
 namespace GLSLPT
 {
-    Program* LoadShaders(const std::string& vertFileName, const std::string& fragFileName);
+    Program* LoadShaders(const std::string& vertFileName, const std::string& fragFileName, const std::string& defines = "");
 
 	void GenTexture2D(GLuint& target, GLint internalformat, GLenum format, GLenum type, int width, int height, void* data);
 
@@ -25,6 +27,13 @@ namespace GLSLPT
             windowSize = Vector2(1280, 720);
             frameSize  = windowSize;
 			intensity  = 1.0f;
+            sampler          = SobolSampler;
+            enableDenoiser   = false;
+            dynamicPreview   = true;
+            previewFrameTime = 33.3f;
+            temporalReprojection = true;
+            temporalHistory      = 16;
+            compressedGeometry   = false;
         }
 
         Vector2 windowSize;
@@ -35,9 +44,46 @@ namespace GLSLPT
         int numTilesY;
         bool useEnvMap;
         float intensity;
+        int sampler;
+
+        // A-trous filter guided by albedo/normal AOVs, applied as a display filter
+        bool enableDenoiser;
+        DenoiserOptions denoiserOptions;
+
+        // Preview while the camera moves: scale/depth are adapted to hit previewFrameTime (ms of GPU time)
+        bool dynamicPreview;
+        float previewFrameTime;
+
+        // Preview frames are reprojected and blended over at most temporalHistory frames instead of restarting
+        bool temporalReprojection;
+        int temporalHistory;
+
+        // Quantized vertex and BVH encodings (core/CompressedGeometry.h); takes effect when the renderer is created
+        bool compressedGeometry;
+    };
+
+    // Accumulation state of a renderer between two Render() calls, as stored by core/Checkpoint.h
+    struct RenderState
+    {
+        int width;
+        int height;
+        int numTilesX;
+        int numTilesY;
+        int tileX;
+        int tileY;
+        int sampleCounter;
+
+        // Completed samples of every tile, row-major from the bottom row
+        std::vector<int> tileSamples;
+
+        // RGBA32F sums, same layout as GetOutputBuffer()/GetAovBuffers() before normalisation
+        std::vector<float> accumulation;
+        std::vector<float> albedo;
+        std::vector<float> normal;
     };
 
     class Scene;
+    class ShaderCache;
 
     class Renderer
     {
@@ -55,8 +101,26 @@ namespace GLSLPT
         virtual float GetProgress() const = 0;
         virtual int GetSampleCount() const = 0;
 
+        // Mean radiance (RGBA32F) of the accumulation buffer, exact when GetProgress() is 0
+        virtual void GetOutputBuffer(std::vector<float>& data, int& width, int& height) const = 0;
+
+        // Accumulated first-hit AOVs: albedo sums with the sample count in alpha, unnormalised normal sums
+        virtual void GetAovBuffers(std::vector<float>& albedo, std::vector<float>& normal, int& width, int& height) const = 0;
+
+        // Renders samples [firstSample, firstSample + numSamples) of one tile on its own and reads back their
+        // RGBA32F sum. Camera state comes from the last Update(); the interactive accumulation of that tile is lost.
+        virtual void RenderTile(int tileX, int tileY, int firstSample, int numSamples, std::vector<float>& data, int& width, int& height) = 0;
+
+        // Captures/restores the accumulation; GetState fails while there is nothing accumulated (e.g. previewing)
+        virtual bool GetState(RenderState& state) const = 0;
+        virtual bool SetState(const RenderState& state) = 0;
+
 	protected:
+		// (Re)uploads scene->lights and the light BVH, reallocating the textures when they no longer fit
+		void UploadLights();
+
 		GfxTexture* bvhTex = nullptr;
+		// With compressed geometry these hold the quantized bounds and the bounds frames
 		GfxTexture* aabbMinTex = nullptr;
 		GfxTexture* aabbMaxTex = nullptr;
 		GfxTexture* vertexIndicesTex = nullptr;
@@ -65,15 +129,22 @@ namespace GLSLPT
 		GfxTexture* materialsTex = nullptr;
 		GfxTexture* transformsTex = nullptr;
 		GfxTexture* lightsTex = nullptr;
+		GfxTexture* lightBvhTex = nullptr;
 		GfxTexture* textureMapsArrayTex = nullptr;
 		GfxTexture* hdrTex = nullptr;
 		GfxTexture* hdrMarginalDistTex = nullptr;
 		GfxTexture* hdrConditionalDistTex = nullptr;
+		GfxTexture* blueNoiseTex = nullptr;
+
+		SamplerTables samplerTables;
         
 		bool initialized;
+		bool compressedGeometry = false;
 
 		Scene* scene;
 		Quad *quad;
+		// Owns the programs of the renderer
+		ShaderCache* shaderCache = nullptr;
 		int numOfLights;
 		std::string shadersDirectory;
     };
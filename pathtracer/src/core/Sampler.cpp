@@ -0,0 +1,262 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+
+#include "Sampler.h"
+
+namespace GLSLPT
+{
+	static const unsigned int samplerCacheMagic   = 0x53545047; // "GPTS"
+	static const unsigned int samplerCacheVersion = 1;
+
+	struct SamplerCacheHeader
+	{
+		unsigned int magic;
+		unsigned int version;
+		int numSobolDimensions;
+		int numSobolBits;
+		int blueNoiseSize;
+	};
+
+	bool SamplerTables::LoadOrGenerate(const std::string& cacheFile)
+	{
+		if (Load(cacheFile))
+		{
+			printf("Sampler tables loaded from %s\n", cacheFile.c_str());
+			loaded = true;
+			return true;
+		}
+
+		printf("Generating sampler tables\n");
+		GenerateSobol();
+		GenerateBlueNoise();
+		loaded = true;
+
+		if (!Save(cacheFile)) {
+			printf("Unable to write sampler cache %s\n", cacheFile.c_str());
+		}
+
+		return true;
+	}
+
+	bool SamplerTables::Load(const std::string& cacheFile)
+	{
+		FILE* file = fopen(cacheFile.c_str(), "rb");
+		if (!file) {
+			return false;
+		}
+
+		SamplerCacheHeader header;
+		bool valid = fread(&header, sizeof(header), 1, file) == 1
+			&& header.magic == samplerCacheMagic
+			&& header.version == samplerCacheVersion
+			&& header.numSobolDimensions == numSobolDimensions
+			&& header.numSobolBits == numSobolBits
+			&& header.blueNoiseSize == blueNoiseSize;
+
+		if (valid)
+		{
+			sobolDirections.resize(numSobolDimensions * numSobolBits);
+			blueNoise.resize(blueNoiseSize * blueNoiseSize * 4);
+			valid = fread(&sobolDirections[0], sizeof(unsigned int), sobolDirections.size(), file) == sobolDirections.size()
+				&& fread(&blueNoise[0], sizeof(float), blueNoise.size(), file) == blueNoise.size();
+		}
+
+		fclose(file);
+		return valid;
+	}
+
+	bool SamplerTables::Save(const std::string& cacheFile) const
+	{
+		// Write next to the cache and rename, so an interrupted run never leaves a truncated table behind
+		std::string tempFile = cacheFile + ".tmp";
+		FILE* file = fopen(tempFile.c_str(), "wb");
+		if (!file) {
+			return false;
+		}
+
+		SamplerCacheHeader header;
+		header.magic              = samplerCacheMagic;
+		header.version            = samplerCacheVersion;
+		header.numSobolDimensions = numSobolDimensions;
+		header.numSobolBits       = numSobolBits;
+		header.blueNoiseSize      = blueNoiseSize;
+
+		bool written = fwrite(&header, sizeof(header), 1, file) == 1
+			&& fwrite(&sobolDirections[0], sizeof(unsigned int), sobolDirections.size(), file) == sobolDirections.size()
+			&& fwrite(&blueNoise[0], sizeof(float), blueNoise.size(), file) == blueNoise.size();
+
+		fclose(file);
+
+		if (written)
+		{
+			remove(cacheFile.c_str());
+			written = rename(tempFile.c_str(), cacheFile.c_str()) == 0;
+		}
+
+		if (!written) {
+			remove(tempFile.c_str());
+		}
+
+		return written;
+	}
+
+	void SamplerTables::GenerateSobol()
+	{
+		// Primitive polynomials and initial direction numbers for dimensions 2-4 (Joe & Kuo, new-joe-kuo-6.21201)
+		static const int degree[]      = { 1, 2, 3 };
+		static const unsigned int a[]  = { 0, 1, 1 };
+		static const unsigned int m[][3] = { { 1, 0, 0 }, { 1, 3, 0 }, { 1, 3, 1 } };
+
+		sobolDirections.resize(numSobolDimensions * numSobolBits);
+
+		// First dimension is the van der Corput sequence
+		for (int i = 0; i < numSobolBits; ++i) {
+			sobolDirections[i] = 1u << (31 - i);
+		}
+
+		for (int d = 1; d < numSobolDimensions; ++d)
+		{
+			unsigned int* v = &sobolDirections[d * numSobolBits];
+			int s = degree[d - 1];
+
+			for (int i = 0; i < numSobolBits; ++i)
+			{
+				if (i < s)
+				{
+					v[i] = m[d - 1][i] << (31 - i);
+					continue;
+				}
+
+				v[i] = v[i - s] ^ (v[i - s] >> s);
+				for (int k = 1; k < s; ++k) {
+					v[i] ^= ((a[d - 1] >> (s - 1 - k)) & 1) * v[i - k];
+				}
+			}
+		}
+	}
+
+	void SamplerTables::GenerateBlueNoise()
+	{
+		blueNoise.resize(blueNoiseSize * blueNoiseSize * 4);
+
+		for (int channel = 0; channel < 4; ++channel) {
+			GenerateBlueNoiseChannel(channel, 0x9e3779b9u * (channel + 1));
+		}
+	}
+
+	void SamplerTables::GenerateBlueNoiseChannel(int channel, unsigned int seed)
+	{
+		// Void-and-cluster (Ulichney 1993) on a toroidal tile
+		const int size  = blueNoiseSize;
+		const int count = size * size;
+		const float sigma = 1.5f;
+
+		std::vector<float> kernel(count);
+		for (int y = 0; y < size; ++y)
+		{
+			for (int x = 0; x < size; ++x)
+			{
+				int dx = std::min(x, size - x);
+				int dy = std::min(y, size - y);
+				kernel[y * size + x] = expf(-float(dx * dx + dy * dy) / (2.0f * sigma * sigma));
+			}
+		}
+
+		std::vector<char> initialPattern(count, 0);
+		std::vector<float> initialEnergy(count, 0.0f);
+
+		auto splat = [&](std::vector<float>& energy, int p, float sign)
+		{
+			int px = p % size;
+			int py = p / size;
+			for (int y = 0; y < size; ++y)
+			{
+				const float* row = &kernel[((y - py + size) % size) * size];
+				for (int x = 0; x < size; ++x) {
+					energy[y * size + x] += sign * row[(x - px + size) % size];
+				}
+			}
+		};
+
+		auto tightestCluster = [&](const std::vector<char>& pattern, const std::vector<float>& energy)
+		{
+			int best = -1;
+			for (int i = 0; i < count; ++i) {
+				if (pattern[i] && (best < 0 || energy[i] > energy[best])) best = i;
+			}
+			return best;
+		};
+
+		auto largestVoid = [&](const std::vector<char>& pattern, const std::vector<float>& energy)
+		{
+			int best = -1;
+			for (int i = 0; i < count; ++i) {
+				if (!pattern[i] && (best < 0 || energy[i] < energy[best])) best = i;
+			}
+			return best;
+		};
+
+		// Random initial binary pattern, relaxed until the tightest cluster is also the largest void
+		std::mt19937 rng(seed);
+		int numInitial = count / 10;
+		for (int placed = 0; placed < numInitial;)
+		{
+			int p = int(rng() % count);
+			if (initialPattern[p]) {
+				continue;
+			}
+			initialPattern[p] = 1;
+			splat(initialEnergy, p, 1.0f);
+			++placed;
+		}
+
+		for (int iteration = 0; iteration < count; ++iteration)
+		{
+			int cluster = tightestCluster(initialPattern, initialEnergy);
+			initialPattern[cluster] = 0;
+			splat(initialEnergy, cluster, -1.0f);
+
+			int voidIndex = largestVoid(initialPattern, initialEnergy);
+			initialPattern[voidIndex] = 1;
+			splat(initialEnergy, voidIndex, 1.0f);
+
+			if (voidIndex == cluster) {
+				break;
+			}
+		}
+
+		std::vector<int> rank(count, 0);
+
+		// Phase 1: rank the initial points by repeatedly removing the tightest cluster
+		{
+			std::vector<char> pattern = initialPattern;
+			std::vector<float> energy = initialEnergy;
+			for (int r = numInitial - 1; r >= 0; --r)
+			{
+				int cluster = tightestCluster(pattern, energy);
+				pattern[cluster] = 0;
+				splat(energy, cluster, -1.0f);
+				rank[cluster] = r;
+			}
+		}
+
+		// Phase 2 and 3: fill the remaining pixels into the largest void
+		{
+			std::vector<char> pattern = initialPattern;
+			std::vector<float> energy = initialEnergy;
+			for (int r = numInitial; r < count; ++r)
+			{
+				int voidIndex = largestVoid(pattern, energy);
+				pattern[voidIndex] = 1;
+				splat(energy, voidIndex, 1.0f);
+				rank[voidIndex] = r;
+			}
+		}
+
+		for (int i = 0; i < count; ++i) {
+			blueNoise[i * 4 + channel] = (float(rank[i]) + 0.5f) / float(count);
+		}
+	}
+}
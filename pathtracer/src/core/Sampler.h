@@ -0,0 +1,41 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace GLSLPT
+{
+	enum SamplerType
+	{
+		RandomSampler,
+		SobolSampler
+	};
+
+	// Tables behind the low-discrepancy sampler in shaders/common/Sampler.glsl:
+	// 4D Sobol direction numbers (Owen-scrambled in the shader and padded by hashing)
+	// and a 4-channel void-and-cluster blue-noise tile used as per-pixel dimension offsets.
+	class SamplerTables
+	{
+	public:
+		static const int numSobolDimensions = 4;
+		static const int numSobolBits = 32;
+		static const int blueNoiseSize = 64;
+
+		SamplerTables() : loaded(false) {}
+
+		// Reads the tables from cacheFile, or generates and writes them when the cache is missing or stale
+		bool LoadOrGenerate(const std::string& cacheFile);
+
+		std::vector<unsigned int> sobolDirections;
+		std::vector<float> blueNoise;
+		bool loaded;
+
+	private:
+		bool Load(const std::string& cacheFile);
+		bool Save(const std::string& cacheFile) const;
+
+		void GenerateSobol();
+		void GenerateBlueNoise();
+		void GenerateBlueNoiseChannel(int channel, unsigned int seed);
+	};
+}
@@ -57,22 +57,22 @@ namespace GLSLPT
 	{
 		int id = meshes.size();
 		meshes.push_back(mesh);
+		meshIDs.insert(std::make_pair(mesh->name, id));
 		return id;
 	}
 
 	int Scene::AddMesh(const std::string& filename)
 	{
-		for (int i = 0; i < meshes.size(); ++i) 
-		{
-			if (meshes[i]->name == filename) {
-				return i;
-			}
+		std::unordered_map<std::string, int>::const_iterator it = meshIDs.find(filename);
+		if (it != meshIDs.end()) {
+			return it->second;
 		}
 
 		int id = meshes.size();
 		Mesh* mesh = new Mesh;
 		mesh->name = filename;
 		meshes.push_back(mesh);
+		meshIDs.insert(std::make_pair(filename, id));
 
 		return id;
 	}
@@ -92,23 +92,23 @@ namespace GLSLPT
 		std::copy(data, data + width * height * comp, texture->texData.begin());
 		
 		textures.push_back(texture);
+		textureIDs.insert(std::make_pair(filename, id));
 
 		return id;
 	}
 
 	int Scene::AddTexture(const std::string& filename)
 	{
-		for (int i = 0; i < textures.size(); ++i)
-		{
-			if (textures[i]->name == filename) {
-				return i;
-			}
+		std::unordered_map<std::string, int>::const_iterator it = textureIDs.find(filename);
+		if (it != textureIDs.end()) {
+			return it->second;
 		}
 
 		int id = textures.size();
 		Texture* texture = new Texture();
 		texture->name = filename;
 		textures.push_back(texture);
+		textureIDs.insert(std::make_pair(filename, id));
 
 		return id;
 	}
@@ -307,6 +307,78 @@ namespace GLSLPT
 		sceneBounds = sceneBvh->Bounds();
 	}
 
+	void Scene::CreateLightBvh()
+	{
+		// Also run with no lights left, which empties the tree
+		if (!lights.empty()) {
+			printf("Building light BVH for %d lights\n", int(lights.size()));
+		}
+		lightBvh.Build(lights);
+	}
+
+	bool Scene::CreateMeshLights()
+	{
+		// Analytic lights come first and stay; the triangles of the previous build are replaced
+		size_t numAnalytic = 0;
+		while (numAnalytic < lights.size() && int(lights[numAnalytic].type) != TriangleLight) {
+			numAnalytic++;
+		}
+		bool hadMeshLights = numAnalytic < lights.size();
+		lights.resize(numAnalytic);
+
+		std::vector<int> meshTriOffsets(meshes.size());
+		int numTris = 0;
+		for (int i = 0; i < meshes.size(); ++i)
+		{
+			meshTriOffsets[i] = numTris;
+			numTris += meshes[i]->bvh->GetNumIndices();
+		}
+
+		meshLightRanges.assign(transforms.size() * (sizeof(Matrix4x4) / sizeof(Vector4)), Vector4(-1.0f, 0.0f, 0.0f, 0.0f));
+
+		for (int i = 0; i < meshInstances.size(); ++i)
+		{
+			const MeshInstance& instance = meshInstances[i];
+			const Material& material = materials[instance.materialID];
+
+			// Textured emission varies over the triangle, so those meshes are still only found by hits
+			if (material.emission.x + material.emission.y + material.emission.z <= 0.0f || material.emissionTexID >= 0.0f) {
+				continue;
+			}
+
+			// Triangles are added in BVH order, so the shader maps a hit triangle to its light by offset
+			const Mesh* mesh = meshes[instance.meshID];
+			const int* triIndices = mesh->bvh->GetIndices();
+			int numIndices = mesh->bvh->GetNumIndices();
+
+			meshLightRanges[i] = Vector4(float(lights.size()), float(meshTriOffsets[instance.meshID]), 0.0f, 0.0f);
+
+			for (int j = 0; j < numIndices; ++j)
+			{
+				int index = triIndices[j];
+				Vector3 p0 = Vector3(instance.transform.TransformPosition(Vector3(mesh->verticesUVX[index * 3 + 0])));
+				Vector3 p1 = Vector3(instance.transform.TransformPosition(Vector3(mesh->verticesUVX[index * 3 + 1])));
+				Vector3 p2 = Vector3(instance.transform.TransformPosition(Vector3(mesh->verticesUVX[index * 3 + 2])));
+
+				Light light;
+				light.position = p0;
+				light.emission = material.emission;
+				light.u        = p1 - p0;
+				light.v        = p2 - p0;
+				light.radius   = 0.0f;
+				light.area     = 0.5f * Vector3::CrossProduct(light.u, light.v).Size();
+				light.type     = TriangleLight;
+				lights.push_back(light);
+			}
+		}
+
+		if (lights.size() > numAnalytic) {
+			printf("Sampling %d emissive triangles as lights\n", int(lights.size() - numAnalytic));
+		}
+
+		return hadMeshLights || lights.size() > numAnalytic;
+	}
+
 	void Scene::CreateBLAS()
 	{
 		class BuildBVHJob : public ThreadTask
@@ -383,12 +455,21 @@ namespace GLSLPT
 		CreateTLAS();
 
 		bvhTranslator.UpdateTLAS(sceneBvh, meshInstances);
+
+		if (compressedGeometry.IsBuilt()) {
+			compressedGeometry.UpdateTLAS(*this);
+		}
 		
 		// Copy transforms
 		for (int i = 0; i < meshInstances.size(); i++) 
 		{
 			transforms[i] = meshInstances[i].transform;
 		}
+
+		// Emissive triangles follow their instance and material
+		if (CreateMeshLights()) {
+			CreateLightBvh();
+		}
 		
 		instancesModified = true;
 	}
@@ -478,6 +559,9 @@ namespace GLSLPT
 		{
 			transforms[i] = meshInstances[i].transform;
 		}
+
+		CreateMeshLights();
+		CreateLightBvh();
 		
 		// Copy Textures
 		for (int i = 0; i < textures.size(); i++)
@@ -3,6 +3,7 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <unordered_map>
 
 #include "Renderer.h"
 #include "Mesh.h"
@@ -10,9 +11,11 @@
 #include "Texture.h"
 #include "Material.h"
 #include "Light.h"
+#include "CompressedGeometry.h"
 
 #include "bvh/Bvh.h"
 #include "bvh/BvhTranslator.h"
+#include "bvh/LightBvh.h"
 #include "parser/HDRLoader.h"
 #include "math/Math.h"
 #include "math/Vector4.h"
@@ -64,6 +67,8 @@ namespace GLSLPT
 	private:
 		void CreateBLAS();
 		void CreateTLAS();
+		void CreateLightBvh();
+		bool CreateMeshLights();
 		void LoadAssets();
 		void ValidateTextures();
 
@@ -77,6 +82,7 @@ namespace GLSLPT
 		std::vector<MeshInstance>	meshInstances;
 		// Lights
 		std::vector<Light>			lights;
+		LightBvh					lightBvh;
 		// HDR
 		HDRData*					hdrData;
 		std::string					hdrFile;
@@ -88,11 +94,16 @@ namespace GLSLPT
 		std::vector<Vector4>		verticesUVX;
 		std::vector<Vector4>		normalsUVY;
 		std::vector<Matrix4x4>		transforms;
+		// Second row of the transforms texture, x: first TriangleLight of the instance or -1,
+		// y: first triangle of its mesh in vertIndices
+		std::vector<Vector4>		meshLightRanges;
 		// texture size
 		int							indicesTexWidth;
 		int							triDataTexWidth;
 		// Bvh
 		RadeonRays::BvhTranslator	bvhTranslator;
+		// Built by the renderer when renderOptions.compressedGeometry is set
+		CompressedGeometry			compressedGeometry;
 		// Texture Data
 		std::vector<Texture*>		textures;
 		std::vector<uint8>			textureMapsArray;
@@ -105,5 +116,8 @@ namespace GLSLPT
 
 	private:
 		RadeonRays::Bvh*			sceneBvh;
+		// Name lookups for AddMesh() and AddTexture(); the first entry with a name wins
+		std::unordered_map<std::string, int> meshIDs;
+		std::unordered_map<std::string, int> textureIDs;
 	};
 }
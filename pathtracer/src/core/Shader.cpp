@@ -7,10 +7,17 @@
 
 namespace GLSLPT
 {
-    Shader::Shader(const std::string& filePath, GLuint shaderType)
+    Shader::Shader(const std::string& filePath, GLuint shaderType, const std::string& defines)
     {
 		std::string source = GLSLPT::ShaderInclude::Load(filePath);
 
+		if (!defines.empty())
+		{
+			size_t version = source.find("#version");
+			size_t lineEnd = version == std::string::npos ? 0 : source.find('\n', version) + 1;
+			source.insert(lineEnd, defines);
+		}
+
         m_Object = glCreateShader(shaderType);
 		printf("Compiling Shader %s -> %d\n", filePath.c_str(), int(m_Object));
 
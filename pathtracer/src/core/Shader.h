@@ -9,7 +9,8 @@ namespace GLSLPT
     class Shader
     {
     public:
-        Shader(const std::string& filePath, GLuint shaderType);
+        // defines are inserted after the #version line
+        Shader(const std::string& filePath, GLuint shaderType, const std::string& defines = "");
         GLuint Object() const;
 	private:
 		GLuint m_Object;
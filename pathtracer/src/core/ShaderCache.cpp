@@ -0,0 +1,267 @@
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#if defined(_WIN32)
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+#include "ShaderCache.h"
+#include "ShaderIncludes.h"
+#include "Renderer.h"
+
+#ifndef APIENTRY
+#define APIENTRY
+#endif
+
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+
+namespace GLSLPT
+{
+    typedef void (APIENTRY* GetProgramBinaryFunc)(GLuint program, GLsizei bufSize, GLsizei* length, GLenum* binaryFormat, void* binary);
+    typedef void (APIENTRY* ProgramBinaryFunc)(GLuint program, GLenum binaryFormat, const void* binary, GLsizei length);
+    typedef void (APIENTRY* ProgramParameteriFunc)(GLuint program, GLenum pname, GLint value);
+
+    static GetProgramBinaryFunc getProgramBinary = nullptr;
+    static ProgramBinaryFunc programBinary = nullptr;
+    static ProgramParameteriFunc programParameteri = nullptr;
+
+    static const uint32_t cacheMagic = 0x43535047; // "GPSC"
+    static const uint32_t cacheVersion = 1;
+
+    struct CacheHeader
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t sourceHash;
+        uint32_t format;
+        uint32_t length;
+    };
+
+    // FNV-1a
+    static void HashString(uint64_t& hash, const std::string& text)
+    {
+        for (size_t i = 0; i < text.size(); ++i)
+        {
+            hash ^= (unsigned char)text[i];
+            hash *= 1099511628211ull;
+        }
+        // Separator, so moving text between two strings changes the hash
+        hash ^= 0xFF;
+        hash *= 1099511628211ull;
+    }
+
+    static std::string GLString(GLenum name)
+    {
+        const GLubyte* value = glGetString(name);
+        return value ? std::string((const char*)value) : std::string();
+    }
+
+    static bool BinarySupported()
+    {
+        GLint major = 0;
+        GLint minor = 0;
+        glGetIntegerv(GL_MAJOR_VERSION, &major);
+        glGetIntegerv(GL_MINOR_VERSION, &minor);
+        bool supported = major > 4 || (major == 4 && minor >= 1);
+
+        GLint numExtensions = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+        for (GLint i = 0; i < numExtensions && !supported; ++i)
+        {
+            const GLubyte* extension = glGetStringi(GL_EXTENSIONS, i);
+            supported = extension && strcmp((const char*)extension, "GL_ARB_get_program_binary") == 0;
+        }
+
+        // Drivers may support the entry points but no format at all
+        GLint numFormats = 0;
+        if (supported) {
+            glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+        }
+        return numFormats > 0;
+    }
+
+    // Without the hint some drivers keep no binary around and glGetProgramBinary returns nothing
+    static void MarkRetrievable(GLuint program)
+    {
+        programParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+
+    void ShaderCache::LoadBinaryFunctions(GetProcAddressFunc getProcAddress)
+    {
+        getProgramBinary  = nullptr;
+        programBinary     = nullptr;
+        programParameteri = nullptr;
+
+        if (!BinarySupported())
+        {
+            printf("Program binaries are not supported, shaders are compiled on every launch\n");
+            return;
+        }
+
+        getProgramBinary  = (GetProgramBinaryFunc)getProcAddress("glGetProgramBinary");
+        programBinary     = (ProgramBinaryFunc)getProcAddress("glProgramBinary");
+        programParameteri = (ProgramParameteriFunc)getProcAddress("glProgramParameteri");
+        if (!getProgramBinary || !programBinary || !programParameteri)
+        {
+            getProgramBinary  = nullptr;
+            programBinary     = nullptr;
+            programParameteri = nullptr;
+        }
+    }
+
+    ShaderCache::ShaderCache(const std::string& cacheDirectory)
+        : cacheDirectory(cacheDirectory)
+    {
+        if (!programBinary) {
+            return;
+        }
+
+        // Fails harmlessly when the directory exists; a read-only location just never hits
+#if defined(_WIN32)
+        _mkdir(cacheDirectory.c_str());
+#else
+        mkdir(cacheDirectory.c_str(), 0755);
+#endif
+    }
+
+    ShaderCache::~ShaderCache()
+    {
+        for (std::map<std::string, Program*>::iterator it = programs.begin(); it != programs.end(); ++it) {
+            delete it->second;
+        }
+    }
+
+    Program* ShaderCache::Get(const std::string& vertFileName, const std::string& fragFileName, const std::string& defines)
+    {
+        std::string key = vertFileName + "|" + fragFileName + "|" + defines;
+        std::map<std::string, Program*>::iterator it = programs.find(key);
+        if (it != programs.end()) {
+            return it->second;
+        }
+
+        Program* program = nullptr;
+        std::string file;
+        uint64_t sourceHash = 14695981039346656037ull;
+
+        if (programBinary)
+        {
+            // The sources after include expansion, so editing any included file invalidates the binary
+            HashString(sourceHash, ShaderInclude::Load(vertFileName));
+            HashString(sourceHash, ShaderInclude::Load(fragFileName));
+            HashString(sourceHash, defines);
+            HashString(sourceHash, GLString(GL_VENDOR));
+            HashString(sourceHash, GLString(GL_RENDERER));
+            HashString(sourceHash, GLString(GL_VERSION));
+
+            char name[32];
+            snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)sourceHash);
+            file = cacheDirectory + name;
+
+            program = LoadBinary(file, sourceHash);
+        }
+
+        if (!program)
+        {
+            if (programBinary)
+            {
+                std::vector<Shader> shaders;
+                shaders.push_back(Shader(vertFileName, GL_VERTEX_SHADER, defines));
+                shaders.push_back(Shader(fragFileName, GL_FRAGMENT_SHADER, defines));
+                program = new Program(shaders, MarkRetrievable);
+                SaveBinary(file, sourceHash, program);
+            }
+            else
+            {
+                program = LoadShaders(vertFileName, fragFileName, defines);
+            }
+        }
+
+        programs[key] = program;
+        return program;
+    }
+
+    Program* ShaderCache::LoadBinary(const std::string& file, uint64_t sourceHash)
+    {
+        FILE* input = fopen(file.c_str(), "rb");
+        if (!input) {
+            return nullptr;
+        }
+
+        CacheHeader header;
+        std::vector<char> binary;
+        bool valid = fread(&header, sizeof(header), 1, input) == 1
+            && header.magic == cacheMagic && header.version == cacheVersion && header.sourceHash == sourceHash && header.length > 0;
+
+        if (valid)
+        {
+            binary.resize(header.length);
+            valid = fread(&binary[0], 1, binary.size(), input) == binary.size();
+        }
+        fclose(input);
+
+        if (!valid) {
+            return nullptr;
+        }
+
+        // A driver update can reject a binary even with the same version string; compile again then
+        GLuint object = glCreateProgram();
+        programBinary(object, header.format, &binary[0], GLsizei(binary.size()));
+
+        GLint success = 0;
+        glGetProgramiv(object, GL_LINK_STATUS, &success);
+        if (success == GL_FALSE)
+        {
+            glDeleteProgram(object);
+            return nullptr;
+        }
+
+        printf("Loaded program %d from %s\n", int(object), file.c_str());
+        return new Program(object);
+    }
+
+    void ShaderCache::SaveBinary(const std::string& file, uint64_t sourceHash, Program* program)
+    {
+        GLint length = 0;
+        glGetProgramiv(program->Object(), GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0) {
+            return;
+        }
+
+        std::vector<char> binary(length);
+        GLenum format = 0;
+        getProgramBinary(program->Object(), length, &length, &format, &binary[0]);
+
+        CacheHeader header;
+        header.magic      = cacheMagic;
+        header.version    = cacheVersion;
+        header.sourceHash = sourceHash;
+        header.format     = format;
+        header.length     = uint32_t(length);
+
+        FILE* output = fopen(file.c_str(), "wb");
+        if (!output) {
+            return;
+        }
+
+        bool written = fwrite(&header, sizeof(header), 1, output) == 1 && fwrite(&binary[0], 1, length, output) == size_t(length);
+        fclose(output);
+
+        // Never leave a truncated binary behind
+        if (!written) {
+            remove(file.c_str());
+        }
+    }
+}
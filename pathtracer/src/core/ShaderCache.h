@@ -0,0 +1,36 @@
+#pragma once
+
+#include <map>
+#include <string>
+
+#include "Program.h"
+
+namespace GLSLPT
+{
+    // Owns every program a renderer loads, keyed by its shader files and defines, so switching back to a
+    // shader variant costs nothing. Linked programs are also saved as GL program binaries in
+    // cacheDirectory, keyed by their preprocessed sources and the driver, so a relaunch skips GLSL compilation.
+    class ShaderCache
+    {
+    public:
+        typedef void (*GLProc)();
+        typedef GLProc (*GetProcAddressFunc)(const char* name);
+
+        // Program binaries need GL 4.1 or ARB_get_program_binary, which the 3.3 core loader does not cover.
+        // Until this is called with a context current (or without driver support) programs are only cached in memory.
+        static void LoadBinaryFunctions(GetProcAddressFunc getProcAddress);
+
+        ShaderCache(const std::string& cacheDirectory);
+        ~ShaderCache();
+
+        // Compiles the program on the first request, throws like LoadShaders()
+        Program* Get(const std::string& vertFileName, const std::string& fragFileName, const std::string& defines = "");
+
+    private:
+        Program* LoadBinary(const std::string& file, uint64_t sourceHash);
+        void SaveBinary(const std::string& file, uint64_t sourceHash, Program* program);
+
+        std::string cacheDirectory;
+        std::map<std::string, Program*> programs;
+    };
+}
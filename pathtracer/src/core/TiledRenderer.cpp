@@ -1,4 +1,5 @@
 #include "TiledRenderer.h"
+#include "ShaderCache.h"
 #include "ShaderIncludes.h"
 #include "Camera.h"
 #include "Scene.h"
@@ -6,9 +7,42 @@
 #include "glad/glad.h"
 
 #include <string>
+#include <algorithm>
 
 namespace GLSLPT
 {
+    // Resolution scales the preview can step through, from coarsest to full resolution
+    static const float previewScales[] = { 0.125f, 0.1667f, 0.25f, 0.3333f, 0.5f, 0.6667f, 1.0f };
+    static const int numPreviewLevels = sizeof(previewScales) / sizeof(previewScales[0]);
+    static const int defaultPreviewLevel = 2;
+    static const int defaultPreviewDepth = 2;
+
+    // Once motion stops the preview keeps refining while a frame stays within this multiple of the target time
+    static const float previewRefineBudget = 4.0f;
+
+    static float PreviewArea(int level)
+    {
+        return previewScales[level] * previewScales[level];
+    }
+
+    static uint32_t Hash(uint32_t x)
+    {
+        x ^= x >> 16;
+        x *= 0x7feb352du;
+        x ^= x >> 15;
+        x *= 0x846ca68bu;
+        x ^= x >> 16;
+        return x;
+    }
+
+    // randomVector as a pure function of a key, for samples that must come out the same wherever they are rendered
+    static void HashRandomVector(uint32_t key, float& r1, float& r2, float& r3)
+    {
+        key = Hash(key);
+        r1 = float(Hash(key + 0u) >> 8) / 16777216.0f;
+        r2 = float(Hash(key + 1u) >> 8) / 16777216.0f;
+        r3 = float(Hash(key + 2u) >> 8) / 16777216.0f;
+    }
     TiledRenderer::TiledRenderer(Scene* scene, const std::string& shadersDirectory) 
 		: Renderer(scene, shadersDirectory)
         , numTilesX(scene->renderOptions.numTilesX)
@@ -41,16 +75,39 @@ namespace GLSLPT
 		tileX      = -1;
 		tileY      = numTilesY - 1;
 
+		previewQueryPending = false;
+		previewQueryLevel   = defaultPreviewLevel;
+		previewQueryDepth   = defaultPreviewDepth;
+		previewTime         = 0;
+		previewTimeLevel    = defaultPreviewLevel;
+		previewTimeDepth    = defaultPreviewDepth;
+		previewing          = true;
+		previewRefining     = true;
+		previewLevel        = defaultPreviewLevel;
+		previewDepth        = defaultPreviewDepth;
+		previewTexLevel     = -1;
+		renderLevel         = defaultPreviewLevel;
+		renderDepth         = defaultPreviewDepth;
+		glGenQueries(1, &previewQuery);
+
+		currentHistory = 0;
+		historyValid   = false;
+		previewFrame   = 0;
+
 		printf("Debug sizes : %d %d - %f %f\n", tileWidth, tileHeight, frameSize.x, frameSize.y);
 
         //----------------------------------------------------------
         // Shaders
         //----------------------------------------------------------
-		pathTraceShader = LoadShaders(shadersDirectory + "common/Vertex.glsl", shadersDirectory + "Tiled.glsl");
-		pathTraceShaderLowRes = LoadShaders(shadersDirectory + "common/Vertex.glsl", shadersDirectory + "Progressive.glsl");
-		accumShader = LoadShaders(shadersDirectory + "common/Vertex.glsl", shadersDirectory + "Accumulation.glsl");
-		tileOutputShader = LoadShaders(shadersDirectory + "common/Vertex.glsl", shadersDirectory + "TileOutput.glsl");
-		outputShader = LoadShaders(shadersDirectory + "common/Vertex.glsl", shadersDirectory + "Output.glsl");
+		// The path trace programs are picked by UpdateVariants() below
+		pathTraceShader = nullptr;
+		pathTraceShaderLowRes = nullptr;
+		accumShader = shaderCache->Get(shadersDirectory + "common/Vertex.glsl", shadersDirectory + "Accumulation.glsl");
+		tileOutputShader = shaderCache->Get(shadersDirectory + "common/Vertex.glsl", shadersDirectory + "TileOutput.glsl");
+		outputShader = shaderCache->Get(shadersDirectory + "common/Vertex.glsl", shadersDirectory + "Output.glsl");
+		aovAccumShader = shaderCache->Get(shadersDirectory + "common/Vertex.glsl", shadersDirectory + "AovAccumulation.glsl");
+		denoiseShader = shaderCache->Get(shadersDirectory + "common/Vertex.glsl", shadersDirectory + "Denoise.glsl");
+		temporalShader = shaderCache->Get(shadersDirectory + "common/Vertex.glsl", shadersDirectory + "TemporalAccumulation.glsl");
 
         //----------------------------------------------------------
         // FBO Setup
@@ -69,6 +126,15 @@ namespace GLSLPT
 		glBindTexture(GL_TEXTURE_2D, 0);
 		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, pathTraceTexture, 0);
 
+		// AOV attachments written alongside the radiance
+		GenTexture2D(pathTraceAlbedoTexture, GL_RGBA32F, GL_RGBA, GL_FLOAT, tileWidth, tileHeight, 0);
+		GenTexture2D(pathTraceNormalTexture, GL_RGBA32F, GL_RGBA, GL_FLOAT, tileWidth, tileHeight, 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, pathTraceAlbedoTexture, 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, pathTraceNormalTexture, 0);
+
+		GLenum pathTraceBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+		glDrawBuffers(3, pathTraceBuffers);
+
 		// Create FBOs for path trace shader (Progressive)
 		printf("Buffer pathTraceFBOLowRes\n");
 		glGenFramebuffers(1, &pathTraceFBOLowRes);
@@ -76,14 +142,37 @@ namespace GLSLPT
 
 		// Create Texture for FBO
 		glGenTextures(1, &pathTraceTextureLowRes);
-		glBindTexture(GL_TEXTURE_2D, pathTraceTextureLowRes);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, frameSize.x / 4, frameSize.y / 4, 0, GL_RGBA, GL_FLOAT, 0);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glGenTextures(1, &pathTracePositionLowRes);
+		ResizePreview(renderLevel);
+		GLuint lowResTextures[] = { pathTraceTextureLowRes, pathTracePositionLowRes };
+		for (int i = 0; i < 2; ++i)
+		{
+			glBindTexture(GL_TEXTURE_2D, lowResTextures[i]);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		}
 		glBindTexture(GL_TEXTURE_2D, 0);
 		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, pathTraceTextureLowRes, 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, pathTracePositionLowRes, 0);
+
+		GLenum lowResBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+		glDrawBuffers(2, lowResBuffers);
+
+		// Create FBO for the reprojected preview history
+		printf("Buffer temporalFBO\n");
+		glGenFramebuffers(1, &temporalFBO);
+		glBindFramebuffer(GL_FRAMEBUFFER, temporalFBO);
+
+		for (int i = 0; i < 2; ++i)
+		{
+			GenTexture2D(historyTexture[i], GL_RGBA32F, GL_RGBA, GL_FLOAT, frameSize.x, frameSize.y, 0);
+			GenTexture2D(historyPositionTexture[i], GL_RGBA32F, GL_RGBA, GL_FLOAT, frameSize.x, frameSize.y, 0);
+		}
+
+		GLenum temporalBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+		glDrawBuffers(2, temporalBuffers);
 
 		// Create FBOs for accum buffer
 		printf("Buffer accumFBO\n");
@@ -121,64 +210,57 @@ namespace GLSLPT
 
 		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tileOutputTexture[currentBuffer], 0);
 
-		GLuint shaderObject;
+		// Create FBO for the accumulated AOVs
+		printf("Buffer aovFBO\n");
+		glGenFramebuffers(1, &aovFBO);
+		glBindFramebuffer(GL_FRAMEBUFFER, aovFBO);
 
-		{
-			pathTraceShader->Active();
-			shaderObject = pathTraceShader->Object();
+		GenTexture2D(albedoTexture, GL_RGBA32F, GL_RGBA, GL_FLOAT, frameSize.x, frameSize.y, 0);
+		GenTexture2D(normalTexture, GL_RGBA32F, GL_RGBA, GL_FLOAT, frameSize.x, frameSize.y, 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, albedoTexture, 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, normalTexture, 0);
 
-			glUniform1f(glGetUniformLocation(shaderObject, "hdrResolution"), scene->hdrData == nullptr ? 0 : float(scene->hdrData->width * scene->hdrData->height));
-			glUniform1i(glGetUniformLocation(shaderObject, "topBVHIndex"), scene->bvhTranslator.topLevelIndexPackedXY);
-			glUniform1i(glGetUniformLocation(shaderObject, "vertIndicesSize"), scene->indicesTexWidth);
-			glUniform2f(glGetUniformLocation(shaderObject, "screenResolution"), frameSize.x, frameSize.y);
-			glUniform1i(glGetUniformLocation(shaderObject, "numOfLights"), numOfLights);
-			glUniform1f(glGetUniformLocation(shaderObject, "invTileWidth"), 1.0f / numTilesX);
-			glUniform1f(glGetUniformLocation(shaderObject, "invTileHeight"), 1.0f / numTilesY);
-			glUniform1i(glGetUniformLocation(shaderObject, "accumTexture"), 0);
-			glUniform1i(glGetUniformLocation(shaderObject, "BVH"), 1);
-			glUniform1i(glGetUniformLocation(shaderObject, "BBoxMin"), 2);
-			glUniform1i(glGetUniformLocation(shaderObject, "BBoxMax"), 3);
-			glUniform1i(glGetUniformLocation(shaderObject, "vertexIndicesTex"), 4);
-			glUniform1i(glGetUniformLocation(shaderObject, "verticesTex"), 5);
-			glUniform1i(glGetUniformLocation(shaderObject, "normalsTex"), 6);
-			glUniform1i(glGetUniformLocation(shaderObject, "materialsTex"), 7);
-			glUniform1i(glGetUniformLocation(shaderObject, "transformsTex"), 8);
-			glUniform1i(glGetUniformLocation(shaderObject, "lightsTex"), 9);
-			glUniform1i(glGetUniformLocation(shaderObject, "textureMapsArrayTex"), 10);
-			glUniform1i(glGetUniformLocation(shaderObject, "hdrTex"), 11);
-			glUniform1i(glGetUniformLocation(shaderObject, "hdrMarginalDistTex"), 12);
-			glUniform1i(glGetUniformLocation(shaderObject, "hdrCondDistTex"), 13);
+		GLenum aovBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+		glDrawBuffers(2, aovBuffers);
+		glClear(GL_COLOR_BUFFER_BIT);
 
-			pathTraceShader->Deactive();
-		}
-		
-		{
-			pathTraceShaderLowRes->Active();
-			shaderObject = pathTraceShaderLowRes->Object();
+		// Create FBO for the denoiser ping-pong
+		printf("Buffer denoiseFBO\n");
+		glGenFramebuffers(1, &denoiseFBO);
+		glBindFramebuffer(GL_FRAMEBUFFER, denoiseFBO);
 
-			glUniform1f(glGetUniformLocation(shaderObject, "hdrResolution"), scene->hdrData == nullptr ? 0 : float(scene->hdrData->width * scene->hdrData->height));
-			glUniform1i(glGetUniformLocation(shaderObject, "topBVHIndex"), scene->bvhTranslator.topLevelIndexPackedXY);
-			glUniform1i(glGetUniformLocation(shaderObject, "vertIndicesSize"), scene->indicesTexWidth);
-			glUniform2f(glGetUniformLocation(shaderObject, "screenResolution"), frameSize.x, frameSize.y);
-			glUniform1i(glGetUniformLocation(shaderObject, "numOfLights"), numOfLights);
-			glUniform1i(glGetUniformLocation(shaderObject, "accumTexture"), 0);
-			glUniform1i(glGetUniformLocation(shaderObject, "BVH"), 1);
-			glUniform1i(glGetUniformLocation(shaderObject, "BBoxMin"), 2);
-			glUniform1i(glGetUniformLocation(shaderObject, "BBoxMax"), 3);
-			glUniform1i(glGetUniformLocation(shaderObject, "vertexIndicesTex"), 4);
-			glUniform1i(glGetUniformLocation(shaderObject, "verticesTex"), 5);
-			glUniform1i(glGetUniformLocation(shaderObject, "normalsTex"), 6);
-			glUniform1i(glGetUniformLocation(shaderObject, "materialsTex"), 7);
-			glUniform1i(glGetUniformLocation(shaderObject, "transformsTex"), 8);
-			glUniform1i(glGetUniformLocation(shaderObject, "lightsTex"), 9);
-			glUniform1i(glGetUniformLocation(shaderObject, "textureMapsArrayTex"), 10);
-			glUniform1i(glGetUniformLocation(shaderObject, "hdrTex"), 11);
-			glUniform1i(glGetUniformLocation(shaderObject, "hdrMarginalDistTex"), 12);
-			glUniform1i(glGetUniformLocation(shaderObject, "hdrCondDistTex"), 13);
+		GenTexture2D(denoiseTexture[0], GL_RGBA32F, GL_RGBA, GL_FLOAT, frameSize.x, frameSize.y, 0);
+		GenTexture2D(denoiseTexture[1], GL_RGBA32F, GL_RGBA, GL_FLOAT, frameSize.x, frameSize.y, 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, denoiseTexture[0], 0);
 
-			pathTraceShaderLowRes->Deactive();
+		GLuint shaderObject;
+
+		// AOVs are bound above the scene data units (0-15) so the path trace bindings stay untouched
+		temporalShader->Active();
+		shaderObject = temporalShader->Object();
+		glUniform1i(glGetUniformLocation(shaderObject, "pathTraceTexture"), 0);
+		glUniform1i(glGetUniformLocation(shaderObject, "positionTexture"), 16);
+		glUniform1i(glGetUniformLocation(shaderObject, "historyTexture"), 17);
+		glUniform1i(glGetUniformLocation(shaderObject, "historyPositionTexture"), 18);
+		glUniform2f(glGetUniformLocation(shaderObject, "screenResolution"), frameSize.x, frameSize.y);
+		glUniform1f(glGetUniformLocation(shaderObject, "positionTolerance"), 0.02f);
+		temporalShader->Deactive();
+
+		Program* aovPrograms[] = { aovAccumShader, denoiseShader, outputShader };
+		for (int i = 0; i < 3; ++i)
+		{
+			aovPrograms[i]->Active();
+			shaderObject = aovPrograms[i]->Object();
+			glUniform1i(glGetUniformLocation(shaderObject, "pathTraceTexture"), 0);
+			glUniform1i(glGetUniformLocation(shaderObject, "albedoTexture"), 16);
+			glUniform1i(glGetUniformLocation(shaderObject, "normalTexture"), 17);
+			aovPrograms[i]->Deactive();
 		}
 
+		pathTraceDefines.clear();
+		pathTraceLowResDefines.clear();
+		UpdateVariants();
+
 		glActiveTexture(GL_TEXTURE1);
         bvhTex->Active();
 		glActiveTexture(GL_TEXTURE2);
@@ -214,6 +296,12 @@ namespace GLSLPT
 		glActiveTexture(GL_TEXTURE13);
         if (hdrConditionalDistTex) {
             hdrConditionalDistTex->Active();
+        }
+		glActiveTexture(GL_TEXTURE14);
+        blueNoiseTex->Active();
+		glActiveTexture(GL_TEXTURE15);
+        if (lightBvhTex) {
+            lightBvhTex->Active();
         }
     }
 
@@ -228,17 +316,26 @@ namespace GLSLPT
 		glDeleteTextures(1, &accumTexture);
 		glDeleteTextures(1, &tileOutputTexture[0]);
 		glDeleteTextures(1, &tileOutputTexture[1]);
+		glDeleteTextures(1, &pathTraceAlbedoTexture);
+		glDeleteTextures(1, &pathTraceNormalTexture);
+		glDeleteTextures(1, &albedoTexture);
+		glDeleteTextures(1, &normalTexture);
+		glDeleteTextures(2, denoiseTexture);
+		glDeleteTextures(1, &pathTracePositionLowRes);
+		glDeleteTextures(2, historyTexture);
+		glDeleteTextures(2, historyPositionTexture);
 
 		glDeleteFramebuffers(1, &pathTraceFBO);
 		glDeleteFramebuffers(1, &pathTraceFBOLowRes);
 		glDeleteFramebuffers(1, &accumFBO);
 		glDeleteFramebuffers(1, &outputFBO);
+		glDeleteFramebuffers(1, &aovFBO);
+		glDeleteFramebuffers(1, &denoiseFBO);
+		glDeleteFramebuffers(1, &temporalFBO);
 
-		delete pathTraceShader;
-		delete accumShader;
-		delete tileOutputShader;
-		delete outputShader;
+		glDeleteQueries(1, &previewQuery);
 
+		// The programs belong to the shader cache
         Renderer::Dispose();
     }
 
@@ -255,7 +352,7 @@ namespace GLSLPT
 		glActiveTexture(GL_TEXTURE0);
 		glBindTexture(GL_TEXTURE_2D, accumTexture);
 
-		if (!scene->camera->isMoving && !scene->instancesModified && !scene->hdrModified)
+		if (!previewing)
 		{
 			glBindFramebuffer(GL_FRAMEBUFFER, pathTraceFBO);
 			glViewport(0, 0, tileWidth, tileHeight);
@@ -267,29 +364,103 @@ namespace GLSLPT
 			glBindTexture(GL_TEXTURE_2D, pathTraceTexture);
 			quad->Draw(accumShader);
 
+			// Sum this tile's AOVs into the full-frame targets
+			glBindFramebuffer(GL_FRAMEBUFFER, aovFBO);
+			glViewport(tileWidth * tileX, tileHeight * tileY, tileWidth, tileHeight);
+			glActiveTexture(GL_TEXTURE16);
+			glBindTexture(GL_TEXTURE_2D, pathTraceAlbedoTexture);
+			glActiveTexture(GL_TEXTURE17);
+			glBindTexture(GL_TEXTURE_2D, pathTraceNormalTexture);
+			glEnable(GL_BLEND);
+			glBlendFunc(GL_ONE, GL_ONE);
+			quad->Draw(aovAccumShader);
+			glDisable(GL_BLEND);
+
 			glBindFramebuffer(GL_FRAMEBUFFER, outputFBO);
 			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tileOutputTexture[currentBuffer], 0);
 			glViewport(0, 0, frameSize.x, frameSize.y);
 			glActiveTexture(GL_TEXTURE0);
 			glBindTexture(GL_TEXTURE_2D, accumTexture);
 			quad->Draw(tileOutputShader);
-            
+
+			GLuint displayTexture = tileOutputTexture[1 - currentBuffer];
+			float displayScale = 1.0f / sampleCounter;
+			const DenoiserOptions& denoiser = scene->renderOptions.denoiserOptions;
+			bool denoise = scene->renderOptions.enableDenoiser && denoiser.iterations > 0;
+
+			if (denoise)
+			{
+				glActiveTexture(GL_TEXTURE16);
+				glBindTexture(GL_TEXTURE_2D, albedoTexture);
+				glActiveTexture(GL_TEXTURE17);
+				glBindTexture(GL_TEXTURE_2D, normalTexture);
+
+				// All but the last a-trous iteration ping-pong here; Output.glsl runs the last one
+				glBindFramebuffer(GL_FRAMEBUFFER, denoiseFBO);
+				glViewport(0, 0, frameSize.x, frameSize.y);
+				for (int i = 0; i < denoiser.iterations - 1; ++i)
+				{
+					glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, denoiseTexture[i % 2], 0);
+					glActiveTexture(GL_TEXTURE0);
+					glBindTexture(GL_TEXTURE_2D, displayTexture);
+					SetDenoiseUniforms(denoiseShader, i, displayScale);
+					quad->Draw(denoiseShader);
+
+					displayTexture = denoiseTexture[i % 2];
+					displayScale   = 1.0f;
+				}
+
+				SetDenoiseUniforms(outputShader, denoiser.iterations - 1, displayScale);
+			}
+
+			outputShader->Active();
+			glUniform1i(glGetUniformLocation(outputShader->Object(), "enableDenoiser"), denoise);
+			outputShader->Deactive();
+
 			glBindFramebuffer(GL_FRAMEBUFFER, 0);
 			glViewport(0, 0, frameSize.x, frameSize.y);
 			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, tileOutputTexture[1 - currentBuffer]);
+			glBindTexture(GL_TEXTURE_2D, displayTexture);
 			quad->Draw(outputShader);
 		}
 		else
 		{
+			ResizePreview(renderLevel);
+
+			// Only time a frame when the previous result has been read back, so polling never stalls
+			bool timed = !previewQueryPending;
+			if (timed)
+			{
+				previewQueryLevel = renderLevel;
+				previewQueryDepth = renderDepth;
+				glBeginQuery(GL_TIME_ELAPSED, previewQuery);
+			}
+
 			glBindFramebuffer(GL_FRAMEBUFFER, pathTraceFBOLowRes);
-			glViewport(0, 0, frameSize.x / 4, frameSize.y / 4);
+			glViewport(0, 0, frameSize.x * previewScales[renderLevel], frameSize.y * previewScales[renderLevel]);
 			quad->Draw(pathTraceShaderLowRes);
 
+			if (timed)
+			{
+				glEndQuery(GL_TIME_ELAPSED);
+				previewQueryPending = true;
+			}
+
+			GLuint previewTexture = pathTraceTextureLowRes;
+			if (scene->renderOptions.temporalReprojection)
+			{
+				ResolveTemporal();
+				previewTexture = historyTexture[currentHistory];
+			}
+
+			outputShader->Active();
+			glUniform1i(glGetUniformLocation(outputShader->Object(), "enableDenoiser"), false);
+			outputShader->Deactive();
+
 			glBindFramebuffer(GL_FRAMEBUFFER, 0);
 			glViewport(0, 0, frameSize.x, frameSize.y);
 			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, pathTraceTextureLowRes);
+			glBindTexture(GL_TEXTURE_2D, previewTexture);
 			quad->Draw(outputShader);
 		}
 
@@ -308,19 +479,479 @@ namespace GLSLPT
 		return sampleCounter;
 	}
 
+	void TiledRenderer::GetOutputBuffer(std::vector<float>& data, int& width, int& height) const
+	{
+		width  = int(scene->renderOptions.frameSize.x);
+		height = int(scene->renderOptions.frameSize.y);
+		data.resize(width * height * 4);
+
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, accumTexture);
+		glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, &data[0]);
+
+		// sampleCounter already counts the pass in flight
+		float passes = std::max(1.0f, sampleCounter - 1.0f);
+		for (size_t i = 0; i < data.size(); ++i) {
+			data[i] /= passes;
+		}
+	}
+
+	void TiledRenderer::GetAovBuffers(std::vector<float>& albedo, std::vector<float>& normal, int& width, int& height) const
+	{
+		width  = int(scene->renderOptions.frameSize.x);
+		height = int(scene->renderOptions.frameSize.y);
+		albedo.resize(width * height * 4);
+		normal.resize(width * height * 4);
+
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, albedoTexture);
+		glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, &albedo[0]);
+		glBindTexture(GL_TEXTURE_2D, normalTexture);
+		glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, &normal[0]);
+	}
+
+	void TiledRenderer::RenderTile(int x, int y, int firstSample, int numSamples, std::vector<float>& data, int& width, int& height)
+	{
+		width  = tileWidth;
+		height = tileHeight;
+		data.resize(width * height * 4);
+
+		// Start the tile from zero; Tiled.glsl adds each pass onto what accumTexture holds
+		glBindFramebuffer(GL_FRAMEBUFFER, accumFBO);
+		glEnable(GL_SCISSOR_TEST);
+		glScissor(tileWidth * x, tileHeight * y, tileWidth, tileHeight);
+		glClear(GL_COLOR_BUFFER_BIT);
+		glDisable(GL_SCISSOR_TEST);
+
+		GLuint shaderObject = pathTraceShader->Object();
+
+		for (int i = 0; i < numSamples; ++i)
+		{
+			pathTraceShader->Active();
+			glUniform1i(glGetUniformLocation(shaderObject, "tileX"), x);
+			glUniform1i(glGetUniformLocation(shaderObject, "tileY"), y);
+			glUniform1i(glGetUniformLocation(shaderObject, "sampleIndex"), firstSample + i);
+			// Keyed by tile and sample, so a tile reassigned to another worker renders the same samples
+			float r[3];
+			HashRandomVector(Hash(uint32_t(y * numTilesX + x)) ^ uint32_t(firstSample + i), r[0], r[1], r[2]);
+			glUniform3f(glGetUniformLocation(shaderObject, "randomVector"), r[0], r[1], r[2]);
+			pathTraceShader->Deactive();
+
+			glBindFramebuffer(GL_FRAMEBUFFER, pathTraceFBO);
+			glViewport(0, 0, tileWidth, tileHeight);
+			glActiveTexture(GL_TEXTURE0);
+			glBindTexture(GL_TEXTURE_2D, accumTexture);
+			quad->Draw(pathTraceShader);
+
+			glBindFramebuffer(GL_FRAMEBUFFER, accumFBO);
+			glViewport(tileWidth * x, tileHeight * y, tileWidth, tileHeight);
+			glBindTexture(GL_TEXTURE_2D, pathTraceTexture);
+			quad->Draw(accumShader);
+		}
+
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glBindTexture(GL_TEXTURE_2D, pathTraceTexture);
+		glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, &data[0]);
+
+		// Put the interactive tile cursor back for the next Render()
+		pathTraceShader->Active();
+		glUniform1i(glGetUniformLocation(shaderObject, "tileX"), tileX);
+		glUniform1i(glGetUniformLocation(shaderObject, "tileY"), tileY);
+		glUniform1i(glGetUniformLocation(shaderObject, "sampleIndex"), int(sampleCounter) - 1);
+		pathTraceShader->Deactive();
+	}
+
+	bool TiledRenderer::GetState(RenderState& state) const
+	{
+		if (previewing || sampleCounter < 1) {
+			return false;
+		}
+
+		state.numTilesX     = numTilesX;
+		state.numTilesY     = numTilesY;
+		state.tileX         = tileX;
+		state.tileY         = tileY;
+		state.sampleCounter = int(sampleCounter);
+
+		// Tiles up to the cursor already hold this pass's sample
+		int cursor = (numTilesY - tileY - 1) * numTilesX + tileX;
+		state.tileSamples.resize(numTilesX * numTilesY);
+		for (int y = 0; y < numTilesY; ++y)
+		{
+			for (int x = 0; x < numTilesX; ++x)
+			{
+				int order = (numTilesY - y - 1) * numTilesX + x;
+				state.tileSamples[y * numTilesX + x] = order <= cursor ? state.sampleCounter : state.sampleCounter - 1;
+			}
+		}
+
+		state.width  = int(scene->renderOptions.frameSize.x);
+		state.height = int(scene->renderOptions.frameSize.y);
+		state.accumulation.resize(state.width * state.height * 4);
+
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, accumTexture);
+		glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, &state.accumulation[0]);
+
+		int width;
+		int height;
+		GetAovBuffers(state.albedo, state.normal, width, height);
+
+		return true;
+	}
+
+	bool TiledRenderer::SetState(const RenderState& state)
+	{
+		int width  = int(scene->renderOptions.frameSize.x);
+		int height = int(scene->renderOptions.frameSize.y);
+		size_t size = size_t(width) * height * 4;
+
+		if (state.width != width || state.height != height || state.numTilesX != numTilesX || state.numTilesY != numTilesY ||
+			state.accumulation.size() != size || state.albedo.size() != size || state.normal.size() != size) {
+			return false;
+		}
+
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, accumTexture);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_FLOAT, &state.accumulation[0]);
+		glBindTexture(GL_TEXTURE_2D, albedoTexture);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_FLOAT, &state.albedo[0]);
+		glBindTexture(GL_TEXTURE_2D, normalTexture);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_FLOAT, &state.normal[0]);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		tileX         = state.tileX;
+		tileY         = state.tileY;
+		sampleCounter = float(state.sampleCounter);
+
+		// Init already uploaded the scene; consume its change flags like Render() does, so the next
+		// Update() continues from the restored cursor instead of dropping back into preview
+		previewing      = false;
+		previewRefining = false;
+		scene->hdrModified       = false;
+		scene->instancesModified = false;
+		scene->camera->isMoving  = false;
+
+		return true;
+	}
+
+	void TiledRenderer::SetDenoiseUniforms(Program* program, int iteration, float colorScale)
+	{
+		const DenoiserOptions& denoiser = scene->renderOptions.denoiserOptions;
+
+		program->Active();
+		GLuint shaderObject = program->Object();
+		glUniform1i(glGetUniformLocation(shaderObject, "stepWidth"), 1 << iteration);
+		glUniform1f(glGetUniformLocation(shaderObject, "colorScale"), colorScale);
+		glUniform1f(glGetUniformLocation(shaderObject, "colorPhi"), denoiser.colorPhi * powf(2.0f, -float(iteration)));
+		glUniform1f(glGetUniformLocation(shaderObject, "normalPhi"), denoiser.normalPhi);
+		glUniform1f(glGetUniformLocation(shaderObject, "albedoPhi"), denoiser.albedoPhi);
+		program->Deactive();
+	}
+
+	void TiledRenderer::ResolveTemporal()
+	{
+		Vector2 frameSize = scene->renderOptions.frameSize;
+		Camera* camera = scene->camera;
+
+		// Edited geometry or lighting makes the history wrong even where it reprojects cleanly
+		if (scene->instancesModified || scene->hdrModified) {
+			historyValid = false;
+		}
+
+		int next = 1 - currentHistory;
+
+		glBindFramebuffer(GL_FRAMEBUFFER, temporalFBO);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, historyTexture[next], 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, historyPositionTexture[next], 0);
+		glViewport(0, 0, frameSize.x, frameSize.y);
+
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, pathTraceTextureLowRes);
+		glActiveTexture(GL_TEXTURE16);
+		glBindTexture(GL_TEXTURE_2D, pathTracePositionLowRes);
+		glActiveTexture(GL_TEXTURE17);
+		glBindTexture(GL_TEXTURE_2D, historyTexture[currentHistory]);
+		glActiveTexture(GL_TEXTURE18);
+		glBindTexture(GL_TEXTURE_2D, historyPositionTexture[currentHistory]);
+
+		temporalShader->Active();
+		GLuint shaderObject = temporalShader->Object();
+		glUniform3f(glGetUniformLocation(shaderObject, "prevCamera.position"), prevCameraPosition.x, prevCameraPosition.y, prevCameraPosition.z);
+		glUniform3f(glGetUniformLocation(shaderObject, "prevCamera.right"), prevCameraRight.x, prevCameraRight.y, prevCameraRight.z);
+		glUniform3f(glGetUniformLocation(shaderObject, "prevCamera.up"), prevCameraUp.x, prevCameraUp.y, prevCameraUp.z);
+		glUniform3f(glGetUniformLocation(shaderObject, "prevCamera.forward"), prevCameraForward.x, prevCameraForward.y, prevCameraForward.z);
+		glUniform1f(glGetUniformLocation(shaderObject, "prevCamera.fov"), prevCameraFov);
+		glUniform3f(glGetUniformLocation(shaderObject, "cameraPosition"), camera->GetPosition().x, camera->GetPosition().y, camera->GetPosition().z);
+		glUniform1i(glGetUniformLocation(shaderObject, "resetHistory"), !historyValid);
+		glUniform1f(glGetUniformLocation(shaderObject, "maxHistory"), float(std::max(1, scene->renderOptions.temporalHistory)));
+		temporalShader->Deactive();
+
+		quad->Draw(temporalShader);
+
+		currentHistory = next;
+		historyValid   = true;
+
+		prevCameraPosition = camera->GetPosition();
+		prevCameraRight    = camera->GetLeft();
+		prevCameraUp       = camera->GetUp();
+		prevCameraForward  = camera->GetForward();
+		prevCameraFov      = camera->GetFov();
+	}
+
+	void TiledRenderer::ResizePreview(int level)
+	{
+		if (level == previewTexLevel) {
+			return;
+		}
+
+		Vector2 frameSize = scene->renderOptions.frameSize;
+		int width  = std::max(1, int(frameSize.x * previewScales[level]));
+		int height = std::max(1, int(frameSize.y * previewScales[level]));
+
+		glBindTexture(GL_TEXTURE_2D, pathTraceTextureLowRes);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, 0);
+		glBindTexture(GL_TEXTURE_2D, pathTracePositionLowRes);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, 0);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		previewTexLevel = level;
+	}
+
+	void TiledRenderer::UpdatePreview()
+	{
+		const RenderOptions& options = scene->renderOptions;
+		bool moving = scene->camera->isMoving || scene->instancesModified || scene->hdrModified;
+		int topDepth = std::max(1, options.maxDepth);
+
+		if (!options.dynamicPreview)
+		{
+			previewLevel    = defaultPreviewLevel;
+			previewDepth    = std::min(defaultPreviewDepth, topDepth);
+			previewRefining = false;
+			previewing      = moving;
+			renderLevel     = previewLevel;
+			renderDepth     = previewDepth;
+			return;
+		}
+
+		// Collect the GPU time of the last timed preview frame
+		bool measured = false;
+		if (previewQueryPending)
+		{
+			GLint available = 0;
+			glGetQueryObjectiv(previewQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+			if (available)
+			{
+				GLuint64 elapsed = 0;
+				glGetQueryObjectui64v(previewQuery, GL_QUERY_RESULT, &elapsed);
+				previewTime      = float(elapsed) * 1e-6f;
+				previewTimeLevel = previewQueryLevel;
+				previewTimeDepth = previewQueryDepth;
+				previewQueryPending = false;
+				measured = previewQueryLevel == previewLevel && previewQueryDepth == previewDepth;
+			}
+		}
+
+		previewDepth = std::min(previewDepth, topDepth);
+
+		if (moving)
+		{
+			// Trade bounces above 2 first, then resolution, then the last bounce
+			float target = options.previewFrameTime;
+			if (measured && previewTime > target)
+			{
+				if (previewDepth > defaultPreviewDepth)
+					previewDepth--;
+				else if (previewLevel > 0)
+					previewLevel--;
+				else if (previewDepth > 1)
+					previewDepth--;
+			}
+			else if (measured)
+			{
+				// Only step up when the predicted cost still fits, which keeps the controller from oscillating
+				float perDepth = previewTime / previewDepth;
+				if (previewDepth < std::min(defaultPreviewDepth, topDepth) && previewTime + perDepth < target)
+					previewDepth++;
+				else if (previewLevel < numPreviewLevels - 1 && previewTime * PreviewArea(previewLevel + 1) / PreviewArea(previewLevel) < target)
+					previewLevel++;
+				else if (previewDepth < topDepth && previewTime + perDepth < target)
+					previewDepth++;
+			}
+
+			previewing      = true;
+			previewRefining = true;
+			renderLevel     = previewLevel;
+			renderDepth     = previewDepth;
+			return;
+		}
+
+		// Motion stopped: step the preview up toward full resolution before handing over to tiles
+		if (previewRefining)
+		{
+			int next = renderLevel + 1;
+			if (next < numPreviewLevels)
+			{
+				int depth  = next == numPreviewLevels - 1 ? topDepth : previewDepth;
+				float cost = previewTime * PreviewArea(next) / PreviewArea(previewTimeLevel) * depth / previewTimeDepth;
+				if (previewTime == 0 || cost < options.previewFrameTime * previewRefineBudget)
+				{
+					renderLevel = next;
+					renderDepth = depth;
+					previewing  = true;
+					return;
+				}
+			}
+			previewRefining = false;
+		}
+
+		previewing = false;
+	}
+
+	std::string TiledRenderer::PathTraceDefines(bool tiled) const
+	{
+		const RenderOptions& options = scene->renderOptions;
+		std::string defines;
+
+		if (compressedGeometry) {
+			defines += "#define COMPRESSED_GEOMETRY\n";
+		}
+
+		if (scene->hdrData != nullptr && options.useEnvMap) {
+			defines += "#define OPT_ENVMAP\n";
+		}
+
+		// Light count buckets: none, a single light (no light BVH walk), many
+		if (numOfLights > 0) {
+			defines += "#define OPT_LIGHTS\n";
+		}
+		if (numOfLights == 1) {
+			defines += "#define OPT_SINGLE_LIGHT\n";
+		}
+
+		bool glass = false;
+		bool textures = false;
+		for (size_t i = 0; i < scene->materials.size(); ++i)
+		{
+			const Material& material = scene->materials[i];
+			glass    |= material.type == GLASS;
+			textures |= material.albedoTexID >= 0 || material.paramsTexID >= 0 || material.normalmapTexID >= 0 || material.emissionTexID >= 0;
+		}
+
+		if (glass) {
+			defines += "#define OPT_GLASS\n";
+		}
+		if (textures && textureMapsArrayTex) {
+			defines += "#define OPT_TEXTURES\n";
+		}
+
+		// The preview adapts its depth every frame, so only the tiled kernel gets a constant loop bound
+		if (tiled) {
+			defines += "#define OPT_MAX_DEPTH " + std::to_string(std::max(1, options.maxDepth)) + "\n";
+		}
+
+		return defines;
+	}
+
+	void TiledRenderer::UpdateVariants()
+	{
+		std::string tiledDefines = PathTraceDefines(true);
+		if (tiledDefines != pathTraceDefines)
+		{
+			pathTraceShader = shaderCache->Get(shadersDirectory + "common/Vertex.glsl", shadersDirectory + "Tiled.glsl", tiledDefines);
+			pathTraceDefines = tiledDefines;
+			SetPathTraceUniforms(pathTraceShader, true);
+		}
+
+		std::string lowResDefines = PathTraceDefines(false);
+		if (lowResDefines != pathTraceLowResDefines)
+		{
+			pathTraceShaderLowRes = shaderCache->Get(shadersDirectory + "common/Vertex.glsl", shadersDirectory + "Progressive.glsl", lowResDefines);
+			pathTraceLowResDefines = lowResDefines;
+			SetPathTraceUniforms(pathTraceShaderLowRes, false);
+		}
+	}
+
+	void TiledRenderer::SetPathTraceUniforms(Program* program, bool tiled)
+	{
+		Vector2 frameSize = scene->renderOptions.frameSize;
+
+		program->Active();
+		GLuint shaderObject = program->Object();
+
+		glUniform1f(glGetUniformLocation(shaderObject, "hdrResolution"), scene->hdrData == nullptr ? 0 : float(scene->hdrData->width * scene->hdrData->height));
+		glUniform1i(glGetUniformLocation(shaderObject, "topBVHIndex"), scene->bvhTranslator.topLevelIndexPackedXY);
+		glUniform1i(glGetUniformLocation(shaderObject, "vertIndicesSize"), scene->indicesTexWidth);
+		glUniform2f(glGetUniformLocation(shaderObject, "screenResolution"), frameSize.x, frameSize.y);
+		glUniform1i(glGetUniformLocation(shaderObject, "numOfLights"), numOfLights);
+		if (tiled)
+		{
+			glUniform1f(glGetUniformLocation(shaderObject, "invTileWidth"), 1.0f / numTilesX);
+			glUniform1f(glGetUniformLocation(shaderObject, "invTileHeight"), 1.0f / numTilesY);
+		}
+		glUniform1i(glGetUniformLocation(shaderObject, "accumTexture"), 0);
+		glUniform1i(glGetUniformLocation(shaderObject, "BVH"), 1);
+		glUniform1i(glGetUniformLocation(shaderObject, "BBoxMin"), 2);
+		glUniform1i(glGetUniformLocation(shaderObject, "BBoxMax"), 3);
+		glUniform1i(glGetUniformLocation(shaderObject, "BBoxQuantized"), 2);
+		glUniform1i(glGetUniformLocation(shaderObject, "BBoxFrames"), 3);
+		glUniform1i(glGetUniformLocation(shaderObject, "vertexIndicesTex"), 4);
+		glUniform1i(glGetUniformLocation(shaderObject, "verticesTex"), 5);
+		glUniform1i(glGetUniformLocation(shaderObject, "normalsTex"), 6);
+		glUniform1i(glGetUniformLocation(shaderObject, "materialsTex"), 7);
+		glUniform1i(glGetUniformLocation(shaderObject, "transformsTex"), 8);
+		glUniform1i(glGetUniformLocation(shaderObject, "lightsTex"), 9);
+		glUniform1i(glGetUniformLocation(shaderObject, "textureMapsArrayTex"), 10);
+		glUniform1i(glGetUniformLocation(shaderObject, "hdrTex"), 11);
+		glUniform1i(glGetUniformLocation(shaderObject, "hdrMarginalDistTex"), 12);
+		glUniform1i(glGetUniformLocation(shaderObject, "hdrCondDistTex"), 13);
+		glUniform1i(glGetUniformLocation(shaderObject, "blueNoiseTex"), 14);
+		glUniform1i(glGetUniformLocation(shaderObject, "lightBvhTex"), 15);
+		glUniform1uiv(glGetUniformLocation(shaderObject, "sobolDirections"), GLsizei(samplerTables.sobolDirections.size()), &samplerTables.sobolDirections[0]);
+
+		program->Deactive();
+	}
+
     void TiledRenderer::Update(float secondsElapsed)
     {
 		Renderer::Update(secondsElapsed);
 
+		// The light textures may have been reallocated for a different number of emissive triangles
+		if (scene->instancesModified)
+		{
+			glActiveTexture(GL_TEXTURE9);
+			glBindTexture(GL_TEXTURE_2D, lightsTex ? lightsTex->GetTexture() : 0);
+			glActiveTexture(GL_TEXTURE15);
+			glBindTexture(GL_TEXTURE_2D, lightBvhTex ? lightBvhTex->GetTexture() : 0);
+			glActiveTexture(GL_TEXTURE0);
+
+			pathTraceShader->Active();
+			glUniform1i(glGetUniformLocation(pathTraceShader->Object(), "numOfLights"), numOfLights);
+			pathTraceShaderLowRes->Active();
+			glUniform1i(glGetUniformLocation(pathTraceShaderLowRes->Object(), "numOfLights"), numOfLights);
+			pathTraceShaderLowRes->Deactive();
+		}
+
+		UpdateVariants();
+		UpdatePreview();
+
 		float r1;
 		float r2;
 		float r3;
+		int previewSample = 0;
 		
         Vector2 frameSize = scene->renderOptions.frameSize;
         
-		if (scene->camera->isMoving || scene->instancesModified || scene->hdrModified)
+		if (previewing)
 		{
-			r1 = r2 = r3 = 0;
+			// Every preview frame is a new sample, so the temporal history converges; a rejected history starts over
+			if (!historyValid || scene->instancesModified || scene->hdrModified) {
+				previewFrame = 0;
+			}
+			HashRandomVector(uint32_t(previewFrame), r1, r2, r3);
+			previewSample = previewFrame++;
+
 			tileX = -1;
 			tileY = numTilesY - 1;
 			sampleCounter = 1;
@@ -329,11 +960,14 @@ namespace GLSLPT
 			glViewport(0, 0, frameSize.x, frameSize.y);
 			glClear(GL_COLOR_BUFFER_BIT);
 
+			glBindFramebuffer(GL_FRAMEBUFFER, aovFBO);
+			glClear(GL_COLOR_BUFFER_BIT);
+
 			glBindFramebuffer(GL_FRAMEBUFFER, outputFBO);
 			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tileOutputTexture[1 - currentBuffer], 0);
 			glViewport(0, 0, frameSize.x, frameSize.y);
 			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, pathTraceTextureLowRes);
+			glBindTexture(GL_TEXTURE_2D, scene->renderOptions.temporalReprojection ? historyTexture[currentHistory] : pathTraceTextureLowRes);
 			quad->Draw(accumShader);
 
 			glBindFramebuffer(GL_FRAMEBUFFER, 0);
@@ -388,11 +1022,11 @@ namespace GLSLPT
 			glUniform1f(glGetUniformLocation(shaderObject, "camera.focalDist"), scene->camera->focalDist);
 			glUniform1f(glGetUniformLocation(shaderObject, "camera.aperture"), scene->camera->aperture);
 			glUniform3f(glGetUniformLocation(shaderObject, "randomVector"), r1, r2, r3);
-			glUniform1i(glGetUniformLocation(shaderObject, "useEnvMap"), scene->hdrData == nullptr ? false : scene->renderOptions.useEnvMap);
 			glUniform1f(glGetUniformLocation(shaderObject, "hdrMultiplier"), scene->renderOptions.intensity);
-			glUniform1i(glGetUniformLocation(shaderObject, "maxDepth"), scene->camera->isMoving || scene->instancesModified ? 2 : scene->renderOptions.maxDepth);
 			glUniform1i(glGetUniformLocation(shaderObject, "tileX"), tileX);
 			glUniform1i(glGetUniformLocation(shaderObject, "tileY"), tileY);
+			glUniform1i(glGetUniformLocation(shaderObject, "samplerType"), scene->renderOptions.sampler);
+			glUniform1i(glGetUniformLocation(shaderObject, "sampleIndex"), int(sampleCounter) - 1);
 			pathTraceShader->Deactive();
 		}
 
@@ -423,9 +1057,10 @@ namespace GLSLPT
 			glUniform1f(glGetUniformLocation(shaderObject, "camera.focalDist"), scene->camera->focalDist);
 			glUniform1f(glGetUniformLocation(shaderObject, "camera.aperture"), scene->camera->aperture);
 			glUniform3f(glGetUniformLocation(shaderObject, "randomVector"), r1, r2, r3);
-			glUniform1i(glGetUniformLocation(shaderObject, "useEnvMap"), scene->hdrData == nullptr ? false : scene->renderOptions.useEnvMap);
 			glUniform1f(glGetUniformLocation(shaderObject, "hdrMultiplier"), scene->renderOptions.intensity);
-			glUniform1i(glGetUniformLocation(shaderObject, "maxDepth"), scene->camera->isMoving || scene->instancesModified ? 2: scene->renderOptions.maxDepth);
+			glUniform1i(glGetUniformLocation(shaderObject, "maxDepth"), renderDepth);
+			glUniform1i(glGetUniformLocation(shaderObject, "samplerType"), scene->renderOptions.sampler);
+			glUniform1i(glGetUniformLocation(shaderObject, "sampleIndex"), previewSample);
 			pathTraceShaderLowRes->Deactive();
 		}
 
@@ -1,6 +1,9 @@
 #pragma once
 
+#include <string>
+
 #include "Renderer.h"
+#include "math/Vector3.h"
 
 namespace GLSLPT
 {
@@ -19,24 +22,68 @@ namespace GLSLPT
         void Update(float secondsElapsed);
         float GetProgress() const;
         int GetSampleCount() const;
+        void GetOutputBuffer(std::vector<float>& data, int& width, int& height) const;
+        void GetAovBuffers(std::vector<float>& albedo, std::vector<float>& normal, int& width, int& height) const;
+        void RenderTile(int tileX, int tileY, int firstSample, int numSamples, std::vector<float>& data, int& width, int& height);
+        bool GetState(RenderState& state) const;
+        bool SetState(const RenderState& state);
 
 	private:
+		void UpdatePreview();
+		void ResizePreview(int level);
+		void SetDenoiseUniforms(Program* program, int iteration, float colorScale);
+		void ResolveTemporal();
+
+		// Scene features compiled into the path trace kernels; a change selects (and if needed compiles) a new variant
+		std::string PathTraceDefines(bool tiled) const;
+		void UpdateVariants();
+		void SetPathTraceUniforms(Program* program, bool tiled);
+
 		GLuint pathTraceFBO;
 		GLuint pathTraceFBOLowRes;
 		GLuint accumFBO;
 		GLuint outputFBO;
+		GLuint aovFBO;
+		GLuint denoiseFBO;
+		GLuint temporalFBO;
 
 		Program* pathTraceShader;
 		Program* pathTraceShaderLowRes;
 		Program* accumShader;
 		Program* tileOutputShader;
 		Program* outputShader;
+		Program* aovAccumShader;
+		Program* denoiseShader;
+		Program* temporalShader;
+		std::string pathTraceDefines;
+		std::string pathTraceLowResDefines;
 
 		GLuint pathTraceTexture;
 		GLuint pathTraceTextureLowRes;
 		GLuint accumTexture;
 		GLuint tileOutputTexture[2];
 
+		// First-hit AOVs: per tile from the path trace pass, then summed over the frame
+		GLuint pathTraceAlbedoTexture;
+		GLuint pathTraceNormalTexture;
+		GLuint albedoTexture;
+		GLuint normalTexture;
+		GLuint denoiseTexture[2];
+
+		// Reprojected preview history: running mean (alpha = frame count) and first-hit positions
+		GLuint pathTracePositionLowRes;
+		GLuint historyTexture[2];
+		GLuint historyPositionTexture[2];
+		int currentHistory;
+		bool historyValid;
+		int previewFrame; // sample index of the preview frame, counted from the last history reset
+
+		Vector3 prevCameraPosition;
+		Vector3 prevCameraRight;
+		Vector3 prevCameraUp;
+		Vector3 prevCameraForward;
+		float prevCameraFov;
+
 		int tileX;
 		int tileY;
 		int numTilesX;
@@ -47,5 +94,22 @@ namespace GLSLPT
 
 		float sampleCounter;
 		float totalTime;
+
+		// Dynamic preview controller
+		GLuint previewQuery;
+		bool previewQueryPending;
+		int previewQueryLevel;
+		int previewQueryDepth;
+		float previewTime;
+		int previewTimeLevel;
+		int previewTimeDepth;
+
+		bool previewing;
+		bool previewRefining;
+		int previewLevel;
+		int previewDepth;
+		int previewTexLevel;
+		int renderLevel;
+		int renderDepth;
     };
 }
@@ -0,0 +1,499 @@
+#include "RenderFarm.h"
+#include "Socket.h"
+#include "core/Renderer.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+
+#if defined(_WIN32)
+#include <process.h>
+#else
+#include <spawn.h>
+#include <sys/wait.h>
+extern char** environ;
+#endif
+
+namespace GLSLPT
+{
+	enum FarmPacketType
+	{
+		FarmSetupPacket = 1,
+		FarmJobPacket,
+		FarmResultPacket,
+		FarmDonePacket
+	};
+
+	static const int farmProtocolVersion = 1;
+
+	static double Now()
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	// Packets are raw little-endian PODs: the farm is meant for machines of the same architecture
+	template <typename T>
+	static void Write(std::vector<char>& payload, const T& value)
+	{
+		const char* bytes = (const char*)&value;
+		payload.insert(payload.end(), bytes, bytes + sizeof(T));
+	}
+
+	static void WriteString(std::vector<char>& payload, const std::string& value)
+	{
+		Write(payload, int(value.size()));
+		payload.insert(payload.end(), value.begin(), value.end());
+	}
+
+	template <typename T>
+	static bool Read(const std::vector<char>& payload, size_t& offset, T& value)
+	{
+		if (offset + sizeof(T) > payload.size()) {
+			return false;
+		}
+		memcpy(&value, &payload[offset], sizeof(T));
+		offset += sizeof(T);
+		return true;
+	}
+
+	static bool ReadString(const std::vector<char>& payload, size_t& offset, std::string& value)
+	{
+		int size;
+		if (!Read(payload, offset, size) || size < 0 || offset + size > payload.size()) {
+			return false;
+		}
+		value.assign(payload.begin() + offset, payload.begin() + offset + size);
+		offset += size;
+		return true;
+	}
+
+	//-----------------------------------------------------------------------
+	// Coordinator
+	//-----------------------------------------------------------------------
+
+	FarmCoordinator::FarmCoordinator(const FarmSetup& setup, const FarmOptions& options)
+		: setup(setup)
+		, options(options)
+		, listenSocket(nullptr)
+		, nextWorkerId(0)
+		, completedJobs(0)
+		, requeuedJobs(0)
+		, startTime(0)
+	{
+		tileWidth  = setup.width / setup.numTilesX;
+		tileHeight = setup.height / setup.numTilesY;
+
+		Socket::Startup();
+		listenSocket = Socket::Listen(options.port);
+	}
+
+	FarmCoordinator::~FarmCoordinator()
+	{
+		for (size_t i = 0; i < workers.size(); ++i)
+		{
+			delete workers[i]->socket;
+			delete workers[i];
+		}
+		delete listenSocket;
+
+		Socket::Shutdown();
+	}
+
+	bool FarmCoordinator::SpawnLocalWorkers(const std::string& exePath, int count)
+	{
+		char address[32];
+		snprintf(address, sizeof(address), "localhost:%d", options.port);
+
+		for (int i = 0; i < count; ++i)
+		{
+#if defined(_WIN32)
+			const char* argv[] = { exePath.c_str(), "-worker", address, nullptr };
+			if (_spawnv(_P_NOWAIT, exePath.c_str(), argv) == -1)
+#else
+			char* argv[] = { (char*)exePath.c_str(), (char*)"-worker", address, nullptr };
+			pid_t pid;
+			if (posix_spawn(&pid, exePath.c_str(), nullptr, nullptr, argv, environ) != 0)
+#endif
+			{
+				printf("Farm: failed to start worker %s\n", exePath.c_str());
+				return false;
+			}
+#if !defined(_WIN32)
+			localWorkers.push_back(int(pid));
+#endif
+		}
+
+		return true;
+	}
+
+	bool FarmCoordinator::Run(std::vector<float>& image)
+	{
+		if (!listenSocket) {
+			return false;
+		}
+
+		// Sample batches outermost, so the whole frame converges evenly while the farm runs
+		jobs.clear();
+		pendingJobs.clear();
+		for (int first = 0; first < options.spp; first += options.samplesPerJob)
+		{
+			for (int y = setup.numTilesY - 1; y >= 0; --y)
+			{
+				for (int x = 0; x < setup.numTilesX; ++x)
+				{
+					Job job;
+					job.tileX        = x;
+					job.tileY        = y;
+					job.firstSample  = first;
+					job.numSamples   = std::min(options.samplesPerJob, options.spp - first);
+					job.worker       = -1;
+					job.dispatchTime = 0;
+					job.done         = false;
+
+					pendingJobs.push_back(int(jobs.size()));
+					jobs.push_back(job);
+				}
+			}
+		}
+
+		accumulation.assign(setup.width * setup.height * 3, 0.0f);
+		completedJobs = 0;
+		requeuedJobs  = 0;
+		startTime     = Now();
+
+		printf("Farm: %d jobs of %dx%d pixels, %d spp, listening on port %d\n", int(jobs.size()), tileWidth, tileHeight, options.spp, options.port);
+
+		double lastStats = startTime;
+		std::vector<Socket*> sockets;
+		std::vector<Socket*> readable;
+
+		while (completedJobs < int(jobs.size()))
+		{
+			sockets.clear();
+			sockets.push_back(listenSocket);
+			for (size_t i = 0; i < workers.size(); ++i) {
+				sockets.push_back(workers[i]->socket);
+			}
+
+			Socket::Select(sockets, readable, 100);
+
+			for (size_t i = 0; i < readable.size(); ++i)
+			{
+				if (readable[i] == listenSocket)
+				{
+					AcceptWorker();
+					continue;
+				}
+
+				for (size_t w = 0; w < workers.size(); ++w)
+				{
+					if (workers[w]->socket == readable[i])
+					{
+						if (!ReceiveResults(workers[w])) {
+							DropWorker(workers[w], "connection lost");
+						}
+						break;
+					}
+				}
+			}
+
+			double now = Now();
+			for (int w = int(workers.size()) - 1; w >= 0; --w)
+			{
+				Worker* worker = workers[w];
+				if (!worker->jobs.empty() && now - jobs[worker->jobs.front()].dispatchTime > options.jobTimeout) {
+					DropWorker(worker, "job timed out");
+				}
+			}
+
+			for (int w = int(workers.size()) - 1; w >= 0; --w) {
+				DispatchJobs(workers[w]);
+			}
+
+			ReapLocalWorkers();
+
+			if (now - lastStats > options.statsInterval)
+			{
+				PrintStats();
+				lastStats = now;
+			}
+		}
+
+		std::vector<char> payload;
+		for (size_t i = 0; i < workers.size(); ++i) {
+			workers[i]->socket->SendPacket(FarmDonePacket, payload);
+		}
+
+		PrintStats();
+
+		float invSpp = 1.0f / options.spp;
+		image.resize(setup.width * setup.height * 4);
+		for (int i = 0; i < setup.width * setup.height; ++i)
+		{
+			image[i * 4 + 0] = accumulation[i * 3 + 0] * invSpp;
+			image[i * 4 + 1] = accumulation[i * 3 + 1] * invSpp;
+			image[i * 4 + 2] = accumulation[i * 3 + 2] * invSpp;
+			image[i * 4 + 3] = 1.0f;
+		}
+
+		return true;
+	}
+
+	void FarmCoordinator::AcceptWorker()
+	{
+		Socket* socket = listenSocket->Accept();
+		if (!socket) {
+			return;
+		}
+
+		std::vector<char> payload;
+		Write(payload, farmProtocolVersion);
+		WriteString(payload, setup.sceneFile);
+		Write(payload, setup.width);
+		Write(payload, setup.height);
+		Write(payload, setup.numTilesX);
+		Write(payload, setup.numTilesY);
+		Write(payload, setup.maxDepth);
+		Write(payload, setup.sampler);
+		Write(payload, setup.useEnvMap);
+		Write(payload, setup.intensity);
+
+		if (!socket->SendPacket(FarmSetupPacket, payload))
+		{
+			delete socket;
+			return;
+		}
+
+		Worker* worker = new Worker;
+		worker->socket        = socket;
+		worker->id            = nextWorkerId++;
+		worker->connectTime   = Now();
+		worker->pixelSamples  = 0;
+		worker->completedJobs = 0;
+		workers.push_back(worker);
+
+		printf("Farm: worker %d connected from %s\n", worker->id, socket->GetPeerName().c_str());
+	}
+
+	void FarmCoordinator::DropWorker(Worker* worker, const char* reason)
+	{
+		printf("Farm: worker %d dropped (%s), requeueing %d jobs\n", worker->id, reason, int(worker->jobs.size()));
+
+		// Put them at the front so the frame doesn't end up waiting on a single straggler tile
+		for (int i = int(worker->jobs.size()) - 1; i >= 0; --i)
+		{
+			jobs[worker->jobs[i]].worker = -1;
+			pendingJobs.push_front(worker->jobs[i]);
+			requeuedJobs++;
+		}
+
+		workers.erase(std::find(workers.begin(), workers.end(), worker));
+		delete worker->socket;
+		delete worker;
+	}
+
+	bool FarmCoordinator::ReceiveResults(Worker* worker)
+	{
+		// Only what has arrived is read, so a worker that stalls in the middle of a result holds up nobody else;
+		// its jobs time out in the main loop like those of any hung worker
+		if (!worker->socket->ReceiveAvailable(worker->received)) {
+			return false;
+		}
+
+		uint32_t type;
+		std::vector<char> payload;
+		while (true)
+		{
+			bool complete;
+			if (!Socket::TakePacket(worker->received, complete, type, payload)) {
+				return false;
+			}
+			if (!complete) {
+				return true;
+			}
+			if (type != FarmResultPacket || !AccumulateResult(worker, payload)) {
+				return false;
+			}
+		}
+	}
+
+	bool FarmCoordinator::AccumulateResult(Worker* worker, const std::vector<char>& payload)
+	{
+		size_t offset = 0;
+		int jobIndex;
+		if (!Read(payload, offset, jobIndex) || jobIndex < 0 || jobIndex >= int(jobs.size())) {
+			return false;
+		}
+
+		std::vector<int>::iterator it = std::find(worker->jobs.begin(), worker->jobs.end(), jobIndex);
+		size_t tileSize = size_t(tileWidth) * tileHeight * 3 * sizeof(float);
+		if (it == worker->jobs.end() || payload.size() - offset != tileSize) {
+			return false;
+		}
+
+		Job& job = jobs[jobIndex];
+		const float* tile = (const float*)&payload[offset];
+		for (int y = 0; y < tileHeight; ++y)
+		{
+			float* row = &accumulation[((job.tileY * tileHeight + y) * setup.width + job.tileX * tileWidth) * 3];
+			for (int x = 0; x < tileWidth * 3; ++x) {
+				row[x] += tile[y * tileWidth * 3 + x];
+			}
+		}
+
+		job.done = true;
+		worker->jobs.erase(it);
+		worker->pixelSamples += double(tileWidth) * tileHeight * job.numSamples;
+		worker->completedJobs++;
+		completedJobs++;
+
+		return true;
+	}
+
+	void FarmCoordinator::ReapLocalWorkers()
+	{
+#if !defined(_WIN32)
+		// A crashed worker would otherwise stay a zombie until the coordinator exits
+		for (int i = int(localWorkers.size()) - 1; i >= 0; --i)
+		{
+			int status;
+			if (waitpid(pid_t(localWorkers[i]), &status, WNOHANG) == pid_t(localWorkers[i]))
+			{
+				if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+					printf("Farm: local worker process %d exited abnormally\n", localWorkers[i]);
+				}
+				localWorkers.erase(localWorkers.begin() + i);
+			}
+		}
+#endif
+	}
+
+	void FarmCoordinator::DispatchJobs(Worker* worker)
+	{
+		while (int(worker->jobs.size()) < options.jobsPerWorker && !pendingJobs.empty())
+		{
+			int jobIndex = pendingJobs.front();
+			Job& job = jobs[jobIndex];
+
+			std::vector<char> payload;
+			Write(payload, jobIndex);
+			Write(payload, job.tileX);
+			Write(payload, job.tileY);
+			Write(payload, job.firstSample);
+			Write(payload, job.numSamples);
+
+			if (!worker->socket->SendPacket(FarmJobPacket, payload))
+			{
+				DropWorker(worker, "send failed");
+				return;
+			}
+
+			pendingJobs.pop_front();
+			job.worker       = worker->id;
+			job.dispatchTime = Now();
+			worker->jobs.push_back(jobIndex);
+		}
+	}
+
+	void FarmCoordinator::PrintStats()
+	{
+		double now = Now();
+		double total = 0;
+
+		printf("Farm: %d/%d jobs done, %d requeued, %.1f s elapsed\n", completedJobs, int(jobs.size()), requeuedJobs, now - startTime);
+		for (size_t i = 0; i < workers.size(); ++i)
+		{
+			Worker* worker = workers[i];
+			double rate = worker->pixelSamples / std::max(now - worker->connectTime, 1e-3) * 1e-6;
+			total += rate;
+			printf("  worker %-3d %-22s %6d jobs  %8.2f Msamples/s\n", worker->id, worker->socket->GetPeerName().c_str(), worker->completedJobs, rate);
+		}
+		printf("  total                             %8.2f Msamples/s\n", total);
+	}
+
+	//-----------------------------------------------------------------------
+	// Worker
+	//-----------------------------------------------------------------------
+
+	FarmWorker::FarmWorker()
+		: socket(nullptr)
+	{
+		Socket::Startup();
+	}
+
+	FarmWorker::~FarmWorker()
+	{
+		delete socket;
+		Socket::Shutdown();
+	}
+
+	bool FarmWorker::Connect(const std::string& host, int port, FarmSetup& setup)
+	{
+		socket = Socket::Connect(host, port);
+		if (!socket) {
+			return false;
+		}
+
+		uint32_t type;
+		std::vector<char> payload;
+		if (!socket->ReceivePacket(type, payload) || type != FarmSetupPacket)
+		{
+			printf("Farm: no setup received from %s:%d\n", host.c_str(), port);
+			return false;
+		}
+
+		size_t offset = 0;
+		int version = 0;
+		bool valid = Read(payload, offset, version) && version == farmProtocolVersion
+			&& ReadString(payload, offset, setup.sceneFile)
+			&& Read(payload, offset, setup.width)
+			&& Read(payload, offset, setup.height)
+			&& Read(payload, offset, setup.numTilesX)
+			&& Read(payload, offset, setup.numTilesY)
+			&& Read(payload, offset, setup.maxDepth)
+			&& Read(payload, offset, setup.sampler)
+			&& Read(payload, offset, setup.useEnvMap)
+			&& Read(payload, offset, setup.intensity);
+
+		if (!valid) {
+			printf("Farm: incompatible coordinator at %s:%d\n", host.c_str(), port);
+		}
+
+		return valid;
+	}
+
+	void FarmWorker::Run(Renderer* renderer)
+	{
+		uint32_t type;
+		std::vector<char> payload;
+		std::vector<float> tile;
+		std::vector<char> result;
+
+		while (socket->ReceivePacket(type, payload) && type == FarmJobPacket)
+		{
+			size_t offset = 0;
+			int jobIndex, tileX, tileY, firstSample, numSamples;
+			if (!Read(payload, offset, jobIndex) || !Read(payload, offset, tileX) || !Read(payload, offset, tileY)
+				|| !Read(payload, offset, firstSample) || !Read(payload, offset, numSamples)) {
+				break;
+			}
+
+			int width;
+			int height;
+			renderer->RenderTile(tileX, tileY, firstSample, numSamples, tile, width, height);
+
+			// Alpha carries nothing, so only RGB goes over the wire
+			result.clear();
+			Write(result, jobIndex);
+			result.reserve(result.size() + width * height * 3 * sizeof(float));
+			for (int i = 0; i < width * height; ++i) {
+				result.insert(result.end(), (const char*)&tile[i * 4], (const char*)&tile[i * 4 + 3]);
+			}
+
+			if (!socket->SendPacket(FarmResultPacket, result)) {
+				break;
+			}
+		}
+	}
+}
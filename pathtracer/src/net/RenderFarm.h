@@ -0,0 +1,144 @@
+#pragma once
+
+#include <deque>
+#include <string>
+#include <vector>
+
+namespace GLSLPT
+{
+	class Renderer;
+	class Socket;
+
+	struct FarmOptions
+	{
+		FarmOptions()
+		{
+			port          = 7878;
+			spp           = 64;
+			samplesPerJob = 8;
+			jobsPerWorker = 2;
+			jobTimeout    = 600.0f;
+			statsInterval = 10.0f;
+		}
+
+		int port;
+		int spp;
+		int samplesPerJob;
+
+		// Jobs queued on a worker at once, so it never idles waiting for the next one
+		int jobsPerWorker;
+
+		// Seconds before a worker holding a job is considered hung and its jobs are handed out again
+		float jobTimeout;
+		float statsInterval;
+	};
+
+	// Everything a worker needs to reproduce the coordinator's frame. Workers load sceneFile themselves,
+	// so it must be reachable from every worker (shared file system or identical checkout).
+	struct FarmSetup
+	{
+		FarmSetup()
+		{
+			width     = 0;
+			height    = 0;
+			numTilesX = 1;
+			numTilesY = 1;
+			maxDepth  = 4;
+			sampler   = 0;
+			useEnvMap = false;
+			intensity = 1.0f;
+		}
+
+		std::string sceneFile;
+		int width;
+		int height;
+		int numTilesX;
+		int numTilesY;
+		int maxDepth;
+		int sampler;
+		bool useEnvMap;
+		float intensity;
+	};
+
+	// Hands out (tile, sample range) jobs to workers over TCP and sums the returned tiles.
+	// Jobs of workers that disconnect or time out are queued again; samples are indexed
+	// globally, so a re-rendered job produces exactly the same contribution.
+	class FarmCoordinator
+	{
+	public:
+		FarmCoordinator(const FarmSetup& setup, const FarmOptions& options);
+		~FarmCoordinator();
+
+		// Starts count worker processes of exePath on this machine, pointed at this coordinator
+		bool SpawnLocalWorkers(const std::string& exePath, int count);
+
+		// Serves jobs until every tile has options.spp samples; image receives the mean radiance as RGBA32F
+		bool Run(std::vector<float>& image);
+
+	private:
+		struct Job
+		{
+			int tileX;
+			int tileY;
+			int firstSample;
+			int numSamples;
+			int worker;
+			double dispatchTime;
+			bool done;
+		};
+
+		struct Worker
+		{
+			Socket* socket;
+			std::vector<char> received; // bytes of a packet still arriving
+			int id;
+			std::vector<int> jobs;
+			double connectTime;
+			double pixelSamples;
+			int completedJobs;
+		};
+
+		void AcceptWorker();
+		void DropWorker(Worker* worker, const char* reason);
+		bool ReceiveResults(Worker* worker);
+		bool AccumulateResult(Worker* worker, const std::vector<char>& payload);
+		void ReapLocalWorkers();
+		void DispatchJobs(Worker* worker);
+		void PrintStats();
+
+		FarmSetup setup;
+		FarmOptions options;
+
+		Socket* listenSocket;
+		std::vector<Worker*> workers;
+		std::vector<int> localWorkers; // processes started by SpawnLocalWorkers that haven't exited yet (POSIX only)
+		int nextWorkerId;
+
+		std::vector<Job> jobs;
+		std::deque<int> pendingJobs;
+		int completedJobs;
+		int requeuedJobs;
+
+		int tileWidth;
+		int tileHeight;
+		std::vector<float> accumulation;
+
+		double startTime;
+	};
+
+	// Connects to a coordinator, renders the jobs it receives with a GPU renderer and streams tiles back
+	class FarmWorker
+	{
+	public:
+		FarmWorker();
+		~FarmWorker();
+
+		bool Connect(const std::string& host, int port, FarmSetup& setup);
+
+		// Returns once the coordinator says the frame is done or the connection drops
+		void Run(Renderer* renderer);
+
+	private:
+		Socket* socket;
+	};
+}
@@ -0,0 +1,315 @@
+#include "Socket.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+
+#if defined(_WIN32)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+typedef int socklen_t;
+#define CLOSE_SOCKET closesocket
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <signal.h>
+#define INVALID_SOCKET (-1)
+#define CLOSE_SOCKET close
+#endif
+
+namespace GLSLPT
+{
+	// Larger packets are treated as a corrupt stream
+	static const uint32_t maxPacketSize = 256u << 20;
+
+	static double Now()
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	static double Deadline(int timeoutMs)
+	{
+		return timeoutMs < 0 ? -1.0 : Now() + timeoutMs / 1000.0;
+	}
+
+	static void SetNoDelay(intptr_t handle)
+	{
+		// Jobs are tiny and latency bound
+		int flag = 1;
+		setsockopt(handle, IPPROTO_TCP, TCP_NODELAY, (const char*)&flag, sizeof(flag));
+	}
+
+	Socket::Socket(intptr_t handle, const std::string& peerName)
+		: handle(handle)
+		, peerName(peerName)
+	{
+
+	}
+
+	Socket::~Socket()
+	{
+		Close();
+	}
+
+	bool Socket::Startup()
+	{
+#if defined(_WIN32)
+		WSADATA data;
+		return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+#else
+		// A dead peer must show up as a failed send, not kill the process
+		signal(SIGPIPE, SIG_IGN);
+		return true;
+#endif
+	}
+
+	void Socket::Shutdown()
+	{
+#if defined(_WIN32)
+		WSACleanup();
+#endif
+	}
+
+	Socket* Socket::Listen(int port)
+	{
+		intptr_t handle = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		if (handle == INVALID_SOCKET)
+		{
+			printf("Socket: failed to create listen socket\n");
+			return nullptr;
+		}
+
+		int reuse = 1;
+		setsockopt(handle, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+
+		sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family      = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_ANY);
+		addr.sin_port        = htons((unsigned short)port);
+
+		if (bind(handle, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(handle, 64) != 0)
+		{
+			printf("Socket: failed to listen on port %d\n", port);
+			CLOSE_SOCKET(handle);
+			return nullptr;
+		}
+
+		return new Socket(handle, "listen");
+	}
+
+	Socket* Socket::Connect(const std::string& host, int port)
+	{
+		char service[16];
+		snprintf(service, sizeof(service), "%d", port);
+
+		addrinfo hints;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family   = AF_INET;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_protocol = IPPROTO_TCP;
+
+		addrinfo* result = nullptr;
+		if (getaddrinfo(host.c_str(), service, &hints, &result) != 0 || result == nullptr)
+		{
+			printf("Socket: cannot resolve %s\n", host.c_str());
+			return nullptr;
+		}
+
+		intptr_t handle = INVALID_SOCKET;
+		for (addrinfo* info = result; info != nullptr; info = info->ai_next)
+		{
+			handle = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+			if (handle == INVALID_SOCKET) {
+				continue;
+			}
+			if (connect(handle, info->ai_addr, (socklen_t)info->ai_addrlen) == 0) {
+				break;
+			}
+			CLOSE_SOCKET(handle);
+			handle = INVALID_SOCKET;
+		}
+		freeaddrinfo(result);
+
+		if (handle == INVALID_SOCKET)
+		{
+			printf("Socket: cannot connect to %s:%d\n", host.c_str(), port);
+			return nullptr;
+		}
+
+		SetNoDelay(handle);
+		return new Socket(handle, host + ":" + service);
+	}
+
+	void Socket::Select(const std::vector<Socket*>& sockets, std::vector<Socket*>& readable, int timeoutMs)
+	{
+		readable.clear();
+
+		fd_set set;
+		FD_ZERO(&set);
+		intptr_t maxHandle = 0;
+		for (size_t i = 0; i < sockets.size(); ++i)
+		{
+			FD_SET(sockets[i]->handle, &set);
+			if (sockets[i]->handle > maxHandle) {
+				maxHandle = sockets[i]->handle;
+			}
+		}
+
+		timeval timeout;
+		timeout.tv_sec  = timeoutMs / 1000;
+		timeout.tv_usec = (timeoutMs % 1000) * 1000;
+
+		if (select(int(maxHandle + 1), &set, nullptr, nullptr, &timeout) <= 0) {
+			return;
+		}
+
+		for (size_t i = 0; i < sockets.size(); ++i)
+		{
+			if (FD_ISSET(sockets[i]->handle, &set)) {
+				readable.push_back(sockets[i]);
+			}
+		}
+	}
+
+	Socket* Socket::Accept()
+	{
+		sockaddr_in addr;
+		socklen_t length = sizeof(addr);
+		intptr_t client = accept(handle, (sockaddr*)&addr, &length);
+		if (client == INVALID_SOCKET) {
+			return nullptr;
+		}
+
+		SetNoDelay(client);
+
+		char name[64];
+		snprintf(name, sizeof(name), "%s:%d", inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
+		return new Socket(client, name);
+	}
+
+	void Socket::Close()
+	{
+		if (handle != INVALID_SOCKET)
+		{
+			CLOSE_SOCKET(handle);
+			handle = INVALID_SOCKET;
+		}
+	}
+
+	bool Socket::Send(const void* data, size_t size)
+	{
+		const char* bytes = (const char*)data;
+		while (size > 0)
+		{
+			int sent = send(handle, bytes, int(size), 0);
+			if (sent <= 0) {
+				return false;
+			}
+			bytes += sent;
+			size  -= sent;
+		}
+		return true;
+	}
+
+	bool Socket::Receive(void* data, size_t size, int timeoutMs)
+	{
+		return ReceiveUntil(data, size, Deadline(timeoutMs));
+	}
+
+	bool Socket::ReceiveUntil(void* data, size_t size, double deadline)
+	{
+		char* bytes = (char*)data;
+		while (size > 0)
+		{
+			// Only recv once select says it won't block, so the deadline holds in the middle of a packet too
+			if (deadline >= 0.0)
+			{
+				double remaining = deadline - Now();
+				if (remaining < 0.0) {
+					remaining = 0.0;
+				}
+
+				fd_set set;
+				FD_ZERO(&set);
+				FD_SET(handle, &set);
+
+				timeval timeout;
+				timeout.tv_sec  = long(remaining);
+				timeout.tv_usec = long((remaining - double(timeout.tv_sec)) * 1e6);
+
+				if (select(int(handle + 1), &set, nullptr, nullptr, &timeout) <= 0) {
+					return false;
+				}
+			}
+
+			int received = recv(handle, bytes, int(size), 0);
+			if (received <= 0) {
+				return false;
+			}
+			bytes += received;
+			size  -= received;
+		}
+		return true;
+	}
+
+	bool Socket::ReceiveAvailable(std::vector<char>& buffer)
+	{
+		char chunk[64 * 1024];
+		int received = recv(handle, chunk, int(sizeof(chunk)), 0);
+		if (received <= 0) {
+			return false;
+		}
+		buffer.insert(buffer.end(), chunk, chunk + received);
+		return true;
+	}
+
+	bool Socket::TakePacket(std::vector<char>& buffer, bool& complete, uint32_t& type, std::vector<char>& payload)
+	{
+		complete = false;
+
+		uint32_t header[2];
+		if (buffer.size() < sizeof(header)) {
+			return true;
+		}
+		memcpy(header, &buffer[0], sizeof(header));
+		if (header[1] > maxPacketSize) {
+			return false;
+		}
+		if (buffer.size() - sizeof(header) < header[1]) {
+			return true;
+		}
+
+		type = header[0];
+		payload.assign(buffer.begin() + sizeof(header), buffer.begin() + sizeof(header) + header[1]);
+		buffer.erase(buffer.begin(), buffer.begin() + sizeof(header) + header[1]);
+		complete = true;
+		return true;
+	}
+
+	bool Socket::SendPacket(uint32_t type, const std::vector<char>& payload)
+	{
+		uint32_t header[2] = { type, uint32_t(payload.size()) };
+		return Send(header, sizeof(header)) && (payload.empty() || Send(&payload[0], payload.size()));
+	}
+
+	bool Socket::ReceivePacket(uint32_t& type, std::vector<char>& payload, int timeoutMs)
+	{
+		double deadline = Deadline(timeoutMs);
+
+		uint32_t header[2];
+		if (!ReceiveUntil(header, sizeof(header), deadline) || header[1] > maxPacketSize) {
+			return false;
+		}
+
+		type = header[0];
+		payload.resize(header[1]);
+		return payload.empty() || ReceiveUntil(&payload[0], payload.size(), deadline);
+	}
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace GLSLPT
+{
+	// Blocking TCP socket with length-prefixed packets: a 32-bit type and a 32-bit payload size, then the payload.
+	class Socket
+	{
+	public:
+		~Socket();
+
+		static bool Startup();
+		static void Shutdown();
+
+		static Socket* Listen(int port);
+		static Socket* Connect(const std::string& host, int port);
+
+		// Returns the sockets that have data (or a pending connection) within timeoutMs
+		static void Select(const std::vector<Socket*>& sockets, std::vector<Socket*>& readable, int timeoutMs);
+
+		Socket* Accept();
+		void Close();
+
+		// A non-negative timeoutMs bounds the whole call: a peer that stalls part way through fails it
+		bool Send(const void* data, size_t size);
+		bool Receive(void* data, size_t size, int timeoutMs = -1);
+
+		bool SendPacket(uint32_t type, const std::vector<char>& payload);
+		bool ReceivePacket(uint32_t& type, std::vector<char>& payload, int timeoutMs = -1);
+
+		// Non-blocking receive for a socket Select reported readable: a single recv appended to buffer.
+		// TakePacket then moves the first complete packet out of buffer; both return false on a dead or corrupt stream.
+		bool ReceiveAvailable(std::vector<char>& buffer);
+		static bool TakePacket(std::vector<char>& buffer, bool& complete, uint32_t& type, std::vector<char>& payload);
+
+		const std::string& GetPeerName() const { return peerName; }
+
+	private:
+		Socket(intptr_t handle, const std::string& peerName);
+
+		bool ReceiveUntil(void* data, size_t size, double deadline);
+
+		intptr_t handle;
+		std::string peerName;
+	};
+}
@@ -1,6 +1,9 @@
 
 
 #include <map>
+#include <thread>
+#include <string.h>
+#include <algorithm>
 
 #include "math/Matrix4x4.h"
 #include "math/Quat.h"
@@ -9,6 +12,8 @@
 #include "math/Vector4.h"
 
 #include "GLBLoader.h"
+#include "job/ThreadTask.h"
+#include "job/TaskThreadPool.h"
 
 #define TINYGLTF_IMPLEMENTATION
 #define TINYGLTF_NO_STB_IMAGE_WRITE
@@ -140,6 +145,346 @@ namespace GLSLPT
 		}
 	}
 
+	// Typed, strided access to the elements of an accessor, read in place from the glTF buffer.
+	// Sparse accessors are the one exception: their substitutions are applied once to a dense copy.
+	class GLTFAccessorView
+	{
+	public:
+		GLTFAccessorView()
+			: data(nullptr)
+			, stride(0)
+			, count(0)
+			, components(0)
+			, componentType(0)
+			, normalized(false)
+		{
+
+		}
+
+		bool Init(const tinygltf::Model& model, int accessorIndex)
+		{
+			if (accessorIndex < 0 || accessorIndex >= model.accessors.size()) {
+				return false;
+			}
+
+			const tinygltf::Accessor& accessor = model.accessors[accessorIndex];
+			int componentSize = tinygltf::GetComponentSizeInBytes(accessor.componentType);
+			components        = tinygltf::GetTypeSizeInBytes(accessor.type);
+			componentType     = accessor.componentType;
+			normalized        = accessor.normalized;
+			count             = accessor.count;
+
+			if (componentSize <= 0 || components <= 0 || componentType == TINYGLTF_COMPONENT_TYPE_DOUBLE) {
+				return false;
+			}
+
+			size_t elementSize = size_t(componentSize) * components;
+			stride = elementSize;
+
+			if (accessor.bufferView >= 0)
+			{
+				const tinygltf::BufferView& view = model.bufferViews[accessor.bufferView];
+				int byteStride = accessor.ByteStride(view);
+				if (byteStride <= 0) {
+					return false;
+				}
+
+				stride = size_t(byteStride);
+				if (!ViewRange(model, accessor.bufferView, accessor.byteOffset, count == 0 ? 0 : stride * (count - 1) + elementSize, data)) {
+					return false;
+				}
+			}
+
+			if (!accessor.sparse.isSparse)
+			{
+				// Zero filled attributes only make sense with sparse substitutions
+				return data != nullptr || count == 0;
+			}
+
+			return ApplySparse(model, accessor, elementSize);
+		}
+
+		size_t Count() const { return count; }
+		int Components() const { return components; }
+
+		// Reads up to n components of element i, converting integer types as glTF prescribes
+		void Read(size_t i, float* out, int n) const
+		{
+			const uint8* element = data + i * stride;
+			int size = tinygltf::GetComponentSizeInBytes(componentType);
+			for (int c = 0; c < n; ++c) {
+				out[c] = c < components ? ReadComponent(element + c * size) : 0.0f;
+			}
+		}
+
+		uint32 ReadIndex(size_t i) const
+		{
+			return ReadInteger(data + i * stride, componentType);
+		}
+
+	private:
+		static bool ViewRange(const tinygltf::Model& model, int bufferView, size_t byteOffset, size_t size, const uint8*& out)
+		{
+			if (bufferView < 0 || bufferView >= model.bufferViews.size()) {
+				return false;
+			}
+
+			const tinygltf::BufferView& view = model.bufferViews[bufferView];
+			if (view.buffer < 0 || view.buffer >= model.buffers.size()) {
+				return false;
+			}
+
+			const std::vector<unsigned char>& buffer = model.buffers[view.buffer].data;
+			size_t begin = view.byteOffset + byteOffset;
+			if (byteOffset + size > view.byteLength || begin + size > buffer.size()) {
+				return false;
+			}
+
+			out = buffer.data() + begin;
+			return true;
+		}
+
+		static uint32 ReadInteger(const uint8* p, int type)
+		{
+			switch (type)
+			{
+				case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:  return *p;
+				case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: { uint16 v; memcpy(&v, p, sizeof(v)); return v; }
+				case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:   { uint32 v; memcpy(&v, p, sizeof(v)); return v; }
+				default: return 0;
+			}
+		}
+
+		float ReadComponent(const uint8* p) const
+		{
+			// memcpy since a byteStride only has to be a multiple of the component size
+			switch (componentType)
+			{
+				case TINYGLTF_COMPONENT_TYPE_FLOAT:
+				{
+					float v;
+					memcpy(&v, p, sizeof(v));
+					return v;
+				}
+				case TINYGLTF_COMPONENT_TYPE_BYTE:
+				{
+					int8 v;
+					memcpy(&v, p, sizeof(v));
+					return normalized ? std::max(v / 127.0f, -1.0f) : float(v);
+				}
+				case TINYGLTF_COMPONENT_TYPE_SHORT:
+				{
+					int16 v;
+					memcpy(&v, p, sizeof(v));
+					return normalized ? std::max(v / 32767.0f, -1.0f) : float(v);
+				}
+				case TINYGLTF_COMPONENT_TYPE_INT:
+				{
+					int32 v;
+					memcpy(&v, p, sizeof(v));
+					return float(v);
+				}
+				case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+					return normalized ? *p / 255.0f : float(*p);
+				case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+					return normalized ? ReadInteger(p, componentType) / 65535.0f : float(ReadInteger(p, componentType));
+				case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+					return float(ReadInteger(p, componentType));
+				default:
+					return 0.0f;
+			}
+		}
+
+		bool ApplySparse(const tinygltf::Model& model, const tinygltf::Accessor& accessor, size_t elementSize)
+		{
+			size_t numSparse = size_t(std::max(accessor.sparse.count, 0));
+			int indexSize    = tinygltf::GetComponentSizeInBytes(accessor.sparse.indices.componentType);
+
+			const uint8* indices = nullptr;
+			const uint8* values  = nullptr;
+			if (indexSize <= 0
+				|| !ViewRange(model, accessor.sparse.indices.bufferView, accessor.sparse.indices.byteOffset, numSparse * indexSize, indices)
+				|| !ViewRange(model, accessor.sparse.values.bufferView, accessor.sparse.values.byteOffset, numSparse * elementSize, values)) {
+				return false;
+			}
+
+			dense.assign(count * elementSize, 0);
+			if (data)
+			{
+				for (size_t i = 0; i < count; ++i) {
+					memcpy(&dense[i * elementSize], data + i * stride, elementSize);
+				}
+			}
+
+			for (size_t i = 0; i < numSparse; ++i)
+			{
+				uint32 index = ReadInteger(indices + i * indexSize, accessor.sparse.indices.componentType);
+				if (index < count) {
+					memcpy(&dense[index * elementSize], values + i * elementSize, elementSize);
+				}
+			}
+
+			data   = dense.data();
+			stride = elementSize;
+			return true;
+		}
+
+		const uint8* data;
+		size_t stride;
+		size_t count;
+		int components;
+		int componentType;
+		bool normalized;
+		std::vector<uint8> dense;
+	};
+
+	// Gathers one triangle primitive straight into the unindexed layout of Mesh
+	class GLTFPrimitiveJob : public ThreadTask
+	{
+	public:
+		GLTFPrimitiveJob(const tinygltf::Model& inModel, const tinygltf::Primitive& inPrimitive, const std::string& inName)
+			: model(inModel)
+			, primitive(inPrimitive)
+			, mesh(nullptr)
+			, done(false)
+		{
+			mesh = new Mesh();
+			mesh->name = inName;
+		}
+
+		virtual void DoThreadedWork() override
+		{
+			mesh->loaded = Load();
+			done = true;
+		}
+
+		virtual void Abandon() override
+		{
+
+		}
+
+		bool Load()
+		{
+			if (primitive.mode != TINYGLTF_MODE_TRIANGLES && primitive.mode != TINYGLTF_MODE_TRIANGLE_STRIP && primitive.mode != TINYGLTF_MODE_TRIANGLE_FAN)
+			{
+				printf("Mesh %s: skipping primitive with non triangle mode %d\n", mesh->name.c_str(), primitive.mode);
+				return false;
+			}
+
+			GLTFAccessorView positions;
+			GLTFAccessorView normals;
+			GLTFAccessorView uvs;
+			GLTFAccessorView indices;
+
+			if (!positions.Init(model, Attribute("POSITION")) || positions.Components() < 3)
+			{
+				printf("Mesh %s: missing or invalid POSITION accessor\n", mesh->name.c_str());
+				return false;
+			}
+
+			bool hasNormals = normals.Init(model, Attribute("NORMAL")) && normals.Count() == positions.Count();
+			bool hasUVs     = uvs.Init(model, Attribute("TEXCOORD_0")) && uvs.Count() == positions.Count();
+			bool indexed    = primitive.indices >= 0;
+
+			if (indexed && !indices.Init(model, primitive.indices))
+			{
+				printf("Mesh %s: invalid index accessor\n", mesh->name.c_str());
+				return false;
+			}
+
+			size_t numVertices = indexed ? indices.Count() : positions.Count();
+			size_t numTriangles = 0;
+			if (primitive.mode == TINYGLTF_MODE_TRIANGLES) {
+				numTriangles = numVertices / 3;
+			}
+			else if (numVertices >= 3) {
+				numTriangles = numVertices - 2;
+			}
+
+			mesh->verticesUVX.resize(numTriangles * 3);
+			mesh->normalsUVY.resize(numTriangles * 3);
+
+			for (size_t t = 0; t < numTriangles; ++t)
+			{
+				for (int k = 0; k < 3; ++k)
+				{
+					size_t corner = Corner(t, k);
+					uint32 vertex = indexed ? indices.ReadIndex(corner) : uint32(corner);
+					if (vertex >= positions.Count())
+					{
+						printf("Mesh %s: index %u out of range\n", mesh->name.c_str(), vertex);
+						mesh->verticesUVX.clear();
+						mesh->normalsUVY.clear();
+						return false;
+					}
+
+					float pos[3];
+					float nrm[3] = { 0.0f, 0.0f, 0.0f };
+					float uv[2]  = { 0.0f, 0.0f };
+					positions.Read(vertex, pos, 3);
+					if (hasNormals) {
+						normals.Read(vertex, nrm, 3);
+					}
+					if (hasUVs) {
+						uvs.Read(vertex, uv, 2);
+					}
+
+					Vector3 p(pos[0], pos[1], pos[2]);
+					bounds.min = Vector3::Min(bounds.min, p);
+					bounds.max = Vector3::Max(bounds.max, p);
+
+					mesh->verticesUVX[t * 3 + k] = Vector4(p, uv[0]);
+					mesh->normalsUVY[t * 3 + k]  = Vector4(Vector3(nrm[0], nrm[1], nrm[2]), hasUVs ? 1.0f - uv[1] : 0.0f);
+				}
+
+				if (!hasNormals)
+				{
+					Vector4* v = &mesh->verticesUVX[t * 3];
+					Vector3 n = Vector3::CrossProduct(Vector3(v[1]) - Vector3(v[0]), Vector3(v[2]) - Vector3(v[0]));
+					n.Normalize();
+
+					for (int k = 0; k < 3; ++k) {
+						mesh->normalsUVY[t * 3 + k] = Vector4(n, mesh->normalsUVY[t * 3 + k].w);
+					}
+				}
+			}
+
+			return numTriangles > 0;
+		}
+
+		const tinygltf::Model& model;
+		const tinygltf::Primitive& primitive;
+		Mesh* mesh;
+		GLTFBounds bounds;
+		bool done;
+
+	private:
+		int Attribute(const char* name) const
+		{
+			std::map<std::string, int>::const_iterator it = primitive.attributes.find(name);
+			return it != primitive.attributes.end() ? it->second : -1;
+		}
+
+		// Position in the index stream of corner k of triangle t
+		size_t Corner(size_t t, int k) const
+		{
+			if (primitive.mode == TINYGLTF_MODE_TRIANGLE_STRIP)
+			{
+				// Odd triangles swap their first two corners to keep the winding
+				if (t % 2 == 1 && k < 2) {
+					return t + 1 - k;
+				}
+				return t + k;
+			}
+
+			if (primitive.mode == TINYGLTF_MODE_TRIANGLE_FAN) {
+				return k == 0 ? 0 : t + k;
+			}
+
+			return t * 3 + k;
+		}
+	};
+
 	bool LoadSceneFromGLTF(const std::string& filename, Scene* scene)
 	{
 		tinygltf::Model gltfModel;
@@ -147,7 +492,15 @@ namespace GLSLPT
 		std::string error;
 		std::string warning;
 
-		gltfContext.LoadBinaryFromFile(&gltfModel, &error, &warning, filename);
+		bool loaded = gltfContext.LoadBinaryFromFile(&gltfModel, &error, &warning, filename);
+		if (!warning.empty()) {
+			printf("glTF warning: %s\n", warning.c_str());
+		}
+		if (!loaded)
+		{
+			printf("Unable to load %s: %s\n", filename.c_str(), error.c_str());
+			return false;
+		}
 
 		// load textures
 		std::vector<int> textures;
@@ -239,129 +592,64 @@ namespace GLSLPT
 		};
 
 		std::vector<GLTFMesh> meshes;
+
+		// Primitives are gathered in parallel and added to the scene in file order afterwards
+		std::vector<GLTFPrimitiveJob*> jobs;
+		std::vector<int> jobMeshes;
 		for (int32 i = 0; i < gltfModel.meshes.size(); ++i)
 		{
 			tinygltf::Mesh& gltfMesh = gltfModel.meshes[i];
 
 			for (int32 j = 0; j < gltfMesh.primitives.size(); ++j)
 			{
-				tinygltf::Primitive& primitive = gltfMesh.primitives[j];
-
-				std::vector<Vector4> verticesUVX;
-				std::vector<Vector4> normalsUVY;
-				std::vector<int>     indices;
-				GLTFBounds           bounds;
-
-				tinygltf::Accessor& posAccessor = gltfModel.accessors[primitive.attributes.find("POSITION")->second];
-				tinygltf::BufferView& posView   = gltfModel.bufferViews[posAccessor.bufferView];
-				uint8* bufferPos                = &(gltfModel.buffers[posView.buffer].data[posAccessor.byteOffset + posView.byteOffset]);
-
-				tinygltf::Accessor& normAccessor = gltfModel.accessors[primitive.attributes.find("NORMAL")->second];
-				tinygltf::BufferView& normView   = gltfModel.bufferViews[normAccessor.bufferView];
-				uint8* bufferNormals             = &(gltfModel.buffers[normView.buffer].data[normAccessor.byteOffset + normView.byteOffset]);
-
-				tinygltf::Accessor& uvAccessor = gltfModel.accessors[primitive.attributes.find("TEXCOORD_0")->second];
-				tinygltf::BufferView& uvView   = gltfModel.bufferViews[uvAccessor.bufferView];
-				uint8* bufferUV0               = &(gltfModel.buffers[uvView.buffer].data[uvAccessor.byteOffset + uvView.byteOffset]);
-
-				for (int32 v = 0; v < posAccessor.count; ++v)
-				{
-					Vector4 pos;
-					Vector4 nrm;
-
-					// pos
-					if (bufferPos)
-					{
-						const float* buf = (const float*)(bufferPos);
-						pos.x = buf[v * 3 + 0];
-						pos.y = buf[v * 3 + 1];
-						pos.z = buf[v * 3 + 2];
-					}
-					else
-					{
-						pos.x = 0;
-						pos.y = 0;
-						pos.z = 0;
-					}
-
-					bounds.min = Vector3::Min(bounds.min, pos);
-					bounds.max = Vector3::Max(bounds.max, pos);
+				GLTFPrimitiveJob* job = new GLTFPrimitiveJob(gltfModel, gltfMesh.primitives[j], gltfMesh.name + "_" + std::to_string(j));
+				jobs.push_back(job);
+				jobMeshes.push_back(i);
+				scene->taskPool->AddTask(job);
+			}
+		}
 
-					// uv
-					if (bufferUV0)
-					{
-						const float* buf = (const float*)(bufferUV0);
-						pos.w = buf[v * 2 + 0];
-						nrm.w = 1.0f - buf[v * 2 + 1];
-					}
-					else
-					{
-						pos.w = 0;
-						nrm.w = 0;
-					}
-					// normal
-					if (bufferNormals)
-					{
-						const float* buf = (const float*)(bufferNormals);
-						nrm.x = buf[v * 3 + 0];
-						nrm.y = buf[v * 3 + 1];
-						nrm.z = buf[v * 3 + 2];
-					}
-					else
-					{
-						nrm.x = 0;
-						nrm.y = 0;
-						nrm.z = 0;
-					}
+		int defaultMaterialID = -1;
+		for (int i = 0; i < jobs.size(); ++i)
+		{
+			GLTFPrimitiveJob* job = jobs[i];
+			while (!job->done) {
+				std::this_thread::yield();
+			}
 
-					verticesUVX.push_back(pos);
-					normalsUVY.push_back(nrm);
+			if (job->mesh->loaded)
+			{
+				int matID = job->primitive.material;
+				if (matID >= 0 && matID < materials.size()) {
+					matID = materials[matID];
 				}
-
-				// indices
-				tinygltf::Accessor& indicesAccessor     = gltfModel.accessors[primitive.indices];
-				tinygltf::BufferView& indicesBufferView = gltfModel.bufferViews[indicesAccessor.bufferView];
-				uint8* bufferIndices                    = &(gltfModel.buffers[indicesBufferView.buffer].data[indicesAccessor.byteOffset + indicesBufferView.byteOffset]);
-
-				for (int32 v = 0; v < indicesAccessor.count; ++v)
+				else
 				{
-					if (indicesAccessor.componentType == TINYGLTF_PARAMETER_TYPE_UNSIGNED_INT)
-					{
-						const uint32* buf = (const uint32*)(bufferIndices);
-						indices.push_back(buf[v]);
-					}
-					else if (indicesAccessor.componentType == TINYGLTF_PARAMETER_TYPE_UNSIGNED_SHORT)
-					{
-						const uint16* buf = (const uint16*)(bufferIndices);
-						indices.push_back(buf[v]);
-					}
-					else if (indicesAccessor.componentType == TINYGLTF_PARAMETER_TYPE_UNSIGNED_SHORT)
-					{
-						const uint8* buf = (const uint8*)(bufferIndices);
-						indices.push_back(buf[v]);
+					if (defaultMaterialID < 0) {
+						defaultMaterialID = scene->AddMaterial(Material());
 					}
+					matID = defaultMaterialID;
 				}
 
-				Mesh* mesh = new Mesh();
-				mesh->loaded = true;
-
-				// vertices
-				for (int v = 0; v < indices.size(); ++v)
-				{
-					Vector4 posu = verticesUVX[indices[v]];
-					Vector4 nrmv = normalsUVY[indices[v]];
-					mesh->verticesUVX.push_back(posu);
-					mesh->normalsUVY.push_back(nrmv);
-				}
-
-				int meshID = scene->AddMesh(mesh);
-				int matID  = materials[primitive.material];
-				meshes.push_back(GLTFMesh(i, meshID, matID, bounds));
+				int meshID = scene->AddMesh(job->mesh);
+				meshes.push_back(GLTFMesh(jobMeshes[i], meshID, matID, job->bounds));
 			}
+			else
+			{
+				delete job->mesh;
+			}
+
+			delete job;
 		}
 
 		// load nodes
-		tinygltf::Scene& gltfScene = gltfModel.scenes[0];
+		if (gltfModel.scenes.empty())
+		{
+			printf("%s has no scenes\n", filename.c_str());
+			return false;
+		}
+
+		tinygltf::Scene& gltfScene = gltfModel.scenes[gltfModel.defaultScene >= 0 && gltfModel.defaultScene < gltfModel.scenes.size() ? gltfModel.defaultScene : 0];
 		GLTFNode* rootNode = new GLTFNode();
 		std::vector<GLTFNode*> nodeList;
 		for (int i = 0; i < gltfScene.nodes.size(); ++i)
@@ -28,274 +28,633 @@ freely, subject to the following restrictions:
 #include <iostream>
 #include <iterator>
 #include <algorithm>
+#include <unordered_map>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "SceneLoader.h"
 #include "tiny_obj_loader.h"
+#include "json.hpp"
 
 #include "math/Math.h"
 
 namespace GLSLPT
 {
-    static const int s_MAX_LINE_LENGTH = 2048;
+    // Splits the scene text in place into lines of whitespace separated tokens. '#' starts a comment
+    // and the braces are lines of their own, so "material white {" and a brace on the next line read the same.
+    class SceneTokenizer
+    {
+    public:
+        SceneTokenizer(std::vector<char>& text)
+            : cursor(text.data())
+            , end(text.data() + text.size())
+        {
 
-    bool LoadSceneFromFile(const std::string& filename, Scene* scene, RenderOptions& renderOptions)
+        }
+
+        // Returns false at the end of the text; empty lines are skipped
+        bool NextLine(std::vector<const char*>& tokens)
+        {
+            tokens.clear();
+
+            while (cursor < end)
+            {
+                char c = *cursor;
+                if (c == '\n')
+                {
+                    *cursor++ = '\0';
+                    if (!tokens.empty()) {
+                        return true;
+                    }
+                }
+                else if (c == ' ' || c == '\t' || c == '\r')
+                {
+                    *cursor++ = '\0';
+                }
+                else if (c == '#')
+                {
+                    while (cursor < end && *cursor != '\n') {
+                        *cursor++ = '\0';
+                    }
+                }
+                else if (c == '{' || c == '}')
+                {
+                    if (!tokens.empty()) {
+                        return true;
+                    }
+
+                    *cursor++ = '\0';
+                    tokens.push_back(c == '{' ? "{" : "}");
+                    return true;
+                }
+                else
+                {
+                    tokens.push_back(cursor);
+                    while (cursor < end && !strchr(" \t\r\n#{}", *cursor)) {
+                        ++cursor;
+                    }
+                }
+            }
+
+            return !tokens.empty();
+        }
+
+        // Consumes the opening brace of a block
+        bool OpenBlock(std::vector<const char*>& tokens)
+        {
+            return NextLine(tokens) && strcmp(tokens[0], "{") == 0;
+        }
+
+        // Next key line of the block, false at its closing brace
+        bool NextBlockLine(std::vector<const char*>& tokens)
+        {
+            return NextLine(tokens) && strcmp(tokens[0], "}") != 0;
+        }
+
+    private:
+        char* cursor;
+        char* end;
+    };
+
+    static bool ReadFloats(const std::vector<const char*>& tokens, float* out, int count)
+    {
+        if (tokens.size() < size_t(count) + 1) {
+            return false;
+        }
+
+        for (int i = 0; i < count; ++i) {
+            out[i] = strtof(tokens[i + 1], nullptr);
+        }
+        return true;
+    }
+
+    static bool ReadVector(const std::vector<const char*>& tokens, Vector3& out)
+    {
+        return ReadFloats(tokens, &out.x, 3);
+    }
+
+    static bool ReadFloat(const std::vector<const char*>& tokens, float& out)
+    {
+        return ReadFloats(tokens, &out, 1);
+    }
+
+    static bool ReadInt(const std::vector<const char*>& tokens, int& out)
+    {
+        if (tokens.size() < 2) {
+            return false;
+        }
+
+        out = atoi(tokens[1]);
+        return true;
+    }
+
+    static bool ReadString(const std::vector<const char*>& tokens, std::string& out)
+    {
+        if (tokens.size() < 2) {
+            return false;
+        }
+
+        out = tokens[1];
+        return true;
+    }
+
+    // Scene construction shared by the text and the JSON format
+    class SceneBuilder
     {
-		std::string rootPath = filename.substr(0, filename.find_last_of("/\\")) + "/";
+    public:
+        SceneBuilder(const std::string& filename, Scene* scene, RenderOptions& renderOptions)
+            : rootPath(filename.substr(0, filename.find_last_of("/\\")) + "/")
+            , scene(scene)
+            , renderOptions(renderOptions)
+            , cameraAdded(false)
+        {
+            // defaultMat
+            Material defaultMat;
+            scene->AddMaterial(defaultMat);
+        }
+
+        void AddMaterial(const std::string& name, Material material, const std::string& albedoTex, const std::string& paramsTex, const std::string& normalTex)
+        {
+            // Albedo Texture
+            if (!albedoTex.empty() && albedoTex != "None") {
+                material.albedoTexID = scene->AddTexture(rootPath + albedoTex);
+            }
+
+            // MetallicRoughness Texture
+            if (!paramsTex.empty() && paramsTex != "None") {
+                material.paramsTexID = scene->AddTexture(rootPath + paramsTex);
+            }
+
+            // Normal Map Texture
+            if (!normalTex.empty() && normalTex != "None") {
+                material.normalmapTexID = scene->AddTexture(rootPath + normalTex);
+            }
+
+            // The first definition of a name wins
+            if (materialIDs.find(name) == materialIDs.end()) {
+                materialIDs[name] = scene->AddMaterial(material);
+            }
+        }
+
+        int FindMaterial(const std::string& name)
+        {
+            std::unordered_map<std::string, int>::const_iterator it = materialIDs.find(name);
+            if (it == materialIDs.end())
+            {
+                printf("Could not find material %s\n", name.c_str());
+                return 0;
+            }
+            return it->second;
+        }
+
+        void AddLight(Light light, const std::string& type, const Vector3& v1, const Vector3& v2)
+        {
+            if (type == "Quad")
+            {
+                light.type = LightType::QuadLight;
+                light.u    = v1 - light.position;
+                light.v    = v2 - light.position;
+                light.area = Vector3::CrossProduct(light.u, light.v).Size();
+            }
+            else if (type == "Sphere")
+            {
+                light.type = LightType::SphereLight;
+                light.area = 4.0f * PI * light.radius * light.radius;
+            }
+
+            scene->AddLight(light);
+        }
+
+        void AddCamera(const Vector3& position, const Vector3& lookAt, float fov, float aperture, float focalDist)
+        {
+            scene->AddCamera(position, lookAt, fov);
+            scene->camera->aperture  = aperture;
+            scene->camera->focalDist = focalDist;
+            cameraAdded = true;
+        }
+
+        void SetEnvMap(const std::string& envMap)
+        {
+            if (!envMap.empty() && envMap != "None")
+            {
+                scene->AddHDR(rootPath + envMap);
+                renderOptions.useEnvMap = true;
+            }
+        }
+
+        void AddMesh(const std::string& filename, const Matrix4x4& xform, int materialID)
+        {
+            if (filename.empty()) {
+                return;
+            }
+
+            int meshID = scene->AddMesh(rootPath + filename);
+            if (meshID != -1)
+            {
+                std::string baseName = filename.substr(filename.find_last_of("/\\") + 1);
+                scene->AddMeshInstance(MeshInstance(meshID, xform, materialID, baseName));
+            }
+        }
+
+        void Finish()
+        {
+            // Add default camera if none was specified
+            if (!cameraAdded) {
+                scene->AddCamera(Vector3(0.0f, 0.0f, 10.0f), Vector3(0.0f, 0.0f, -10.0f), 35.0f);
+            }
+
+            renderOptions.frameSize = renderOptions.windowSize;
+        }
+
+        std::string rootPath;
+        Scene* scene;
+        RenderOptions& renderOptions;
 
-        FILE* file = fopen(filename.c_str(), "r");
+    private:
+        std::unordered_map<std::string, int> materialIDs;
+        bool cameraAdded;
+    };
+
+    static bool ReadFile(const std::string& filename, std::vector<char>& text)
+    {
+        FILE* file = fopen(filename.c_str(), "rb");
         if (!file)
         {
             printf("Couldn't open %s for reading\n", filename.c_str());
             return false;
         }
-		
-        printf("Loading Scene..\n");
 
-        struct MaterialData
-        {
-            Material mat;
-            int id;
-        };
+        fseek(file, 0, SEEK_END);
+        long size = ftell(file);
+        fseek(file, 0, SEEK_SET);
 
-        std::map<std::string, MaterialData> materialMap;
+        text.resize(size > 0 ? size : 0);
+        bool read = text.empty() || fread(text.data(), 1, text.size(), file) == text.size();
+        fclose(file);
 
-        std::vector<std::string> albedoTex;
-        std::vector<std::string> metallicRoughnessTex;
-        std::vector<std::string> normalTex;
-        
-        char line[s_MAX_LINE_LENGTH];
+        if (!read) {
+            printf("Couldn't read %s\n", filename.c_str());
+        }
+        return read;
+    }
 
-        // defaultMat
-        Material defaultMat;
-        scene->AddMaterial(defaultMat);
+    static bool ParseSceneText(const std::string& filename, SceneBuilder& builder)
+    {
+        std::vector<char> text;
+        if (!ReadFile(filename, text)) {
+            return false;
+        }
 
-        bool cameraAdded = false;
+        SceneTokenizer tokenizer(text);
+        std::vector<const char*> tokens;
+        RenderOptions& renderOptions = builder.renderOptions;
 
-        while (fgets(line, s_MAX_LINE_LENGTH, file))
+        while (tokenizer.NextLine(tokens))
         {
-            // skip comments
-			if (line[0] == '#') {
-				continue;
-			}
-            
-            // name used for materials and meshes
-            char name[s_MAX_LINE_LENGTH] = { 0 };
+            std::string block = tokens[0];
+
+            // A block whose header is commented out is disabled
+            if (block == "{")
+            {
+                while (tokenizer.NextBlockLine(tokens)) {
+
+                }
+                continue;
+            }
+
+            if (block == "}") {
+                continue;
+            }
+
+            std::string name = tokens.size() > 1 ? tokens[1] : "";
+            if (!tokenizer.OpenBlock(tokens))
+            {
+                printf("%s: expected '{' after %s\n", filename.c_str(), block.c_str());
+                return false;
+            }
 
             //--------------------------------------------
             // Material
-            if (sscanf(line, " material %s", name) == 1)
+            if (block == "material")
             {
                 Material material;
-                char albedoTexName[100] = "None";
-                char paramsTexName[100] = "None"; // metallic and roughness
-                char normalTexName[100] = "None";
+                std::string albedoTex;
+                std::string paramsTex; // metallic and roughness
+                std::string normalTex;
 
-                while (fgets(line, s_MAX_LINE_LENGTH, file))
+                while (tokenizer.NextBlockLine(tokens))
                 {
-                    // end group
-					if (strchr(line, '}')) {
-						break;
-					}
-                    
-                    sscanf(line, " name %s", name);
-                    sscanf(line, " color %f %f %f", &material.albedo.x, &material.albedo.y, &material.albedo.z);
-                    sscanf(line, " emission %f %f %f", &material.emission.x, &material.emission.y, &material.emission.z);
-                    sscanf(line, " materialType %f", &material.type);
-                    sscanf(line, " metallic %f", &material.metallic);
-                    sscanf(line, " roughness %f", &material.roughness);
-                    sscanf(line, " ior %f", &material.ior);
-                    sscanf(line, " transmittance %f", &material.transmittance);
-
-                    sscanf(line, " albedoTexture %s", albedoTexName);
-                    sscanf(line, " metallicRoughnessTexture %s", paramsTexName);
-                    sscanf(line, " normalTexture %s", normalTexName);
+                    const char* key = tokens[0];
+                    if      (strcmp(key, "name") == 0)                     ReadString(tokens, name);
+                    else if (strcmp(key, "color") == 0)                    ReadVector(tokens, material.albedo);
+                    else if (strcmp(key, "emission") == 0)                 ReadVector(tokens, material.emission);
+                    else if (strcmp(key, "materialType") == 0)             ReadFloat(tokens, material.type);
+                    else if (strcmp(key, "metallic") == 0)                 ReadFloat(tokens, material.metallic);
+                    else if (strcmp(key, "roughness") == 0)                ReadFloat(tokens, material.roughness);
+                    else if (strcmp(key, "ior") == 0)                      ReadFloat(tokens, material.ior);
+                    else if (strcmp(key, "transmittance") == 0)            ReadFloat(tokens, material.transmittance);
+                    else if (strcmp(key, "albedoTexture") == 0)            ReadString(tokens, albedoTex);
+                    else if (strcmp(key, "metallicRoughnessTexture") == 0) ReadString(tokens, paramsTex);
+                    else if (strcmp(key, "normalTexture") == 0)            ReadString(tokens, normalTex);
                 }
 
-                // Albedo Texture
-				if (strcmp(albedoTexName, "None") != 0) {
-					material.albedoTexID = scene->AddTexture(rootPath + albedoTexName);
-				}
-                
-                // MetallicRoughness Texture
-				if (strcmp(paramsTexName, "None") != 0) {
-					material.paramsTexID = scene->AddTexture(rootPath + paramsTexName);
-				}
-                
-                // Normal Map Texture
-				if (strcmp(normalTexName, "None") != 0) {
-					material.normalmapTexID = scene->AddTexture(rootPath + normalTexName);
-				}
-                
-                // add material to map
-                if (materialMap.find(name) == materialMap.end()) // New material
-                {
-                    int id = scene->AddMaterial(material);
-                    materialMap[name] = MaterialData{ material, id };
-                }
+                builder.AddMaterial(name, material, albedoTex, paramsTex, normalTex);
             }
 
             //--------------------------------------------
             // Light
-            if (strstr(line, "light"))
+            else if (block == "light")
             {
                 Light light;
                 Vector3 v1, v2;
-                char lightType[20] = "None";
-
-                while (fgets(line, s_MAX_LINE_LENGTH, file))
-                {
-                    // end group
-					if (strchr(line, '}')) {
-						break;
-					}
-                    
-                    sscanf(line, " position %f %f %f", &light.position.x, &light.position.y, &light.position.z);
-                    sscanf(line, " emission %f %f %f", &light.emission.x, &light.emission.y, &light.emission.z);
-
-                    sscanf(line, " radius %f", &light.radius);
-                    sscanf(line, " v1 %f %f %f", &v1.x, &v1.y, &v1.z);
-                    sscanf(line, " v2 %f %f %f", &v2.x, &v2.y, &v2.z);
-                    sscanf(line, " type %s", lightType);
-                }
+                std::string lightType;
 
-               if (strcmp(lightType, "Quad") == 0)
-                {
-                    light.type = LightType::QuadLight;
-                    light.u    = v1 - light.position;
-                    light.v    = v2 - light.position;
-                    light.area = Vector3::CrossProduct(light.u, light.v).Size();
-                }
-                else if (strcmp(lightType, "Sphere") == 0)
+                while (tokenizer.NextBlockLine(tokens))
                 {
-                    light.type = LightType::SphereLight;
-                    light.area = 4.0f * PI * light.radius * light.radius;
+                    const char* key = tokens[0];
+                    if      (strcmp(key, "position") == 0) ReadVector(tokens, light.position);
+                    else if (strcmp(key, "emission") == 0) ReadVector(tokens, light.emission);
+                    else if (strcmp(key, "radius") == 0)   ReadFloat(tokens, light.radius);
+                    else if (strcmp(key, "v1") == 0)       ReadVector(tokens, v1);
+                    else if (strcmp(key, "v2") == 0)       ReadVector(tokens, v2);
+                    else if (strcmp(key, "type") == 0)     ReadString(tokens, lightType);
                 }
 
-                scene->AddLight(light);
+                builder.AddLight(light, lightType, v1, v2);
             }
 
             //--------------------------------------------
             // Camera
-            if (strstr(line, "Camera"))
+            else if (block == "Camera")
             {
                 Vector3 position;
                 Vector3 lookAt;
 
-                float fov;
+                float fov = 35.0f;
                 float aperture = 0;
-				float focalDist = 1;
+                float focalDist = 1;
 
-                while (fgets(line, s_MAX_LINE_LENGTH, file))
+                while (tokenizer.NextBlockLine(tokens))
                 {
-                    // end group
-					if (strchr(line, '}')) {
-						break;
-					}
-
-                    sscanf(line, " position %f %f %f", &position.x, &position.y, &position.z);
-                    sscanf(line, " lookAt %f %f %f", &lookAt.x, &lookAt.y, &lookAt.z);
-                    sscanf(line, " aperture %f ", &aperture);
-                    sscanf(line, " focaldist %f", &focalDist);
-                    sscanf(line, " fov %f", &fov);
+                    const char* key = tokens[0];
+                    if      (strcmp(key, "position") == 0)  ReadVector(tokens, position);
+                    else if (strcmp(key, "lookAt") == 0)    ReadVector(tokens, lookAt);
+                    else if (strcmp(key, "aperture") == 0)  ReadFloat(tokens, aperture);
+                    else if (strcmp(key, "focaldist") == 0) ReadFloat(tokens, focalDist);
+                    else if (strcmp(key, "fov") == 0)       ReadFloat(tokens, fov);
                 }
 
-                scene->AddCamera(position, lookAt, fov);
-                scene->camera->aperture  = aperture;
-                scene->camera->focalDist = focalDist;
-
-                cameraAdded = true;
+                builder.AddCamera(position, lookAt, fov, aperture, focalDist);
             }
 
             //--------------------------------------------
             // Renderer
-            if (strstr(line, "Renderer"))
+            else if (block == "Renderer")
             {
-                char envMap[200] = "None";
+                std::string envMap;
+                int compressedGeometry = 0;
 
-                while (fgets(line, s_MAX_LINE_LENGTH, file))
+                while (tokenizer.NextBlockLine(tokens))
                 {
-                    // end group
-					if (strchr(line, '}')) {
-						break;
-					}
-                    
-                    sscanf(line, " envMap %s", envMap);
-                    sscanf(line, " resolution %f %f", &renderOptions.windowSize.x, &renderOptions.windowSize.y);
-                    sscanf(line, " hdrMultiplier %f", &renderOptions.intensity);
-                    sscanf(line, " maxDepth %i", &renderOptions.maxDepth);
-                    sscanf(line, " numTilesX %i", &renderOptions.numTilesX);
-                    sscanf(line, " numTilesY %i", &renderOptions.numTilesY);
+                    const char* key = tokens[0];
+                    if      (strcmp(key, "envMap") == 0)             ReadString(tokens, envMap);
+                    else if (strcmp(key, "resolution") == 0)         ReadFloats(tokens, &renderOptions.windowSize.x, 2);
+                    else if (strcmp(key, "hdrMultiplier") == 0)      ReadFloat(tokens, renderOptions.intensity);
+                    else if (strcmp(key, "maxDepth") == 0)           ReadInt(tokens, renderOptions.maxDepth);
+                    else if (strcmp(key, "numTilesX") == 0)          ReadInt(tokens, renderOptions.numTilesX);
+                    else if (strcmp(key, "numTilesY") == 0)          ReadInt(tokens, renderOptions.numTilesY);
+                    else if (strcmp(key, "previewFrameTime") == 0)   ReadFloat(tokens, renderOptions.previewFrameTime);
+                    else if (strcmp(key, "compressedGeometry") == 0) ReadInt(tokens, compressedGeometry);
                 }
 
-                if (strcmp(envMap, "None") != 0)
-                {
-                    scene->AddHDR(rootPath + envMap);
-                    renderOptions.useEnvMap = true;
-                }
+                renderOptions.compressedGeometry = compressedGeometry != 0;
+                builder.SetEnvMap(envMap);
             }
 
             //--------------------------------------------
             // Mesh
-            if (strstr(line, "mesh"))
+            else if (block == "mesh")
             {
-                std::string filename;
-                Vector3 pos;
-                Vector3 scale;
+                std::string file;
                 Matrix4x4 xform;
                 int materialID = 0; // Default Material ID
 
-                while (fgets(line, s_MAX_LINE_LENGTH, file))
+                while (tokenizer.NextBlockLine(tokens))
                 {
-                    // end group
-					if (strchr(line, '}')) {
-						break;
-					}
-                    
-                    char file[2048];
-                    char matName[100];
-
-                    if (sscanf(line, " file %s", file) == 1) {
-                        filename = file;
-                    }
-
-                    if (sscanf(line, " material %s", matName) == 1)
+                    const char* key = tokens[0];
+                    if      (strcmp(key, "file") == 0)     ReadString(tokens, file);
+                    else if (strcmp(key, "material") == 0 && tokens.size() > 1) materialID = builder.FindMaterial(tokens[1]);
+                    else if (strcmp(key, "position") == 0) ReadFloats(tokens, &xform.m[3][0], 3);
+                    else if (strcmp(key, "scale") == 0 && tokens.size() > 3)
                     {
-                        // look up material in dictionary
-                        if (materialMap.find(matName) != materialMap.end())
-                        {
-                            materialID = float(materialMap[matName].id);
-                        }
-                        else
-                        {
-                            printf("Could not find material %s\n", matName);
-                        }
+                        xform.m[0][0] = strtof(tokens[1], nullptr);
+                        xform.m[1][1] = strtof(tokens[2], nullptr);
+                        xform.m[2][2] = strtof(tokens[3], nullptr);
                     }
-
-                    sscanf(line, " position %f %f %f", &xform.m[3][0], &xform.m[3][1], &xform.m[3][2]);
-                    sscanf(line, " scale %f %f %f", &xform.m[0][0], &xform.m[1][1], &xform.m[2][2]);
                 }
 
-                if (!filename.empty())
-                {
-                    int meshID = scene->AddMesh(rootPath + filename);
-                    if (meshID != -1)
-                    {
-						std::string baseName = filename.substr(filename.find_last_of("/\\") + 1);
-                        scene->AddMeshInstance(MeshInstance(meshID, xform, materialID, baseName));
-                    }
+                builder.AddMesh(file, xform, materialID);
+            }
+
+            else
+            {
+                printf("%s: skipping unknown block %s\n", filename.c_str(), block.c_str());
+                while (tokenizer.NextBlockLine(tokens)) {
+
                 }
             }
         }
 
-        fclose(file);
+        return true;
+    }
 
-        // Add default camera if none was specified
-		if (!cameraAdded) {
-			scene->AddCamera(Vector3(0.0f, 0.0f, 10.0f), Vector3(0.0f, 0.0f, -10.0f), 35.0f);
-		}
-        
-		renderOptions.frameSize = renderOptions.windowSize;
+    // The JSON scene mirrors the text format; every key is optional:
+    // {
+    //     "renderer":  { "resolution": [w, h], "envMap": "...", "hdrMultiplier": 1, "maxDepth": 2, ... },
+    //     "camera":    { "position": [x, y, z], "lookAt": [x, y, z], "fov": 35, "aperture": 0, "focaldist": 1 },
+    //     "materials": [ { "name": "white", "color": [r, g, b], "albedoTexture": "...", ... } ],
+    //     "lights":    [ { "type": "Quad", "position": [...], "v1": [...], "v2": [...], "emission": [...] } ],
+    //     "meshes":    [ { "file": "...", "material": "white", "position": [...], "scale": [...] } ]
+    // }
+    using json = nlohmann::json;
+
+    template <typename T>
+    static void ReadJson(const json& object, const char* key, T& out)
+    {
+        json::const_iterator it = object.find(key);
+        if (it != object.end() && !it->is_null()) {
+            out = it->get<T>();
+        }
+    }
+
+    static void ReadJson(const json& object, const char* key, float* out, int count)
+    {
+        json::const_iterator it = object.find(key);
+        if (it != object.end() && it->is_array() && it->size() >= size_t(count))
+        {
+            for (int i = 0; i < count; ++i) {
+                out[i] = (*it)[i].get<float>();
+            }
+        }
+    }
+
+    static void ReadJson(const json& object, const char* key, Vector3& out)
+    {
+        ReadJson(object, key, &out.x, 3);
+    }
+
+    static const json& JsonMember(const json& object, const char* key)
+    {
+        static const json empty;
+        json::const_iterator it = object.find(key);
+        return it != object.end() ? *it : empty;
+    }
+
+    static bool ParseSceneJson(const std::string& filename, SceneBuilder& builder)
+    {
+        std::vector<char> text;
+        if (!ReadFile(filename, text)) {
+            return false;
+        }
+
+        json root = json::parse(text.begin(), text.end(), nullptr, false);
+        if (root.is_discarded() || !root.is_object())
+        {
+            printf("%s is not a valid JSON scene\n", filename.c_str());
+            return false;
+        }
+
+        RenderOptions& renderOptions = builder.renderOptions;
+
+        const json& renderer = JsonMember(root, "renderer");
+        if (renderer.is_object())
+        {
+            std::string envMap;
+            bool compressedGeometry = renderOptions.compressedGeometry;
+            ReadJson(renderer, "envMap", envMap);
+            ReadJson(renderer, "resolution", &renderOptions.windowSize.x, 2);
+            ReadJson(renderer, "hdrMultiplier", renderOptions.intensity);
+            ReadJson(renderer, "maxDepth", renderOptions.maxDepth);
+            ReadJson(renderer, "numTilesX", renderOptions.numTilesX);
+            ReadJson(renderer, "numTilesY", renderOptions.numTilesY);
+            ReadJson(renderer, "previewFrameTime", renderOptions.previewFrameTime);
+            ReadJson(renderer, "compressedGeometry", compressedGeometry);
+
+            renderOptions.compressedGeometry = compressedGeometry;
+            builder.SetEnvMap(envMap);
+        }
+
+        const json& camera = JsonMember(root, "camera");
+        if (camera.is_object())
+        {
+            Vector3 position;
+            Vector3 lookAt;
+            float fov = 35.0f;
+            float aperture = 0;
+            float focalDist = 1;
+            ReadJson(camera, "position", position);
+            ReadJson(camera, "lookAt", lookAt);
+            ReadJson(camera, "fov", fov);
+            ReadJson(camera, "aperture", aperture);
+            ReadJson(camera, "focaldist", focalDist);
+
+            builder.AddCamera(position, lookAt, fov, aperture, focalDist);
+        }
+
+        for (const json& entry : JsonMember(root, "materials"))
+        {
+            Material material;
+            std::string name;
+            std::string albedoTex;
+            std::string paramsTex;
+            std::string normalTex;
+            ReadJson(entry, "name", name);
+            ReadJson(entry, "color", material.albedo);
+            ReadJson(entry, "emission", material.emission);
+            ReadJson(entry, "materialType", material.type);
+            ReadJson(entry, "metallic", material.metallic);
+            ReadJson(entry, "roughness", material.roughness);
+            ReadJson(entry, "ior", material.ior);
+            ReadJson(entry, "transmittance", material.transmittance);
+            ReadJson(entry, "albedoTexture", albedoTex);
+            ReadJson(entry, "metallicRoughnessTexture", paramsTex);
+            ReadJson(entry, "normalTexture", normalTex);
+
+            builder.AddMaterial(name, material, albedoTex, paramsTex, normalTex);
+        }
+
+        for (const json& entry : JsonMember(root, "lights"))
+        {
+            Light light;
+            Vector3 v1, v2;
+            std::string lightType;
+            ReadJson(entry, "type", lightType);
+            ReadJson(entry, "position", light.position);
+            ReadJson(entry, "emission", light.emission);
+            ReadJson(entry, "radius", light.radius);
+            ReadJson(entry, "v1", v1);
+            ReadJson(entry, "v2", v2);
+
+            builder.AddLight(light, lightType, v1, v2);
+        }
+
+        for (const json& entry : JsonMember(root, "meshes"))
+        {
+            std::string file;
+            std::string material;
+            Matrix4x4 xform;
+            Vector3 scale(1.0f, 1.0f, 1.0f);
+            ReadJson(entry, "file", file);
+            ReadJson(entry, "material", material);
+            ReadJson(entry, "position", &xform.m[3][0], 3);
+            ReadJson(entry, "scale", scale);
+            xform.m[0][0] = scale.x;
+            xform.m[1][1] = scale.y;
+            xform.m[2][2] = scale.z;
+
+            builder.AddMesh(file, xform, material.empty() ? 0 : builder.FindMaterial(material));
+        }
+
+        return true;
+    }
+
+    bool ParseSceneFile(const std::string& filename, Scene* scene, RenderOptions& renderOptions)
+    {
+        printf("Loading Scene..\n");
+
+        SceneBuilder builder(filename, scene, renderOptions);
+
+        std::string ext = filename.substr(filename.find_last_of(".") + 1);
+        bool parsed = false;
+        if (ext == "json")
+        {
+            // Values of the wrong type make nlohmann::json throw
+            try {
+                parsed = ParseSceneJson(filename, builder);
+            }
+            catch (const std::exception& e) {
+                printf("%s: %s\n", filename.c_str(), e.what());
+            }
+        }
+        else
+        {
+            parsed = ParseSceneText(filename, builder);
+        }
+
+        if (!parsed) {
+            return false;
+        }
+
+        builder.Finish();
+        return true;
+    }
+
+    bool LoadSceneFromFile(const std::string& filename, Scene* scene, RenderOptions& renderOptions)
+    {
+        if (!ParseSceneFile(filename, scene, renderOptions)) {
+            return false;
+        }
 
         scene->CreateAccelerationStructures();
 
@@ -6,5 +6,9 @@
 
 namespace GLSLPT
 {
+    // Loads a .scene text file or its .json equivalent, then builds the scene
     bool LoadSceneFromFile(const std::string& filename, Scene* scene, RenderOptions& renderOptions);
+
+    // Only fills the scene from the file: no assets are loaded and no acceleration structures built
+    bool ParseSceneFile(const std::string& filename, Scene* scene, RenderOptions& renderOptions);
 }
\ No newline at end of file
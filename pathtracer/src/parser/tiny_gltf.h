@@ -560,8 +560,7 @@ struct BufferView {
 };
 
 struct Accessor {
-  int bufferView;  // optional in spec but required here since sparse accessor
-                   // are not supported
+  int bufferView;  // optional in spec; -1 means zeros (only useful with sparse)
   std::string name;
   size_t byteOffset;
   bool normalized;    // optinal.
@@ -573,7 +572,20 @@ struct Accessor {
   std::vector<double> minValues;  // optional
   std::vector<double> maxValues;  // optional
 
-  // TODO(syoyo): "sparse"
+  // Sparse substitutions applied on top of bufferView (or zeros without one)
+  struct {
+    int count;
+    bool isSparse;
+    struct {
+      int byteOffset;
+      int bufferView;
+      int componentType;  // a TINYGLTF_COMPONENT_TYPE_ value
+    } indices;
+    struct {
+      int bufferView;
+      int byteOffset;
+    } values;
+  } sparse;
 
   ///
   /// Utility function to compute byteStride for a given bufferView object.
@@ -612,7 +624,16 @@ struct Accessor {
     return 0;
   }
 
-  Accessor() { bufferView = -1; }
+  Accessor() {
+    bufferView = -1;
+    sparse.count = 0;
+    sparse.isSparse = false;
+    sparse.indices.byteOffset = 0;
+    sparse.indices.bufferView = -1;
+    sparse.indices.componentType = 0;
+    sparse.values.bufferView = -1;
+    sparse.values.byteOffset = 0;
+  }
   bool operator==(const tinygltf::Accessor &) const;
 };
 
@@ -2771,6 +2792,54 @@ static bool ParseBufferView(BufferView *bufferView, std::string *err,
   return true;
 }
 
+static bool ParseSparseAccessor(Accessor *accessor, std::string *err,
+                                const json &o) {
+  accessor->sparse.isSparse = true;
+
+  double count = 0.0;
+  if (!ParseNumberProperty(&count, err, o, "count", true, "SparseAccessor")) {
+    return false;
+  }
+
+  json::const_iterator indicesIt = o.find("indices");
+  json::const_iterator valuesIt = o.find("values");
+  if (indicesIt == o.end() || !indicesIt.value().is_object() ||
+      valuesIt == o.end() || !valuesIt.value().is_object()) {
+    if (err) {
+      (*err) += "Sparse accessor needs `indices` and `values` objects.\n";
+    }
+    return false;
+  }
+
+  double indicesBufferView = 0.0, indicesByteOffset = 0.0,
+         indicesComponentType = 0.0;
+  if (!ParseNumberProperty(&indicesBufferView, err, indicesIt.value(),
+                           "bufferView", true, "SparseAccessor") ||
+      !ParseNumberProperty(&indicesComponentType, err, indicesIt.value(),
+                           "componentType", true, "SparseAccessor")) {
+    return false;
+  }
+  ParseNumberProperty(&indicesByteOffset, err, indicesIt.value(), "byteOffset",
+                      false, "SparseAccessor");
+
+  double valuesBufferView = 0.0, valuesByteOffset = 0.0;
+  if (!ParseNumberProperty(&valuesBufferView, err, valuesIt.value(),
+                           "bufferView", true, "SparseAccessor")) {
+    return false;
+  }
+  ParseNumberProperty(&valuesByteOffset, err, valuesIt.value(), "byteOffset",
+                      false, "SparseAccessor");
+
+  accessor->sparse.count = static_cast<int>(count);
+  accessor->sparse.indices.bufferView = static_cast<int>(indicesBufferView);
+  accessor->sparse.indices.byteOffset = static_cast<int>(indicesByteOffset);
+  accessor->sparse.indices.componentType =
+      static_cast<int>(indicesComponentType);
+  accessor->sparse.values.bufferView = static_cast<int>(valuesBufferView);
+  accessor->sparse.values.byteOffset = static_cast<int>(valuesByteOffset);
+  return true;
+}
+
 static bool ParseAccessor(Accessor *accessor, std::string *err, const json &o) {
   double bufferView = -1.0;
   ParseNumberProperty(&bufferView, err, o, "bufferView", false, "Accessor");
@@ -2852,6 +2921,13 @@ static bool ParseAccessor(Accessor *accessor, std::string *err, const json &o) {
 
   ParseExtrasProperty(&(accessor->extras), o);
 
+  json::const_iterator sparseIt = o.find("sparse");
+  if (sparseIt != o.end() && sparseIt.value().is_object()) {
+    if (!ParseSparseAccessor(accessor, err, sparseIt.value())) {
+      return false;
+    }
+  }
+
   return true;
 }
 
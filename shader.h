@@ -5,6 +5,7 @@
 // MPL-2.0 license
 
 #include "common.h"
+#include <cstdint>
 
 namespace Kasumi
 {
@@ -23,6 +24,12 @@ public:
 	static std::shared_ptr<Shader> DefaultFrameShader;
 	static std::shared_ptr<Shader> Default2DShader;
 	static std::shared_ptr<Shader> DefaultSimpleMeshShader;
+	static std::shared_ptr<Shader> DefaultImpostorShader; // ray-cast spheres, see SphereImpostors
+	static std::shared_ptr<Shader> DefaultVolumeShader; // raymarched 3D textures, see Volume
+
+	// linked programs are kept as driver binaries, keyed by source and driver; an empty dir means the system temp dir
+	static bool UseProgramCache;
+	static std::string ProgramCacheDir;
 
 public:
 	Shader(const std::string &vertex_path, const std::string &fragment_path);
@@ -43,9 +50,30 @@ public:
 	void uniform(const std::string &name, const std::vector<unsigned int> &value, size_t size) const;
 
 	void use() const;
+	// the same program with `uniform mat4 model` read per instance from locations 7-10 instead; built on first call,
+	// nullptr when the vertex stage has no such uniform or a geometry stage is involved
+	auto instanced() -> std::shared_ptr<Shader>;
 
 private:
+	struct Deferred {};
+	Shader(Deferred, const char *vertex_src, const char *fragment_src, const char *geometry_src);
+	void _compile(const char *vertex_src, const char *fragment_src, const char *geometry_src);
+	void _finish() const;
+	auto _load_binary() -> bool;
+	void _save_binary() const;
 	static void _validate(unsigned int shader, const std::string &type);
+
+private:
+	// stages still being compiled; the default shaders are finished on first use, so the driver can compile them in parallel
+	mutable unsigned int _stages[3] = {0, 0, 0};
+	mutable bool _pending = false;
+	std::uint64_t _cache_key = 0;
+	std::string _cache_file;
+
+	std::string _vertex_src, _fragment_src;
+	bool _has_geometry = false;
+	std::shared_ptr<Shader> _instanced;
+	bool _instanced_tried = false;
 };
 using ShaderPtr = std::shared_ptr<Shader>;
 } // namespace Kasumi
@@ -8,31 +8,110 @@
 
 #include <string>
 #include <memory>
+#include <map>
+#include <future>
+#include <span>
+#include <vector>
 
 namespace Kasumi
 {
-class Texture
+class Texture : public HinaPE::CopyDisable
 {
 public:
 	using Pixel = Eigen::Matrix<unsigned char, 3, 1>;
-	explicit Texture(const std::string &path);
-	Texture(unsigned char *data, int width, int height, int channels);
+	explicit Texture(const std::string &path); // editable: decoded right here and the pixels are kept
+	Texture(unsigned char *data, int width, int height, int channels, bool editable = true); // takes over data from stbi_load
+	Texture(int width, int height, int channels); // blank and editable
 	~Texture();
 
+	// read only textures shared by path: a file is decoded once, on a worker thread, and lives as long as someone holds it.
+	// Until Poll() uploads it the texture binds a 1x1 white placeholder
+	static auto Load(const std::string &path) -> std::shared_ptr<Texture>;
+	static void Poll(); // uploads finished decodes, called by the Platform every frame
+	static void Wait(); // blocks until every pending decode is uploaded
+	static bool UseMipmaps;
+	static bool UseCompression; // BC1 (rgb) / BC3 (rgba) for shared textures, when the driver has S3TC
+	static bool UseDiskCache; // compressed mip chains are kept on disk, keyed like the mesh cache
+	static std::string CacheDir; // empty means the system temp dir
+
 	auto operator()(int x, int y) -> Eigen::Map<Pixel>;
 
 	void bind(int texture_idx = 0) const;
 	void update(bool init = false);
-	auto get(int x, int y) const -> mVector4;
+	auto get(int x, int y) const -> mVector4; // channels the texture lacks read as 0, alpha as 255
 	void set(int x, int y, const mVector4& pixel);
+	inline auto ready() const -> bool { return ID != 0; }
+
+	// bulk editing, for any channel count. Every edit grows a dirty rectangle and update() sends only that rectangle,
+	// through a pixel buffer; writes straight into _data are not tracked and make update() send everything
+	struct DirtyRect
+	{
+		int x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+		void add(int x, int y, int width, int height, int max_width, int max_height); // clipped to the texture
+		inline auto empty() const -> bool { return x0 >= x1 || y0 >= y1; }
+		inline void clear() { x0 = y0 = x1 = y1 = 0; }
+	};
+	auto row(int y) -> std::span<unsigned char>; // marks the whole row dirty
+	void fill(int x, int y, int width, int height, const mVector4 &pixel);
+	void blit(int x, int y, int width, int height, const unsigned char *src, int src_channels, size_t src_stride = 0); // stride in texels, 0 means width
+	void blit(int x, int y, int width, int height, const float *src, int src_channels, float lower = 0, float upper = 1, size_t src_stride = 0); // [lower, upper] to 0..255
+	void mark_dirty(int x, int y, int width, int height);
 
 public:
 	unsigned int ID = 0;
 	std::string _path;
-	int _width, _height, _nr_channels;
-	unsigned char *_data;
+	int _width = 0, _height = 0, _nr_channels = 0;
+	unsigned char *_data = nullptr; // CPU pixels, released after upload unless the texture is editable
+	bool _editable = true;
+
+private:
+	DirtyRect _dirty;
+	unsigned int _pbo = 0;
+	bool _mipmapped = false;
+
+	struct Decoded // CPU side of a shared texture, built on a worker thread
+	{
+		int width = 0, height = 0, channels = 0;
+		unsigned int format = 0; // GL internal format; a compressed one means every level is blocks
+		std::vector<std::vector<unsigned char>> levels;
+		std::vector<std::pair<int, int>> sizes;
+	};
+	Texture() = default;
+	static auto _decode(const std::string &path, bool compress, bool mipmaps) -> Decoded; // no GL, runs on the workers
+	void _upload(Decoded &&decoded);
+
+	static std::map<std::string, std::weak_ptr<Texture>> _registry;
+	static std::vector<std::pair<std::weak_ptr<Texture>, std::future<Decoded>>> _pending;
 };
 using TexturePtr = std::shared_ptr<Texture>;
+
+// float texels (GL_R32F .. GL_RGBA32F) for simulation fields, so values reach the shader without a round trip through bytes.
+// Edited and uploaded like an editable Texture, without mipmaps
+class FloatTexture final : public HinaPE::CopyDisable
+{
+public:
+	FloatTexture(int width, int height, int channels = 1);
+	~FloatTexture();
+
+	void bind(int texture_idx = 0) const;
+	void update(); // sends the dirty rectangle, or everything after writes straight into _data
+	auto get(int x, int y) const -> mVector4; // channels the texture lacks read as 0
+	void set(int x, int y, const mVector4 &value);
+	auto row(int y) -> std::span<float>; // marks the whole row dirty
+	void fill(int x, int y, int width, int height, const mVector4 &value);
+	void blit(int x, int y, int width, int height, const float *src, int src_channels, size_t src_stride = 0); // stride in texels, 0 means width
+	void mark_dirty(int x, int y, int width, int height);
+
+public:
+	unsigned int ID = 0;
+	int _width = 0, _height = 0, _nr_channels = 0;
+	std::vector<float> _data;
+
+private:
+	Texture::DirtyRect _dirty;
+	unsigned int _pbo = 0;
+};
+using FloatTexturePtr = std::shared_ptr<FloatTexture>;
 } // namespace Kasumi
 
 #endif //BACKENDS_TEXTURE_H